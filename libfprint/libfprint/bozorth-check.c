@@ -0,0 +1,159 @@
+/*
+ * Concurrency check for the Bozorth3 matcher
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Matches every probe against every gallery print on one thread, then again
+ * on N threads at once, half of them in their own context and half in their
+ * default one, and in a shuffled order through a single context. Every score
+ * has to be bit-identical to the serial one: a score that depends on what
+ * matched before in the context, like the stale colp row bz_match() now
+ * clears, shows up as a difference.
+ *
+ * Run by make check, or as bozorth-check [threads].
+ */
+
+#include <config.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check-prints.h"
+
+#define CHECK_PROBES 12
+#define CHECK_GALLERY 60
+#define CHECK_FINGERS 20
+#define CHECK_ROUNDS 3
+#define CHECK_DEFAULT_THREADS 8
+
+static struct xyt_struct probes[CHECK_PROBES];
+static struct xyt_struct gallery[CHECK_GALLERY];
+static int serial[CHECK_PROBES][CHECK_GALLERY];
+static int differ;
+static pthread_mutex_t differ_lock = PTHREAD_MUTEX_INITIALIZER;
+static int n_threads;
+
+static void check_score(int probe, int print, int score)
+{
+	if (score == serial[probe][print])
+		return;
+
+	pthread_mutex_lock(&differ_lock);
+	fprintf(stderr, "probe %d, print %d: score %d, %d serially\n", probe,
+		print, score, serial[probe][print]);
+	differ++;
+	pthread_mutex_unlock(&differ_lock);
+}
+
+/* thread t matches probes t, t + n_threads, ... a few times over */
+static void *check_thread(void *data)
+{
+	long t = (long) data;
+	struct bz_context *ctx = t & 1 ? bz_context_new() : NULL;
+	int r, i, j;
+
+	for (r = 0; r < CHECK_ROUNDS; r++) {
+		for (i = t; i < CHECK_PROBES; i += n_threads) {
+			int len = ctx ? bozorth_probe_init_ctx(ctx, &probes[i])
+				: bozorth_probe_init(&probes[i]);
+
+			for (j = 0; j < CHECK_GALLERY; j++)
+				check_score(i, j, ctx ?
+					bozorth_to_gallery_ctx(ctx, len, &probes[i], &gallery[j]) :
+					bozorth_to_gallery(len, &probes[i], &gallery[j]));
+		}
+	}
+
+	bz_context_free(ctx);
+	return NULL;
+}
+
+static void check_shuffled(void)
+{
+	struct bz_context *ctx = bz_context_new();
+	int n = CHECK_PROBES * CHECK_GALLERY;
+	int *order = malloc(sizeof(*order) * n);
+	int i;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	srand(1);
+	for (i = n - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (i = 0; i < n; i++) {
+		int probe = order[i] / CHECK_GALLERY;
+		int print = order[i] % CHECK_GALLERY;
+		int len = bozorth_probe_init_ctx(ctx, &probes[probe]);
+
+		check_score(probe, print, bozorth_to_gallery_ctx(ctx, len,
+			&probes[probe], &gallery[print]));
+	}
+
+	free(order);
+	bz_context_free(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *threads;
+	int matched = 0;
+	long t;
+	int i, j;
+
+	n_threads = argc > 1 ? atoi(argv[1]) : CHECK_DEFAULT_THREADS;
+	if (n_threads <= 0) {
+		fprintf(stderr, "usage: %s [threads]\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < CHECK_PROBES; i++)
+		check_print(&probes[i], i, 0);
+	for (j = 0; j < CHECK_GALLERY; j++)
+		check_print(&gallery[j], j % CHECK_FINGERS, j + 1);
+
+	for (i = 0; i < CHECK_PROBES; i++) {
+		int len = bozorth_probe_init(&probes[i]);
+
+		for (j = 0; j < CHECK_GALLERY; j++) {
+			serial[i][j] = bozorth_to_gallery(len, &probes[i], &gallery[j]);
+			if (serial[i][j] >= 40)
+				matched++;
+		}
+	}
+
+	threads = malloc(sizeof(*threads) * n_threads);
+	for (t = 0; t < n_threads; t++)
+		if (pthread_create(&threads[t], NULL, check_thread, (void *) t)) {
+			fprintf(stderr, "Failed to start thread %ld\n", t);
+			return 1;
+		}
+	for (t = 0; t < n_threads; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+
+	check_shuffled();
+
+	printf("%d scores, %d of them matches, on %d threads: %d differ\n",
+		CHECK_PROBES * CHECK_GALLERY, matched, n_threads, differ);
+	return differ != 0;
+}
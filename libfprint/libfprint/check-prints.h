@@ -0,0 +1,62 @@
+/*
+ * Synthetic minutiae for the matcher checks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __CHECK_PRINTS_H__
+#define __CHECK_PRINTS_H__
+
+#include <string.h>
+
+#include "nbis/include/bozorth.h"
+
+static unsigned int check_seed;
+
+static int check_rand(int n)
+{
+	check_seed = check_seed * 1103515245 + 12345;
+	return (check_seed >> 8) % n;
+}
+
+/* The minutiae of finger number finger. Scans other than 0 are shifted,
+ * jittered and miss a few minutiae, so they match scan 0 of the same finger
+ * and not of the others. */
+static void check_print(struct xyt_struct *xyt, int finger, int scan)
+{
+	int i;
+
+	memset(xyt, 0, sizeof(*xyt));
+	check_seed = 1000 + finger * 7919;
+	xyt->nrows = 30 + check_rand(60);
+	for (i = 0; i < xyt->nrows; i++) {
+		xyt->xcol[i] = check_rand(300);
+		xyt->ycol[i] = check_rand(400);
+		xyt->thetacol[i] = check_rand(360) - 179;
+	}
+
+	if (scan == 0)
+		return;
+
+	check_seed = scan * 31337;
+	for (i = 0; i < xyt->nrows; i++) {
+		xyt->xcol[i] += check_rand(7) - 3 + 10;
+		xyt->ycol[i] += check_rand(7) - 3 - 5;
+		xyt->thetacol[i] = IANGLE180(xyt->thetacol[i] + check_rand(9) - 4);
+	}
+	xyt->nrows -= check_rand(8);
+}
+
+#endif
@@ -30,8 +30,10 @@
 static int log_level = 0;
 static int log_level_fixed = 0;
 
-libusb_context *fpi_usb_ctx = NULL;
-GSList *opened_devices = NULL;
+/* set up by fp_init() for applications that don't create contexts */
+static struct fp_context *default_ctx = NULL;
+/* pushed by fp_context_push_thread_default(), innermost first */
+static __thread GSList *thread_ctxs = NULL;
 
 /**
  * \mainpage libfprint API Reference
@@ -279,8 +281,6 @@ GSList *opened_devices = NULL;
  * circumstances, you don't have to worry about driver IDs at all.
  */
 
-static GSList *registered_drivers = NULL;
-
 void fpi_log(enum fpi_log_level level, const char *component,
 	const char *function, const char *format, ...)
 {
@@ -329,13 +329,14 @@ void fpi_log(enum fpi_log_level level, const char *component,
 	fprintf(stream, "\n");
 }
 
-static void register_driver(struct fp_driver *drv)
+static void register_driver(struct fp_context *ctx, struct fp_driver *drv)
 {
 	if (drv->id == 0) {
 		fp_err("not registering driver %s: driver ID is 0", drv->name);
 		return;
 	}
-	registered_drivers = g_slist_prepend(registered_drivers, (gpointer) drv);
+	ctx->registered_drivers = g_slist_prepend(ctx->registered_drivers,
+		(gpointer) drv);
 	fp_dbg("registered driver %s", drv->name);
 }
 
@@ -410,18 +411,24 @@ static struct fp_img_driver * const img_drivers[] = {
 	*/
 };
 
-static void register_drivers(void)
+static void register_drivers(struct fp_context *ctx)
 {
+	static gsize img_drivers_setup = 0;
 	unsigned int i;
 
+	/* the drivers are shared by all contexts, which may be created from
+	 * different threads */
+	if (g_once_init_enter(&img_drivers_setup)) {
+		for (i = 0; i < G_N_ELEMENTS(img_drivers); i++)
+			fpi_img_driver_setup(img_drivers[i]);
+		g_once_init_leave(&img_drivers_setup, 1);
+	}
+
 	for (i = 0; i < G_N_ELEMENTS(primitive_drivers); i++)
-		register_driver(primitive_drivers[i]);
+		register_driver(ctx, primitive_drivers[i]);
 
-	for (i = 0; i < G_N_ELEMENTS(img_drivers); i++) {
-		struct fp_img_driver *imgdriver = img_drivers[i];
-		fpi_img_driver_setup(imgdriver);
-		register_driver(&imgdriver->driver);
-	}
+	for (i = 0; i < G_N_ELEMENTS(img_drivers); i++)
+		register_driver(ctx, &img_drivers[i]->driver);
 }
 
 API_EXPORTED struct fp_driver **fprint_get_drivers (void)
@@ -442,11 +449,11 @@ API_EXPORTED struct fp_driver **fprint_get_drivers (void)
 	return (struct fp_driver **) g_ptr_array_free (array, FALSE);
 }
 
-static struct fp_driver *find_supporting_driver(libusb_device *udev,
-	const struct usb_id **usb_id, uint32_t *devtype)
+static struct fp_driver *find_supporting_driver(struct fp_context *ctx,
+	libusb_device *udev, const struct usb_id **usb_id, uint32_t *devtype)
 {
 	int ret;
-	GSList *elem = registered_drivers;
+	GSList *elem = ctx->registered_drivers;
 	struct libusb_device_descriptor dsc;
 
 	const struct usb_id *best_usb_id;
@@ -507,19 +514,21 @@ static struct fp_driver *find_supporting_driver(libusb_device *udev,
 	return best_drv;
 }
 
-static struct fp_dscv_dev *discover_dev(libusb_device *udev)
+static struct fp_dscv_dev *discover_dev(struct fp_context *ctx,
+	libusb_device *udev)
 {
 	const struct usb_id *usb_id;
 	struct fp_driver *drv;
 	struct fp_dscv_dev *ddev;
 	uint32_t devtype;
 
-	drv = find_supporting_driver(udev, &usb_id, &devtype);
+	drv = find_supporting_driver(ctx, udev, &usb_id, &devtype);
 
 	if (!drv)
 		return NULL;
 
 	ddev = g_malloc0(sizeof(*ddev));
+	ddev->ctx = ctx;
 	ddev->drv = drv;
 	ddev->udev = udev;
 	ddev->driver_data = usb_id->driver_data;
@@ -535,6 +544,7 @@ static struct fp_dscv_dev *discover_dev(libusb_device *udev)
  */
 API_EXPORTED struct fp_dscv_dev **fp_discover_devs(void)
 {
+	struct fp_context *ctx = fpi_context_get();
 	GSList *tmplist = NULL;
 	struct fp_dscv_dev **list;
 	libusb_device *udev;
@@ -543,10 +553,10 @@ API_EXPORTED struct fp_dscv_dev **fp_discover_devs(void)
 	int r;
 	int i = 0;
 
-	if (registered_drivers == NULL)
+	if (ctx == NULL || ctx->registered_drivers == NULL)
 		return NULL;
 
-	r = libusb_get_device_list(fpi_usb_ctx, &devs);
+	r = libusb_get_device_list(ctx->usb_ctx, &devs);
 	if (r < 0) {
 		fp_err("couldn't enumerate USB devices, error %d", r);
 		return NULL;
@@ -558,7 +568,7 @@ API_EXPORTED struct fp_dscv_dev **fp_discover_devs(void)
 	 * Quite inefficient but excusable as we'll only be dealing with small
 	 * sets of drivers against small sets of USB devices */
 	while ((udev = devs[i++]) != NULL) {
-		struct fp_dscv_dev *ddev = discover_dev(udev);
+		struct fp_dscv_dev *ddev = discover_dev(ctx, udev);
 		if (!ddev)
 			continue;
 		tmplist = g_slist_prepend(tmplist, (gpointer) ddev);
@@ -900,16 +910,145 @@ API_EXPORTED int fp_dev_get_img_height(struct fp_dev *dev)
  * If libfprint was compiled with verbose debug message logging, this function
  * does nothing: you'll always get messages from all levels.
  *
- * \param ctx the context to operate on, or NULL for the default context
+ * The level applies to every context, including the USB messages of those
+ * created from now on. The USB messages of the existing ones only follow it
+ * for the current context.
+ *
  * \param level debug level to set
  */
 API_EXPORTED void fp_set_debug(int level)
 {
+	struct fp_context *ctx = fpi_context_get();
+
 	if (log_level_fixed)
 		return;
 
 	log_level = level;
-	libusb_set_debug(fpi_usb_ctx, level);
+	if (ctx)
+		libusb_set_debug(ctx->usb_ctx, level);
+}
+
+static int context_new(struct fp_context **out)
+{
+	struct fp_context *ctx;
+	int r;
+
+	ctx = g_malloc0(sizeof(*ctx));
+	r = libusb_init(&ctx->usb_ctx);
+	if (r < 0) {
+		g_free(ctx);
+		return r;
+	}
+
+	if (log_level)
+		libusb_set_debug(ctx->usb_ctx, log_level);
+
+	register_drivers(ctx);
+	fpi_poll_init(ctx);
+	/* identification starts threads only when asked to */
+	ctx->identify_threads = 1;
+	*out = ctx;
+	return 0;
+}
+
+/** \ingroup core
+ * Create a libfprint context. A context owns everything libfprint keeps
+ * between calls: its USB context, its timeouts and file descriptors to poll,
+ * the devices opened in it and the location of the stored prints. Separate
+ * contexts share nothing, so each can be driven from its own thread, for
+ * example one per fingerprint reader.
+ *
+ * The library API has no context parameter. It operates on the context the
+ * calling thread pushed with fp_context_push_thread_default(), or on the one
+ * set up by fp_init() when there is none. The stored print functions also
+ * work with neither, on a location shared by the whole process. Devices
+ * discovered and opened in a context remain in it, and their events are only
+ * handled by fp_handle_events() and its variants called with that context
+ * current.
+ *
+ * A context may be created and freed from any thread, but must only be
+ * current to one thread at a time.
+ *
+ * \returns the new context, to be freed with fp_context_free(), or NULL on
+ * error.
+ */
+API_EXPORTED struct fp_context *fp_context_new(void)
+{
+	struct fp_context *ctx;
+
+	if (context_new(&ctx) < 0)
+		return NULL;
+	return ctx;
+}
+
+/** \ingroup core
+ * Free a context created with fp_context_new(). Devices that were left open
+ * in it are closed first. The context must not be current to any thread,
+ * except the calling one.
+ *
+ * \param ctx the context to free. If NULL, function simply returns.
+ */
+API_EXPORTED void fp_context_free(struct fp_context *ctx)
+{
+	if (!ctx)
+		return;
+
+	if (ctx->opened_devices) {
+		GSList *copy = g_slist_copy(ctx->opened_devices);
+		GSList *elem = copy;
+		fp_dbg("naughty app left devices open on exit!");
+
+		/* closing them handles the events of this context */
+		fp_context_push_thread_default(ctx);
+		do
+			fp_dev_close((struct fp_dev *) elem->data);
+		while ((elem = g_slist_next(elem)));
+		fp_context_pop_thread_default(ctx);
+
+		g_slist_free(copy);
+		g_slist_free(ctx->opened_devices);
+		ctx->opened_devices = NULL;
+	}
+
+	fpi_identify_exit(ctx);
+	fpi_data_exit(ctx);
+	fpi_poll_exit(ctx);
+	g_slist_free(ctx->registered_drivers);
+	libusb_exit(ctx->usb_ctx);
+	g_free(ctx);
+}
+
+/** \ingroup core
+ * Make a context current to the calling thread, until it is popped again
+ * with fp_context_pop_thread_default(). Pushes nest, the last pushed context
+ * is the current one.
+ *
+ * \param ctx the context to make current
+ */
+API_EXPORTED void fp_context_push_thread_default(struct fp_context *ctx)
+{
+	thread_ctxs = g_slist_prepend(thread_ctxs, ctx);
+}
+
+/** \ingroup core
+ * Undo the last fp_context_push_thread_default() of the calling thread.
+ *
+ * \param ctx the context that was pushed last
+ */
+API_EXPORTED void fp_context_pop_thread_default(struct fp_context *ctx)
+{
+	if (!thread_ctxs || thread_ctxs->data != ctx) {
+		fp_err("context %p is not the thread default", ctx);
+		return;
+	}
+	thread_ctxs = g_slist_delete_link(thread_ctxs, thread_ctxs);
+}
+
+struct fp_context *fpi_context_get(void)
+{
+	if (thread_ctxs)
+		return thread_ctxs->data;
+	return default_ctx;
 }
 
 /** \ingroup core
@@ -920,53 +1059,27 @@ API_EXPORTED void fp_set_debug(int level)
 API_EXPORTED int fp_init(void)
 {
 	char *dbg = getenv("LIBFPRINT_DEBUG");
-	int r;
 	fp_dbg("");
 
-	r = libusb_init(&fpi_usb_ctx);
-	if (r < 0)
-		return r;
-
 	if (dbg) {
 		log_level = atoi(dbg);
-		if (log_level) {
+		if (log_level)
 			log_level_fixed = 1;
-			libusb_set_debug(fpi_usb_ctx, log_level);
-		}
 	}
 
-	register_drivers();
-	fpi_poll_init();
-	return 0;
+	return context_new(&default_ctx);
 }
 
 /** \ingroup core
  * Deinitialise libfprint. This function should be called during your program
  * exit sequence. You must not use any libfprint functions after calling this
- * function, unless you call fp_init() again.
+ * function, unless you call fp_init() again. Contexts created with
+ * fp_context_new() are not affected.
  */
 API_EXPORTED void fp_exit(void)
 {
 	fp_dbg("");
 
-	if (opened_devices) {
-		GSList *copy = g_slist_copy(opened_devices);
-		GSList *elem = copy;
-		fp_dbg("naughty app left devices open on exit!");
-
-		do
-			fp_dev_close((struct fp_dev *) elem->data);
-		while ((elem = g_slist_next(elem)));
-
-		g_slist_free(copy);
-		g_slist_free(opened_devices);
-		opened_devices = NULL;
-	}
-
-	fpi_data_exit();
-	fpi_poll_exit();
-	g_slist_free(registered_drivers);
-	registered_drivers = NULL;
-	libusb_exit(fpi_usb_ctx);
+	fp_context_free(default_ctx);
+	default_ctx = NULL;
 }
-
@@ -47,26 +47,42 @@
  * in any fashion that suits you.
  */
 
-static char *base_store = NULL;
-
-static void storage_setup(void)
+static char *build_base_store(void)
 {
-	const char *homedir;
+	const char *homedir = g_getenv("HOME");
+	char *store;
 
-	homedir = g_getenv("HOME");
 	if (!homedir)
 		homedir = g_get_home_dir();
-	if (!homedir)
-		return;
 
-	base_store = g_build_filename(homedir, ".fprint/prints", NULL);
-	g_mkdir_with_parents(base_store, DIR_PERMS);
+	store = g_build_filename(homedir, ".fprint/prints", NULL);
+	g_mkdir_with_parents(store, DIR_PERMS);
 	/* FIXME handle failure */
+	return store;
+}
+
+/* the store of the current context, set up on first use. Without any
+ * context, as before fp_init(), one for the whole process. */
+static const char *get_base_store(void)
+{
+	struct fp_context *ctx = fpi_context_get();
+	static gsize process_store = 0;
+
+	if (!ctx) {
+		if (g_once_init_enter(&process_store))
+			g_once_init_leave(&process_store, (gsize) build_base_store());
+		return (const char *) process_store;
+	}
+
+	if (!ctx->base_store)
+		ctx->base_store = build_base_store();
+	return ctx->base_store;
 }
 
-void fpi_data_exit(void)
+void fpi_data_exit(struct fp_context *ctx)
 {
-	g_free(base_store);
+	g_free(ctx->base_store);
+	ctx->base_store = NULL;
 }
 
 #define FP_FINGER_IS_VALID(finger) \
@@ -94,7 +110,7 @@ static const char *finger_num_to_str(enum fp_finger finger)
 }
 #endif
 
-static struct fp_print_data *print_data_new(uint16_t driver_id,
+struct fp_print_data *fpi_print_data_new_for_driver(uint16_t driver_id,
 	uint32_t devtype, enum fp_print_data_type type)
 {
 	struct fp_print_data *data = g_malloc0(sizeof(*data));
@@ -120,7 +136,7 @@ struct fp_print_data_item *fpi_print_data_item_new(size_t length)
 
 struct fp_print_data *fpi_print_data_new(struct fp_dev *dev)
 {
-	return print_data_new(dev->drv->id, dev->devtype,
+	return fpi_print_data_new_for_driver(dev->drv->id, dev->devtype,
 		fpi_driver_get_data_type(dev->drv));
 }
 
@@ -189,7 +205,7 @@ static struct fp_print_data *fpi_print_data_from_fp1_data(unsigned char *buf,
 	struct fpi_print_data_fp2 *raw = (struct fpi_print_data_fp2 *) buf;
 
 	print_data_len = buflen - sizeof(*raw);
-	data = print_data_new(GUINT16_FROM_LE(raw->driver_id),
+	data = fpi_print_data_new_for_driver(GUINT16_FROM_LE(raw->driver_id),
 		GUINT32_FROM_LE(raw->devtype), raw->data_type);
 	item = fpi_print_data_item_new(print_data_len);
 	/* FIXME: fp_print_data->data content is not endianess agnostic */
@@ -210,7 +226,7 @@ static struct fp_print_data *fpi_print_data_from_fp2_data(unsigned char *buf,
 	struct fpi_print_data_item_fp2 *raw_item;
 
 	total_data_len = buflen - sizeof(*raw);
-	data = print_data_new(GUINT16_FROM_LE(raw->driver_id),
+	data = fpi_print_data_new_for_driver(GUINT16_FROM_LE(raw->driver_id),
 		GUINT32_FROM_LE(raw->devtype), raw->data_type);
 	raw_buf = raw->data;
 	while (total_data_len) {
@@ -282,7 +298,7 @@ static char *get_path_to_storedir(uint16_t driver_id, uint32_t devtype)
 	g_snprintf(idstr, sizeof(idstr), "%04x", driver_id);
 	g_snprintf(devtypestr, sizeof(devtypestr), "%08x", devtype);
 
-	return g_build_filename(base_store, idstr, devtypestr, NULL);
+	return g_build_filename(get_base_store(), idstr, devtypestr, NULL);
 }
 
 static char *__get_path_to_print(uint16_t driver_id, uint32_t devtype,
@@ -330,9 +346,6 @@ API_EXPORTED int fp_print_data_save(struct fp_print_data *data,
 	size_t len;
 	int r;
 
-	if (!base_store)
-		storage_setup();
-
 	fp_dbg("save %s print from driver %04x", finger_num_to_str(finger),
 		data->driver_id);
 	len = fp_print_data_get_data(data, &buf);
@@ -436,9 +449,6 @@ API_EXPORTED int fp_print_data_load(struct fp_dev *dev,
 	struct fp_print_data *fdata;
 	int r;
 
-	if (!base_store)
-		storage_setup();
-
 	path = get_path_to_print(dev, finger);
 	r = load_from_file(path, &fdata);
 	g_free(path);
@@ -651,6 +661,7 @@ static GSList *scan_driver_store_dir(char *drvpath, uint16_t driver_id,
  */
 API_EXPORTED struct fp_dscv_print **fp_discover_prints(void)
 {
+	const char *base_store;
 	GDir *dir;
 	const gchar *ent;
 	GError *err = NULL;
@@ -660,9 +671,7 @@ API_EXPORTED struct fp_dscv_print **fp_discover_prints(void)
 	struct fp_dscv_print **list;
 	unsigned int i;
 
-	if (!base_store)
-		storage_setup();
-
+	base_store = get_base_store();
 	dir = g_dir_open(base_store, 0, &err);
 	if (!dir) {
 		fp_err("opendir %s failed: %s", base_store, err->message);
@@ -99,7 +99,38 @@ enum fp_dev_state {
 
 struct fp_driver **fprint_get_drivers (void);
 
+/* everything a libfprint instance owns. a context is only ever driven from
+ * one thread at a time, so none of this is locked. */
+struct fp_context {
+	libusb_context *usb_ctx;
+	GSList *registered_drivers;
+	GSList *opened_devices;
+	/* lazily set up by data.c */
+	char *base_store;
+
+	/* poll.c, see there */
+	struct fpi_timeout **timer_heap;
+	unsigned int timer_heap_len;
+	unsigned int timer_heap_size;
+	unsigned long timer_seq;
+	GSList *timeout_chunks;
+	struct fpi_timeout *free_timeouts;
+	int timer_fd;
+	int event_fd;
+	fp_pollfd_added_cb fd_added_cb;
+	fp_pollfd_removed_cb fd_removed_cb;
+
+	/* identify.c */
+	enum fp_identify_mode identify_mode;
+	unsigned int identify_threads;
+	struct fpi_identify_pool *identify_pool;
+};
+
+/* the thread default context, or the one set up by fp_init() */
+struct fp_context *fpi_context_get(void);
+
 struct fp_dev {
+	struct fp_context *ctx;
 	struct fp_driver *drv;
 	libusb_device_handle *udev;
 	uint32_t devtype;
@@ -312,15 +343,13 @@ extern struct fp_img_driver vfs0050_driver;
 extern struct fp_img_driver elan_driver;
 #endif
 
-extern libusb_context *fpi_usb_ctx;
-extern GSList *opened_devices;
-
 void fpi_img_driver_setup(struct fp_img_driver *idriver);
 
 #define fpi_driver_to_img_driver(drv) \
 	container_of((drv), struct fp_img_driver, driver)
 
 struct fp_dscv_dev {
+	struct fp_context *ctx;
 	struct libusb_device *udev;
 	struct fp_driver *drv;
 	unsigned long driver_data;
@@ -364,8 +393,10 @@ struct fpi_print_data_item_fp2 {
 	unsigned char data[0];
 } __attribute__((__packed__));
 
-void fpi_data_exit(void);
+void fpi_data_exit(struct fp_context *ctx);
 struct fp_print_data *fpi_print_data_new(struct fp_dev *dev);
+struct fp_print_data *fpi_print_data_new_for_driver(uint16_t driver_id,
+	uint32_t devtype, enum fp_print_data_type type);
 struct fp_print_data_item *fpi_print_data_item_new(size_t length);
 gboolean fpi_print_data_compatible(uint16_t driver_id1, uint32_t devtype1,
 	enum fp_print_data_type type1, uint16_t driver_id2, uint32_t devtype2,
@@ -408,12 +439,17 @@ int fpi_img_compare_print_data(struct fp_print_data *enrolled_print,
 	struct fp_print_data *new_print);
 int fpi_img_compare_print_data_to_gallery(struct fp_print_data *print,
 	struct fp_print_data **gallery, int match_threshold, size_t *match_offset);
+
+struct xyt_struct;
+int fpi_identify_gallery(struct xyt_struct *probe,
+	struct fp_print_data **gallery, int match_threshold, size_t *match_offset);
+void fpi_identify_exit(struct fp_context *ctx);
 struct fp_img *fpi_im_resize(struct fp_img *img, unsigned int w_factor, unsigned int h_factor);
 
 /* polling and timeouts */
 
-void fpi_poll_init(void);
-void fpi_poll_exit(void);
+void fpi_poll_init(struct fp_context *ctx);
+void fpi_poll_exit(struct fp_context *ctx);
 
 typedef void (*fpi_timeout_fn)(void *data);
 
@@ -34,6 +34,7 @@ struct fp_dev;
 struct fp_driver;
 struct fp_print_data;
 struct fp_img;
+struct fp_context;
 
 /* misc/general stuff */
 
@@ -251,6 +252,22 @@ static inline int fp_identify_finger(struct fp_dev *dev,
 	return fp_identify_finger_img(dev, print_gallery, match_offset, NULL);
 }
 
+/** \ingroup dev
+ * Which print of the gallery identification reports when several of them
+ * match the scanned finger, see fp_set_identify_mode().
+ */
+enum fp_identify_mode {
+	/** The first one in gallery order. The prints after it are not
+	 * compared. */
+	FP_IDENTIFY_FIRST_MATCH = 0,
+	/** The one with the highest score, the first one in gallery order in
+	 * case of a tie. All the prints are compared. */
+	FP_IDENTIFY_BEST_MATCH,
+};
+
+void fp_set_identify_mode(enum fp_identify_mode mode);
+void fp_set_identify_threads(unsigned int threads);
+
 /* Data handling */
 int fp_print_data_load(struct fp_dev *dev, enum fp_finger finger,
 	struct fp_print_data **data);
@@ -290,6 +307,10 @@ int fp_img_save_to_file(struct fp_img *img, char *path);
 void fp_img_standardize(struct fp_img *img);
 struct fp_img *fp_img_binarize(struct fp_img *img);
 struct fp_minutia **fp_img_get_minutiae(struct fp_img *img, int *nr_minutiae);
+struct fp_img *fp_img_new_from_data(const unsigned char *data, int width,
+	int height);
+int fp_img_to_print_data(struct fp_img *img, uint16_t driver_id,
+	uint32_t devtype, struct fp_print_data **ret);
 void fp_img_free(struct fp_img *img);
 
 /* Polling and timing */
@@ -303,6 +324,8 @@ int fp_handle_events_timeout(struct timeval *timeout);
 int fp_handle_events(void);
 size_t fp_get_pollfds(struct fp_pollfd **pollfds);
 int fp_get_next_timeout(struct timeval *tv);
+int fp_get_event_fd(void);
+int fp_dispatch_events(void);
 
 typedef void (*fp_pollfd_added_cb)(int fd, short events);
 typedef void (*fp_pollfd_removed_cb)(int fd);
@@ -314,6 +337,11 @@ int fp_init(void);
 void fp_exit(void);
 void fp_set_debug(int level);
 
+struct fp_context *fp_context_new(void);
+void fp_context_free(struct fp_context *ctx);
+void fp_context_push_thread_default(struct fp_context *ctx);
+void fp_context_pop_thread_default(struct fp_context *ctx);
+
 /* Asynchronous I/O */
 
 typedef void (*fp_dev_open_cb)(struct fp_dev *dev, int status, void *user_data);
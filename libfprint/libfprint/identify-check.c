@@ -0,0 +1,152 @@
+/*
+ * Check of parallel identification against a serial scan
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Identifies probes against galleries of several sizes, some smaller than
+ * the number of threads, with one thread, which scans the gallery in order,
+ * and then with the pool. Both have to report the same print, in either
+ * identify mode, and the pool has to stay the same whatever the gallery size.
+ *
+ * Run by make check, or as identify-check [threads].
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fp_internal.h"
+#include "check-prints.h"
+
+#define CHECK_THRESHOLD 40
+#define CHECK_PROBES 6
+#define CHECK_FINGERS 8
+#define CHECK_ROUNDS 5
+#define CHECK_DEFAULT_THREADS 4
+
+static const size_t check_sizes[] = { 1, 2, 3, 5, 12, 40 };
+
+/* print k holds 1 to 3 scans of finger k % CHECK_FINGERS */
+static struct fp_print_data **check_gallery(size_t size)
+{
+	struct fp_print_data **gallery = g_new0(struct fp_print_data *, size + 1);
+	size_t k;
+	int i;
+
+	for (k = 0; k < size; k++) {
+		gallery[k] = fpi_print_data_new_for_driver(0, 0, PRINT_DATA_NBIS_MINUTIAE);
+		for (i = 0; i <= k % 3; i++) {
+			struct fp_print_data_item *item =
+				fpi_print_data_item_new(sizeof(struct xyt_struct));
+
+			check_print((struct xyt_struct *) item->data,
+				k % CHECK_FINGERS, k * 3 + i + 1);
+			gallery[k]->prints = g_slist_append(gallery[k]->prints, item);
+		}
+	}
+	return gallery;
+}
+
+static void check_gallery_free(struct fp_print_data **gallery)
+{
+	size_t k;
+
+	for (k = 0; gallery[k]; k++)
+		fp_print_data_free(gallery[k]);
+	g_free(gallery);
+}
+
+static int check_identify(struct xyt_struct *probe,
+	struct fp_print_data **gallery, unsigned int threads, size_t *offset)
+{
+	fp_set_identify_threads(threads);
+	*offset = (size_t) -1;
+	return fpi_identify_gallery(probe, gallery, CHECK_THRESHOLD, offset);
+}
+
+int main(int argc, char **argv)
+{
+	const enum fp_identify_mode modes[] = {
+		FP_IDENTIFY_FIRST_MATCH, FP_IDENTIFY_BEST_MATCH,
+	};
+	struct xyt_struct probes[CHECK_PROBES];
+	struct fpi_identify_pool *pool = NULL;
+	unsigned int threads;
+	int runs = 0, matches = 0, differ = 0;
+	int m, i, r;
+	size_t s;
+
+	threads = argc > 1 ? atoi(argv[1]) : CHECK_DEFAULT_THREADS;
+	if (threads < 2) {
+		fprintf(stderr, "usage: %s [threads], at least 2\n", argv[0]);
+		return 1;
+	}
+
+	r = fp_init();
+	if (r < 0) {
+		fprintf(stderr, "Failed to initialize libfprint\n");
+		return 1;
+	}
+
+	for (i = 0; i < CHECK_PROBES; i++)
+		check_print(&probes[i], i, 0);
+
+	for (m = 0; m < G_N_ELEMENTS(modes); m++) {
+		fp_set_identify_mode(modes[m]);
+
+		for (s = 0; s < G_N_ELEMENTS(check_sizes); s++) {
+			struct fp_print_data **gallery = check_gallery(check_sizes[s]);
+
+			for (i = 0; i < CHECK_PROBES; i++) {
+				size_t serial_offset, offset;
+				int serial = check_identify(&probes[i], gallery, 1,
+					&serial_offset);
+
+				if (serial == FP_VERIFY_MATCH)
+					matches++;
+				for (r = 0; r < CHECK_ROUNDS; r++) {
+					int result = check_identify(&probes[i], gallery,
+						threads, &offset);
+
+					runs++;
+					if (result != serial || (result == FP_VERIFY_MATCH &&
+							offset != serial_offset)) {
+						fprintf(stderr, "mode %d, %zu prints, probe %d: "
+							"%d at %zd, serially %d at %zd\n", modes[m],
+							check_sizes[s], i, result, (ssize_t) offset,
+							serial, (ssize_t) serial_offset);
+						differ++;
+					}
+				}
+			}
+
+			/* one pool for every gallery size */
+			if (pool && fpi_context_get()->identify_pool != pool) {
+				fprintf(stderr, "pool replaced for %zu prints\n",
+					check_sizes[s]);
+				differ++;
+			}
+			pool = fpi_context_get()->identify_pool;
+			check_gallery_free(gallery);
+		}
+	}
+
+	printf("%d identifications on %u threads, %d serial matches: %d differ\n",
+		runs, threads, matches, differ);
+	fp_exit();
+	return differ != 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * Parallel identification against a gallery
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "identify"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "fp_internal.h"
+#include "nbis/include/bozorth.h"
+
+/* Every enrolled sample of the gallery is compared on its own. Samples are
+ * handed out one at a time in gallery order to the calling thread and to the
+ * workers of the context's pool, each matching in its own Bozorth3 context.
+ * As they are handed out in order, once a match is found nothing that is
+ * still to be handed out can come before it, so only the comparisons in
+ * flight are waited for and the result is the one of a serial scan.
+ *
+ * The pool follows fp_set_identify_threads() only. A gallery with fewer
+ * samples than threads lets just as many workers take part, and the others
+ * go back to waiting without touching the job. */
+
+struct identify_sample {
+	/* of the print in the gallery */
+	size_t offset;
+	struct xyt_struct *xyt;
+};
+
+struct identify_job {
+	struct xyt_struct *probe;
+	struct identify_sample *samples;
+	size_t n_samples;
+	int threshold;
+	enum fp_identify_mode mode;
+
+	/* protects the rest */
+	pthread_mutex_t lock;
+	/* next sample to hand out */
+	size_t next;
+	int matched;
+	size_t match_offset;
+	int match_score;
+};
+
+struct fpi_identify_pool {
+	pthread_mutex_t lock;
+	/* a job was posted, or the pool is exiting */
+	pthread_cond_t job_cond;
+	/* a worker is done with the job */
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	/* started, and asked for */
+	unsigned int n_threads;
+	unsigned int wanted;
+
+	struct identify_job *job;
+	unsigned long job_seq;
+	/* workers that may take part in the job, and that did so far */
+	unsigned int job_workers;
+	unsigned int joined;
+	/* workers that are not done with the job yet */
+	unsigned int busy;
+	int exiting;
+};
+
+static void job_report(struct identify_job *job, size_t offset, int score)
+{
+	if (score < job->threshold)
+		return;
+
+	/* the lowest offset wins, among the best scores for a best match */
+	if (job->matched) {
+		if (job->mode == FP_IDENTIFY_FIRST_MATCH) {
+			if (offset >= job->match_offset)
+				return;
+		} else if (score < job->match_score || (score == job->match_score &&
+				offset >= job->match_offset)) {
+			return;
+		}
+	}
+
+	job->matched = 1;
+	job->match_offset = offset;
+	job->match_score = score;
+}
+
+static void job_run(struct identify_job *job)
+{
+	int probe_len = -1;
+
+	pthread_mutex_lock(&job->lock);
+	while (job->next < job->n_samples) {
+		struct identify_sample *sample;
+		int score;
+
+		/* everything left comes after the match */
+		if (job->matched && job->mode == FP_IDENTIFY_FIRST_MATCH)
+			break;
+
+		sample = &job->samples[job->next++];
+		pthread_mutex_unlock(&job->lock);
+
+		if (probe_len < 0)
+			probe_len = bozorth_probe_init(job->probe);
+		score = bozorth_to_gallery(probe_len, job->probe, sample->xyt);
+		fp_dbg("score %d for print %zu", score, sample->offset);
+
+		pthread_mutex_lock(&job->lock);
+		job_report(job, sample->offset, score);
+	}
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void *pool_worker(void *data)
+{
+	struct fpi_identify_pool *pool = data;
+	unsigned long seen_seq = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		struct identify_job *job = NULL;
+
+		while (!pool->exiting && pool->job_seq == seen_seq)
+			pthread_cond_wait(&pool->job_cond, &pool->lock);
+		if (pool->exiting)
+			break;
+
+		seen_seq = pool->job_seq;
+		if (pool->joined < pool->job_workers) {
+			pool->joined++;
+			job = pool->job;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (job)
+			job_run(job);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void pool_free(struct fpi_identify_pool *pool)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->exiting = 1;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_mutex_destroy(&pool->lock);
+	g_free(pool->threads);
+	g_free(pool);
+}
+
+static struct fpi_identify_pool *pool_new(unsigned int n_threads)
+{
+	struct fpi_identify_pool *pool = g_malloc0(sizeof(*pool));
+	unsigned int i;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	pool->threads = g_malloc(sizeof(*pool->threads) * n_threads);
+	pool->wanted = n_threads;
+
+	for (i = 0; i < n_threads; i++) {
+		int r = pthread_create(&pool->threads[i], NULL, pool_worker, pool);
+		if (r) {
+			fp_err("only started %u of %u identify workers, error %d",
+				i, n_threads, r);
+			break;
+		}
+	}
+	pool->n_threads = i;
+
+	if (pool->n_threads == 0) {
+		pool_free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+/* the calling thread works on the job too, with up to n_workers workers */
+static void pool_run(struct fpi_identify_pool *pool, struct identify_job *job,
+	unsigned int n_workers)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->job_seq++;
+	pool->job_workers = n_workers;
+	pool->joined = 0;
+	pool->busy = pool->n_threads;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	job_run(job);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pool->job = NULL;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static unsigned int identify_threads(struct fp_context *ctx)
+{
+	long cpus;
+
+	if (!ctx)
+		return 1;
+	if (ctx->identify_threads > 0)
+		return ctx->identify_threads;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? cpus : 1;
+}
+
+/* workers of the context's pool, which is set up on first use and follows
+ * fp_set_identify_threads() */
+static struct fpi_identify_pool *get_pool(struct fp_context *ctx,
+	unsigned int n_threads)
+{
+	if (ctx->identify_pool && ctx->identify_pool->wanted != n_threads) {
+		pool_free(ctx->identify_pool);
+		ctx->identify_pool = NULL;
+	}
+	if (!ctx->identify_pool)
+		ctx->identify_pool = pool_new(n_threads);
+	return ctx->identify_pool;
+}
+
+int fpi_identify_gallery(struct xyt_struct *probe,
+	struct fp_print_data **gallery, int match_threshold, size_t *match_offset)
+{
+	struct fp_context *ctx = fpi_context_get();
+	struct fpi_identify_pool *pool = NULL;
+	struct identify_job job;
+	GArray *samples;
+	unsigned int n_threads;
+	size_t i;
+
+	samples = g_array_new(FALSE, FALSE, sizeof(struct identify_sample));
+	for (i = 0; gallery[i]; i++) {
+		GSList *elem;
+
+		for (elem = gallery[i]->prints; elem; elem = g_slist_next(elem)) {
+			struct fp_print_data_item *item = elem->data;
+			struct identify_sample sample = { i, (struct xyt_struct *) item->data };
+			g_array_append_val(samples, sample);
+		}
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.probe = probe;
+	job.samples = (struct identify_sample *) samples->data;
+	job.n_samples = samples->len;
+	job.threshold = match_threshold;
+	job.mode = ctx ? ctx->identify_mode : FP_IDENTIFY_FIRST_MATCH;
+	pthread_mutex_init(&job.lock, NULL);
+
+	n_threads = identify_threads(ctx);
+	if (ctx && n_threads > 1 && job.n_samples > 1)
+		pool = get_pool(ctx, n_threads - 1);
+	if (pool)
+		pool_run(pool, &job, MIN(pool->n_threads, job.n_samples - 1));
+	else
+		job_run(&job);
+
+	pthread_mutex_destroy(&job.lock);
+	g_array_free(samples, TRUE);
+
+	if (!job.matched)
+		return FP_VERIFY_NO_MATCH;
+
+	fp_dbg("print %zu matched with score %d", job.match_offset,
+		job.match_score);
+	*match_offset = job.match_offset;
+	return FP_VERIFY_MATCH;
+}
+
+void fpi_identify_exit(struct fp_context *ctx)
+{
+	if (ctx->identify_pool) {
+		pool_free(ctx->identify_pool);
+		ctx->identify_pool = NULL;
+	}
+}
+
+/** \ingroup dev
+ * Choose which print of the gallery identification reports when several of
+ * them match the scanned finger. The setting belongs to the current context,
+ * see fp_context_new().
+ *
+ * \param mode #FP_IDENTIFY_FIRST_MATCH, the default, or
+ * #FP_IDENTIFY_BEST_MATCH
+ */
+API_EXPORTED void fp_set_identify_mode(enum fp_identify_mode mode)
+{
+	struct fp_context *ctx = fpi_context_get();
+
+	if (ctx)
+		ctx->identify_mode = mode;
+}
+
+/** \ingroup dev
+ * Set the number of threads that compare a scanned finger with the gallery
+ * during identification, the calling one included. The comparisons of a
+ * gallery are independent from each other, so identification against a
+ * large gallery gets faster with every core it is spread over. The threads
+ * are started on the first identification and kept until the context is
+ * freed, or until the setting changes. Each of them keeps its own matcher
+ * state of about 47 MB, mostly untouched scratch space. The setting belongs to
+ * the current context, see fp_context_new().
+ *
+ * \param threads number of threads. 1, the default, compares on the calling
+ * thread only and starts no threads, 0 uses one thread per online CPU.
+ */
+API_EXPORTED void fp_set_identify_threads(unsigned int threads)
+{
+	struct fp_context *ctx = fpi_context_get();
+
+	if (ctx)
+		ctx->identify_threads = threads;
+}
@@ -64,6 +64,34 @@ struct fp_img *fpi_img_new_for_imgdev(struct fp_img_dev *imgdev)
 	return img;
 }
 
+/** \ingroup img
+ * Creates an image from 8-bit greyscale pixel data held by the caller, for
+ * example an image read from a sensor that has no libfprint driver. The data
+ * is copied and is expected to be in \ref img_std "standard" form.
+ * \param data width * height bytes of pixel data, row by row
+ * \param width the pixel width of the image
+ * \param height the pixel height of the image
+ * \returns the new image, or NULL if data is NULL, a dimension is not
+ * positive or the image is too large. Must be freed with fp_img_free() after
+ * use.
+ */
+API_EXPORTED struct fp_img *fp_img_new_from_data(const unsigned char *data,
+	int width, int height)
+{
+	struct fp_img *img;
+
+	if (!data || width <= 0 || height <= 0 || width > G_MAXINT / height) {
+		fp_err("invalid image data %p, %dx%d", data, width, height);
+		return NULL;
+	}
+
+	img = fpi_img_new(width * height);
+	img->width = width;
+	img->height = height;
+	memcpy(img->data, data, width * height);
+	return img;
+}
+
 gboolean fpi_img_is_sane(struct fp_img *img)
 {
 	/* basic checks */
@@ -312,11 +340,8 @@ int fpi_img_detect_minutiae(struct fp_img *img)
 	return minutiae->num;
 }
 
-int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
-	struct fp_print_data **ret)
+static int img_ensure_minutiae(struct fp_img *img)
 {
-	struct fp_print_data *print;
-	struct fp_print_data_item *item;
 	int r;
 
 	if (!img->minutiae) {
@@ -329,9 +354,15 @@ int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
 		}
 	}
 
+	return 0;
+}
+
+static void img_fill_print_data(struct fp_img *img, struct fp_print_data *print)
+{
+	struct fp_print_data_item *item;
+
 	/* FIXME: space is wasted if we dont hit the max minutiae count. would
 	 * be good to make this dynamic. */
-	print = fpi_print_data_new(imgdev->dev);
 	item = fpi_print_data_item_new(sizeof(struct xyt_struct));
 	print->type = PRINT_DATA_NBIS_MINUTIAE;
 	minutiae_to_xyt(img->minutiae, img->width, img->height, item->data);
@@ -340,6 +371,50 @@ int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
 	/* FIXME: the print buffer at this point is endian-specific, and will
 	 * only work when loaded onto machines with identical endianness. not good!
 	 * data format should be platform-independent. */
+}
+
+int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
+	struct fp_print_data **ret)
+{
+	struct fp_print_data *print;
+	int r;
+
+	r = img_ensure_minutiae(img);
+	if (r < 0)
+		return r;
+
+	print = fpi_print_data_new(imgdev->dev);
+	img_fill_print_data(img, print);
+	*ret = print;
+
+	return 0;
+}
+
+/** \ingroup img
+ * Detects the minutiae of an image and turns them into print data, the same
+ * way an imaging device does after a capture, for images that come from
+ * outside of libfprint. The print is tagged with the given driver ID and
+ * device type, so it only matches prints of that same pair.
+ * \param img a standardized image
+ * \param driver_id the driver ID to store in the print
+ * \param devtype the device type to store in the print
+ * \param ret output location for the print data. Must be freed with
+ * fp_print_data_free() after use.
+ * \returns 0 on success, negative error code on failure
+ */
+API_EXPORTED int fp_img_to_print_data(struct fp_img *img, uint16_t driver_id,
+	uint32_t devtype, struct fp_print_data **ret)
+{
+	struct fp_print_data *print;
+	int r;
+
+	r = img_ensure_minutiae(img);
+	if (r < 0)
+		return r;
+
+	print = fpi_print_data_new_for_driver(driver_id, devtype,
+		PRINT_DATA_NBIS_MINUTIAE);
+	img_fill_print_data(img, print);
 	*ret = print;
 
 	return 0;
@@ -385,14 +460,7 @@ int fpi_img_compare_print_data(struct fp_print_data *enrolled_print,
 int fpi_img_compare_print_data_to_gallery(struct fp_print_data *print,
 	struct fp_print_data **gallery, int match_threshold, size_t *match_offset)
 {
-	struct xyt_struct *pstruct;
-	struct xyt_struct *gstruct;
-	struct fp_print_data *gallery_print;
 	struct fp_print_data_item *data_item;
-	int probe_len;
-	size_t i = 0;
-	int r;
-	GSList *list_item;
 
 	if (g_slist_length(print->prints) != 1) {
 		fp_err("new_print contains more than one sample, is it enrolled print?");
@@ -400,23 +468,8 @@ int fpi_img_compare_print_data_to_gallery(struct fp_print_data *print,
 	}
 
 	data_item = print->prints->data;
-	pstruct = (struct xyt_struct *)data_item->data;
-
-	probe_len = bozorth_probe_init(pstruct);
-	while ((gallery_print = gallery[i++])) {
-		list_item = gallery_print->prints;
-		do {
-			data_item = list_item->data;
-			gstruct = (struct xyt_struct *)data_item->data;
-			r = bozorth_to_gallery(probe_len, pstruct, gstruct);
-			if (r >= match_threshold) {
-				*match_offset = i - 1;
-				return FP_VERIFY_MATCH;
-			}
-			list_item = g_slist_next(list_item);
-		} while (list_item);
-	}
-	return FP_VERIFY_NO_MATCH;
+	return fpi_identify_gallery((struct xyt_struct *)data_item->data, gallery,
+		match_threshold, match_offset);
 }
 
 /** \ingroup img
@@ -353,6 +353,7 @@ while ( shiftcount-- > 0 ) {
 /* Return value is the # of compatible edge pairs           */
 /***********************************************************************/
 int bz_match(
+	struct bz_context * ctx,	/* INPUT and OUTPUT: working arrays of this match */
 	int probe_ptrlist_len,		/* INPUT:  pruned length of Subject's pointer list */
 	int gallery_ptrlist_len		/* INPUT:  pruned length of On-File Record's pointer list */
 	)
@@ -377,21 +378,14 @@ int t;			/* Top of search range */
 register int * rotptr;
 
 
-#define ROT_SIZE_1 20000
-#define ROT_SIZE_2 5
 
-static int rot[ ROT_SIZE_1 ][ ROT_SIZE_2 ];
 
-
-static int * rtp[ ROT_SIZE_1 ];
-
-
-
-
-/* These now externally defined in bozorth.h */
-/* extern int * scolpt[ SCOLPT_SIZE ];			 INPUT */
-/* extern int * fcolpt[ FCOLPT_SIZE ];			 INPUT */
-/* extern int   colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];	 OUTPUT */
+/* These now in struct bz_context in bozorth.h */
+/* int * scolpt[ SCOLPT_SIZE ];			 INPUT */
+/* int * fcolpt[ FCOLPT_SIZE ];			 INPUT */
+/* int   colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];	 OUTPUT */
+/* int   rot[ ROT_SIZE_1 ][ ROT_SIZE_2 ];	 WORK */
+/* int * rtp[ ROT_SIZE_1 ];			 WORK */
 /* extern int verbose_bozorth; */
 /* extern FILE * stderr; */
 /* extern char * get_progname( void ); */
@@ -403,17 +397,17 @@ static int * rtp[ ROT_SIZE_1 ];
 
 st = 1;
 edge_pair_index = 0;
-rotptr = &rot[0][0];
+rotptr = &ctx->rot[0][0];
 
 /* Foreach sorted edge in Subject's Web ... */
 
 for ( k = 1; k < probe_ptrlist_len; k++ ) {
-	ss = scolpt[k-1];
+	ss = ctx->scolpt[k-1];
 
 	/* Foreach sorted edge in On-File Record's Web ... */
 
 	for ( j = st; j <= gallery_ptrlist_len; j++ ) {
-		ff = fcolpt[j-1];
+		ff = ctx->fcolpt[j-1];
 		dz = *ff - *ss;
 
 		fi = ( 2.0F * TK ) * ( *ff + *ss );
@@ -540,8 +534,8 @@ for ( k = 1; k < probe_ptrlist_len; k++ ) {
 								/*	2 = Subject's Jth */
 
 				ii = ii_table[i];
-				p1 = rot[edge_pair_index][ii];
-				p2 = *( rtp[l-1] + ii );
+				p1 = ctx->rot[edge_pair_index][ii];
+				p2 = *( ctx->rtp[l-1] + ii );
 
 				n = SENSE(p1,p2);
 
@@ -565,7 +559,7 @@ for ( k = 1; k < probe_ptrlist_len; k++ ) {
 		if ( n == 1 )
 			++l;
 
-		rtp_insert( rtp, l, edge_pair_index, &rot[edge_pair_index][0] );
+		rtp_insert( ctx->rtp, l, edge_pair_index, &ctx->rot[edge_pair_index][0] );
 		++edge_pair_index;
 
 		if ( edge_pair_index == 19999 ) {
@@ -585,13 +579,18 @@ for ( k = 1; k < probe_ptrlist_len; k++ ) {
 
 END:
 {
-	int * colp_ptr = &colp[0][0];
+	int * colp_ptr = &ctx->colp[0][0];
 
 	for ( i = 0; i < edge_pair_index; i++ ) {
-		INT_COPY( colp_ptr, rtp[i], COLP_SIZE_2 );
+		INT_COPY( colp_ptr, ctx->rtp[i], COLP_SIZE_2 );
 
 
 	}
+
+	/* bz_match_score() looks one row past the last edge pair, it must */
+	/* find it as a fresh table has it, not left over from a previous  */
+	/* match in the same context                                       */
+	INT_SET( colp_ptr, COLP_SIZE_2, 0 );
 }
 
 
@@ -600,19 +599,15 @@ return edge_pair_index;			/* Return the number of compatible edge pairs stored i
 }
 
 /**************************************************************************/
-/* These global arrays are declared "static" as they are only used        */
+/* The arrays ct, gct, ctt, ctp and yy of the context are only used       */
 /* between bz_match_score() & bz_final_loop()                             */
 /**************************************************************************/
-static int ct[ CT_SIZE ];
-static int gct[ GCT_SIZE ];
-static int ctt[ CTT_SIZE ];
-static int ctp[ CTP_SIZE_1 ][ CTP_SIZE_2 ];
-static int yy[ YY_SIZE_1 ][ YY_SIZE_2 ][ YY_SIZE_3 ];
 
-static int    bz_final_loop( int );
+static int    bz_final_loop( struct bz_context *, int );
 
 /**************************************************************************/
 int bz_match_score(
+	struct bz_context * ctx,
 	int np,
 	struct xyt_struct * pstruct,
 	struct xyt_struct * gstruct
@@ -690,16 +685,16 @@ if ( gstruct->nrows < MIN_COMPUTABLE_BOZORTH_MINUTIAE ) {
 
 
 								/* initialize tables to 0's */
-INT_SET( (int *) &yl, YL_SIZE_1 * YL_SIZE_2, 0 );
+INT_SET( (int *) &ctx->yl, YL_SIZE_1 * YL_SIZE_2, 0 );
 
 
 
-INT_SET( (int *) &sc, SC_SIZE, 0 );
-INT_SET( (int *) &cp, CP_SIZE, 0 );
-INT_SET( (int *) &rp, RP_SIZE, 0 );
-INT_SET( (int *) &tq, TQ_SIZE, 0 );
-INT_SET( (int *) &rq, RQ_SIZE, 0 );
-INT_SET( (int *) &zz, ZZ_SIZE, 1000 );				/* zz[] initialized to 1000's */
+INT_SET( (int *) &ctx->sc, SC_SIZE, 0 );
+INT_SET( (int *) &ctx->cp, CP_SIZE, 0 );
+INT_SET( (int *) &ctx->rp, RP_SIZE, 0 );
+INT_SET( (int *) &ctx->tq, TQ_SIZE, 0 );
+INT_SET( (int *) &ctx->rq, RQ_SIZE, 0 );
+INT_SET( (int *) &ctx->zz, ZZ_SIZE, 1000 );				/* zz[] initialized to 1000's */
 
 INT_SET( (int *) &avn, AVN_SIZE, 0 );				/* avn[0...4] <== 0; */
 
@@ -717,19 +712,19 @@ match_score = 0;
 for ( k = 0; k < np - 1; k++ ) {
 					/* printf( "compute(): looping with k=%d\n", k ); */
 
-	if ( sc[k] )			/* If SC counter for current pair already incremented ... */
+	if ( ctx->sc[k] )			/* If SC counter for current pair already incremented ... */
 		continue;		/*		Skip to next pair */
 
 
-	i = colp[k][1];
-	t = colp[k][3];
+	i = ctx->colp[k][1];
+	t = ctx->colp[k][3];
 
 
 
 
-	qq[0]   = i;
-	rq[t-1] = i;
-	tq[i-1] = t;
+	ctx->qq[0]   = i;
+	ctx->rq[t-1] = i;
+	ctx->tq[i-1] = t;
 
 
 	ww = 0;
@@ -754,10 +749,10 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 
-			kz = colp[kx][2];
-			l  = colp[kx][4];
+			kz = ctx->colp[kx][2];
+			l  = ctx->colp[kx][4];
 			kx++;
-			bz_sift( &ww, kz, &qh, l, kx, ftt, &tot, &qq_overflow );
+			bz_sift( ctx, &ww, kz, &qh, l, kx, ftt, &tot, &qq_overflow );
 			if ( qq_overflow ) {
 				fprintf( stderr, "%s: WARNING: bz_match_score(): qq[] overflow from bz_sift() #1 [p=%s; g=%s]\n",
 							get_progname(), get_probe_filename(), get_gallery_filename() );
@@ -766,10 +761,10 @@ for ( k = 0; k < np - 1; k++ ) {
 
 #ifndef NOVERBOSE
 			if ( verbose_bozorth )
-				printf( "x1 %d %d %d %d %d %d\n", kx, colp[kx][0], colp[kx][1], colp[kx][2], colp[kx][3], colp[kx][4] );
+				printf( "x1 %d %d %d %d %d %d\n", kx, ctx->colp[kx][0], ctx->colp[kx][1], ctx->colp[kx][2], ctx->colp[kx][3], ctx->colp[kx][4] );
 #endif
 
-		} while ( colp[kx][3] == colp[k][3] && colp[kx][1] == colp[k][1] );
+		} while ( ctx->colp[kx][3] == ctx->colp[k][3] && ctx->colp[kx][1] == ctx->colp[k][1] );
 			/* While the startpoints of lookahead edge pairs are the same as the starting points of the */
 			/* current pair, set KQ to lookahead edge pair index where above bz_sift() loop left off */
 
@@ -785,9 +780,9 @@ for ( k = 0; k < np - 1; k++ ) {
 								get_progname(), j-1, get_probe_filename(), get_gallery_filename() );
 							return QQ_OVERFLOW_SCORE;
 						}
-						p1 = qq[j];
+						p1 = ctx->qq[j];
 					} else {
-						p1 = tq[p1-1];
+						p1 = ctx->tq[p1-1];
 
 					}
 
@@ -796,20 +791,20 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 
-					if ( colp[i][2*z] != p1 )
+					if ( ctx->colp[i][2*z] != p1 )
 						break;
 				}
 
 
 				if ( z == 3 ) {
-					z = colp[i][1];
-					l = colp[i][3];
+					z = ctx->colp[i][1];
+					l = ctx->colp[i][3];
 
 
 
-					if ( z != colp[k][1] && l != colp[k][3] ) {
+					if ( z != ctx->colp[k][1] && l != ctx->colp[k][3] ) {
 						kx = i + 1;
-						bz_sift( &ww, z, &qh, l, kx, ftt, &tot, &qq_overflow );
+						bz_sift( ctx, &ww, z, &qh, l, kx, ftt, &tot, &qq_overflow );
 						if ( qq_overflow ) {
 							fprintf( stderr, "%s: WARNING: bz_match_score(): qq[] overflow from bz_sift() #2 [p=%s; g=%s]\n",
 								get_progname(), get_probe_filename(), get_gallery_filename() );
@@ -842,14 +837,14 @@ for ( k = 0; k < np - 1; k++ ) {
 								get_progname(), j-1, get_probe_filename(), get_gallery_filename() );
 							return QQ_OVERFLOW_SCORE;
 						}
-						p1 = qq[j];
+						p1 = ctx->qq[j];
 					} else {
-						p1 = tq[p1-1];
+						p1 = ctx->tq[p1-1];
 					}
 
 
 
-					p2 = colp[l-1][i*2-1];
+					p2 = ctx->colp[l-1][i*2-1];
 
 					n = SENSE(p1,p2);
 
@@ -871,23 +866,23 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 					/* Locates the head of consecutive sequence of edge pairs all having the same starting Subject and On-File edgepoints */
-					while ( colp[l-2][3] == p2 && colp[l-2][1] == colp[l-1][1] )
+					while ( ctx->colp[l-2][3] == p2 && ctx->colp[l-2][1] == ctx->colp[l-1][1] )
 						l--;
 
 					kx = l - 1;
 
 
 					do {
-						kz = colp[kx][2];
-						l  = colp[kx][4];
+						kz = ctx->colp[kx][2];
+						l  = ctx->colp[kx][4];
 						kx++;
-						bz_sift( &ww, kz, &qh, l, kx, ftt, &tot, &qq_overflow );
+						bz_sift( ctx, &ww, kz, &qh, l, kx, ftt, &tot, &qq_overflow );
 						if ( qq_overflow ) {
 							fprintf( stderr, "%s: WARNING: bz_match_score(): qq[] overflow from bz_sift() #3 [p=%s; g=%s]\n",
 								get_progname(), get_probe_filename(), get_gallery_filename() );
 							return QQ_OVERFLOW_SCORE;
 						}
-					} while ( colp[kx][3] == p2 && colp[kx][1] == colp[kx-1][1] );
+					} while ( ctx->colp[kx][3] == p2 && ctx->colp[kx][1] == ctx->colp[kx-1][1] );
 
 					break;
 				} /* END if ( n == 0 ) */
@@ -908,7 +903,7 @@ for ( k = 0; k < np - 1; k++ ) {
 			for ( i = 0; i < tot; i++ ) {
 
 
-				int colp_value = colp[ y[i]-1 ][0];
+				int colp_value = ctx->colp[ ctx->y[i]-1 ][0];
 				if ( colp_value < 0 ) {
 					kk += colp_value;
 					n++;
@@ -945,7 +940,7 @@ for ( k = 0; k < np - 1; k++ ) {
 
 			kk = 0;
 			for ( i = 0; i < tot; i++ ) {
-				int diff = colp[ y[i]-1 ][0] - jj;
+				int diff = ctx->colp[ ctx->y[i]-1 ][0] - jj;
 				j = SQUARED( diff );
 
 
@@ -954,7 +949,7 @@ for ( k = 0; k < np - 1; k++ ) {
 				if ( j > TXS && j < CTXS )
 					kk++;
 				else
-					y[i-kk] = y[i];
+					ctx->y[i-kk] = ctx->y[i];
 			} /* END FOR i */
 
 			tot -= kk;				/* Adjust the total edge pairs TOT based on # of edge pairs skipped */
@@ -970,11 +965,11 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 			for ( i = tot-1 ; i >= 0; i-- ) {
-				int idx = y[i] - 1;
-				if ( rk[idx] == 0 ) {
-					sc[idx] = -1;
+				int idx = ctx->y[i] - 1;
+				if ( ctx->rk[idx] == 0 ) {
+					ctx->sc[idx] = -1;
 				} else {
-					sc[idx] = rk[idx];
+					ctx->sc[idx] = ctx->rk[idx];
 				}
 			}
 			ftt--;
@@ -988,7 +983,7 @@ for ( k = 0; k < np - 1; k++ ) {
 			int pd = 0;
 
 			for ( i = 0; i < tot; i++ ) {
-				int idx = y[i] - 1;
+				int idx = ctx->y[i] - 1;
 				for ( ii = 1; ii < 4; ii++ ) {
 
 
@@ -999,15 +994,15 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 
-					jj = colp[idx][kk];
+					jj = ctx->colp[idx][kk];
 
 					switch ( ii ) {
 					  case 1:
-						if ( colp[idx][0] < 0 ) {
-							pd += colp[idx][0];
+						if ( ctx->colp[idx][0] < 0 ) {
+							pd += ctx->colp[idx][0];
 							pb++;
 						} else {
-							pa += colp[idx][0];
+							pa += ctx->colp[idx][0];
 							pc++;
 						}
 						break;
@@ -1037,15 +1032,15 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 
-						p1 = colp[idx][ 2 * ii + jj ];
+						p1 = ctx->colp[idx][ 2 * ii + jj ];
 
 
 						b = 0;
-						t = yl[ii][tp] + 1;
+						t = ctx->yl[ii][tp] + 1;
 
 						while ( t - b > 1 ) {
 							l  = ( b + t ) / 2;
-							p2 = yy[l-1][ii][tp];
+							p2 = ctx->yy[l-1][ii][tp];
 							n  = SENSE(p1,p2);
 
 							if ( n < 0 ) {
@@ -1063,12 +1058,12 @@ for ( k = 0; k < np - 1; k++ ) {
 							if ( n == 1 )
 								++l;
 
-							for ( kk = yl[ii][tp]; kk >= l; --kk ) {
-								yy[kk][ii][tp] = yy[kk-1][ii][tp];
+							for ( kk = ctx->yl[ii][tp]; kk >= l; --kk ) {
+								ctx->yy[kk][ii][tp] = ctx->yy[kk-1][ii][tp];
 							}
 
-							++yl[ii][tp];
-							yy[l-1][ii][tp] = p1;
+							++ctx->yl[ii][tp];
+							ctx->yy[l-1][ii][tp] = p1;
 
 
 						} /* END if ( n != 0 ) */
@@ -1110,14 +1105,14 @@ for ( k = 0; k < np - 1; k++ ) {
 				avn[ii] = 0;
 			}
 
-			ct[tp]  = tot;
-			gct[tp] = tot;
+			ctx->ct[tp]  = tot;
+			ctx->gct[tp] = tot;
 
 			if ( tot > match_score )		/* If current TOT > match_score ... */
 				match_score = tot;		/*	Keep track of max TOT in match_score */
 
-			ctt[tp]    = 0;		/* Init CTT[TP] to 0 */
-			ctp[tp][0] = tp;	/* Store TP into CTP */
+			ctx->ctt[tp]    = 0;		/* Init CTT[TP] to 0 */
+			ctx->ctp[tp][0] = tp;	/* Store TP into CTP */
 
 			for ( ii = 0; ii < tp; ii++ ) {
 				int found;
@@ -1306,7 +1301,7 @@ for ( k = 0; k < np - 1; k++ ) {
 					ll = 0;
 
 					do {
-						while ( yy[jj][kk][ii] < yy[ll][kk][tp] && jj < yl[kk][ii] ) {
+						while ( ctx->yy[jj][kk][ii] < ctx->yy[ll][kk][tp] && jj < ctx->yl[kk][ii] ) {
 
 							jj++;
 						}
@@ -1314,7 +1309,7 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 
-						while ( yy[jj][kk][ii] > yy[ll][kk][tp] && ll < yl[kk][tp] ) {
+						while ( ctx->yy[jj][kk][ii] > ctx->yy[ll][kk][tp] && ll < ctx->yl[kk][tp] ) {
 
 							ll++;
 						}
@@ -1322,23 +1317,23 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 
-						if ( yy[jj][kk][ii] == yy[ll][kk][tp] && jj < yl[kk][ii] && ll < yl[kk][tp] ) {
+						if ( ctx->yy[jj][kk][ii] == ctx->yy[ll][kk][tp] && jj < ctx->yl[kk][ii] && ll < ctx->yl[kk][tp] ) {
 							found = 1;
 							break;
 						}
 
 
-					} while ( jj < yl[kk][ii] && ll < yl[kk][tp] );
+					} while ( jj < ctx->yl[kk][ii] && ll < ctx->yl[kk][tp] );
 					if ( found )
 						break;
 				} /* END for kk */
 
 				if ( ! found ) {			/* If we didn't find what we were searching for ... */
-					gct[ii] += ct[tp];
-					if ( gct[ii] > match_score )
-						match_score = gct[ii];
-					++ctt[ii];
-					ctp[ii][ctt[ii]] = tp;
+					ctx->gct[ii] += ctx->ct[tp];
+					if ( ctx->gct[ii] > match_score )
+						match_score = ctx->gct[ii];
+					++ctx->ctt[ii];
+					ctx->ctp[ii][ctx->ctt[ii]] = tp;
 				}
 
 			} /* END for ii in [0,TP-1] prior TP group */
@@ -1356,55 +1351,55 @@ for ( k = 0; k < np - 1; k++ ) {
 			return QQ_OVERFLOW_SCORE;
 		}
 		for ( i = qh - 1; i > 0; i-- ) {
-			n = qq[i] - 1;
-			if ( ( tq[n] - 1 ) >= 0 ) {
-				rq[tq[n]-1] = 0;
-				tq[n]       = 0;
-				zz[n]       = 1000;
+			n = ctx->qq[i] - 1;
+			if ( ( ctx->tq[n] - 1 ) >= 0 ) {
+				ctx->rq[ctx->tq[n]-1] = 0;
+				ctx->tq[n]       = 0;
+				ctx->zz[n]       = 1000;
 			}
 		}
 
 		for ( i = dw - 1; i >= 0; i-- ) {
 			n = rr[i] - 1;
-			if ( tq[n] ) {
-				rq[tq[n]-1] = 0;
-				tq[n]       = 0;
+			if ( ctx->tq[n] ) {
+				ctx->rq[ctx->tq[n]-1] = 0;
+				ctx->tq[n]       = 0;
 			}
 		}
 
 		i = 0;
 		j = ww - 1;
 		while ( i >= 0 && j >= 0 ) {
-			if ( nn[j] < mm[j] ) {
-				++nn[j];
+			if ( ctx->nn[j] < ctx->mm[j] ) {
+				++ctx->nn[j];
 
 				for ( i = ww - 1; i >= 0; i-- ) {
-					int rt = rx[i];
+					int rt = ctx->rx[i];
 					if ( rt < 0 ) {
 						rt = - rt;
 						rt--;
-						z  = rf[i][nn[i]-1]-1;
+						z  = ctx->rf[i][ctx->nn[i]-1]-1;
 
 
 
-						if (( tq[z] != (rt+1) && tq[z] ) || ( rq[rt] != (z+1) && rq[rt] ))
+						if (( ctx->tq[z] != (rt+1) && ctx->tq[z] ) || ( ctx->rq[rt] != (z+1) && ctx->rq[rt] ))
 							break;
 
 
-						tq[z]  = rt+1;
-						rq[rt] = z+1;
+						ctx->tq[z]  = rt+1;
+						ctx->rq[rt] = z+1;
 						rr[i]  = z+1;
 					} else {
 						rt--;
-						z = cf[i][nn[i]-1]-1;
+						z = ctx->cf[i][ctx->nn[i]-1]-1;
 
 
-						if (( tq[rt] != (z+1) && tq[rt] ) || ( rq[z] != (rt+1) && rq[z] ))
+						if (( ctx->tq[rt] != (z+1) && ctx->tq[rt] ) || ( ctx->rq[z] != (rt+1) && ctx->rq[z] ))
 							break;
 
 
-						tq[rt] = z+1;
-						rq[z]  = rt+1;
+						ctx->tq[rt] = z+1;
+						ctx->rq[z]  = rt+1;
 						rr[i]  = rt+1;
 					}
 				} /* END for i */
@@ -1412,16 +1407,16 @@ for ( k = 0; k < np - 1; k++ ) {
 				if ( i >= 0 ) {
 					for ( z = i + 1; z < ww; z++) {
 						n = rr[z] - 1;
-						if ( tq[n] - 1 >= 0 ) {
-							rq[tq[n]-1] = 0;
-							tq[n]       = 0;
+						if ( ctx->tq[n] - 1 >= 0 ) {
+							ctx->rq[ctx->tq[n]-1] = 0;
+							ctx->tq[n]       = 0;
 						}
 					}
 					j = ww - 1;
 				}
 
 			} else {
-				nn[j] = 1;
+				ctx->nn[j] = 1;
 				j--;
 			}
 
@@ -1442,19 +1437,19 @@ for ( k = 0; k < np - 1; k++ ) {
 
 
 
-	n = qq[0] - 1;
-	if ( tq[n] - 1 >= 0 ) {
-		rq[tq[n]-1] = 0;
-		tq[n]       = 0;
+	n = ctx->qq[0] - 1;
+	if ( ctx->tq[n] - 1 >= 0 ) {
+		ctx->rq[ctx->tq[n]-1] = 0;
+		ctx->tq[n]       = 0;
 	}
 
 	for ( i = ww-1; i >= 0; i-- ) {
-		n = rx[i];
+		n = ctx->rx[i];
 		if ( n < 0 ) {
 			n = - n;
-			rp[n-1] = 0;
+			ctx->rp[n-1] = 0;
 		} else {
-			cp[n-1] = 0;
+			ctx->cp[n-1] = 0;
 		}
 
 	}
@@ -1467,14 +1462,14 @@ if ( match_score < MMSTR ) {
 	return match_score;
 }
 
-match_score = bz_final_loop( tp );
+match_score = bz_final_loop( ctx, tp );
 return match_score;
 }
 
 
 /***********************************************************************/
 /* These globals signficantly used by bz_sift () */
-/* Now externally defined in bozorth.h */
+/* Now in struct bz_context in bozorth.h */
 /* extern int sc[ SC_SIZE ]; */
 /* extern int rq[ RQ_SIZE ]; */
 /* extern int tq[ TQ_SIZE ]; */
@@ -1491,6 +1486,7 @@ return match_score;
 /* extern int y[ Y_SIZE ]; */
 
 void bz_sift(
+	struct bz_context * ctx,	/* INPUT and OUTPUT: working arrays of this match */
 	int * ww,		/* INPUT and OUTPUT; endpoint groups index; *ww may be bumped by one or by two */
 	int   kz,		/* INPUT only;       endpoint of lookahead Subject edge */
 	int * qh,		/* INPUT and OUTPUT; the value is an index into qq[] and is stored in zz[]; *qh may be bumped by one */
@@ -1512,16 +1508,16 @@ int t;
 
 
 
-n = tq[ kz - 1];	/* Lookup On-File edgepoint stored in TQ at index of endpoint of lookahead Subject edge */
-t = rq[ l  - 1];	/* Lookup Subject edgepoint stored in RQ at index of endpoint of lookahead On-File edge */
+n = ctx->tq[ kz - 1];	/* Lookup On-File edgepoint stored in TQ at index of endpoint of lookahead Subject edge */
+t = ctx->rq[ l  - 1];	/* Lookup Subject edgepoint stored in RQ at index of endpoint of lookahead On-File edge */
 
 if ( n == 0 && t == 0 ) {
 
 
-	if ( sc[kx-1] != ftt ) {
-		y[ (*tot)++ ] = kx;
-		rk[kx-1] = sc[kx-1];
-		sc[kx-1] = ftt;
+	if ( ctx->sc[kx-1] != ftt ) {
+		ctx->y[ (*tot)++ ] = kx;
+		ctx->rk[kx-1] = ctx->sc[kx-1];
+		ctx->sc[kx-1] = ftt;
 	}
 
 	if ( *qh >= QQ_SIZE ) {
@@ -1531,13 +1527,13 @@ if ( n == 0 && t == 0 ) {
 		*qq_overflow = 1;
 		return;
 	}
-	qq[ *qh ]  = kz;
-	zz[ kz-1 ] = (*qh)++;
+	ctx->qq[ *qh ]  = kz;
+	ctx->zz[ kz-1 ] = (*qh)++;
 
 
 				/* The TQ and RQ locations are set, so set them ... */
-	tq[ kz-1 ] = l;
-	rq[ l-1 ] = kz;
+	ctx->tq[ kz-1 ] = l;
+	ctx->rq[ l-1 ] = kz;
 
 	return;
 } /* END if ( n == 0 && t == 0 ) */
@@ -1552,8 +1548,8 @@ if ( n == 0 && t == 0 ) {
 
 if ( n == l ) {
 
-	if ( sc[kx-1] != ftt ) {
-		if ( zz[kx-1] == 1000 ) {
+	if ( ctx->sc[kx-1] != ftt ) {
+		if ( ctx->zz[kx-1] == 1000 ) {
 			if ( *qh >= QQ_SIZE ) {
 				fprintf( stderr, "%s: ERROR: bz_sift(): qq[] overflow #2; the index [*qh] is %d [p=%s; g=%s]\n",
 							get_progname(),
@@ -1562,12 +1558,12 @@ if ( n == l ) {
 				*qq_overflow = 1;
 				return;
 			}
-			qq[*qh]  = kz;
-			zz[kz-1] = (*qh)++;
+			ctx->qq[*qh]  = kz;
+			ctx->zz[kz-1] = (*qh)++;
 		}
-		y[(*tot)++] = kx;
-		rk[kx-1] = sc[kx-1];
-		sc[kx-1] = ftt;
+		ctx->y[(*tot)++] = kx;
+		ctx->rk[kx-1] = ctx->sc[kx-1];
+		ctx->sc[kx-1] = ftt;
 	}
 
 	return;
@@ -1592,22 +1588,22 @@ register int * lptr;
 /* If lookahead Subject endpoint previously assigned to TQ but not paired with lookahead On-File endpoint ... */
 
 if ( n ) {
-	b = cp[ kz - 1 ];
+	b = ctx->cp[ kz - 1 ];
 	if ( b == 0 ) {
 		b              = ++*ww;
 		b_index        = b - 1;
-		cp[kz-1]       = b;
-		cf[b_index][0] = n;
-		mm[b_index]    = 1;
-		nn[b_index]    = 1;
-		rx[b_index]    = kz;
+		ctx->cp[kz-1]       = b;
+		ctx->cf[b_index][0] = n;
+		ctx->mm[b_index]    = 1;
+		ctx->nn[b_index]    = 1;
+		ctx->rx[b_index]    = kz;
 
 	} else {
 		b_index = b - 1;
 	}
 
-	lim = mm[b_index];
-	lptr = &cf[b_index][0];
+	lim = ctx->mm[b_index];
+	lptr = &ctx->cf[b_index][0];
 	notfound = 1;
 
 #ifndef NOVERBOSE
@@ -1628,8 +1624,8 @@ if ( n ) {
 		}
 	}
 	if ( notfound ) {		/* If lookahead On-File endpoint not in list ... */
-		cf[b_index][i] = l;
-		++mm[b_index];
+		ctx->cf[b_index][i] = l;
+		++ctx->mm[b_index];
 	}
 } /* END if ( n ) */
 
@@ -1637,23 +1633,23 @@ if ( n ) {
 /* If lookahead On-File endpoint previously assigned to RQ but not paired with lookahead Subject endpoint... */
 
 if ( t ) {
-	b = rp[ l - 1 ];
+	b = ctx->rp[ l - 1 ];
 	if ( b == 0 ) {
 		b              = ++*ww;
 		b_index        = b - 1;
-		rp[l-1]        = b;
-		rf[b_index][0] = t;
-		mm[b_index]    = 1;
-		nn[b_index]    = 1;
-		rx[b_index]    = -l;
+		ctx->rp[l-1]        = b;
+		ctx->rf[b_index][0] = t;
+		ctx->mm[b_index]    = 1;
+		ctx->nn[b_index]    = 1;
+		ctx->rx[b_index]    = -l;
 
 
 	} else {
 		b_index = b - 1;
 	}
 
-	lim = mm[b_index];
-	lptr = &rf[b_index][0];
+	lim = ctx->mm[b_index];
+	lptr = &ctx->rf[b_index][0];
 	notfound = 1;
 
 #ifndef NOVERBOSE
@@ -1674,8 +1670,8 @@ if ( t ) {
 		}
 	}
 	if ( notfound ) {		/* If lookahead Subject endpoint not in list ... */
-		rf[b_index][i] = kz;
-		++mm[b_index];
+		ctx->rf[b_index][i] = kz;
+		++ctx->mm[b_index];
 	}
 } /* END if ( t ) */
 
@@ -1685,94 +1681,92 @@ if ( t ) {
 
 /**************************************************************************/
 
-static int bz_final_loop( int tp )
+static int bz_final_loop( struct bz_context * ctx, int tp )
 {
 int ii, i, t, b, n, k, j, kk, jj;
 int lim;
 int match_score;
 
-/* This array originally declared global, but moved here */
-/* locally because it is only used herein.  The use of   */
-/* "static" is required as the array will exceed the     */
-/* stack allocation on our local systems otherwise.      */
-static int sct[ SCT_SIZE_1 ][ SCT_SIZE_2 ];
+/* The sct array of the context is only used herein.    */
+/* It will exceed the stack allocation on our local     */
+/* systems otherwise.                                   */
 
 match_score = 0;
 for ( ii = 0; ii < tp; ii++ ) {				/* For each index up to the current value of TP ... */
 
-		if ( match_score >= gct[ii] )		/* if next group total not bigger than current match_score.. */
+		if ( match_score >= ctx->gct[ii] )		/* if next group total not bigger than current match_score.. */
 			continue;			/*		skip to next TP index */
 
-		lim = ctt[ii] + 1;
+		lim = ctx->ctt[ii] + 1;
 		for ( i = 0; i < lim; i++ ) {
-			sct[i][0] = ctp[ii][i];
+			ctx->sct[i][0] = ctx->ctp[ii][i];
 		}
 
 		t     = 0;
-		y[0]  = lim;
-		cp[0] = 1;
+		ctx->y[0]  = lim;
+		ctx->cp[0] = 1;
 		b     = 0;
 		n     = 1;
 		do {					/* looping until T < 0 ... */
-			if ( y[t] - cp[t] > 1 ) {
-				k = sct[cp[t]][t];
-				j = ctt[k] + 1;
+			if ( ctx->y[t] - ctx->cp[t] > 1 ) {
+				k = ctx->sct[ctx->cp[t]][t];
+				j = ctx->ctt[k] + 1;
 				for ( i = 0; i < j; i++ ) {
-					rp[i] = ctp[k][i];
+					ctx->rp[i] = ctx->ctp[k][i];
 				}
 				k  = 0;
-				kk = cp[t];
+				kk = ctx->cp[t];
 				jj = 0;
 
 				do {
-					while ( rp[jj] < sct[kk][t] && jj < j )
+					while ( ctx->rp[jj] < ctx->sct[kk][t] && jj < j )
 						jj++;
-					while ( rp[jj] > sct[kk][t] && kk < y[t] )
+					while ( ctx->rp[jj] > ctx->sct[kk][t] && kk < ctx->y[t] )
 						kk++;
-					while ( rp[jj] == sct[kk][t] && kk < y[t] && jj < j ) {
-						sct[k][t+1] = sct[kk][t];
+					while ( ctx->rp[jj] == ctx->sct[kk][t] && kk < ctx->y[t] && jj < j ) {
+						ctx->sct[k][t+1] = ctx->sct[kk][t];
 						k++;
 						kk++;
 						jj++;
 					}
-				} while ( kk < y[t] && jj < j );
+				} while ( kk < ctx->y[t] && jj < j );
 
 				t++;
-				cp[t] = 1;
-				y[t]  = k;
+				ctx->cp[t] = 1;
+				ctx->y[t]  = k;
 				b     = t;
 				n     = 1;
 			} else {
 				int tot = 0;
 
-				lim = y[t];
+				lim = ctx->y[t];
 				for ( i = n-1; i < lim; i++ ) {
-					tot += ct[ sct[i][t] ];
+					tot += ctx->ct[ ctx->sct[i][t] ];
 				}
 
 				for ( i = 0; i < b; i++ ) {
-					tot += ct[ sct[0][i] ];
+					tot += ctx->ct[ ctx->sct[0][i] ];
 				}
 
 				if ( tot > match_score ) {		/* If the current total is larger than the running total ... */
 					match_score = tot;		/*	then set match_score to the new total */
 					for ( i = 0; i < b; i++ ) {
-						rk[i] = sct[0][i];
+						ctx->rk[i] = ctx->sct[0][i];
 					}
 
 					{
 					int rk_index = b;
-					lim = y[t];
+					lim = ctx->y[t];
 					for ( i = n-1; i < lim; ) {
-						rk[ rk_index++ ] = sct[ i++ ][ t ];
+						ctx->rk[ rk_index++ ] = ctx->sct[ i++ ][ t ];
 					}
 					}
 				}
 				b = t;
 				t--;
 				if ( t >= 0 ) {
-					++cp[t];
-					n = y[t];
+					++ctx->cp[t];
+					n = ctx->y[t];
 				}
 			} /* END IF */
 
@@ -76,6 +76,8 @@ identified are necessarily the best available for the purpose.
 #cat:                        single probe fingerprint is to be matched
 #cat:                        to a single gallery fingerprint as in
 #cat:                        verificaiton mode
+#cat: bozorth_*_ctx -        the same, in a given match context rather
+#cat:                        than the default one of the calling thread
 
 ***********************************************************************/
 
@@ -86,7 +88,7 @@ identified are necessarily the best available for the purpose.
 
 /**************************************************************************/
 
-int bozorth_probe_init( struct xyt_struct * pstruct )
+int bozorth_probe_init_ctx( struct bz_context * ctx, struct xyt_struct * pstruct )
 {
 int sim;	/* number of pointwise comparisons for Subject's record*/
 int msim;	/* Pruned length of Subject's comparison pointer list */
@@ -101,14 +103,14 @@ bz_comp(
 	pstruct->ycol,
 	pstruct->thetacol,
 	&sim,
-	scols,
-	scolpt );
+	ctx->scols,
+	ctx->scolpt );
 
 msim = sim;	/* Init search to end of Subject's pointwise comparison table (last edge in Web) */
 
 
 
-bz_find( &msim, scolpt );
+bz_find( &msim, ctx->scolpt );
 
 
 
@@ -124,7 +126,7 @@ return msim;
 
 /**************************************************************************/
 
-int bozorth_gallery_init( struct xyt_struct * gstruct )
+int bozorth_gallery_init_ctx( struct bz_context * ctx, struct xyt_struct * gstruct )
 {
 int fim;	/* number of pointwise comparisons for On-File record*/
 int mfim;	/* Pruned length of On-File Record's pointer list */
@@ -138,14 +140,14 @@ bz_comp(
 	gstruct->ycol,
 	gstruct->thetacol,
 	&fim,
-	fcols,
-	fcolpt );
+	ctx->fcols,
+	ctx->fcolpt );
 
 mfim = fim;	/* Init search to end of On-File Record's pointwise comparison table (last edge in Web) */
 
 
 
-bz_find( &mfim, fcolpt );
+bz_find( &mfim, ctx->fcolpt );
 
 
 
@@ -161,7 +163,8 @@ return mfim;
 
 /**************************************************************************/
 
-int bozorth_to_gallery(
+int bozorth_to_gallery_ctx(
+		struct bz_context * ctx,
 		int probe_len,
 		struct xyt_struct * pstruct,
 		struct xyt_struct * gstruct
@@ -170,14 +173,15 @@ int bozorth_to_gallery(
 int np;
 int gallery_len;
 
-gallery_len = bozorth_gallery_init( gstruct );
-np = bz_match( probe_len, gallery_len );
-return bz_match_score( np, pstruct, gstruct );
+gallery_len = bozorth_gallery_init_ctx( ctx, gstruct );
+np = bz_match( ctx, probe_len, gallery_len );
+return bz_match_score( ctx, np, pstruct, gstruct );
 }
 
 /**************************************************************************/
 
-int bozorth_main(
+int bozorth_main_ctx(
+		struct bz_context * ctx,
 		struct xyt_struct * pstruct,
 		struct xyt_struct * gstruct
 		)
@@ -192,26 +196,26 @@ int gallery_len;
 #ifdef DEBUG
 	printf( "PROBE_INIT() called\n" );
 #endif
-probe_len   = bozorth_probe_init( pstruct );
+probe_len   = bozorth_probe_init_ctx( ctx, pstruct );
 
 
 #ifdef DEBUG
 	printf( "GALLERY_INIT() called\n" );
 #endif
-gallery_len = bozorth_gallery_init( gstruct );
+gallery_len = bozorth_gallery_init_ctx( ctx, gstruct );
 
 
 #ifdef DEBUG
 	printf( "BZ_MATCH() called\n" );
 #endif
-np = bz_match( probe_len, gallery_len );
+np = bz_match( ctx, probe_len, gallery_len );
 
 
 #ifdef DEBUG
 	printf( "BZ_MATCH() returned %d edge pairs\n", np );
 	printf( "COMPUTE() called\n" );
 #endif
-ms = bz_match_score( np, pstruct, gstruct );
+ms = bz_match_score( ctx, np, pstruct, gstruct );
 
 
 #ifdef DEBUG
@@ -221,3 +225,58 @@ ms = bz_match_score( np, pstruct, gstruct );
 
 return ms;
 }
+
+/**************************************************************************/
+/* The original entry points, in the default context of the calling      */
+/* thread.  The probe is kept in that context between                    */
+/* bozorth_probe_init() and bozorth_to_gallery().                        */
+/**************************************************************************/
+
+int bozorth_probe_init( struct xyt_struct * pstruct )
+{
+struct bz_context * ctx = bz_context_get_default();
+
+if ( ctx == (struct bz_context *) NULL )
+	return 0;
+return bozorth_probe_init_ctx( ctx, pstruct );
+}
+
+/**************************************************************************/
+
+int bozorth_gallery_init( struct xyt_struct * gstruct )
+{
+struct bz_context * ctx = bz_context_get_default();
+
+if ( ctx == (struct bz_context *) NULL )
+	return 0;
+return bozorth_gallery_init_ctx( ctx, gstruct );
+}
+
+/**************************************************************************/
+
+int bozorth_to_gallery(
+		int probe_len,
+		struct xyt_struct * pstruct,
+		struct xyt_struct * gstruct
+		)
+{
+struct bz_context * ctx = bz_context_get_default();
+
+if ( ctx == (struct bz_context *) NULL )
+	return ZERO_MATCH_SCORE;
+return bozorth_to_gallery_ctx( ctx, probe_len, pstruct, gstruct );
+}
+
+/**************************************************************************/
+
+int bozorth_main(
+		struct xyt_struct * pstruct,
+		struct xyt_struct * gstruct
+		)
+{
+struct bz_context * ctx = bz_context_get_default();
+
+if ( ctx == (struct bz_context *) NULL )
+	return ZERO_MATCH_SCORE;
+return bozorth_main_ctx( ctx, pstruct, gstruct );
+}
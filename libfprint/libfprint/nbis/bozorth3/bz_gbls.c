@@ -58,56 +58,74 @@ identified are necessarily the best available for the purpose.
                       Stan Janet (NIST)
       DATE:           09/21/2004
 
-      Contains global variables responsible for supporting the
-      Bozorth3 fingerprint matching "core" algorithm.
+      Contains the match context, formerly global variables,
+      responsible for supporting the Bozorth3 fingerprint matching
+      "core" algorithm.
 
 ***********************************************************************
+
+      ROUTINES:
+#cat: bz_context_new -         allocates the working arrays of a match
+#cat: bz_context_free -        releases them
+#cat: bz_context_get_default - returns the context of the calling thread
+#cat:                          used by the original bozorth_* routines
+
 ***********************************************************************/
 
+#include <pthread.h>
+#include <string.h>
 #include <bozorth.h>
 
 /**************************************************************************/
-/* General supporting global variables */
-/**************************************************************************/
+/* returns NULL on error */
+struct bz_context * bz_context_new( void )
+{
+struct bz_context * ctx;
+
+/* The arrays start zeroed, as the globals did.  Most of the size is the */
+/* scratch tables of bz_match_score(), only touched as far as needed.    */
+ctx = calloc( 1, sizeof( struct bz_context ) );
+if ( ctx == (struct bz_context *) NULL ) {
+	fprintf( stderr, "%s: ERROR: calloc() of %d bytes for match context failed: %s\n",
+						get_progname(),
+						(int) sizeof( struct bz_context ),
+						strerror( errno )
+						);
+	return (struct bz_context *) NULL;
+}
+return ctx;
+}
 
-int colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];		/* Output from match(), this is a sorted table of compatible edge pairs containing: */
-						/*	DeltaThetaKJs, Subject's K, J, then On-File's {K,J} or {J,K} depending */
-						/* Sorted first on Subject's point index K, */
-						/*	then On-File's K or J point index (depending), */
-						/*	lastly on Subject's J point index */
-int scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];	/* Subject's pointwise comparison table containing: */
-						/*	Distance,min(BetaK,BetaJ),max(BetaK,BbetaJ), K,J,ThetaKJ */
-int fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];	/* On-File Record's pointwise comparison table with: */
-						/*	Distance,min(BetaK,BetaJ),max(BetaK,BbetaJ),K,J, ThetaKJ */
-int * scolpt[ SCOLPT_SIZE ];			/* Subject's list of pointers to pointwise comparison rows, sorted on: */
-						/*	Distance, min(BetaK,BetaJ), then max(BetaK,BetaJ) */
-int * fcolpt[ FCOLPT_SIZE ];			/* On-File Record's list of pointers to pointwise comparison rows sorted on: */
-						/*	Distance, min(BetaK,BetaJ), then max(BetaK,BetaJ) */
-int sc[ SC_SIZE ];				/* Flags all compatible edges in the Subject's Web */
-
-int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
+/**************************************************************************/
 
+void bz_context_free( struct bz_context * ctx )
+{
+free( ctx );
+}
 
 /**************************************************************************/
-/* Globals used significantly by sift() */
+/* Default contexts, one per thread, released when the thread exits */
 /**************************************************************************/
-int rq[ RQ_SIZE ] = {};
-int tq[ TQ_SIZE ] = {};
-int zz[ ZZ_SIZE ] = {};
-
-int rx[ RX_SIZE ] = {};
-int mm[ MM_SIZE ] = {};
-int nn[ NN_SIZE ] = {};
-
-int qq[ QQ_SIZE ] = {};
-
-int rk[ RK_SIZE ] = {};
-
-int cp[ CP_SIZE ] = {};
-int rp[ RP_SIZE ] = {};
-
-int rf[RF_SIZE_1][RF_SIZE_2] = {};
-int cf[CF_SIZE_1][CF_SIZE_2] = {};
-
-int y[20000] = {};
 
+static pthread_key_t default_context_key;
+static pthread_once_t default_context_once = PTHREAD_ONCE_INIT;
+
+static void default_context_key_create( void )
+{
+pthread_key_create( &default_context_key, (void (*)( void * )) bz_context_free );
+}
+
+/* returns NULL on error */
+struct bz_context * bz_context_get_default( void )
+{
+struct bz_context * ctx;
+
+pthread_once( &default_context_once, default_context_key_create );
+ctx = pthread_getspecific( default_context_key );
+if ( ctx == (struct bz_context *) NULL ) {
+	ctx = bz_context_new();
+	if ( ctx != (struct bz_context *) NULL )
+		pthread_setspecific( default_context_key, ctx );
+}
+return ctx;
+}
@@ -191,35 +191,60 @@ extern int verbose_threshold;
 /**************************************************************************/
 /* In: BZ_GBLS.C */
 /**************************************************************************/
-/* Global arrays supporting "core" bozorth algorithm */
-extern int colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];
-extern int scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];
-extern int fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];
-extern int * scolpt[ SCOLPT_SIZE ];
-extern int * fcolpt[ FCOLPT_SIZE ];
-extern int sc[ SC_SIZE ];
-extern int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
-/* Global arrays supporting "core" bozorth algorithm continued: */
-/*    Globals used significantly by sift() */
-extern int rq[ RQ_SIZE ];
-extern int tq[ TQ_SIZE ];
-extern int zz[ ZZ_SIZE ];
-extern int rx[ RX_SIZE ];
-extern int mm[ MM_SIZE ];
-extern int nn[ NN_SIZE ];
-extern int qq[ QQ_SIZE ];
-extern int rk[ RK_SIZE ];
-extern int cp[ CP_SIZE ];
-extern int rp[ RP_SIZE ];
-extern int rf[RF_SIZE_1][RF_SIZE_2];
-extern int cf[CF_SIZE_1][CF_SIZE_2];
-extern int y[20000];
+/* Working arrays of the "core" bozorth algorithm, formerly globals.   */
+/* A match only uses the context it is given, so matches in different  */
+/* contexts may run concurrently.                                      */
+struct bz_context {
+	int colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];
+	int scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];
+	int fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];
+	int * scolpt[ SCOLPT_SIZE ];
+	int * fcolpt[ FCOLPT_SIZE ];
+	int sc[ SC_SIZE ];
+	int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
+	/* Used significantly by sift() */
+	int rq[ RQ_SIZE ];
+	int tq[ TQ_SIZE ];
+	int zz[ ZZ_SIZE ];
+	int rx[ RX_SIZE ];
+	int mm[ MM_SIZE ];
+	int nn[ NN_SIZE ];
+	int qq[ QQ_SIZE ];
+	int rk[ RK_SIZE ];
+	int cp[ CP_SIZE ];
+	int rp[ RP_SIZE ];
+	int rf[ RF_SIZE_1 ][ RF_SIZE_2 ];
+	int cf[ CF_SIZE_1 ][ CF_SIZE_2 ];
+	int y[ Y_SIZE ];
+	/* Formerly static in bz_match() */
+	int rot[ ROT_SIZE_1 ][ ROT_SIZE_2 ];
+	int * rtp[ ROT_SIZE_1 ];
+	/* Formerly static, shared by bz_match_score() & bz_final_loop() */
+	int ct[ CT_SIZE ];
+	int gct[ GCT_SIZE ];
+	int ctt[ CTT_SIZE ];
+	int ctp[ CTP_SIZE_1 ][ CTP_SIZE_2 ];
+	int yy[ YY_SIZE_1 ][ YY_SIZE_2 ][ YY_SIZE_3 ];
+	int sct[ SCT_SIZE_1 ][ SCT_SIZE_2 ];
+};
 
 /**************************************************************************/
 /**************************************************************************/
 /* ROUTINE PROTOTYPES */
 /**************************************************************************/
+/* In: BZ_GBLS.C */
+extern struct bz_context *bz_context_new(void);
+extern void bz_context_free(struct bz_context *);
+extern struct bz_context *bz_context_get_default(void);
 /* In: BZ_DRVRS.C */
+/* The _ctx variants match in the given context, the others in the */
+/* calling thread's default context.                               */
+extern int bozorth_probe_init_ctx(struct bz_context *, struct xyt_struct *);
+extern int bozorth_gallery_init_ctx(struct bz_context *, struct xyt_struct *);
+extern int bozorth_to_gallery_ctx(struct bz_context *, int,
+                    struct xyt_struct *, struct xyt_struct *);
+extern int bozorth_main_ctx(struct bz_context *, struct xyt_struct *,
+                    struct xyt_struct *);
 extern int bozorth_probe_init( struct xyt_struct *);
 extern int bozorth_gallery_init( struct xyt_struct *);
 extern int bozorth_to_gallery(int, struct xyt_struct *, struct xyt_struct *);
@@ -228,9 +253,11 @@ extern int bozorth_main(struct xyt_struct *, struct xyt_struct *);
 extern void bz_comp(int, int [], int [], int [], int *, int [][COLS_SIZE_2],
                     int *[]);
 extern void bz_find(int *, int *[]);
-extern int bz_match(int, int);
-extern int bz_match_score(int, struct xyt_struct *, struct xyt_struct *);
-extern void bz_sift(int *, int, int *, int, int, int, int *, int *);
+extern int bz_match(struct bz_context *, int, int);
+extern int bz_match_score(struct bz_context *, int, struct xyt_struct *,
+                    struct xyt_struct *);
+extern void bz_sift(struct bz_context *, int *, int, int *, int, int, int,
+                    int *, int *);
 /* In: BZ_ALLOC.C */
 extern char *malloc_or_exit(int, const char *);
 extern char *malloc_or_return_error(int, const char *);
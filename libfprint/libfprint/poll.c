@@ -21,8 +21,19 @@
 
 #include <config.h>
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include <glib.h>
 #include <libusb.h>
@@ -34,8 +45,10 @@
  * These functions are only applicable to users of libfprint's asynchronous
  * API.
  *
- * libfprint does not create internal library threads and hence can only
- * execute when your application is calling a libfprint function. However,
+ * libfprint does not create internal library threads, unless identification
+ * is told to with fp_set_identify_threads(), and hence can only execute when
+ * your application is calling a libfprint function. The identification
+ * threads only work while a gallery is matched within such a call. However,
  * libfprint often has work to be do, such as handling of completed USB
  * transfers, and processing of timeouts required in order for the library
  * to function. Therefore it is essential that your own application must
@@ -53,45 +66,178 @@
  * fp_handle_events_timeout() instead. If you wish to do a nonblocking
  * iteration, call fp_handle_events_timeout() with a zero timeout.
  *
+ * Applications with their own main loop can instead wait for the single file
+ * descriptor returned by fp_get_event_fd() to become readable, and then call
+ * fp_dispatch_events() which handles everything that is ready without
+ * blocking.
+ *
+ * All of these operate on the current context, see fp_context_new(): a
+ * thread that pushed its own context only handles the events of the devices
+ * it opened, next to other threads doing the same with theirs.
+ *
  * TODO: document how application is supposed to know when to call these
  * functions.
  */
 
-/* this is a singly-linked list of pending timers, sorted with the timer that
- * is expiring soonest at the head. */
-static GSList *active_timers = NULL;
+/* pending timers are kept in a binary min-heap in their context, the timer
+ * that is expiring soonest at index 0. every timer knows its own index so
+ * that it can be cancelled in O(log n) as well. timers expiring at the same
+ * time are ordered by when they were added.
+ *
+ * timer nodes are carved out of chunks and recycled through a free list, so
+ * that drivers arming short sleeps in every SSM state don't hit malloc */
+#define TIMEOUT_POOL_CHUNK 64
 
-/* notifiers for added or removed poll fds */
-static fp_pollfd_added_cb fd_added_cb = NULL;
-static fp_pollfd_removed_cb fd_removed_cb = NULL;
+#define EVENT_FD_MAX_EVENTS 16
 
 struct fpi_timeout {
+	struct fp_context *ctx;
 	struct timeval expiry;
+	unsigned long seq;
 	fpi_timeout_fn callback;
 	void *data;
+	/* position in the heap of ctx, -1 when not pending */
+	int heap_index;
+	struct fpi_timeout *next_free;
 };
 
-static int timeout_sort_fn(gconstpointer _a, gconstpointer _b)
+static struct fpi_timeout *timeout_alloc(struct fp_context *ctx)
 {
-	struct fpi_timeout *a = (struct fpi_timeout *) _a;
-	struct fpi_timeout *b = (struct fpi_timeout *) _b;
-	struct timeval *tv_a = &a->expiry;
-	struct timeval *tv_b = &b->expiry;
-
-	if (timercmp(tv_a, tv_b, <))
-		return -1;
-	else if (timercmp(tv_a, tv_b, >))
-		return 1;
+	struct fpi_timeout *timeout;
+
+	if (!ctx->free_timeouts) {
+		struct fpi_timeout *chunk = g_malloc(sizeof(*chunk) * TIMEOUT_POOL_CHUNK);
+		int i;
+
+		for (i = 0; i < TIMEOUT_POOL_CHUNK; i++) {
+			chunk[i].next_free = ctx->free_timeouts;
+			ctx->free_timeouts = &chunk[i];
+		}
+		ctx->timeout_chunks = g_slist_prepend(ctx->timeout_chunks, chunk);
+	}
+
+	timeout = ctx->free_timeouts;
+	ctx->free_timeouts = timeout->next_free;
+	return timeout;
+}
+
+static void timeout_release(struct fpi_timeout *timeout)
+{
+	struct fp_context *ctx = timeout->ctx;
+
+	timeout->heap_index = -1;
+	timeout->next_free = ctx->free_timeouts;
+	ctx->free_timeouts = timeout;
+}
+
+static int timeout_before(struct fpi_timeout *a, struct fpi_timeout *b)
+{
+	if (timercmp(&a->expiry, &b->expiry, !=))
+		return timercmp(&a->expiry, &b->expiry, <);
+	return a->seq < b->seq;
+}
+
+static void heap_set(struct fp_context *ctx, unsigned int i,
+	struct fpi_timeout *timeout)
+{
+	ctx->timer_heap[i] = timeout;
+	timeout->heap_index = i;
+}
+
+static void heap_sift_up(struct fp_context *ctx, unsigned int i)
+{
+	struct fpi_timeout *timeout = ctx->timer_heap[i];
+
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!timeout_before(timeout, ctx->timer_heap[parent]))
+			break;
+		heap_set(ctx, i, ctx->timer_heap[parent]);
+		i = parent;
+	}
+	heap_set(ctx, i, timeout);
+}
+
+static void heap_sift_down(struct fp_context *ctx, unsigned int i)
+{
+	struct fpi_timeout *timeout = ctx->timer_heap[i];
+
+	for (;;) {
+		unsigned int child = i * 2 + 1;
+		if (child >= ctx->timer_heap_len)
+			break;
+		if (child + 1 < ctx->timer_heap_len &&
+				timeout_before(ctx->timer_heap[child + 1], ctx->timer_heap[child]))
+			child++;
+		if (!timeout_before(ctx->timer_heap[child], timeout))
+			break;
+		heap_set(ctx, i, ctx->timer_heap[child]);
+		i = child;
+	}
+	heap_set(ctx, i, timeout);
+}
+
+static void heap_push(struct fp_context *ctx, struct fpi_timeout *timeout)
+{
+	if (ctx->timer_heap_len == ctx->timer_heap_size) {
+		ctx->timer_heap_size = ctx->timer_heap_size ?
+			ctx->timer_heap_size * 2 : TIMEOUT_POOL_CHUNK;
+		ctx->timer_heap = g_realloc(ctx->timer_heap,
+			sizeof(*ctx->timer_heap) * ctx->timer_heap_size);
+	}
+	ctx->timer_heap[ctx->timer_heap_len] = timeout;
+	heap_sift_up(ctx, ctx->timer_heap_len++);
+}
+
+static void heap_remove(struct fpi_timeout *timeout)
+{
+	struct fp_context *ctx = timeout->ctx;
+	unsigned int i = timeout->heap_index;
+	struct fpi_timeout *last = ctx->timer_heap[--ctx->timer_heap_len];
+
+	timeout->heap_index = -1;
+	if (last == timeout)
+		return;
+
+	/* the last timer takes the hole and moves whichever way it has to */
+	heap_set(ctx, i, last);
+	if (i > 0 && timeout_before(last, ctx->timer_heap[(i - 1) / 2]))
+		heap_sift_up(ctx, i);
 	else
-		return 0;
+		heap_sift_down(ctx, i);
+}
+
+/* arm the timerfd for the soonest timer, or disarm it when there is none */
+static void update_timer_fd(struct fp_context *ctx)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+	struct itimerspec its;
+	int r;
+
+	if (ctx->timer_fd < 0)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	if (ctx->timer_heap_len > 0) {
+		TIMEVAL_TO_TIMESPEC(&ctx->timer_heap[0]->expiry, &its.it_value);
+		/* a zero it_value would disarm it */
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+			its.it_value.tv_nsec = 1;
+	}
+
+	r = timerfd_settime(ctx->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	if (r < 0)
+		fp_err("failed to arm timerfd, errno=%d", errno);
+#endif
 }
 
 /* A timeout is the asynchronous equivalent of sleeping. You create a timeout
  * saying that you'd like to have a function invoked at a certain time in
- * the future. */
+ * the future. It fires from the events handling of the current context. */
 struct fpi_timeout *fpi_timeout_add(unsigned int msec, fpi_timeout_fn callback,
 	void *data)
 {
+	struct fp_context *ctx = fpi_context_get();
 	struct timespec ts;
 	struct timeval add_msec;
 	struct fpi_timeout *timeout;
@@ -105,9 +251,11 @@ struct fpi_timeout *fpi_timeout_add(unsigned int msec, fpi_timeout_fn callback,
 		return NULL;
 	}
 
-	timeout = g_malloc(sizeof(*timeout));
+	timeout = timeout_alloc(ctx);
+	timeout->ctx = ctx;
 	timeout->callback = callback;
 	timeout->data = data;
+	timeout->seq = ctx->timer_seq++;
 	TIMESPEC_TO_TIMEVAL(&timeout->expiry, &ts);
 
 	/* calculate timeout expiry by adding delay to current monotonic clock */
@@ -116,33 +264,42 @@ struct fpi_timeout *fpi_timeout_add(unsigned int msec, fpi_timeout_fn callback,
 	add_msec.tv_usec = (msec % 1000) * 1000;
 	timeradd(&timeout->expiry, &add_msec, &timeout->expiry);
 
-	active_timers = g_slist_insert_sorted(active_timers, timeout,
-		timeout_sort_fn);
+	heap_push(ctx, timeout);
+	if (timeout->heap_index == 0)
+		update_timer_fd(ctx);
 
 	return timeout;
 }
 
 void fpi_timeout_cancel(struct fpi_timeout *timeout)
 {
+	struct fp_context *ctx = timeout->ctx;
+	int was_next;
+
 	fp_dbg("");
-	active_timers = g_slist_remove(active_timers, timeout);
-	g_free(timeout);
+	if (timeout->heap_index < 0)
+		return;
+
+	was_next = timeout->heap_index == 0;
+	heap_remove(timeout);
+	timeout_release(timeout);
+	if (was_next)
+		update_timer_fd(ctx);
 }
 
-/* get the expiry time and optionally the timeout structure for the next
- * timeout. returns 0 if there are no expired timers, or 1 if the
- * timeval/timeout output parameters were populated. if the returned timeval
- * is zero then it means the timeout has already expired and should be handled
- * ASAP. */
-static int get_next_timeout_expiry(struct timeval *out,
-	struct fpi_timeout **out_timeout)
+/* get the expiry time for the next timeout. returns 0 if there are no pending
+ * timers, or 1 if the timeval output parameter was populated. if the returned
+ * timeval is zero then it means the timeout has already expired and should be
+ * handled ASAP. */
+static int get_next_timeout_expiry(struct fp_context *ctx,
+	struct timeval *out)
 {
 	struct timespec ts;
 	struct timeval tv;
 	struct fpi_timeout *next_timeout;
 	int r;
 
-	if (active_timers == NULL)
+	if (ctx->timer_heap_len == 0)
 		return 0;
 
 	r = clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -152,10 +309,7 @@ static int get_next_timeout_expiry(struct timeval *out,
 	}
 	TIMESPEC_TO_TIMEVAL(&tv, &ts);
 
-	next_timeout = active_timers->data;
-	if (out_timeout)
-		*out_timeout = next_timeout;
-
+	next_timeout = ctx->timer_heap[0];
 	if (timercmp(&tv, &next_timeout->expiry, >=)) {
 		fp_dbg("first timeout already expired");
 		timerclear(out);
@@ -167,28 +321,48 @@ static int get_next_timeout_expiry(struct timeval *out,
 	return 1;
 }
 
-/* handle a timeout that has expired */
-static void handle_timeout(struct fpi_timeout *timeout)
-{
-	fp_dbg("");
-	timeout->callback(timeout->data);
-	active_timers = g_slist_remove(active_timers, timeout);
-	g_free(timeout);
-}
-
-static int handle_timeouts(void)
+/* handle every timeout that has expired. timeouts added by the callbacks wait
+ * for the next call, even if they expire right away. */
+static int handle_timeouts(struct fp_context *ctx)
 {
-	struct timeval next_timeout_expiry;
-	struct fpi_timeout *next_timeout;
+	struct timespec ts;
+	struct timeval now;
+	unsigned long last_seq = ctx->timer_seq;
 	int r;
 
-	r = get_next_timeout_expiry(&next_timeout_expiry, &next_timeout);
-	if (r <= 0)
+#ifdef HAVE_SYS_TIMERFD_H
+	if (ctx->timer_fd >= 0) {
+		uint64_t expirations;
+		/* nonblocking, only clears the readable state */
+		if (read(ctx->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+				errno != EAGAIN)
+			fp_err("failed to read timerfd, errno=%d", errno);
+	}
+#endif
+
+	if (ctx->timer_heap_len == 0)
+		return 0;
+
+	r = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (r < 0) {
+		fp_err("failed to read monotonic clock, errno=%d", errno);
 		return r;
+	}
+	TIMESPEC_TO_TIMEVAL(&now, &ts);
+
+	while (ctx->timer_heap_len > 0) {
+		struct fpi_timeout *timeout = ctx->timer_heap[0];
+
+		if (timercmp(&now, &timeout->expiry, <) || timeout->seq >= last_seq)
+			break;
 
-	if (!timerisset(&next_timeout_expiry))
-		handle_timeout(next_timeout);
+		fp_dbg("");
+		heap_remove(timeout);
+		timeout->callback(timeout->data);
+		timeout_release(timeout);
+	}
 
+	update_timer_fd(ctx);
 	return 0;
 }
 
@@ -203,21 +377,19 @@ static int handle_timeouts(void)
  */
 API_EXPORTED int fp_handle_events_timeout(struct timeval *timeout)
 {
+	struct fp_context *ctx = fpi_context_get();
 	struct timeval next_timeout_expiry;
 	struct timeval select_timeout;
-	struct fpi_timeout *next_timeout;
 	int r;
 
-	r = get_next_timeout_expiry(&next_timeout_expiry, &next_timeout);
+	r = get_next_timeout_expiry(ctx, &next_timeout_expiry);
 	if (r < 0)
 		return r;
 
 	if (r) {
 		/* timer already expired? */
-		if (!timerisset(&next_timeout_expiry)) {
-			handle_timeout(next_timeout);
-			return 0;
-		}
+		if (!timerisset(&next_timeout_expiry))
+			return handle_timeouts(ctx);
 
 		/* choose the smallest of next URB timeout or user specified timeout */
 		if (timercmp(&next_timeout_expiry, timeout, <))
@@ -228,12 +400,12 @@ API_EXPORTED int fp_handle_events_timeout(struct timeval *timeout)
 		select_timeout = *timeout;
 	}
 
-	r = libusb_handle_events_timeout(fpi_usb_ctx, &select_timeout);
+	r = libusb_handle_events_timeout(ctx->usb_ctx, &select_timeout);
 	*timeout = select_timeout;
 	if (r < 0)
 		return r;
 
-	return handle_timeouts();
+	return handle_timeouts(ctx);
 }
 
 /** \ingroup poll
@@ -251,19 +423,90 @@ API_EXPORTED int fp_handle_events(void)
 	return fp_handle_events_timeout(&tv);
 }
 
+/** \ingroup poll
+ * Retrieve a single file descriptor that becomes readable (POLLIN) whenever
+ * libfprint has work to do: USB transfers to complete or timeouts that have
+ * expired. It aggregates the descriptors of fp_get_pollfds() and follows
+ * their additions and removals by itself, so it can be added once to the
+ * main loop of an application that multiplexes many other sources.
+ *
+ * When it becomes readable, call fp_dispatch_events(). If libusb can't
+ * report its own timeouts through file descriptors on this system,
+ * fp_get_next_timeout() still has to be honoured.
+ *
+ * \returns the file descriptor, or -1 if the system doesn't support it, in
+ * which case fp_get_pollfds() has to be used instead. It stays valid until
+ * fp_exit() and must not be closed by the application.
+ */
+API_EXPORTED int fp_get_event_fd(void)
+{
+	struct fp_context *ctx = fpi_context_get();
+
+	return ctx->event_fd;
+}
+
+/** \ingroup poll
+ * Handle all pending events without blocking: every completed USB transfer
+ * and every timeout that has expired by the time of the call. Timeouts added
+ * by the callbacks are handled by the next call, even if they expire right
+ * away. Meant to be called when the descriptor returned by fp_get_event_fd()
+ * becomes readable, but it's safe to call at any time.
+ *
+ * \returns 0 on success, non-zero on error.
+ */
+API_EXPORTED int fp_dispatch_events(void)
+{
+	struct fp_context *ctx = fpi_context_get();
+	struct timeval zero_tv = { 0, 0 };
+	int usb_ready = 1;
+	int r;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (ctx->event_fd >= 0) {
+		struct epoll_event events[EVENT_FD_MAX_EVENTS];
+		struct timeval usb_tv;
+		int i;
+
+		/* only go through libusb when one of its fds is ready or one of
+		 * its transfers timed out */
+		r = epoll_wait(ctx->event_fd, events, EVENT_FD_MAX_EVENTS, 0);
+		if (r < 0 && errno != EINTR) {
+			fp_err("failed to check the event fd, errno=%d", errno);
+			return -errno;
+		}
+		usb_ready = r == EVENT_FD_MAX_EVENTS;
+		for (i = 0; i < r; i++)
+			if (events[i].data.fd != ctx->timer_fd)
+				usb_ready = 1;
+		if (!usb_ready && libusb_get_next_timeout(ctx->usb_ctx, &usb_tv) == 1 &&
+				!timerisset(&usb_tv))
+			usb_ready = 1;
+	}
+#endif
+
+	if (usb_ready) {
+		r = libusb_handle_events_timeout(ctx->usb_ctx, &zero_tv);
+		if (r < 0)
+			return r;
+	}
+
+	return handle_timeouts(ctx);
+}
+
 /* FIXME: docs
  * returns 0 if no timeouts active
  * returns 1 if timeout returned
  * zero timeout means events are to be handled immediately */
 API_EXPORTED int fp_get_next_timeout(struct timeval *tv)
 {
+	struct fp_context *ctx = fpi_context_get();
 	struct timeval fprint_timeout;
 	struct timeval libusb_timeout;
 	int r_fprint;
 	int r_libusb;
 
-	r_fprint = get_next_timeout_expiry(&fprint_timeout, NULL);
-	r_libusb = libusb_get_next_timeout(fpi_usb_ctx, &libusb_timeout);
+	r_fprint = get_next_timeout_expiry(ctx, &fprint_timeout);
+	r_libusb = libusb_get_next_timeout(ctx->usb_ctx, &libusb_timeout);
 
 	/* if we have no pending timeouts and the same is true for libusb,
 	 * indicate that we have no pending timouts */
@@ -293,19 +536,24 @@ API_EXPORTED int fp_get_next_timeout(struct timeval *tv)
  * simplistic users will be able to call fp_handle_events() or a variant
  * directly.
  *
+ * The list ends with a timer file descriptor that becomes readable when a
+ * libfprint timeout expires, so fp_get_next_timeout() doesn't need to be
+ * polled on systems that support it.
+ *
  * \param pollfds output location for a list of pollfds. If non-NULL, must be
  * released with free() when done.
  * \returns the number of pollfds in the resultant list, or negative on error.
  */
 API_EXPORTED size_t fp_get_pollfds(struct fp_pollfd **pollfds)
 {
+	struct fp_context *ctx = fpi_context_get();
 	const struct libusb_pollfd **usbfds;
 	const struct libusb_pollfd *usbfd;
 	struct fp_pollfd *ret;
 	size_t cnt = 0;
 	size_t i = 0;
 
-	usbfds = libusb_get_pollfds(fpi_usb_ctx);
+	usbfds = libusb_get_pollfds(ctx->usb_ctx);
 	if (!usbfds) {
 		*pollfds = NULL;
 		return -EIO;
@@ -314,7 +562,7 @@ API_EXPORTED size_t fp_get_pollfds(struct fp_pollfd **pollfds)
 	while ((usbfd = usbfds[i++]) != NULL)
 		cnt++;
 
-	ret = g_malloc(sizeof(struct fp_pollfd) * cnt);
+	ret = g_malloc(sizeof(struct fp_pollfd) * (cnt + 1));
 	i = 0;
 	while ((usbfd = usbfds[i]) != NULL) {
 		ret[i].fd = usbfd->fd;
@@ -322,6 +570,12 @@ API_EXPORTED size_t fp_get_pollfds(struct fp_pollfd **pollfds)
 		i++;
 	}
 
+	if (ctx->timer_fd >= 0) {
+		ret[cnt].fd = ctx->timer_fd;
+		ret[cnt].events = POLLIN;
+		cnt++;
+	}
+
 	*pollfds = ret;
 	return cnt;
 }
@@ -330,33 +584,116 @@ API_EXPORTED size_t fp_get_pollfds(struct fp_pollfd **pollfds)
 API_EXPORTED void fp_set_pollfd_notifiers(fp_pollfd_added_cb added_cb,
 	fp_pollfd_removed_cb removed_cb)
 {
-	fd_added_cb = added_cb;
-	fd_removed_cb = removed_cb;
+	struct fp_context *ctx = fpi_context_get();
+
+	ctx->fd_added_cb = added_cb;
+	ctx->fd_removed_cb = removed_cb;
+}
+
+static void event_fd_add(struct fp_context *ctx, int fd, short events)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event event;
+
+	if (ctx->event_fd < 0)
+		return;
+
+	memset(&event, 0, sizeof(event));
+	/* the poll and epoll bits are the same */
+	event.events = (unsigned short) events;
+	event.data.fd = fd;
+	if (epoll_ctl(ctx->event_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		fp_err("failed to add fd %d to the event fd, errno=%d", fd, errno);
+#endif
+}
+
+static void event_fd_remove(struct fp_context *ctx, int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	/* a closed fd has left the set already */
+	if (ctx->event_fd >= 0 &&
+			epoll_ctl(ctx->event_fd, EPOLL_CTL_DEL, fd, NULL) < 0 &&
+			errno != EBADF && errno != ENOENT)
+		fp_err("failed to remove fd %d from the event fd, errno=%d", fd, errno);
+#endif
 }
 
 static void add_pollfd(int fd, short events, void *user_data)
 {
-	if (fd_added_cb)
-		fd_added_cb(fd, events);
+	struct fp_context *ctx = user_data;
+
+	event_fd_add(ctx, fd, events);
+	if (ctx->fd_added_cb)
+		ctx->fd_added_cb(fd, events);
 }
 
 static void remove_pollfd(int fd, void *user_data)
 {
-	if (fd_removed_cb)
-		fd_removed_cb(fd);
+	struct fp_context *ctx = user_data;
+
+	event_fd_remove(ctx, fd);
+	if (ctx->fd_removed_cb)
+		ctx->fd_removed_cb(fd);
+}
+
+static void event_fd_init(struct fp_context *ctx)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	const struct libusb_pollfd **usbfds;
+	int i;
+
+	ctx->event_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->event_fd < 0) {
+		fp_err("failed to create the event fd, errno=%d", errno);
+		return;
+	}
+
+	/* libusb only notifies about fds opened from now on */
+	usbfds = libusb_get_pollfds(ctx->usb_ctx);
+	if (!usbfds)
+		return;
+	for (i = 0; usbfds[i] != NULL; i++)
+		event_fd_add(ctx, usbfds[i]->fd, usbfds[i]->events);
+	free(usbfds);
+#endif
 }
 
-void fpi_poll_init(void)
+void fpi_poll_init(struct fp_context *ctx)
 {
-	libusb_set_pollfd_notifiers(fpi_usb_ctx, add_pollfd, remove_pollfd, NULL);
+	ctx->timer_fd = -1;
+	ctx->event_fd = -1;
+	event_fd_init(ctx);
+#ifdef HAVE_SYS_TIMERFD_H
+	ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ctx->timer_fd < 0)
+		fp_err("failed to create timerfd, errno=%d", errno);
+	else
+		add_pollfd(ctx->timer_fd, POLLIN, ctx);
+#endif
+	libusb_set_pollfd_notifiers(ctx->usb_ctx, add_pollfd, remove_pollfd, ctx);
 }
 
-void fpi_poll_exit(void)
+void fpi_poll_exit(struct fp_context *ctx)
 {
-	g_slist_free(active_timers);
-	active_timers = NULL;
-	fd_added_cb = NULL;
-	fd_removed_cb = NULL;
-	libusb_set_pollfd_notifiers(fpi_usb_ctx, NULL, NULL, NULL);
+	if (ctx->timer_fd >= 0) {
+		remove_pollfd(ctx->timer_fd, ctx);
+		close(ctx->timer_fd);
+		ctx->timer_fd = -1;
+	}
+	if (ctx->event_fd >= 0) {
+		close(ctx->event_fd);
+		ctx->event_fd = -1;
+	}
+
+	/* timers still pending belong to the freed chunks */
+	g_slist_free_full(ctx->timeout_chunks, g_free);
+	ctx->timeout_chunks = NULL;
+	ctx->free_timeouts = NULL;
+	g_free(ctx->timer_heap);
+	ctx->timer_heap = NULL;
+	ctx->timer_heap_len = ctx->timer_heap_size = 0;
+	ctx->fd_added_cb = NULL;
+	ctx->fd_removed_cb = NULL;
+	libusb_set_pollfd_notifiers(ctx->usb_ctx, NULL, NULL, NULL);
 }
 
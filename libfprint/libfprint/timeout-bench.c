@@ -0,0 +1,233 @@
+/*
+ * Stress benchmark for driver timeouts
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Adds and cancels thousands of concurrent timeouts, the way drivers do for
+ * every USB command, through fpi_timeout_add() and through the sorted list
+ * libfprint used before the heap. Then lets them fire and checks that they do
+ * in expiry order, woken up by the event fd only.
+ *
+ * Built with make timeout-bench, run as timeout-bench [timeouts] [rounds]
+ */
+
+#include <config.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "fp_internal.h"
+
+#define BENCH_DEFAULT_TIMEOUTS 5000
+#define BENCH_DEFAULT_ROUNDS 20
+
+/* the pending timeouts as libfprint kept them before the heap: a GSList
+ * sorted by expiry, one g_malloc per timeout */
+struct list_timeout {
+	struct timeval expiry;
+	fpi_timeout_fn callback;
+	void *data;
+};
+
+static GSList *list_timers = NULL;
+
+static int list_sort_fn(gconstpointer _a, gconstpointer _b)
+{
+	const struct list_timeout *a = _a;
+	const struct list_timeout *b = _b;
+
+	if (timercmp(&a->expiry, &b->expiry, <))
+		return -1;
+	else if (timercmp(&a->expiry, &b->expiry, >))
+		return 1;
+	else
+		return 0;
+}
+
+static struct list_timeout *list_timeout_add(unsigned int msec,
+	fpi_timeout_fn callback, void *data)
+{
+	struct timespec ts;
+	struct timeval add_msec;
+	struct list_timeout *timeout;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	timeout = g_malloc(sizeof(*timeout));
+	timeout->callback = callback;
+	timeout->data = data;
+	TIMESPEC_TO_TIMEVAL(&timeout->expiry, &ts);
+
+	timerclear(&add_msec);
+	add_msec.tv_sec = msec / 1000;
+	add_msec.tv_usec = (msec % 1000) * 1000;
+	timeradd(&timeout->expiry, &add_msec, &timeout->expiry);
+
+	list_timers = g_slist_insert_sorted(list_timers, timeout, list_sort_fn);
+	return timeout;
+}
+
+static void list_timeout_cancel(struct list_timeout *timeout)
+{
+	list_timers = g_slist_remove(list_timers, timeout);
+	g_free(timeout);
+}
+
+static int fired;
+static int last_msec;
+static int out_of_order;
+
+static void bench_cb(void *data)
+{
+	int msec = GPOINTER_TO_INT(data);
+
+	if (msec < last_msec)
+		out_of_order++;
+	last_msec = msec;
+	fired++;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the delays drivers use for their commands, 1 to 6 seconds */
+static unsigned int *bench_delays(int n)
+{
+	unsigned int *delays = g_new(unsigned int, n);
+	int i;
+
+	srand(1);
+	for (i = 0; i < n; i++)
+		delays[i] = 1000 + rand() % 5000;
+	return delays;
+}
+
+static double bench_heap(int n, int rounds)
+{
+	struct fpi_timeout **timeouts = g_new(struct fpi_timeout *, n);
+	unsigned int *delays = bench_delays(n);
+	double start = bench_now();
+	int r, i;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n; i++)
+			timeouts[i] = fpi_timeout_add(delays[i], bench_cb, NULL);
+		for (i = 0; i < n; i++)
+			fpi_timeout_cancel(timeouts[i]);
+	}
+
+	start = bench_now() - start;
+	g_free(delays);
+	g_free(timeouts);
+	return start;
+}
+
+static double bench_list(int n, int rounds)
+{
+	struct list_timeout **timeouts = g_new(struct list_timeout *, n);
+	unsigned int *delays = bench_delays(n);
+	double start = bench_now();
+	int r, i;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n; i++)
+			timeouts[i] = list_timeout_add(delays[i], bench_cb, NULL);
+		for (i = 0; i < n; i++)
+			list_timeout_cancel(timeouts[i]);
+	}
+
+	start = bench_now() - start;
+	g_free(delays);
+	g_free(timeouts);
+	return start;
+}
+
+/* n timeouts within 50ms, a third of them cancelled, fire in order */
+static int bench_fire(int n)
+{
+	struct fpi_timeout **timeouts = g_new(struct fpi_timeout *, n);
+	int expected = n - (n + 2) / 3;
+	int wakeups = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		int msec = rand() % 50;
+		timeouts[i] = fpi_timeout_add(msec, bench_cb, GINT_TO_POINTER(msec));
+	}
+	for (i = 0; i < n; i += 3)
+		fpi_timeout_cancel(timeouts[i]);
+	g_free(timeouts);
+
+	fired = 0;
+	last_msec = -1;
+	out_of_order = 0;
+	while (fired < expected) {
+		struct pollfd pfd = { fp_get_event_fd(), POLLIN, 0 };
+
+		if (poll(&pfd, 1, 1000) != 1) {
+			fprintf(stderr, "no wakeup, %d of %d timeouts fired\n",
+				fired, expected);
+			return 1;
+		}
+		wakeups++;
+		fp_dispatch_events();
+	}
+
+	printf("fired %d timeouts in %d wakeups, %d out of order\n", fired,
+		wakeups, out_of_order);
+	return out_of_order != 0;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_TIMEOUTS;
+	int rounds = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_ROUNDS;
+	double heap, list;
+	int r;
+
+	if (n <= 0 || rounds <= 0) {
+		fprintf(stderr, "usage: %s [timeouts] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	r = fp_init();
+	if (r < 0) {
+		fprintf(stderr, "Failed to initialize libfprint\n");
+		return 1;
+	}
+	if (fp_get_event_fd() < 0) {
+		fprintf(stderr, "No event fd on this system\n");
+		fp_exit();
+		return 1;
+	}
+
+	list = bench_list(n, rounds);
+	heap = bench_heap(n, rounds);
+	printf("%d concurrent timeouts, %d rounds of add and cancel\n", n, rounds);
+	printf("sorted list: %.3f us per timeout\n", list / (n * rounds) * 1e6);
+	printf("heap:        %.3f us per timeout\n", heap / (n * rounds) * 1e6);
+
+	r = bench_fire(n);
+	fp_exit();
+	return r;
+}
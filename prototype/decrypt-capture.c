@@ -0,0 +1,159 @@
+/*
+ * Validity90 capture decryptor
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "validity90/capture.h"
+#include "validity90/utils.h"
+
+static const char *kind_names[] = {
+    [VALIDITY90_CAPTURE_PLAIN] = "plain",
+    [VALIDITY90_CAPTURE_TLS] = "tls",
+    [VALIDITY90_CAPTURE_DECRYPTED] = "dec",
+    [VALIDITY90_CAPTURE_ENCRYPTED] = "enc",
+};
+
+typedef struct output {
+    gboolean started;
+    gint64 first_ts;
+    char *line;
+    gsize line_size;
+} output;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-k KEY_BLOCK | -m MASTER_SECRET] CAPTURE.pcapng\n"
+            "\n"
+            "Prints the commands and responses of the sensor in a usbmon capture, one per line:\n"
+            "  seconds, OUT or IN, plain/tls/dec/enc with the TLS type, length and hex data.\n"
+            "Application data is decrypted with the key block printed by the prototype, or\n"
+            "with the one expanded from the master secret and the hello randoms.\n",
+            name);
+}
+
+static void print_message_cb(const validity90_capture_message *message, gpointer user_data) {
+    static const char digits[] = "0123456789abcdef";
+    output *out = user_data;
+    gsize needed = message->data_len * 2 + 1;
+
+    if (!out->started) {
+        out->started = TRUE;
+        out->first_ts = message->ts_us;
+    }
+
+    if (out->line_size < needed) {
+        out->line_size = MAX(needed, out->line_size * 2);
+        out->line = g_realloc(out->line, out->line_size);
+    }
+    for (gsize i = 0; i < message->data_len; i++) {
+        out->line[i * 2] = digits[message->data[i] >> 4];
+        out->line[i * 2 + 1] = digits[message->data[i] & 0x0f];
+    }
+    out->line[message->data_len * 2] = '\0';
+
+    if (message->kind == VALIDITY90_CAPTURE_PLAIN) {
+        printf("%11.6f %-3s %-6s %6lu %s\n", (message->ts_us - out->first_ts) / 1e6, message->in ? "IN" : "OUT",
+               kind_names[message->kind], message->data_len, out->line);
+    } else {
+        printf("%11.6f %-3s %s:%02x %6lu %s\n", (message->ts_us - out->first_ts) / 1e6, message->in ? "IN" : "OUT",
+               kind_names[message->kind], message->type, message->data_len, out->line);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *key_block_hex = NULL, *master_secret_hex = NULL, *path = NULL;
+    output out = { 0 };
+    validity90_capture_stats stats = { 0 };
+    GError *error = NULL;
+    GStatBuf st;
+    guint8 *key;
+    gsize key_len;
+    int ret = EXIT_FAILURE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            key_block_hex = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            master_secret_hex = argv[++i];
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (path == NULL || (key_block_hex != NULL && master_secret_hex != NULL)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    validity90_capture_decoder *decoder = validity90_capture_decoder_new(print_message_cb, &out);
+
+    if (key_block_hex != NULL) {
+        if (!validity90_parse_hex(key_block_hex, &key, &key_len)) {
+            fprintf(stderr, "Key block is not hex\n");
+            goto end;
+        }
+        gboolean ok = validity90_capture_decoder_set_key_block(decoder, key, key_len, &error);
+        memset(key, 0, key_len);
+        g_free(key);
+        if (!ok) {
+            fprintf(stderr, "Bad key block: %s\n", error->message);
+            goto end;
+        }
+    }
+    if (master_secret_hex != NULL) {
+        if (!validity90_parse_hex(master_secret_hex, &key, &key_len)) {
+            fprintf(stderr, "Master secret is not hex\n");
+            goto end;
+        }
+        validity90_capture_decoder_set_master_secret(decoder, key, key_len);
+        memset(key, 0, key_len);
+        g_free(key);
+    }
+
+    // Firmware and image transfers make for long lines
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+    gint64 started = g_get_monotonic_time();
+    if (!validity90_capture_decode_file(decoder, path, &stats, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        goto end;
+    }
+    fflush(stdout);
+    gdouble elapsed = (g_get_monotonic_time() - started) / 1e6;
+
+    guint64 size = g_stat(path, &st) == 0 ? st.st_size : 0;
+    fprintf(stderr, "%s: %lu bytes, %u transfers, %u messages (%u decrypted, %u still encrypted) "
+                    "in %.3f ms, %.1f MB/s\n",
+            path, size, stats.packets, stats.messages, stats.decrypted, stats.encrypted,
+            elapsed * 1e3, size / MAX(elapsed, 1e-9) / 1e6);
+    ret = EXIT_SUCCESS;
+
+end:
+    g_clear_error(&error);
+    validity90_capture_decoder_free(decoder);
+    g_free(out.line);
+
+    return ret;
+}
@@ -26,30 +26,28 @@
 #include <libusb.h>
 #include <stdlib.h>
 #include <string.h>
-#include <nss.h>
-#include <keyhi.h>
-#include <keythi.h>
-#include <secoid.h>
-#include <secmodt.h>
-#include <sechash.h>
-#include <pk11pub.h>
 #include <err.h>
 #include <errno.h>
+#include <sys/resource.h>
 
-#include <openssl/ec.h>
-#include <openssl/evp.h>
-#include <openssl/obj_mac.h>
-#include <openssl/err.h>
-#include <openssl/x509.h>
-#include <openssl/aes.h>
-#include <openssl/ssl.h>
-#include <openssl/tls1.h>
-#include <openssl/ecdh.h>
-#include <png.h>
+#include <zlib.h>
 
 #include "constants.h"
+#include "validity90/crypto.h"
 #include "validity90/validity90.h"
 #include "validity90/utils.h"
+#include "validity90/tls.h"
+#include "validity90/readout.h"
+#include "validity90/interrupt.h"
+#include "validity90/transport.h"
+#include "validity90/image.h"
+#include "validity90/handshake.h"
+#include "validity90/daemon.h"
+#include "validity90/scan.h"
+#include "validity90/recovery.h"
+#ifdef VALIDITY90_HAVE_LIBFPRINT
+#include "validity90/template.h"
+#endif
 
 
 #define xstr(a) str(a)
@@ -59,9 +57,33 @@
 #define min(a,b) (a > b ? b : a)
 
 #define err(x) res_err(x, xstr(x))
-#define errb(x) res_errb(x, xstr(x))
 #define byte guint8
 
+typedef struct SequenceDef {
+    const char *name;
+    const validity90_step_def *steps;
+    guint steps_count;
+
+    validity90_sequence *compiled;
+} SequenceDef;
+
+#define SEQUENCE(steps) { #steps, (steps), G_N_ELEMENTS(steps) }
+
+typedef struct DeviceSequences {
+    SequenceDef probe;
+    SequenceDef init;
+    SequenceDef setup;
+    SequenceDef reset;
+} DeviceSequences;
+
+// Shared by every supported device so far
+static DeviceSequences default_sequences = {
+    .probe = SEQUENCE(init_sequence_probe),
+    .init = SEQUENCE(init_sequence),
+    .setup = SEQUENCE(setup_sequence),
+    .reset = SEQUENCE(reset_sequence),
+};
+
 typedef struct DeviceInfo {
     guint16 vid;
     guint16 pid;
@@ -73,18 +95,33 @@ typedef struct DeviceInfo {
     gboolean unsupported;
 
     gchar *description;
+
+    DeviceSequences *sequences;
+    const validity90_image_geometry *geometry;
 } DeviceInfo;
 
 DeviceInfo all_devices[] = {
-    { .vid = 0x138a, .pid = 0x0090, .hasLed = 1, .hasBios = 1, .requiresReset = 0, .hasRawOutput = 1 },
-    { .vid = 0x138a, .pid = 0x0097, .hasLed = 1, .hasBios = 1, .requiresReset = 0, .hasRawOutput = 0 },
+    { .vid = 0x138a, .pid = 0x0090, .hasLed = 1, .hasBios = 1, .requiresReset = 0, .hasRawOutput = 1, .sequences = &default_sequences, .geometry = &validity90_image_geometry_0090 },
+    { .vid = 0x138a, .pid = 0x0097, .hasLed = 1, .hasBios = 1, .requiresReset = 0, .hasRawOutput = 0, .sequences = &default_sequences, .geometry = &validity90_image_geometry_0090 },
     { .vid = 0x138a, .pid = 0x0094, .hasLed = 0, .hasBios = 0, .requiresReset = 1, .hasRawOutput = 1, .unsupported = 1, .description = "Support would be available soon" },
     { .vid = 0x06cb, .pid = 0x0081, .hasLed = -1, .hasBios = -1, .requiresReset = 1, .hasRawOutput = -1, .unsupported = 1, .description = "Support would be available soon" },
-    { .vid = 0x06cb, .pid = 0x009a, .hasLed = 1, .hasBios = -1, .requiresReset = 0, .hasRawOutput = -1 },
+    { .vid = 0x06cb, .pid = 0x009a, .hasLed = 1, .hasBios = -1, .requiresReset = 0, .hasRawOutput = -1, .sequences = &default_sequences, .geometry = &validity90_image_geometry_0090 },
     { .vid = 0x138a, .pid = 0x0091, .unsupported = 1, .description = "Won't be supported, check README" },
 };
 
 static libusb_device_handle * dev;
+static validity90_transport *transport;
+static DeviceSequences *sequences = &default_sequences;
+static const validity90_image_geometry *geometry = &validity90_image_geometry_0090;
+// Allocated with the first scan, for the geometry of the device
+static validity90_image_assembler *assembler;
+
+// Bytes moved through qwrite/qread, for the phase timings
+static guint64 transport_bytes;
+
+// Only with IMAGE_DUMP=<name>, written off the scan path
+static validity90_image_dumper *image_dumper;
+static const char *image_dump_name;
 
 int idProduct = 0;
 
@@ -95,8 +132,6 @@ static const byte client_random[] = {
   0xf8, 0xac, 0xc6, 0x69, 0x24, 0x70, 0xc4, 0x2a
 };
 
-byte server_random[0x40];
-
 void print_hex_gn(byte* data, int len, int sz) {
     for (int i = 0; i < len; i++) {
         if ((i % 16) == 0) {
@@ -127,64 +162,82 @@ void print_hex_dw(dword* data, int len) {
     print_hex_gn(data, len, 4);
 }
 
-bool compare(byte * data1, int data_len, dword * expected, int exp_len) {
-    bool fail = false;
+void res_err(int result, char* where) {
+    if (result != 0) {
+        printf("Failed '%s': %d - %s\n", where, result, libusb_error_name(result));
+        exit(0);
+    }
+}
 
-    if (data_len != exp_len) {
-        printf("Expected len: %d, but got %d\n", exp_len, data_len);
-        fail = true;
-    } else {
-        for (int i = 0; i < data_len; i++) {
-            if (data1[i] != expected[i] && !(expected[i] & MASK_VARIABLE)) {
-                printf("Expected at char %03x\n", i);
-                fail = true;
-                break;
-            }
-        }
+gboolean qwrite_error(byte * data, int len, GError **error) {
+    if (!validity90_transport_write(transport, 0x01, data, len, 10000, error)) {
+        return FALSE;
     }
+    transport_bytes += len;
+
+    puts("usb write:");
+    print_hex(data, len);
+
+    return TRUE;
+}
+
+gboolean qread_error(byte * data, int len, int *out_len, GError **error) {
+    gsize read_len;
 
-    if (fail) {
-        /*puts("Expected:");
-        print_hex_dw(expected, exp_len);
-        puts("Got:");
-        print_hex(data1, data_len);*/
+    if (!validity90_transport_read(transport, 0x81, data, len, &read_len, 10000, error)) {
+        return FALSE;
     }
+    *out_len = read_len;
+    transport_bytes += read_len;
 
-    return data_len == exp_len;
+    puts("usb read:");
+    print_hex(data, *out_len);
+
+    return TRUE;
 }
 
-void res_err(int result, char* where) {
-    if (result != 0) {
-        printf("Failed '%s': %d - %s\n", where, result, libusb_error_name(result));
-        exit(0);
+void qwrite(byte * data, int len) {
+    GError *error = NULL;
+
+    if (!qwrite_error(data, len, &error)) {
+        printf("Failed to write: %s\n", error->message);
+        exit(-1);
     }
 }
 
-void res_errb(int result, char* where) {
-    if (result != 1) {
-        printf("Failed '%s': %d - %s\n", where, result, libusb_error_name(result));
-        ERR_print_errors_fp(stderr);
-        exit(0);
+void qread(byte * data, int len, int *out_len) {
+    GError *error = NULL;
+
+    if (!qread_error(data, len, out_len, &error)) {
+        printf("Failed to read: %s\n", error->message);
+        exit(-1);
     }
 }
 
-void qwrite(byte * data, int len) {
-    int send;
-    err(libusb_bulk_transfer(dev, 0x01, data, len, &send, 10000));
+// Timings go to stderr, so they stay readable with the dumps sent to /dev/null
+void print_timing(const char *phase, gint64 started, guint64 started_bytes) {
+    gint64 elapsed = g_get_monotonic_time() - started;
+    guint64 bytes = transport_bytes - started_bytes;
 
-    puts("usb write:");
-    print_hex(data, len);
+    fprintf(stderr, "%s: %.3f ms, %lu bytes, %.3f MB/s\n", phase, elapsed / 1000.0, bytes,
+            elapsed > 0 ? (double) bytes / elapsed : 0.0);
 }
 
-void qread(byte * data, int len, int *out_len) {
-    err(libusb_bulk_transfer(dev, 0x81, data, len, out_len, 10000));
+// CPU time also counts what ran before main: the dynamic loader and library constructors
+void print_ready(gint64 main_started) {
+    struct rusage usage;
 
-    puts("usb read:");
-    print_hex(data, *out_len);
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "ready: %.3f ms since main, %.3f ms cpu, %ld kB max RSS\n",
+            (g_get_monotonic_time() - main_started) / 1000.0,
+            (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+            (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0,
+            usage.ru_maxrss);
 }
 
 static byte pubkey1[0x40];
 static byte ecdsa_private_key[0x60];
+static GByteArray *client_certificate;
 
 static char masterkey_aes[0x20];
 
@@ -215,16 +268,55 @@ void loadBiosData() {
     fclose(serialFile);
 }
 
-bool do_step(byte *data, int data_len, byte *buff, int *buf_len, byte *expected, int expected_len)
-{
-    qwrite(data, data_len);
-    qread(buff, 1024 * 1024, buf_len);
+// Prints the exchange like qwrite/qread and keeps a copy of the response in user_data, if any
+void print_step_cb(validity90_sequence *seq, const validity90_step_result *result, gpointer user_data) {
+    GByteArray *rsp = user_data;
+
+    printf("step %u\n", result->step + 1);
+    puts("usb write:");
+    print_hex(result->msg, result->msg_len);
+    puts("usb read:");
+    print_hex(result->rsp, result->rsp_len);
+    transport_bytes += result->msg_len + result->rsp_len;
 
-    return compare(buff, *buf_len, expected, expected_len);
+    if (result->rsp_len != result->expected_len && result->expected_len != 0) {
+        printf("Expected len: %lu, but got %lu\n", result->expected_len, result->rsp_len);
+    } else if (result->mismatch >= 0) {
+        printf("Expected at char %03lx\n", result->mismatch);
+    }
+
+    if (rsp != NULL) {
+        g_byte_array_set_size(rsp, 0);
+        g_byte_array_append(rsp, result->rsp, result->rsp_len);
+    }
 }
 
+void probe_step_cb(validity90_sequence *seq, const validity90_step_result *result, gpointer user_data) {
+    gint *state = user_data;
+    const guint8 *field;
+    gsize field_len;
+
+    print_step_cb(seq, result, NULL);
 
-#define STEP(a,b) do_step(a, sizeof(a) / sizeof(byte), buff, &len, b, sizeof(b) / sizeof(dword));
+    if (validity90_sequence_get_field(seq, result, FIELD_SENSOR_STATE, &field, &field_len)) {
+        *state = field[0];
+    }
+}
+
+void run_sequence(SequenceDef *def, validity90_step_cb cb, gpointer user_data) {
+    GError *error = NULL;
+
+    // Compiled on first use and kept for the following runs
+    if (def->compiled == NULL) {
+        def->compiled = validity90_sequence_compile(def->steps, def->steps_count);
+    }
+
+    printf("%s sequence\n", def->name);
+    if (!validity90_sequence_run(def->compiled, transport, cb, user_data, &error)) {
+        printf("Failed to run %s sequence: %s\n", def->name, error->message);
+        exit(-1);
+    }
+}
 
 void init_keys(const byte *buff, int len) {
     byte vbox_serial[] = "VirtualBox\0" "0";
@@ -238,70 +330,16 @@ void init_keys(const byte *buff, int len) {
     }
 
     memcpy(ecdsa_private_key, info->tls_client_privkey->data, info->tls_client_privkey->len);
-    memcpy(tls_certificate + 21, info->tls_cert_raw->data, info->tls_cert_raw->len);
+    client_certificate = g_byte_array_ref(info->tls_cert_raw);
     memcpy(pubkey1, info->tls_server_pubkey->data, info->tls_server_pubkey->len);
 
-    g_byte_array_free_to_bytes(info->tls_cert_raw);
-    g_byte_array_free_to_bytes(info->tls_client_privkey);
-    g_byte_array_free_to_bytes(info->tls_server_pubkey);
-    g_free(info);
+    validity90_rsp6_info_free(info);
 
     fflush(stdout);
 }
 
-void init_steps(byte *buff, int len, int *out_len)
-{
-    puts("step 2");STEP(init_sequence_msg2, init_sequence_rsp2);
-    puts("step 3");STEP(init_sequence_msg3, init_sequence_rsp3);
-    puts("step 4");STEP(init_sequence_msg4, init_sequence_rsp4);
-    puts("step 5");STEP(init_sequence_msg5, init_sequence_rsp5);
-    puts("step 6");STEP(init_sequence_msg6, init_sequence_rsp6);
-    *out_len = len;
-}
-
 void setup() {
-    int len;
-    byte buff[1024 * 1024];
-    byte *keys_buff;
-
-    static const byte setup_sequence_msg13[] = { 0x1a };
-    static const dword setup_sequence_rsp13[] = { 0x00, 0x00 };
-
-    puts("step 2");STEP(init_sequence_msg2, init_sequence_rsp2);
-    print_hex(buff, len);
-
-    puts("step 4");STEP(init_sequence_msg4, init_sequence_rsp4);
-    print_hex(buff, len);
-
-    puts("step 5");STEP(init_sequence_msg5, setup_sequence_rsp5);
-    print_hex(buff, len);
-
-    puts("step 6");STEP(setup_sequence_msg6, setup_sequence_rsp6);
-    print_hex(buff, len);
-
-    puts("step 7");STEP(setup_sequence_msg7, setup_sequence_rsp7);
-    print_hex(buff, len);
-
-    puts("step 8");STEP(setup_sequence_msg8, setup_sequence_rsp8);
-    print_hex(buff, len);
-
-    puts("step 9");STEP(setup_sequence_config_data, setup_sequence_config_data_rsp);
-    print_hex(buff, len);
-
-    puts("step 5");STEP(init_sequence_msg5, setup_sequence_rsp5);
-    print_hex(buff, len);
-
-    puts("step 10");STEP(setup_sequence_msg10, setup_sequence_rsp10);
-    print_hex(buff, len);
-
-    puts("step 11");STEP(setup_sequence_msg11, setup_sequence_rsp11);
-    print_hex(buff, len);
-
-    puts("step 12");STEP(setup_sequence_msg12, setup_sequence_rsp12);
-    print_hex(buff, len);
-
-    puts("step 13");STEP(setup_sequence_msg13, setup_sequence_rsp13);
-    print_hex(buff, len);
+    run_sequence(&sequences->setup, print_step_cb, NULL);
 
     // We need to find a way to retrieve ecdsa_private_key, once we've that
     // we're all set and we can start a TLS session...
@@ -310,75 +348,28 @@ void setup() {
 }
 
 void init() {
-    int len;
-    byte buff[1024 * 1024];
+    GByteArray *rsp = g_byte_array_new();
+    gint state = -1;
 
-    puts("step 1");STEP(init_sequence_msg1, init_sequence_rsp1);
+    run_sequence(&sequences->probe, probe_step_cb, &state);
 
     if (getenv("FORCE_RESET") != NULL) {
         puts("Sending reset commands");
-        STEP(setup_sequence_config_data, setup_sequence_config_data_rsp);
-        const byte reset_cmd[] = "\x10\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" \
-                                 "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" \
-                                 "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" \
-                                 "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" \
-                                 "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" \
-                                 "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" \
-                                 "\x00\x00";
-        qwrite(reset_cmd, sizeof(reset_cmd));
-        qread(buff, sizeof(buff), &len);
-        print_hex(buff, len);
-
-        puts("ACK");
-        STEP(setup_sequence_completed, setup_sequence_completed_rsp);
-        print_hex(buff, len);
+        run_sequence(&sequences->reset, print_step_cb, NULL);
         exit(EXIT_SUCCESS);
     }
 
-    if (buff[len-1] != 0x07 || getenv("FORCE_SETUP") != NULL) {
-        printf("Sensor not initialized, init byte is 0x%x (expected 0x02)\n",
-               buff[len-1]);
+    if (state != VALIDITY90_SENSOR_STATE_READY || getenv("FORCE_SETUP") != NULL) {
+        printf("Sensor not initialized, init byte is 0x%x (expected 0x02)\n", state);
 
         setup();
         exit(EXIT_FAILURE);
-    } else {
-        init_steps(buff, len, &len);
     }
 
-    init_keys(buff, len);
-}
-
-#undef STEP
-
-PK11Context* hmac_make_context(byte *key_bytes, int key_len) {
-    CK_MECHANISM_TYPE hmacMech = CKM_SHA256_HMAC;
-    PK11SlotInfo *slot = PK11_GetBestSlot(hmacMech, NULL);
-
-    SECItem key;
-
-    key.data = key_bytes;
-    key.len = key_len;
-
-    PK11SymKey *pkKey = PK11_ImportSymKey(slot, hmacMech, PK11_OriginUnwrap, CKA_SIGN, &key, NULL);
-
-    SECItem param = { .type = siBuffer, .data = NULL, .len = 0 };
+    run_sequence(&sequences->init, print_step_cb, rsp);
+    init_keys(rsp->data, rsp->len);
 
-    PK11Context* context = PK11_CreateContextBySymKey(hmacMech, CKA_SIGN, pkKey, &param);
-    PK11_DigestBegin(context);
-
-    return context;
-}
-
-byte* hmac_compute(byte *key, int key_len, byte* data, int data_len) {
-    PK11Context* context = hmac_make_context(key, key_len);
-    PK11_DigestOp(context, data, data_len);
-
-    byte *res = malloc(0x20);
-    int len = 0x20;
-    PK11_DigestFinal(context, res, &len, 0x20);
-    PK11_DestroyContext(context, PR_TRUE);
-
-    return res;
+    g_byte_array_free(rsp, TRUE);
 }
 
 //10
@@ -405,74 +396,6 @@ static const byte privkey1[] = {
     0x58, 0x0a, 0xae, 0x80, 0xb4, 0x2d, 0xd0, 0xb5,  0x54, 0x81, 0x89, 0x91, 0xd0, 0x68, 0xb0, 0x26
 };*/
 
-EC_KEY * load_key(byte *data, bool is_private) {
-    BIGNUM *x = BN_bin2bn(data, 0x20, NULL);
-    BIGNUM *y = BN_bin2bn(data + 0x20, 0x20, NULL);
-    BIGNUM *d = NULL;
-    EC_KEY *key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
-
-    if (!EC_KEY_set_public_key_affine_coordinates(key, x, y)) {
-        goto err;
-    }
-
-    if (is_private) {
-        d = BN_bin2bn(data + 0x40, 0x20, NULL);
-        if (!EC_KEY_set_private_key(key, d)) {
-            goto err;
-        }
-    }
-    err(EC_KEY_check_key(key) - 1);
-
-    goto clean;
-
-err:
-    if (key) EC_KEY_free(key);
-    key = NULL;
-    ERR_print_errors_fp(stderr);
-
-clean:
-    if (x) BN_free(x);
-    if (y) BN_free(y);
-    if (d) BN_free(d);
-
-    return key;
-}
-
-EVP_PKEY * load_pkey(byte * data, bool is_private) {
-    EC_KEY *key = load_key(data, is_private);
-
-    EVP_PKEY *priv = EVP_PKEY_new();
-    if (is_private) {
-        EVP_PKEY_set1_EC_KEY(priv, key);
-    } else {
-        EVP_PKEY_set1_EC_KEY(priv, key);
-    }
-    return priv;
-}
-
-byte* P_Hash(byte * secret, int key_len, byte * seed, int seed_len) {
-    byte *a1 = hmac_compute(secret, key_len, seed, seed_len);
-    byte *a2 = hmac_compute(secret, key_len, a1, 0x20);
-
-    byte buff1[seed_len + 0x20];
-    byte buff2[seed_len + 0x20];
-
-    memcpy(buff1, a1, 0x20);
-    memcpy(buff1 + 0x20, seed, seed_len);
-
-    memcpy(buff2, a2, 0x20);
-    memcpy(buff2 + 0x20, seed, seed_len);
-
-    byte * val1 = hmac_compute(secret, key_len, buff1, seed_len + 0x20);
-    byte * val2 = hmac_compute(secret, key_len, buff2, seed_len + 0x20);
-
-    byte * data = malloc(0x30);
-    memcpy(data, val1, 0x20);
-    memcpy(data + 0x20, val2, 0x10);
-
-    return data;
-}
-
 void print_hex_C(FILE *f, byte* data, int len) {
     fprintf(f, " = {\n");
     for (int i = 0; i < len; i++) {
@@ -487,628 +410,481 @@ void print_hex_C(FILE *f, byte* data, int len) {
     fprintf(f, "\n};\n");
 }
 
-byte all_messages[1024 * 1024]; int all_messages_index = 0;
-void HUpdate(HASHContext *context, const unsigned char *src, unsigned int len) {
-    HASH_Update(context, src, len);
-    memcpy(all_messages + all_messages_index, src, len);
-    all_messages_index += len;
-    // puts("HASHING>>>");
-    // print_hex(src, len);
-    // puts("HASHING<<");
-}
-
-guint8 key_block[0x120];
+static validity90_handshake *tls_handshake = NULL;
+static validity90_tls_session *tls_session = NULL;
+static validity90_scanner *scanner = NULL;
+static validity90_recovery *recovery = NULL;
+static GByteArray *tls_write_buff = NULL;
+static byte tls_raw_buff[1024 * 1024];
 
-void mac_then_encrypt(byte type, byte * data, int data_len, byte **res, int *res_len) {
-    byte iv[0x10] = {0x4b, 0x77, 0x62, 0xff, 0xa9, 0x03, 0xc1, 0x1e, 0x6f, 0xd8, 0x35, 0x93, 0x17, 0x2d, 0x54, 0xef};
-
-    int prefix_len = 5;
-    if (type == 0xFF) {
-        prefix_len = 0;
+void handshake() {
+    GError *error = NULL;
+    const guint8 *key_block;
+    gsize key_block_len;
+
+    // Same keys for every handshake of the run, only the state is reset
+    if (tls_handshake == NULL) {
+        validity90_handshake_keys keys = {
+            .ecdh_key = privkey1,
+            .server_key = pubkey1,
+            .ecdsa_key = ecdsa_private_key,
+            .certificate = client_certificate->data,
+            .certificate_len = client_certificate->len,
+        };
+        tls_handshake = validity90_handshake_new(&keys, client_random);
+        // Keys stay in the handshake, a broken session gets a new one without the init
+        recovery = validity90_recovery_new(transport, tls_handshake, client_random, sequences->probe.compiled,
+                                           FIELD_SENSOR_STATE);
+    } else {
+        validity90_handshake_reset(tls_handshake, client_random);
     }
-    // header for hmac + data + hmac
-    byte all_data[prefix_len + data_len + 0x20];
-    all_data[0] = type; all_data[1] = all_data[2] = 0x03; all_data[3] = (data_len >> 8) & 0xFF; all_data[4] = data_len & 0xFF;
-    memcpy(all_data + prefix_len, data, data_len);
-
-    memcpy(all_data + prefix_len + data_len, hmac_compute(key_block + 0x00, 0x20, all_data, prefix_len + data_len), 0x20);
-
-
-    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
-    EVP_EncryptInit(context, EVP_aes_256_cbc(), key_block + 0x40, iv);
-    EVP_CIPHER_CTX_set_padding(context, 0);
 
-    *res_len = ((data_len + 16) / 16) * 16 + 0x30;
-    *res = malloc(*res_len);
-    memcpy(*res, iv, 0x10);
-    int written = 0, wr2, wr3 = 0;
-
-//    puts("To encrypt & mac:");
-//    print_hex(data, data_len);
-
-    EVP_EncryptUpdate(context, *res + 0x10, &written, all_data + prefix_len, data_len + 0x20);
-//    printf("enc written: %02x\n", written);
-
-    int pad_len = *res_len - (0x30 + data_len);
-    if (pad_len == 0) {
-        pad_len = 16;
+    if (!validity90_handshake_run(tls_handshake, transport, &error)) {
+        printf("Handshake failed: %s\n", error->message);
+        exit(-1);
     }
-    byte pad[pad_len];
-    memset(pad, pad_len - 1, pad_len);
-
-    EVP_EncryptUpdate(context, *res + 0x10 + written, &wr3, pad, pad_len);
 
-    EVP_EncryptFinal(context, *res + 0x10 + written + wr3, &wr2);
-//    printf("enc written: %02x\n", wr2);
-    *res_len = written + wr2 + wr3 + 0x10;
-
-//    print_hex(all_data + prefix_len, data_len + 0x20);
+    key_block = validity90_handshake_get_key_block(tls_handshake, &key_block_len);
+    puts("keyblock");
+    print_hex((byte*) key_block, key_block_len);
 
-//    puts("Encrypted& hmac");
-//    print_hex(*res, *res_len);
+    validity90_tls_session_free(tls_session);
+    tls_session = validity90_handshake_steal_session(tls_handshake);
+    if (tls_write_buff == NULL) {
+        tls_write_buff = g_byte_array_sized_new(1024);
+    }
 
-    EVP_CIPHER_CTX_free(context);
-}
+    // A new session comes after a reset, nothing the sensor held is known
+    if (scanner == NULL) {
+        scanner = validity90_scanner_new(transport, tls_session);
+        validity90_scanner_set_fast(scanner, getenv("SCAN_FULL") == NULL);
+    } else {
+        validity90_scanner_forget(scanner, tls_session);
+    }
 
-byte *sign(EVP_PKEY* key, byte *data, int data_len) {
-//    ECDSA_do_sign()
-    int len5;
-    int status;
-    byte * res = NULL;
-    do {
-        free(res);
-        puts("signing...");
-        EVP_PKEY_CTX *sign_ctx = EVP_PKEY_CTX_new(key, NULL);
-        status = EVP_PKEY_sign_init(sign_ctx);
-        status = EVP_PKEY_CTX_set_signature_md(sign_ctx, EVP_sha256());
-
-        status = EVP_PKEY_sign(sign_ctx, NULL, &len5, data, data_len);
-        res = malloc(len5);
-        status = EVP_PKEY_sign(sign_ctx, res, &len5, data, data_len);
-
-        EVP_PKEY_CTX_free(sign_ctx);
-    } while(len5 != 0x48);
-    return res;
+    const validity90_handshake_timing *timing = validity90_handshake_get_timing(tls_handshake);
+    fprintf(stderr, "handshake ecdh: %.3f ms, prf: %.3f ms, sign: %.3f ms, io: %.3f ms\n",
+            timing->ecdh_us / 1000.0, timing->prf_us / 1000.0, timing->sign_us / 1000.0, timing->io_us / 1000.0);
 }
 
-byte *sign2(EC_KEY* key, byte *data, int data_len) {
-    int len = 0;
-    byte * res;
-    do {
-        ECDSA_SIG *sig = ECDSA_do_sign(data, data_len, key);
-        len = i2d_ECDSA_SIG(sig, NULL);
-
-        res = malloc(len);
-        byte *f = res;
-        i2d_ECDSA_SIG(sig, &f);
-    } while (len != 0x48);
+// Replaces the broken session, only a restart helps when it fails
+static void recover(const GError *cause) {
+    GError *error = NULL;
+    const validity90_recovery_stats *stats = validity90_recovery_get_stats(recovery);
 
-/*
-    // test check
-    char packet_bytes[] = {
-      0x30, 0x46, 0x02, 0x21, 0x00, 0xa3, 0xad, 0xaa, 0x61,
-      0x00, 0xe6, 0x9d, 0xbd, 0xcf, 0x48, 0x73, 0xb7,
-      0xa6, 0xed, 0xe3, 0x62, 0x0a, 0x79, 0xe4, 0xf8,
-      0x14, 0x27, 0x4d, 0xeb, 0x73, 0x91, 0x01, 0x0c,
-      0xae, 0x08, 0xb9, 0x43, 0x02, 0x21, 0x00, 0xd3,
-      0x28, 0xa4, 0x86, 0xcf, 0x8b, 0xaf, 0x35, 0xc9,
-      0x04, 0xf7, 0x1f, 0xe2, 0x56, 0x22, 0xf7, 0x5d,
-      0xdf, 0x53, 0x13, 0x4f, 0xc6, 0xdb, 0x6b, 0xc0,
-      0x0d, 0x57, 0x90, 0xc4, 0x23, 0xfe, 0x06
-    };
-    char *test = malloc(sizeof(packet_bytes));
-    memcpy(test, packet_bytes, sizeof(packet_bytes));
-    char* pp = packet_bytes;
+    if (!validity90_recovery_run(recovery, cause, &tls_session, &error)) {
+        printf("Recovery failed: %s\n", error->message);
+        exit(-1);
+    }
+    validity90_scanner_forget(scanner, tls_session);
 
-    ECDSA_SIG *sig2 = d2i_ECDSA_SIG(NULL, &pp, 0x48);
-*/
-//    int status = ECDSA_do_verify(data, data_len, sig2, load_key(ecdsa_private_key, false));
-//    printf("Verified: %d", status);
-//    if (status == 1) {
-//    return test;
-//    } else {
-//        exit(-1);
-//    }
-
-    return res;
+    fprintf(stderr, "recovered: %u handshakes, %u resets, mean %.3f ms, max %.3f ms\n", stats->handshakes,
+            stats->resets, stats->total_us / 1000.0 / stats->recovered, stats->max_us / 1000.0);
 }
 
-
-void handshake() {
-    int len;
-    byte *client_hello = malloc(len = sizeof(tls_client_hello) / sizeof(byte));
-    byte buff[1024 * 1024];
-
-    HASHContext *tls_hash_context = HASH_Create(HASH_AlgSHA256);
-    HASHContext *tls_hash_context2 = HASH_Create(HASH_AlgSHA256);
-    HASH_Begin(tls_hash_context);
-    HASH_Begin(tls_hash_context2);
-
-    // Send ClientHello
-    memcpy(client_hello, tls_client_hello, len);
-    memcpy(client_hello + 0xf, client_random, 0x20);
-    HUpdate(tls_hash_context, client_hello + 0x09, 0x43);
-    HUpdate(tls_hash_context2, client_hello + 0x09, 0x43);
-    qwrite(client_hello, sizeof(tls_client_hello));
-
-    // Receive ServerHello
-    qread(buff, 1024 * 1024, &len);
-
-    // SET DEBUG
-    /*
-     * 10
-     * */
-/*
-    memcpy(buff + 0xb, server_random, 0x20);
-    char packet_bytes[] = {
-      0x54, 0x4c, 0x53, 0x90, 0x0c, 0xb8, 0x01
-    };
-    memcpy(buff + 0x2c, packet_bytes, sizeof(packet_bytes));
-*/
-    /*
-     *11
-     */
-/*
-     char rnd_stat[] = {
-  0x00, 0x00, 0x67, 0x28, 0x90, 0xb8, 0xb0, 0x9a,
-  0x24, 0x98, 0x2e, 0x09, 0x7b, 0x8f, 0x03, 0xa8,
-  0x27, 0x53, 0x79, 0xb2, 0x1f, 0xf3, 0x19, 0xaf,
-  0x2e, 0xa8, 0xff, 0xea, 0x53, 0x02, 0xa7, 0x38
-};
-memcpy(buff + 0xb, rnd_stat, 0x20);
-char packet_bytes[] = {
-  0x54, 0x4c, 0x53, 0x90, 0xb8, 0xb0, 0x9a
-};
-
-memcpy(buff + 0x2c, packet_bytes, sizeof(packet_bytes));
-*/
-//
-// SET DEBUG END
-
-
-    memcpy(server_random, buff + 0xb, 0x20);
-    puts("Server tls Random:");
-    print_hex(server_random, 0x20);
-    printf("%d", len);
-    HUpdate(tls_hash_context, buff + 0x05, 0x3d);
-    HUpdate(tls_hash_context2, buff + 0x05, 0x3d);
-
-
-    // Send cert
-    EC_KEY *priv_key = load_key(privkey1, true);
-    EC_KEY *pub_key = load_key(pubkey1, false);
-    int status;
-
-    if (!priv_key || !pub_key) {
-        puts("failed to load");
-        return;
+// Reports and recovers the error, FALSE for the caller to give up on what it did
+static gboolean check(gboolean result, const char *what, GError **error) {
+    if (result) {
+        return TRUE;
     }
+    printf("%s: %s\n", what, (*error)->message);
+    if (validity90_recovery_classify(*error) != VALIDITY90_RECOVERY_NONE) {
+        recover(*error);
+    }
+    g_clear_error(error);
 
-    EVP_PKEY *priv = EVP_PKEY_new(), *pub = EVP_PKEY_new();
-    status = EVP_PKEY_set1_EC_KEY(priv, priv_key);
-    status = EVP_PKEY_set1_EC_KEY(pub, pub_key);
-
-    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(priv, NULL);
-
-    status = EVP_PKEY_derive_init(ctx);
-    status = EVP_PKEY_derive_set_peer(ctx, pub);
-
-    size_t len2 = 0;
-    status = EVP_PKEY_derive(ctx, NULL, &len2);
-
-    byte pre_master_secret[len2];
-
-    ECDH_compute_key(pre_master_secret, 0x20, EC_KEY_get0_public_key(pub_key), priv_key, NULL);
-
-    char seed[0x40], expansion_seed[0x40];
-    memcpy(seed, client_random, 0x20);
-    memcpy(seed + 0x20, server_random, 0x20);
-
-    memcpy(expansion_seed + 0x20, client_random, 0x20);
-    memcpy(expansion_seed, server_random, 0x20);
-
-    guint8 master_secret[0x30];
-    validity90_tls_prf(pre_master_secret, 0x20, "master secret", seed, 0x40, 0x30, master_secret, NULL);
-
-    puts("master secret");
-    print_hex(master_secret, 0x30);
-
-    validity90_tls_prf(master_secret, 0x30, "key expansion", seed, 0x40, 0x120, key_block, NULL);
-    puts("keyblock");
-    print_hex(key_block, 0x120);
-
-
-    // copy client_random to cert
-//    memcpy(tls_certificate + 0x13, client_random + 0x04, 0x02);
-//    memcpy(tls_certificate + 0x13, client_random + 0x05, 0x02);
-    // copy ecdhe pub to key exchange
-    memcpy(tls_certificate + 0xce + 4, privkey1, 0x40);
-
-    HUpdate(tls_hash_context, tls_certificate + 0x09, 0x109);
-    HUpdate(tls_hash_context2, tls_certificate + 0x09, 0x109);
-
-    byte test[0x20];int test_len;
-    HASH_End(tls_hash_context, test, &test_len, 0x20);
-    puts("Hash");
-    print_hex(test, 0x20);
-
-
-
-    // cert verify
-//    byte* cert_verify_signature = sign(load_pkey(ecdsa_private_key, true), all_messages, all_messages_index);
-    byte* cert_verify_signature = sign2(load_key(ecdsa_private_key, true), test, 0x20);
-//    byte* cert_verify_signature = sign(load_pkey(ecdsa_private_key, true), test, 0x20);
-
-    printf("\nCert signed: \n");
-    print_hex(cert_verify_signature, 0x48);
-    memcpy(tls_certificate + 0x09 + 0x109 + 0x04, cert_verify_signature, 0x48);
-
-//    printf("\nWhat signed: \n");
-//    print_hex(all_messages, all_messages_index);
-
-    // encrypted finished
-    byte handshake_messages[0x20]; int len3 = 0x20;
-    HUpdate(tls_hash_context2, tls_certificate + 0x09 + 0x109, 0x4c);
-    HASH_End(tls_hash_context2, handshake_messages, &len3, 0x20);
+    return FALSE;
+}
 
-    puts("hash of handshake messages");
-    print_hex(handshake_messages, 0x20); // ok
+gboolean tls_write(byte * data, int data_len) {
+    GError *error = NULL;
 
-    byte *finished_message = malloc(0x10);
-    finished_message[0] = 0x14;
-    finished_message[1] = finished_message[2] = 0x00;
-    finished_message[3] = 0x0c;
+    g_byte_array_set_size(tls_write_buff, 0);
+    if (!validity90_tls_session_seal_record(tls_session, 0x17, data, data_len, tls_write_buff, &error)) {
+        printf("Failed to encrypt TLS record: %s\n", error->message);
+        exit(-1);
+    }
+    return check(qwrite_error(tls_write_buff->data, tls_write_buff->len, &error), "Failed to write", &error);
+}
 
-    validity90_tls_prf(master_secret, 0x30, "client finished", handshake_messages, 0x20, 0x0c, finished_message + 0x04, NULL);
-    // copy handshake protocol
+gboolean tls_read(byte *output_buffer, int *output_len) {
+    GError *error = NULL;
+    int raw_len;
+    gsize len;
+    byte *plain;
+
+    if (!check(qread_error(tls_raw_buff, sizeof(tls_raw_buff), &raw_len, &error), "Failed to read", &error) ||
+        !check(validity90_tls_session_open_record(tls_session, tls_raw_buff, raw_len, &plain, &len, &error),
+               "Failed to decrypt TLS record", &error)) {
+        return FALSE;
+    }
+    memcpy(output_buffer, plain, len);
+    *output_len = len;
 
-    puts("client finished");
-    print_hex(finished_message, 0x10);
+    return TRUE;
+}
 
-    byte * final;
-    int final_size;
-    mac_then_encrypt(0x16, finished_message, 0x10, &final, &final_size);
-    memcpy(tls_certificate + 0x169, final, final_size);
+typedef enum scan_wait_result {
+    SCAN_WAIT_PENDING,
+    SCAN_WAIT_SUCCEEDED,
+    SCAN_WAIT_FAILED,
+} scan_wait_result;
 
-    puts("final");
-    print_hex(final, final_size);
+typedef struct scan_wait {
+    scan_wait_result result;
+} scan_wait;
 
-    qwrite(tls_certificate, sizeof(tls_certificate));
-    qread(buff, 1024 * 1024, &len);
+static void interrupt_dump_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    puts("interrupt:");
+    print_hex((byte *) event->data, event->len);
+    fflush(stdout);
 }
 
-void tls_write(byte * data, int data_len) {
-    byte *res;
-    int res_len;
-    mac_then_encrypt(0x17, data, data_len, &res, &res_len);
-    byte *wr = malloc(res_len + 5);
-    memcpy(wr + 5, res, res_len);
-    wr[0] = 0x17; wr[1] = wr[2] = 0x03; wr[3] = res_len >> 8; wr[4] = res_len & 0xFF;
-    qwrite(wr, res_len + 5);
-
-    free(res);
-    free(wr);
+static void scan_progress_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    switch (event->type) {
+    case VALIDITY90_EVENT_WAITING_FINGER:
+        puts("Waiting for finger...");
+        break;
+    case VALIDITY90_EVENT_FINGER_DOWN:
+        puts("Finger is on the sensor...");
+        break;
+    case VALIDITY90_EVENT_SCAN_STARTED:
+        puts("Scan in progress...");
+        break;
+    case VALIDITY90_EVENT_SCAN_COMPLETED:
+        puts("Fingerprint scan completed...");
+        break;
+    default:
+        break;
+    }
+    fflush(stdout);
 }
 
-void tls_read(byte *output_buffer, int *output_len) {
-    byte *raw_buff = malloc(1024 * 1024);
-    int raw_buff_len;
-
-    qread(raw_buff, 1024 * 1024, &raw_buff_len);
-
-    int buff_len = raw_buff_len - 5;
-    byte *buff = raw_buff + 5;
+static void scan_failed_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    scan_wait *wait = user_data;
 
-    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
-    errb(EVP_DecryptInit(context, EVP_aes_256_cbc(), key_block + 0x60, buff));
-    EVP_CIPHER_CTX_set_padding(context, 0);
+    if (event->type == VALIDITY90_EVENT_SCAN_FAILED_TOO_FAST) {
+        puts("Impossible to read fingerprint, movement was too fast");
+    } else {
+        puts("Impossible to read fingerprint, keep it in the sensor");
+    }
+    wait->result = SCAN_WAIT_FAILED;
+    validity90_interrupts_quit(irq);
+}
 
-    int res_len = buff_len - 0x10;
-    int tlen1 = 0, tlen2;
-    byte *res = malloc(res_len);
-    errb(EVP_DecryptUpdate(context, res, &tlen1, buff + 0x10, res_len));
+static void scan_succeeded_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    scan_wait *wait = user_data;
 
-    errb(EVP_DecryptFinal(context, res + tlen1, &tlen2));
-    EVP_CIPHER_CTX_free(context);
+    if (event->type == VALIDITY90_EVENT_SCAN_SUCCEEDED_LOW_QUALITY) {
+        puts(idProduct == 0x97 ? "Scan succeeded! (v97)" : "Scan succeeded! Low quality.");
+    } else {
+        puts("Scan succeeded!");
+    }
+    wait->result = SCAN_WAIT_SUCCEEDED;
+    validity90_interrupts_quit(irq);
+}
 
-    *output_len = tlen1 + tlen2 - 0x20 - (res[res_len - 1] + 1);
-    memcpy(output_buffer, res, *output_len);
+static void match_result_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    int *validated_finger_id = user_data;
 
-    free(raw_buff);
+    interrupt_dump_cb(irq, event, NULL);
+    // interrupt [1] == 0
+    // interrupt [2] == finger id
+    *validated_finger_id = event->len >= 3 && event->data[0] == 0x03 ? event->data[2] : 0;
+    validity90_interrupts_quit(irq);
 }
 
-int writeImage(char* filename, int width, int height, float *buffer) {
-    int code = 0;
-    FILE *fp = NULL;
-    png_structp png_ptr = NULL;
-    png_infop info_ptr = NULL;
-
-    // Open file for writing (binary mode)
-    fp = fopen(filename, "wb");
-    if (fp == NULL) {
-        fprintf(stderr, "Could not open file %s for writing\n", filename);
-        code = 1;
-        goto finalise;
+static void finish_scan();
+
+// Up to the image readout, FALSE when no finger was scanned within timeout_ms (0 waits as long as it takes)
+static gboolean scan_finger(guint timeout_ms) {
+    GError *error = NULL;
+    const validity90_scanner_stats *stats = validity90_scanner_get_stats(scanner);
+    validity90_scanner_stats started = *stats;
+
+    // The register setup only goes out after a reset, the probes that followed it only with SCAN_FULL
+    if (!check(validity90_scanner_set_led(scanner, (byte*) led_green_on, sizeof(led_green_on), TRUE, &error) &&
+               validity90_scanner_prepare(scanner, &error) &&
+               validity90_scanner_arm(scanner, (byte*) scan_matrix1, sizeof(scan_matrix1), &error),
+               "Scan setup failed", &error)) {
+        return FALSE;
     }
+    //validity90_scanner_arm(scanner, (byte*) v97_scan_matrix2, sizeof(v97_scan_matrix2), &error);
+    fprintf(stderr, "scan setup: %.3f ms, %lu commands, %lu skipped\n", (stats->io_us - started.io_us) / 1000.0,
+            stats->sent - started.sent, stats->skipped - started.skipped);
+
+    scan_wait wait = { .result = SCAN_WAIT_PENDING };
+
+    validity90_interrupts *irq = validity90_interrupts_new(transport, 4);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_WAITING_FINGER, scan_progress_cb, NULL);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_FINGER_DOWN, scan_progress_cb, NULL);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_SCAN_STARTED, scan_progress_cb, NULL);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_SCAN_COMPLETED, scan_progress_cb, NULL);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_SCAN_SUCCEEDED, scan_succeeded_cb, &wait);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_SCAN_SUCCEEDED_LOW_QUALITY, scan_succeeded_cb, &wait);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_SCAN_FAILED_TOO_SHORT, scan_failed_cb, &wait);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_SCAN_FAILED_TOO_FAST, scan_failed_cb, &wait);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_ANY, interrupt_dump_cb, NULL);
 
-    // Initialize write structure
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png_ptr == NULL) {
-        fprintf(stderr, "Could not allocate write struct\n");
-        code = 1;
-        goto finalise;
+    puts("Awaiting fingerprint:");
+    gboolean waited = validity90_interrupts_start(irq, &error) && validity90_interrupts_run(irq, timeout_ms, &error);
+    // Before a recovery resets the device under its transfers
+    validity90_interrupts_free(irq);
+    if (g_error_matches(error, VALIDITY90_INTERRUPT_ERROR, VALIDITY90_INTERRUPT_ERR_TIMEOUT)) {
+        puts("No finger on the sensor, scan cancelled");
+        g_clear_error(&error);
+        // Disarms the sensor, the next scan starts over
+        finish_scan();
+        return FALSE;
+    }
+    if (!check(waited, "Waiting for the scan failed", &error)) {
+        wait.result = SCAN_WAIT_FAILED;
     }
 
-    // Initialize info structure
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL) {
-        fprintf(stderr, "Could not allocate info struct\n");
-        code = 1;
-        goto finalise;
+    if (wait.result != SCAN_WAIT_SUCCEEDED) {
+        return FALSE;
     }
 
-    // Setup Exception handling
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        fprintf(stderr, "Error during png creation\n");
-        code = 1;
-        goto finalise;
+    if (assembler == NULL) {
+        assembler = validity90_image_assembler_new(geometry);
     }
 
-    png_init_io(png_ptr, fp);
+    if (!validity90_readout_image(transport, tls_session, 3, assembler, &error)) {
+        check(FALSE, "Image readout failed", &error);
+    } else if (idProduct != 0x97) {
+        const guint8 *image = validity90_image_assembler_get_image(assembler);
 
-    // Write header (8 bit colour depth)
-    png_set_IHDR(png_ptr, info_ptr, width, height,
-            8, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
-            PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+        printf("image %ux%u\n", geometry->width, geometry->height);
 
+#ifdef VALIDITY90_HAVE_LIBFPRINT
+        guint8 *template;
+        gsize template_len;
 
-    png_write_info(png_ptr, info_ptr);
+        if (validity90_template_from_image(image, geometry->width, geometry->height, idProduct,
+                                           &template, &template_len, &error)) {
+            printf("Template: %lu bytes\n", template_len);
+            g_free(template);
+        } else {
+            printf("Template extraction failed: %s\n", error->message);
+            g_clear_error(&error);
+        }
+#endif
 
-    // Write image data
-    int x, y;
-    for (y=0 ; y<height ; y++) {
-       png_write_row(png_ptr, buffer + 36 * y);
+        if (image_dumper != NULL) {
+            validity90_image_dumper_push(image_dumper, image_dump_name, image, geometry->width, geometry->height);
+            printf("Image queued - %s.png, %s.raw\n", image_dump_name, image_dump_name);
+        }
     }
 
-    // End write
-    png_write_end(png_ptr, NULL);
-
-    finalise:
-    if (fp != NULL) fclose(fp);
-    if (info_ptr != NULL) png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-    if (png_ptr != NULL) png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+    //char packet4[] = { 0x4b, 0x00, 0x00, 0x0b, 0x00, 0x53, 0x74, 0x67, 0x57, 0x69, 0x6e, 0x64, 0x73, 0x6f, 0x72, 0x00 };
+    //tls_write(packet4, sizeof(packet4));
+    //tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
 
-    return code;
+    return TRUE;
 }
 
-void fingerprint() {
-    byte data1[] = {
-        0x08, 0x5c, 0x20, 0x00, 0x80, 0x07, 0x00, 0x00, 0x00, 0x04
-    };
-    byte data2[] = {
-        0x07, 0x80, 0x20, 0x00, 0x80, 0x04
-    };
-    byte data345[] = {
-        0x75
-    };
-    byte data67[] = {
-        0x43, 0x02
-    };
-
-    byte data10[] = {
-        0x51, 0x00, 0x20, 0x00, 0x00 // read data - return buffer
-    };
-    byte data11[] = {
-        0x51, 0x00, 0x20, 0x00, 0x00
-    };
-
+// Matches the scanned finger against the DB: its id, 0 when unknown, -1 when the check didn't work
+static int identify_finger() {
     byte response[1024 * 1024];
     int response_len = 0;
+    GError *error = NULL;
 
-    tls_write(led_green_on, sizeof(led_green_on));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-
-    tls_write(data1, sizeof(data1)); // not required
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-
-    tls_write(data2, sizeof(data2)); // not required
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-
-    for (int i =0; i < 3; i++ ){ // not required
-        tls_write(data345, sizeof(data345));
-        tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    // Check against db packet
+    char packet1[] = { 0x5e, 0x02, 0xff, 0x03, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    if (!tls_write(packet1, sizeof(packet1)) || !tls_read(response, &response_len)) {
+        return -1;
     }
+    puts("READ:");print_hex(response, response_len);
 
-    for (int i =0; i < 2; i++ ){ // not required
-        tls_write(data67, sizeof(data67));
-        tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    int validated_finger_id = -1;
+    validity90_interrupts *irq = validity90_interrupts_new(transport, 1);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_ANY, match_result_cb, &validated_finger_id);
+
+    gboolean checked = validity90_interrupts_start(irq, &error) && validity90_interrupts_run(irq, 5 * 1000, &error);
+    validity90_interrupts_free(irq);
+    if (g_error_matches(error, VALIDITY90_INTERRUPT_ERROR, VALIDITY90_INTERRUPT_ERR_TIMEOUT)) {
+        puts("\nValidation check timeout - try restarting prototype\n");
+        g_clear_error(&error);
+    } else {
+        check(checked, "Validation check failed", &error);
     }
 
+    return validated_finger_id;
+}
 
-    /*tls_write(scan_matrix2, sizeof(scan_matrix2));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);*/
+static void finish_scan() {
+    byte response[1024 * 1024];
+    int response_len = 0;
 
-    // Check DB
-    tls_write(scan_matrix1, sizeof(scan_matrix1));tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-    //tls_write(v97_scan_matrix2, sizeof(v97_scan_matrix2)); tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    // Properly reset so consequtive calls work 1
+    char packet2[] = { 0x60, 0x00, 0x00, 0x00, 0x00 };
+    if (!tls_write(packet2, sizeof(packet2)) || !tls_read(response, &response_len)) {
+        return;
+    }
+    puts("READ:");print_hex(response, response_len);
 
-    byte interrupt[0x100]; int interrupt_len;
+    // Properly reset so consequtive calls work 2
+    char packet3[] = { 0x62, 0x00, 0x00, 0x00, 0x00 };
+    if (!tls_write(packet3, sizeof(packet3)) || !tls_read(response, &response_len)) {
+        return;
+    }
+    puts("READ:");print_hex(response, response_len);
+}
 
-    const byte waiting_finger[] = { 0x00, 0x00, 0x00, 0x00, 0x00 };
-    const byte finger_down[] = { 0x02, 0x00, 0x40, 0x10, 0x00 };
-    const byte finger_down2[] = { 0x02, 0x00, 0x40, 0x06, 0x06 };
-    const byte scanning_prints[] = { 0x03, 0x40, 0x01, 0x00, 0x00 };
-    const byte scan_completed[] = { 0x03, 0x41, 0x03, 0x00, 0x40 };
+// LED scripts go through the scanner so it knows which one is showing
+static void set_led(const char *script, gsize script_len, gboolean steady) {
+    GError *error = NULL;
 
-    const byte desired_interrupt[] = { 0x03, 0x43, 0x04, 0x00, 0x41 };
-    const byte desired_interrupt_v97[] = { 0x03, 0x42, 0x04, 0x00, 0x40 };
-    const byte low_quality_scan_interrupt[] = { 0x03, 0x42, 0x04, 0x00, 0x40 };
-    const byte scan_failed_too_short_interrupt[] = { 0x03, 0x60, 0x07, 0x00, 0x40 };
-    const byte scan_failed_too_short2_interrupt[] = { 0x03, 0x61, 0x07, 0x00, 0x41 };
-    const byte scan_failed_too_fast_interrupt[] = { 0x03, 0x20, 0x07, 0x00, 0x00 };
+    if (!validity90_scanner_set_led(scanner, (const byte*) script, script_len, steady, &error)) {
+        printf("LED script failed: %s\n", error->message);
+        g_clear_error(&error);
+    }
+}
 
-    puts("Awaiting fingerprint:");
-    while (true) {
-        int status = libusb_interrupt_transfer(dev, 0x83, interrupt, 0x100, &interrupt_len, 5 * 1000);
-        if (status == 0) {
-            puts("interrupt:");
-            print_hex(interrupt, interrupt_len);
-            fflush(stdout);
-
-            if (sizeof(waiting_finger) == interrupt_len &&
-                memcmp(waiting_finger, interrupt, interrupt_len) == 0) {
-                puts("Waiting for finger...");
-            }
-            if ((sizeof(finger_down) == interrupt_len &&
-                 memcmp(finger_down, interrupt, interrupt_len) == 0) ||
-                (sizeof(finger_down2) == interrupt_len &&
-                 memcmp(finger_down2, interrupt, interrupt_len) == 0)) {
-                puts("Finger is on the sensor...");
-            }
-            if (sizeof(scanning_prints) == interrupt_len &&
-                memcmp(scanning_prints, interrupt, interrupt_len) == 0) {
-                puts("Scan in progress...");
-            }
-            if (sizeof(scan_completed) == interrupt_len &&
-                memcmp(scan_completed, interrupt, interrupt_len) == 0) {
-                puts("Fingerprint scan completed...");
-            }
-            if (sizeof(scan_failed_too_short_interrupt) == interrupt_len &&
-                memcmp(scan_failed_too_short_interrupt, interrupt, interrupt_len) == 0) {
-                puts("Impossible to read fingerprint, keep it in the sensor");
-                return;
-            }
-            if (sizeof(scan_failed_too_short2_interrupt) == interrupt_len &&
-                memcmp(scan_failed_too_short2_interrupt, interrupt, interrupt_len) == 0) {
-                puts("Impossible to read fingerprint, keep it in the sensor (2)");
-                return;
-            }
-            if (sizeof(scan_failed_too_fast_interrupt) == interrupt_len &&
-                memcmp(scan_failed_too_fast_interrupt, interrupt, interrupt_len) == 0) {
-                puts("Impossible to read fingerprint, movement was too fast");
-                return;
-            }
-            if (sizeof(desired_interrupt) == interrupt_len &&
-                memcmp(desired_interrupt, interrupt, interrupt_len) == 0) {
-                puts("Scan succeeded!");
-                break;
-            }
-            if (sizeof(desired_interrupt_v97) == interrupt_len &&
-                memcmp(desired_interrupt_v97, interrupt, interrupt_len) == 0) {
-                puts("Scan succeeded! (v97)");
-                break;
-            }
-            if (sizeof(low_quality_scan_interrupt) == interrupt_len &&
-                memcmp(low_quality_scan_interrupt, interrupt, interrupt_len) == 0) {
-                puts("Scan succeeded! Low quality.");
-                break;
-            }
+static void show_match(int validated_finger_id) {
+    if (validated_finger_id != -1) {
+        if (validated_finger_id > 0) {
+            set_led(led_green_blink, sizeof(led_green_blink), FALSE);
+            printf("\n\nFingerprint MATCHES DB Finger id: %d!\n", validated_finger_id);
+        } else {
+            set_led(led_red_blink, sizeof(led_red_blink), FALSE);
+            printf("\n\nFingerprint UNKNOWN!\n");
         }
+    } else {
+        set_led(led_red_blink, sizeof(led_red_blink), FALSE);
+        puts("Fingerprint check procedure didn't worked");
     }
+}
 
-    byte image[144 * 144];
-    int image_len = 0;
+void fingerprint() {
+    if (!scan_finger(0)) {
+        return;
+    }
+    int validated_finger_id = identify_finger();
+    finish_scan();
+    puts("Done");
 
-    tls_write(data10, sizeof(data10));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-    memcpy(image, response + 0x12, response_len - 0x12);
-    image_len += response_len - 0x12;
+    show_match(validated_finger_id);
+}
+
+// A scan blocks every client of the daemon while it waits for the finger
+#define DAEMON_SCAN_TIMEOUT_S 30
+#define DAEMON_SCAN_MAX_TIMEOUT_S 300
+
+// Scans with the wait the request asks for in seconds, or the default one
+static gboolean daemon_scan(const gchar *args, GError **error) {
+    guint64 seconds = DAEMON_SCAN_TIMEOUT_S;
+    gchar *end;
+
+    if (args[0] != '\0') {
+        seconds = g_ascii_strtoull(args, &end, 10);
+        if (!g_ascii_isdigit(args[0]) || *end != '\0' || seconds == 0 || seconds > DAEMON_SCAN_MAX_TIMEOUT_S) {
+            g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_REQUEST,
+                        "Bad timeout %s, 1 to %d seconds", args, DAEMON_SCAN_MAX_TIMEOUT_S);
+            return FALSE;
+        }
+    }
+    if (!scan_finger(seconds * 1000)) {
+        g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_REQUEST,
+                    "No finger scanned within %u s", (guint) seconds);
+        return FALSE;
+    }
 
-    tls_write(data10, sizeof(data10));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-    memcpy(image + image_len, response + 0x06, response_len - 0x06);
-    image_len += response_len - 0x06;
+    return TRUE;
+}
 
-    tls_write(data10, sizeof(data10));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-    memcpy(image + image_len, response + 0x06, response_len - 0x06);
-    image_len += response_len - 0x06;
+static gboolean daemon_scan_cb(validity90_daemon *daemon, const gchar *args, GString *reply,
+                               gpointer user_data, GError **error) {
+    if (!daemon_scan(args, error)) {
+        return FALSE;
+    }
+    finish_scan();
 
+    return TRUE;
+}
 
+static gboolean daemon_identify_cb(validity90_daemon *daemon, const gchar *args, GString *reply,
+                                   gpointer user_data, GError **error) {
+    if (!daemon_scan(args, error)) {
+        return FALSE;
+    }
+    int validated_finger_id = identify_finger();
+    finish_scan();
 
+    if (validated_finger_id < 0) {
+        g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_REQUEST, "DB check didn't work");
+        return FALSE;
+    }
+    if (validated_finger_id > 0) {
+        g_string_append_printf(reply, "match %d", validated_finger_id);
+    } else {
+        g_string_append(reply, "unknown");
+    }
 
-    //char packet4[] = { 0x4b, 0x00, 0x00, 0x0b, 0x00, 0x53, 0x74, 0x67, 0x57, 0x69, 0x6e, 0x64, 0x73, 0x6f, 0x72, 0x00 };
-    //tls_write(packet4, sizeof(packet4));
-    //tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    return TRUE;
+}
 
-    // Check against db packet
-    char packet1[] = { 0x5e, 0x02, 0xff, 0x03, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 };
-    tls_write(packet1, sizeof(packet1));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+static gboolean daemon_led_cb(validity90_daemon *daemon, const gchar *args, GString *reply,
+                              gpointer user_data, GError **error) {
+    static const struct {
+        const char *name;
+        const char *script;
+        gsize len;
+        gboolean steady;
+    } leds[] = {
+        { "green", led_green_on, sizeof(led_green_on), TRUE },
+        { "green-blink", led_green_blink, sizeof(led_green_blink), FALSE },
+        { "red-blink", led_red_blink, sizeof(led_red_blink), FALSE },
+    };
 
-    int validated_finger_id = -1;
-    while (true) {
-        int status = libusb_interrupt_transfer(dev, 0x83, interrupt, 0x100, &interrupt_len, 5 * 1000);
-        if (status == 0) {
-            puts("interrupt:");
-            print_hex(interrupt, interrupt_len);
-            fflush(stdout);
-            validated_finger_id = interrupt[0] == 0x03 ? interrupt[2] : 0;
-            // interrupt [1] == 0
-            // interrupt [2] == finger id
-            //
-            break;
-        } else if (status == LIBUSB_ERROR_TIMEOUT) {
-            puts("\nValidation check timeout - try restarting prototype\n");
-            break;
+    for (int i = 0; i < G_N_ELEMENTS(leds); i++) {
+        if (strcmp(args, leds[i].name) == 0) {
+            return validity90_scanner_set_led(scanner, (const guint8*) leds[i].script, leds[i].len, leds[i].steady,
+                                              error);
         }
     }
+    g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_REQUEST,
+                "Unknown led %s, green, green-blink or red-blink", args);
 
-    // Properly reset so consequtive calls work 1
-    char packet2[] = { 0x60, 0x00, 0x00, 0x00, 0x00 };
-    tls_write(packet2, sizeof(packet2));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
-
-    // Properly reset so consequtive calls work 2
-    char packet3[] = { 0x62, 0x00, 0x00, 0x00, 0x00 };
-    tls_write(packet3, sizeof(packet3));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    return FALSE;
+}
 
-    if (idProduct != 0x97) {
-        printf("total len  %d\n", image_len);
-        writeImage("img.png", 144, 144, image);
-        puts("Image written - img.png, img.raw");
+// Keeps the device and the session for every client until killed
+void serve(const char *path) {
+    GError *error = NULL;
 
-        FILE *f = fopen("img.raw", "wb");
-        fwrite(image, 144, 144, f);
-        fclose(f);
+    validity90_daemon *reader = validity90_daemon_new(path, &error);
+    if (reader == NULL) {
+        printf("Failed to start the daemon: %s\n", error->message);
+        exit(-1);
     }
+    validity90_daemon_set_handler(reader, "scan", daemon_scan_cb, NULL);
+    validity90_daemon_set_handler(reader, "identify", daemon_identify_cb, NULL);
+    validity90_daemon_set_handler(reader, "led", daemon_led_cb, NULL);
 
-    puts("Done");
+    printf("Serving scan [seconds], identify [seconds] and led on %s\n", path);
+    fflush(stdout);
 
-    if (validated_finger_id != -1) {
-        if (validated_finger_id > 0) {
-            tls_write(led_green_blink, sizeof(led_green_blink));tls_read(response, &response_len);
-            printf("\n\nFingerprint MATCHES DB Finger id: %d!\n", validated_finger_id);
-        } else {
-            tls_write(led_red_blink, sizeof(led_red_blink));tls_read(response, &response_len);
-            printf("\n\nFingerprint UNKNOWN!\n");
-        }
-    } else {
-        tls_write(led_red_blink, sizeof(led_red_blink));tls_read(response, &response_len);
-        puts("Fingerprint check procedure didn't worked");
+    if (!validity90_daemon_run(reader, &error)) {
+        printf("Daemon failed: %s\n", error->message);
+        g_clear_error(&error);
     }
+    validity90_daemon_free(reader);
 }
 
 void led_test() {
-    byte response[1024 * 1024];
-    int response_len = 0;
-
     puts("Green on");
-    tls_write(led_green_on, sizeof(led_green_on));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    set_led(led_green_on, sizeof(led_green_on), TRUE);
 
     sleep(2);
 
     puts("Red blink x3 then off");
-    tls_write(led_red_blink, sizeof(led_red_blink));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    set_led(led_red_blink, sizeof(led_red_blink), FALSE);
 
     sleep(2);
 
     puts("Green blink");
-    tls_write(led_green_blink, sizeof(led_green_blink));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    set_led(led_green_blink, sizeof(led_green_blink), FALSE);
 
     char led_script[] = {
         0x39, // packet type?
@@ -1150,12 +926,10 @@ void led_test() {
 
     sleep(2);
     puts("Custom script");
-    tls_write(led_script, sizeof(led_script));
-    tls_read(response, &response_len);puts("READ:");print_hex(response, response_len);
+    set_led(led_script, sizeof(led_script), FALSE);
 }
 
-int main(int argc, char *argv[]) {
-    puts("Prototype version 15");
+void open_device() {
     libusb_init(NULL);
     libusb_set_debug(NULL, 3);
 
@@ -1176,10 +950,16 @@ int main(int argc, char *argv[]) {
                 }
 
                 if (all_devices[j].unsupported) {
-                    return -1;
+                    exit(-1);
                 }
 
                 idProduct = descriptor.idProduct;
+                if (all_devices[j].sequences != NULL) {
+                    sequences = all_devices[j].sequences;
+                }
+                if (all_devices[j].geometry != NULL) {
+                    geometry = all_devices[j].geometry;
+                }
 
                 err(libusb_get_device_descriptor(dev_list[i], &descr));
                 err(libusb_open(dev_list[i], &dev));
@@ -1190,33 +970,90 @@ int main(int argc, char *argv[]) {
     }
     if (dev == NULL) {
         puts("No devices found");
-        return -1;
+        exit(-1);
     }
 
     err(libusb_reset_device(dev));
     err(libusb_set_configuration(dev, 1));
     err(libusb_claim_interface(dev, 0));
 
-    loadBiosData();
+    transport = validity90_transport_usb_new(dev);
+}
 
-    puts("");
+void finish_image_dumps() {
+    GError *error = NULL;
 
-    SECStatus status = NSS_NoDB_Init(".");
-    if (status != SECSuccess) {
-        puts("failed to init nss");
+    if (image_dumper == NULL) {
+        return;
+    }
+    if (!validity90_image_dumper_free(image_dumper, &error)) {
+        printf("Image dump failed: %s\n", error->message);
+        g_clear_error(&error);
+    }
+    image_dumper = NULL;
+}
+
+int main(int argc, char *argv[]) {
+    gint64 main_started = g_get_monotonic_time();
+
+    puts("Prototype version 15");
+
+    if (!validity90_crypto_init()) {
+        printf("Failed to init %s\n", validity90_crypto_backend());
         return -1;
     }
+    fprintf(stderr, "crypto: %s, %.3f ms\n", validity90_crypto_backend(),
+            (g_get_monotonic_time() - main_started) / 1000.0);
 
-    OpenSSL_add_all_algorithms(); ERR_load_crypto_strings();
+    const char *replay_path = getenv("REPLAY");
 
+    if (replay_path != NULL) {
+        GError *error = NULL;
+
+        printf("Replaying %s\n", replay_path);
+        transport = validity90_transport_replay_new(replay_path, getenv("REPLAY_TIMING") != NULL, &error);
+        if (transport == NULL) {
+            printf("Failed to load the capture: %s\n", error->message);
+            return -1;
+        }
+        // Captures come from other machines, RSP6 is decrypted with the VirtualBox serial
+    } else {
+        open_device();
+        loadBiosData();
+    }
+
+    puts("");
+
+    image_dump_name = getenv("IMAGE_DUMP");
+    if (image_dump_name != NULL) {
+        image_dumper = validity90_image_dumper_new(Z_BEST_SPEED);
+    }
+
+    gint64 started = g_get_monotonic_time();
+    guint64 started_bytes = transport_bytes;
     init();
+    print_timing("init", started, started_bytes);
+
+    started = g_get_monotonic_time();
+    started_bytes = transport_bytes;
     handshake();
+    print_timing("handshake", started, started_bytes);
+    print_ready(main_started);
 
-    printf("IN: "); print_hex_string(key_block + 0x60, 0x20);
-    printf("OUT: "); print_hex_string(key_block + 0x40, 0x20);
+    gsize key_block_len;
+    const guint8 *key_block = validity90_handshake_get_key_block(tls_handshake, &key_block_len);
+    printf("IN: "); print_hex_string((byte*) key_block + 0x60, 0x20);
+    printf("OUT: "); print_hex_string((byte*) key_block + 0x40, 0x20);
 
     fflush(stdout);
 
+    const char *daemon_path = getenv("DAEMON");
+    if (daemon_path != NULL) {
+        serve(daemon_path);
+        finish_image_dumps();
+        return 0;
+    }
+
     while(true) {
         puts("");
         puts("1 - Scan fingerprint");
@@ -1227,10 +1064,14 @@ int main(int argc, char *argv[]) {
         scanf("%s", x);
 
         if (x[0] == '1') {
+            started = g_get_monotonic_time();
+            started_bytes = transport_bytes;
             fingerprint();
+            print_timing("fingerprint", started, started_bytes);
         } else if (x[0] == '2') {
             led_test();
         } else if (x[0] == '0') {
+            finish_image_dumps();
             exit(EXIT_SUCCESS);
         }
     }
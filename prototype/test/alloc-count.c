@@ -0,0 +1,61 @@
+/*
+ * Validity90 tests allocation counter
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+
+#include "test/alloc-count.h"
+
+// glibc entry points, the wrappers below shadow the public names
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static __thread gboolean counting = FALSE;
+static __thread gsize allocations = 0;
+
+void *malloc(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void alloc_count_start(void) {
+    allocations = 0;
+    counting = TRUE;
+}
+
+gsize alloc_count_stop(void) {
+    counting = FALSE;
+    return allocations;
+}
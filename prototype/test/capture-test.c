@@ -0,0 +1,279 @@
+/*
+ * Validity90 tests for capture decoding
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "validity90/capture.h"
+#include "validity90/tls.h"
+#include "validity90/utils.h"
+#include "dump10.h"
+
+typedef struct capture_test_message {
+    gboolean in;
+    validity90_capture_kind kind;
+    guint8 type;
+    GByteArray *data;
+} capture_test_message;
+
+static void capture_test_message_clear(gpointer data) {
+    capture_test_message *message = data;
+
+    g_byte_array_free(message->data, TRUE);
+}
+
+static GArray *capture_test_messages_new(void) {
+    GArray *messages = g_array_new(FALSE, FALSE, sizeof(capture_test_message));
+
+    g_array_set_clear_func(messages, capture_test_message_clear);
+    return messages;
+}
+
+static void capture_test_collect_cb(const validity90_capture_message *message, gpointer user_data) {
+    GArray *messages = user_data;
+    capture_test_message copy = {
+        .in = message->in,
+        .kind = message->kind,
+        .type = message->type,
+        .data = g_byte_array_new(),
+    };
+
+    g_byte_array_append(copy.data, message->data, message->data_len);
+    g_array_append_val(messages, copy);
+}
+
+static void capture_test_assert_message(GArray *messages, guint index, gboolean in, validity90_capture_kind kind,
+                                        guint8 type, gsize len) {
+    g_assert_cmpuint(index, <, messages->len);
+
+    capture_test_message *message = &g_array_index(messages, capture_test_message, index);
+    g_assert_cmpint(message->in, ==, in);
+    g_assert_cmpint(message->kind, ==, kind);
+    g_assert_cmphex(message->type, ==, type);
+    g_assert_cmpuint(message->data->len, ==, len);
+}
+
+// @TEST_DEF /capture/dump
+void CAPTURE_DUMP() {
+    if (!g_file_test(DUMP10_PATH, G_FILE_TEST_EXISTS)) {
+        g_test_skip("no " DUMP10_PATH);
+        return;
+    }
+
+    GArray *messages = capture_test_messages_new();
+    validity90_capture_decoder *decoder = validity90_capture_decoder_new(capture_test_collect_cb, messages);
+    validity90_capture_stats stats;
+    GError *error = NULL;
+
+    g_assert(validity90_capture_decode_file(decoder, DUMP10_PATH, &stats, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(stats.messages, ==, messages->len);
+    g_assert_cmpuint(stats.decrypted, ==, 0);
+
+    // Plain init, responses split in 64 byte completions come out whole
+    capture_test_assert_message(messages, 0, FALSE, VALIDITY90_CAPTURE_PLAIN, 0, 1);
+    capture_test_assert_message(messages, 1, TRUE, VALIDITY90_CAPTURE_PLAIN, 0, 38);
+    capture_test_assert_message(messages, 3, TRUE, VALIDITY90_CAPTURE_PLAIN, 0, 68);
+    capture_test_assert_message(messages, 13, TRUE, VALIDITY90_CAPTURE_PLAIN, 0, 4104);
+
+    // Client hello without the 44 00 00 00 prefix, then the server hello
+    capture_test_assert_message(messages, 14, FALSE, VALIDITY90_CAPTURE_TLS, 0x16, 67);
+    capture_test_assert_message(messages, 15, TRUE, VALIDITY90_CAPTURE_TLS, 0x16, 61);
+
+    // Certificate, change cipher spec and the encrypted finished share one transfer
+    capture_test_assert_message(messages, 16, FALSE, VALIDITY90_CAPTURE_TLS, 0x16, 341);
+    capture_test_assert_message(messages, 17, FALSE, VALIDITY90_CAPTURE_TLS, 0x14, 1);
+    capture_test_assert_message(messages, 18, FALSE, VALIDITY90_CAPTURE_ENCRYPTED, 0x16, 80);
+    capture_test_assert_message(messages, 19, TRUE, VALIDITY90_CAPTURE_TLS, 0x14, 1);
+    capture_test_assert_message(messages, 20, TRUE, VALIDITY90_CAPTURE_ENCRYPTED, 0x16, 80);
+
+    // No keys for this one, application data stays encrypted
+    capture_test_assert_message(messages, 21, FALSE, VALIDITY90_CAPTURE_ENCRYPTED, 0x17, 64);
+    capture_test_assert_message(messages, 22, TRUE, VALIDITY90_CAPTURE_ENCRYPTED, 0x17, 64);
+    g_assert_cmpuint(stats.encrypted, ==, 16);
+
+    validity90_capture_decoder_free(decoder);
+    g_array_free(messages, TRUE);
+
+    decoder = validity90_capture_decoder_new(NULL, NULL);
+    g_assert(!validity90_capture_decode_file(decoder, "../dumps/missing.pcapng", NULL, &error));
+    g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+    g_clear_error(&error);
+    validity90_capture_decoder_free(decoder);
+}
+
+static void capture_test_swap_keys(const guint8 *key_block, guint8 *swapped) {
+    memcpy(swapped, key_block + VALIDITY90_TLS_MAC_IN_OFFSET, VALIDITY90_TLS_MAC_SIZE);
+    memcpy(swapped + VALIDITY90_TLS_MAC_IN_OFFSET, key_block, VALIDITY90_TLS_MAC_SIZE);
+    memcpy(swapped + VALIDITY90_TLS_KEY_OUT_OFFSET, key_block + VALIDITY90_TLS_KEY_IN_OFFSET, 0x20);
+    memcpy(swapped + VALIDITY90_TLS_KEY_IN_OFFSET, key_block + VALIDITY90_TLS_KEY_OUT_OFFSET, 0x20);
+}
+
+static void capture_test_feed_hello(validity90_capture_decoder *decoder, gboolean in, const guint8 *random) {
+    guint8 record[5 + 0x26] = { 0x16, 0x03, 0x03, 0x00, 0x26, in ? 0x02 : 0x01, 0x00, 0x00, 0x22, 0x03, 0x03 };
+    guint8 packet[4 + sizeof(record)] = { 0x44, 0x00, 0x00, 0x00 };
+    const guint8 ccs[] = { 0x14, 0x03, 0x03, 0x00, 0x01, 0x01 };
+
+    memcpy(record + 11, random, 0x20);
+    memcpy(packet + 4, record, sizeof(record));
+    if (in) {
+        validity90_capture_decoder_feed(decoder, 0, TRUE, record, sizeof(record));
+    } else {
+        validity90_capture_decoder_feed(decoder, 0, FALSE, packet, sizeof(packet));
+    }
+    validity90_capture_decoder_feed(decoder, 0, in, ccs, sizeof(ccs));
+}
+
+static void capture_test_session(validity90_capture_decoder *decoder, const guint8 *key_block) {
+    guint8 swapped[VALIDITY90_TLS_KEY_BLOCK_SIZE];
+    guint8 command[0x13], response[0x105];
+    GByteArray *out = g_byte_array_new(), *in = g_byte_array_new();
+
+    capture_test_swap_keys(key_block, swapped);
+    validity90_tls_session *host = validity90_tls_session_new(key_block, VALIDITY90_TLS_KEY_BLOCK_SIZE, NULL);
+    validity90_tls_session *sensor = validity90_tls_session_new(swapped, sizeof(swapped), NULL);
+
+    for (int i = 0; i < sizeof(command); i++) {
+        command[i] = i;
+    }
+    for (int i = 0; i < sizeof(response); i++) {
+        response[i] = 0xff - i;
+    }
+
+    g_assert(validity90_tls_session_seal_record(host, 0x17, command, sizeof(command), out, NULL));
+    g_assert(validity90_tls_session_seal_record(sensor, 0x17, response, sizeof(response), in, NULL));
+
+    validity90_capture_decoder_feed(decoder, 0, FALSE, out->data, out->len);
+    // The response comes in max packet size completions
+    for (gsize pos = 0; pos < in->len; pos += 0x40) {
+        validity90_capture_decoder_feed(decoder, 0, TRUE, in->data + pos, MIN(0x40, in->len - pos));
+    }
+
+    validity90_tls_session_free(host);
+    validity90_tls_session_free(sensor);
+    g_byte_array_free(out, TRUE);
+    g_byte_array_free(in, TRUE);
+}
+
+// @TEST_DEF /capture/decrypt
+void CAPTURE_DECRYPT() {
+    guint8 master_secret[0x30], client_random[0x20], server_random[0x20], seed[0x40];
+    guint8 key_block[0x120];
+
+    for (int i = 0; i < sizeof(master_secret); i++) {
+        master_secret[i] = i * 7;
+    }
+    memset(client_random, 0xc1, sizeof(client_random));
+    memset(server_random, 0x5e, sizeof(server_random));
+    memcpy(seed, client_random, 0x20);
+    memcpy(seed + 0x20, server_random, 0x20);
+    g_assert(validity90_tls_prf(master_secret, sizeof(master_secret), "key expansion", seed, sizeof(seed),
+                                sizeof(key_block), key_block, NULL));
+
+    // Key block given directly
+    GArray *messages = capture_test_messages_new();
+    validity90_capture_decoder *decoder = validity90_capture_decoder_new(capture_test_collect_cb, messages);
+    GError *error = NULL;
+
+    g_assert(validity90_capture_decoder_set_key_block(decoder, key_block, sizeof(key_block), &error));
+    g_assert_no_error(error);
+    capture_test_feed_hello(decoder, FALSE, client_random);
+    capture_test_feed_hello(decoder, TRUE, server_random);
+    capture_test_session(decoder, key_block);
+    validity90_capture_decoder_flush(decoder);
+
+    g_assert_cmpuint(messages->len, ==, 6);
+    capture_test_assert_message(messages, 0, FALSE, VALIDITY90_CAPTURE_TLS, 0x16, 0x26);
+    capture_test_assert_message(messages, 4, FALSE, VALIDITY90_CAPTURE_DECRYPTED, 0x17, 0x13);
+    capture_test_assert_message(messages, 5, TRUE, VALIDITY90_CAPTURE_DECRYPTED, 0x17, 0x105);
+    g_assert_cmpuint(g_array_index(messages, capture_test_message, 4).data->data[0x12], ==, 0x12);
+    g_assert_cmpuint(g_array_index(messages, capture_test_message, 5).data->data[0x104], ==, 0xfb);
+
+    validity90_capture_decoder_free(decoder);
+    g_array_set_size(messages, 0);
+
+    // Expanded from the master secret and the captured randoms
+    decoder = validity90_capture_decoder_new(capture_test_collect_cb, messages);
+    validity90_capture_decoder_set_master_secret(decoder, master_secret, sizeof(master_secret));
+    capture_test_feed_hello(decoder, FALSE, client_random);
+    capture_test_feed_hello(decoder, TRUE, server_random);
+    capture_test_session(decoder, key_block);
+    validity90_capture_decoder_flush(decoder);
+
+    capture_test_assert_message(messages, 4, FALSE, VALIDITY90_CAPTURE_DECRYPTED, 0x17, 0x13);
+    capture_test_assert_message(messages, 5, TRUE, VALIDITY90_CAPTURE_DECRYPTED, 0x17, 0x105);
+
+    validity90_capture_decoder_free(decoder);
+    g_array_set_size(messages, 0);
+
+    // Wrong keys fail the MAC, the record is passed on as it is
+    key_block[VALIDITY90_TLS_MAC_IN_OFFSET] ^= 0x01;
+    decoder = validity90_capture_decoder_new(capture_test_collect_cb, messages);
+    g_assert(validity90_capture_decoder_set_key_block(decoder, key_block, sizeof(key_block), NULL));
+    key_block[VALIDITY90_TLS_MAC_IN_OFFSET] ^= 0x01;
+    capture_test_feed_hello(decoder, FALSE, client_random);
+    capture_test_feed_hello(decoder, TRUE, server_random);
+    capture_test_session(decoder, key_block);
+
+    capture_test_assert_message(messages, 4, FALSE, VALIDITY90_CAPTURE_DECRYPTED, 0x17, 0x13);
+    capture_test_assert_message(messages, 5, TRUE, VALIDITY90_CAPTURE_ENCRYPTED, 0x17, 0x140);
+
+    validity90_capture_decoder_free(decoder);
+    g_array_free(messages, TRUE);
+}
+
+// @TEST_DEF /capture/perf
+void CAPTURE_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    const char *dumps[] = {
+        DUMP10_PATH, "../dumps/dump11.pcapng", "../dumps/dumpF1.pcapng",
+        "../dumps/dumpF1p.pcapng", "../dumps/dupm12.pcapng", "../dumps/dupm13.pcapng",
+    };
+    guint64 total = 0;
+    gdouble total_time = 0;
+
+    for (int i = 0; i < G_N_ELEMENTS(dumps); i++) {
+        validity90_capture_stats stats = { 0 };
+        GStatBuf st;
+
+        if (g_stat(dumps[i], &st) != 0) {
+            continue;
+        }
+
+        validity90_capture_decoder *decoder = validity90_capture_decoder_new(NULL, NULL);
+        g_test_timer_start();
+        // Traces of other sensors may have nothing to decode
+        validity90_capture_decode_file(decoder, dumps[i], &stats, NULL);
+        gdouble time = g_test_timer_elapsed();
+        validity90_capture_decoder_free(decoder);
+
+        g_test_message("%s: %lu bytes, %u messages, %.1f MB/s", dumps[i], (gulong) st.st_size, stats.messages,
+                       st.st_size / time / 1e6);
+        total += st.st_size;
+        total_time += time;
+    }
+
+    if (total_time > 0) {
+        g_test_maximized_result(total / total_time / 1e6, "capture decoding: %.1f MB/s", total / total_time / 1e6);
+    }
+}
@@ -0,0 +1,172 @@
+/*
+ * Validity90 tests for the crypto backend
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "validity90/crypto.h"
+
+// Known answers, the same for every backend
+
+// FIPS 180-2, "abc"
+static const guint8 crypto_test_sha256_abc[] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+};
+
+// RFC 4231 test case 2
+static const guint8 crypto_test_hmac[] = {
+    0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43,
+};
+
+// SP 800-38A F.2.5, the first two blocks
+static const guint8 crypto_test_aes_key[] = {
+    0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+    0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4,
+};
+static const guint8 crypto_test_aes_iv[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
+static const guint8 crypto_test_aes_plain[] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+};
+static const guint8 crypto_test_aes_cipher[] = {
+    0xf5, 0x8c, 0x4c, 0x04, 0xd6, 0xe5, 0xf1, 0xba, 0x77, 0x9e, 0xab, 0xfb, 0x5f, 0x7b, 0xfb, 0xd6,
+    0x9c, 0xfc, 0x4e, 0x96, 0x7e, 0xdb, 0x80, 0x8d, 0x67, 0x9f, 0x77, 0x7b, 0xc6, 0x70, 0x2c, 0x7d,
+};
+
+// @TEST_DEF /crypto/sha256
+void CRYPTO_SHA256() {
+    const validity90_crypto_buffer parts[] = { { (const guint8*) "a", 1 }, { (const guint8*) "bc", 2 } };
+    guint8 out[VALIDITY90_SHA256_SIZE];
+
+    validity90_sha256_buffer((const guint8*) "abc", 3, out);
+    g_assert_cmpmem(out, sizeof(out), crypto_test_sha256_abc, sizeof(crypto_test_sha256_abc));
+
+    memset(out, 0, sizeof(out));
+    validity90_sha256_buffers(parts, G_N_ELEMENTS(parts), out);
+    g_assert_cmpmem(out, sizeof(out), crypto_test_sha256_abc, sizeof(crypto_test_sha256_abc));
+
+    // A peek leaves the running hash alone
+    validity90_sha256 *sha = validity90_sha256_new();
+    g_assert(sha != NULL);
+    validity90_sha256_write(sha, (const guint8*) "ab", 2);
+    g_assert(validity90_sha256_peek(sha, out));
+    validity90_sha256_write(sha, (const guint8*) "c", 1);
+    g_assert(validity90_sha256_peek(sha, out));
+    g_assert_cmpmem(out, sizeof(out), crypto_test_sha256_abc, sizeof(crypto_test_sha256_abc));
+
+    memset(out, 0, sizeof(out));
+    validity90_sha256_reset(sha);
+    validity90_sha256_write(sha, (const guint8*) "abc", 3);
+    validity90_sha256_final(sha, out);
+    g_assert_cmpmem(out, sizeof(out), crypto_test_sha256_abc, sizeof(crypto_test_sha256_abc));
+    validity90_sha256_free(sha);
+}
+
+// @TEST_DEF /crypto/hmac
+void CRYPTO_HMAC() {
+    const gchar *data = "what do ya want for nothing?";
+    guint8 out[VALIDITY90_SHA256_SIZE];
+
+    validity90_hmac *hmac = validity90_hmac_new((const guint8*) "Jefe", 4);
+    g_assert(hmac != NULL);
+
+    // Twice, the second time from the keyed state after a reset
+    for (int i = 0; i < 2; i++) {
+        memset(out, 0, sizeof(out));
+        validity90_hmac_reset(hmac);
+        validity90_hmac_write(hmac, (const guint8*) data, 10);
+        validity90_hmac_write(hmac, (const guint8*) data + 10, strlen(data) - 10);
+        validity90_hmac_final(hmac, out);
+        g_assert_cmpmem(out, sizeof(out), crypto_test_hmac, sizeof(crypto_test_hmac));
+    }
+
+    validity90_hmac_free(hmac);
+}
+
+// @TEST_DEF /crypto/aes
+void CRYPTO_AES() {
+    guint8 out[sizeof(crypto_test_aes_plain)];
+
+    g_assert(validity90_aes_cbc_new(crypto_test_aes_key, 0x10) == NULL);
+    validity90_aes_cbc *aes = validity90_aes_cbc_new(crypto_test_aes_key, sizeof(crypto_test_aes_key));
+    g_assert(aes != NULL);
+
+    g_assert(validity90_aes_cbc_set_iv(aes, crypto_test_aes_iv));
+    g_assert(validity90_aes_cbc_encrypt(aes, crypto_test_aes_plain, out, sizeof(out)));
+    g_assert_cmpmem(out, sizeof(out), crypto_test_aes_cipher, sizeof(crypto_test_aes_cipher));
+
+    // In place and a block at a time, the chain goes on
+    g_assert(validity90_aes_cbc_set_iv(aes, crypto_test_aes_iv));
+    g_assert(validity90_aes_cbc_decrypt(aes, out, out, 0x10));
+    g_assert(validity90_aes_cbc_decrypt(aes, out + 0x10, out + 0x10, 0x10));
+    g_assert_cmpmem(out, sizeof(out), crypto_test_aes_plain, sizeof(crypto_test_aes_plain));
+
+    // Second block alone with the first as its IV
+    g_assert(validity90_aes_cbc_set_iv(aes, crypto_test_aes_cipher));
+    g_assert(validity90_aes_cbc_decrypt(aes, crypto_test_aes_cipher + 0x10, out, 0x10));
+    g_assert_cmpmem(out, 0x10, crypto_test_aes_plain + 0x10, 0x10);
+
+    g_assert(validity90_aes_cbc_set_iv(aes, crypto_test_aes_iv));
+    g_assert(!validity90_aes_cbc_encrypt(aes, crypto_test_aes_plain, out, 0x0f));
+
+    validity90_aes_cbc_free(aes);
+}
+
+// @TEST_DEF /crypto/ec
+void CRYPTO_EC() {
+    guint8 a[VALIDITY90_EC_KEY_SIZE], b[VALIDITY90_EC_KEY_SIZE];
+    guint8 secret_a[VALIDITY90_EC_SCALAR_SIZE], secret_b[VALIDITY90_EC_SCALAR_SIZE];
+    guint8 r[VALIDITY90_EC_SCALAR_SIZE], s[VALIDITY90_EC_SCALAR_SIZE];
+    guint8 hash[VALIDITY90_SHA256_SIZE];
+
+    g_assert(validity90_ec_p256_generate(a));
+    g_assert(validity90_ec_p256_generate(b));
+    g_assert(memcmp(a, b, sizeof(a)) != 0);
+
+    g_assert(validity90_ecdh_p256(a + VALIDITY90_EC_POINT_SIZE, b, secret_a));
+    g_assert(validity90_ecdh_p256(b + VALIDITY90_EC_POINT_SIZE, a, secret_b));
+    g_assert_cmpmem(secret_a, sizeof(secret_a), secret_b, sizeof(secret_b));
+
+    // Not on the curve
+    memcpy(b, a, sizeof(b));
+    b[VALIDITY90_EC_POINT_SIZE - 1] ^= 1;
+    g_assert(!validity90_ecdh_p256(a + VALIDITY90_EC_POINT_SIZE, b, secret_b));
+
+    validity90_sha256_buffer((const guint8*) "abc", 3, hash);
+    validity90_ecdsa_key *key = validity90_ecdsa_key_new(a);
+    g_assert(key != NULL);
+    for (int i = 0; i < 8; i++) {
+        g_assert(validity90_ecdsa_sign(key, hash, r, s));
+        g_assert(validity90_ecdsa_verify(a, hash, r, s));
+
+        // n - s verifies too, and its top bit is the other one
+        guint8 top = s[0] & 0x80;
+        g_assert(validity90_ecdsa_negate_s(key, s));
+        g_assert(validity90_ecdsa_verify(a, hash, r, s));
+        g_assert_cmpint(s[0] & 0x80, !=, top);
+    }
+    validity90_ecdsa_key_free(key);
+
+    hash[0] ^= 1;
+    g_assert(!validity90_ecdsa_verify(a, hash, r, s));
+}
@@ -0,0 +1,331 @@
+/*
+ * Validity90 tests for the reader daemon
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "validity90/daemon.h"
+#include "dump10.h"
+
+typedef struct daemon_test_client {
+    int fd;
+    GString *in;
+} daemon_test_client;
+
+static gchar *daemon_test_path(void) {
+    GError *error = NULL;
+
+    gchar *dir = g_dir_make_tmp("validity90-daemon-XXXXXX", &error);
+    g_assert_no_error(error);
+    gchar *path = g_build_filename(dir, "socket", NULL);
+    g_free(dir);
+
+    return path;
+}
+
+static void daemon_test_path_free(gchar *path) {
+    gchar *dir = g_path_get_dirname(path);
+
+    g_assert(!g_file_test(path, G_FILE_TEST_EXISTS));
+    g_rmdir(dir);
+    g_free(dir);
+    g_free(path);
+}
+
+static void daemon_test_connect(daemon_test_client *client, const gchar *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    strcpy(addr.sun_path, path);
+    client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    g_assert_cmpint(client->fd, >=, 0);
+    g_assert_cmpint(connect(client->fd, (struct sockaddr*) &addr, sizeof(addr)), ==, 0);
+    fcntl(client->fd, F_SETFL, O_NONBLOCK);
+    client->in = g_string_new(NULL);
+}
+
+static void daemon_test_close(daemon_test_client *client) {
+    close(client->fd);
+    g_string_free(client->in, TRUE);
+}
+
+static void daemon_test_send(daemon_test_client *client, const gchar *requests) {
+    g_assert_cmpint(send(client->fd, requests, strlen(requests), MSG_NOSIGNAL), ==, strlen(requests));
+}
+
+// Runs the daemon until the client has a reply, FALSE when the daemon hung up instead
+static gboolean daemon_test_reply(validity90_daemon *daemon, daemon_test_client *client, gchar **reply) {
+    GError *error = NULL;
+    gchar buff[0x400];
+
+    for (int i = 0; i < 100; i++) {
+        gchar *newline = memchr(client->in->str, '\n', client->in->len);
+        if (newline != NULL) {
+            *reply = g_strndup(client->in->str, newline - client->in->str);
+            g_string_erase(client->in, 0, newline - client->in->str + 1);
+            return TRUE;
+        }
+
+        ssize_t len = recv(client->fd, buff, sizeof(buff), 0);
+        if (len == 0) {
+            return FALSE;
+        }
+        if (len > 0) {
+            g_string_append_len(client->in, buff, len);
+            continue;
+        }
+        g_assert_cmpint(errno, ==, EAGAIN);
+        g_assert(validity90_daemon_iterate(daemon, 10, &error));
+        g_assert_no_error(error);
+    }
+    g_assert_not_reached();
+}
+
+static void daemon_test_expect(validity90_daemon *daemon, daemon_test_client *client, const gchar *expected) {
+    gchar *reply = NULL;
+
+    g_assert(daemon_test_reply(daemon, client, &reply));
+    g_assert_cmpstr(reply, ==, expected);
+    g_free(reply);
+}
+
+static gboolean daemon_test_echo_cb(validity90_daemon *daemon, const gchar *args, GString *reply,
+                                    gpointer user_data, GError **error) {
+    g_string_append(reply, args);
+    return TRUE;
+}
+
+static gboolean daemon_test_fail_cb(validity90_daemon *daemon, const gchar *args, GString *reply,
+                                    gpointer user_data, GError **error) {
+    g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_REQUEST, "Broken\nsensor");
+    return FALSE;
+}
+
+// @TEST_DEF /daemon/requests
+void DAEMON_REQUESTS() {
+    daemon_test_client a, b, c;
+    GError *error = NULL;
+    gchar *path = daemon_test_path();
+    gchar *reply;
+
+    validity90_daemon *daemon = validity90_daemon_new(path, &error);
+    g_assert_no_error(error);
+    validity90_daemon_set_handler(daemon, "echo", daemon_test_echo_cb, NULL);
+    validity90_daemon_set_handler(daemon, "fail", daemon_test_fail_cb, NULL);
+
+    daemon_test_connect(&a, path);
+    daemon_test_connect(&b, path);
+    g_assert(validity90_daemon_iterate(daemon, 10, &error));
+
+    // Pipelined, every client gets its own replies in order
+    daemon_test_send(&a, "echo 1\necho  2\nping\nfail\nnope\n");
+    daemon_test_send(&b, "echo b\r\n\n");
+    daemon_test_expect(daemon, &a, "ok 1");
+    daemon_test_expect(daemon, &a, "ok 2");
+    daemon_test_expect(daemon, &a, "ok pong");
+    daemon_test_expect(daemon, &a, "error Broken sensor");
+    daemon_test_expect(daemon, &a, "error Unknown command nope");
+    daemon_test_expect(daemon, &b, "ok b");
+
+    const validity90_daemon_stats *stats = validity90_daemon_get_stats(daemon);
+    g_assert_cmpuint(stats->clients, ==, 2);
+    g_assert_cmpuint(stats->requests, ==, 6);
+    g_assert_cmpuint(stats->failed, ==, 2);
+    g_assert_cmpuint(stats->max_queued, ==, 6);
+
+    // Still answered after the client shut down its side
+    daemon_test_connect(&c, path);
+    daemon_test_send(&c, "echo last\n");
+    shutdown(c.fd, SHUT_WR);
+    daemon_test_expect(daemon, &c, "ok last");
+    g_assert(!daemon_test_reply(daemon, &c, &reply));
+    daemon_test_close(&c);
+
+    gchar line[VALIDITY90_DAEMON_MAX_LINE + 2];
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    daemon_test_send(&b, line);
+    daemon_test_expect(daemon, &b, "error Request too long");
+    g_assert(!daemon_test_reply(daemon, &b, &reply));
+
+    daemon_test_send(&a, "echo still here\n");
+    daemon_test_expect(daemon, &a, "ok still here");
+
+    // One request per iteration, the clients are looked at in between
+    daemon_test_send(&a, "ping\nping\n");
+    g_assert(validity90_daemon_iterate(daemon, 10, &error));
+    g_assert_cmpuint(stats->requests, ==, 9);
+    daemon_test_expect(daemon, &a, "ok pong");
+    daemon_test_expect(daemon, &a, "ok pong");
+    g_assert_cmpuint(stats->requests, ==, 10);
+
+    validity90_daemon_free(daemon);
+    daemon_test_close(&a);
+    daemon_test_close(&b);
+    daemon_test_path_free(path);
+}
+
+// @TEST_DEF /daemon/socket
+void DAEMON_SOCKET() {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    daemon_test_client a;
+    GError *error = NULL;
+    gchar *path = daemon_test_path();
+    GStatBuf st;
+
+    validity90_daemon *daemon = validity90_daemon_new(path, &error);
+    g_assert_no_error(error);
+    g_assert_cmpint(g_stat(path, &st), ==, 0);
+    g_assert_cmpint(st.st_mode & 0777, ==, 0600);
+
+    // A running daemon keeps its socket
+    g_assert(validity90_daemon_new(path, &error) == NULL);
+    g_assert_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_RUNNING);
+    g_clear_error(&error);
+    daemon_test_connect(&a, path);
+    daemon_test_send(&a, "ping\n");
+    daemon_test_expect(daemon, &a, "ok pong");
+    daemon_test_close(&a);
+    validity90_daemon_free(daemon);
+
+    // One that is gone left its socket behind
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    g_assert_cmpint(bind(fd, (struct sockaddr*) &addr, sizeof(addr)), ==, 0);
+    close(fd);
+    g_assert(g_file_test(path, G_FILE_TEST_EXISTS));
+
+    daemon = validity90_daemon_new(path, &error);
+    g_assert_no_error(error);
+    daemon_test_connect(&a, path);
+    daemon_test_send(&a, "ping\n");
+    daemon_test_expect(daemon, &a, "ok pong");
+    daemon_test_close(&a);
+    validity90_daemon_free(daemon);
+
+    daemon_test_path_free(path);
+}
+
+// The sensor behind the send handler
+typedef struct daemon_test_sensor {
+    validity90_transport *transport;
+    validity90_tls_session *session;
+    GByteArray *record;
+} daemon_test_sensor;
+
+// Sends the hex command of args on the session, replies with the opened response in hex
+static gboolean daemon_test_send_cb(validity90_daemon *daemon, const gchar *args, GString *reply,
+                                    gpointer user_data, GError **error) {
+    daemon_test_sensor *sensor = user_data;
+    GByteArray *cmd = g_byte_array_new();
+    guint8 *rsp;
+    gsize rsp_len, len;
+
+    for (; args[0] != '\0' && args[1] != '\0'; args += 2) {
+        guint8 byte = (g_ascii_xdigit_value(args[0]) << 4) | g_ascii_xdigit_value(args[1]);
+        g_byte_array_append(cmd, &byte, 1);
+    }
+
+    g_byte_array_set_size(sensor->record, 0);
+    gboolean result = validity90_tls_session_seal_record(sensor->session, 0x17, cmd->data, cmd->len,
+                                                         sensor->record, error) &&
+                      validity90_transport_write(sensor->transport, 0x01, sensor->record->data, sensor->record->len,
+                                                 1000, error);
+    if (result) {
+        g_byte_array_set_size(sensor->record, 0x10000);
+        result = validity90_transport_read(sensor->transport, 0x81, sensor->record->data, sensor->record->len, &len,
+                                           1000, error) &&
+                 validity90_tls_session_open_record(sensor->session, sensor->record->data, len, &rsp, &rsp_len,
+                                                    error);
+    }
+    for (gsize i = 0; result && i < rsp_len; i++) {
+        g_string_append_printf(reply, "%02x", rsp[i]);
+    }
+    g_byte_array_free(cmd, TRUE);
+
+    return result;
+}
+
+// @TEST_DEF /daemon/replay
+void DAEMON_REPLAY() {
+    daemon_test_sensor sensor;
+    daemon_test_client a, b;
+    GError *error = NULL;
+    gchar *reply;
+
+    // The handshake is followed by the first commands of a scan
+    sensor.transport = dump10_open_session(FALSE, &sensor.session, NULL);
+    if (sensor.transport == NULL) {
+        return;
+    }
+    sensor.record = g_byte_array_new();
+    gchar *path = daemon_test_path();
+
+    validity90_daemon *daemon = validity90_daemon_new(path, &error);
+    g_assert_no_error(error);
+    validity90_daemon_set_handler(daemon, "send", daemon_test_send_cb, &sensor);
+
+    daemon_test_connect(&a, path);
+    daemon_test_connect(&b, path);
+    g_assert(validity90_daemon_iterate(daemon, 10, &error));
+
+    // Two clients on one session, the captured responses only open in this order
+    daemon_test_send(&a, "send 085c2000800700000004\nsend 078020008004\n");
+    daemon_test_send(&b, "send 75\nsend 75\n");
+    daemon_test_expect(daemon, &a, "ok 0000");
+    daemon_test_expect(daemon, &a, "ok 000002000000");
+    daemon_test_expect(daemon, &b, "ok 00000000000002007100");
+    daemon_test_expect(daemon, &b, "ok 00000000000002007100");
+
+    daemon_test_send(&b, "send 75\nsend 4302\n");
+    daemon_test_expect(daemon, &b, "ok 00000000000002007100");
+    g_assert(daemon_test_reply(daemon, &b, &reply));
+    g_assert(g_str_has_prefix(reply, "ok 000001000000060098c97156"));
+    g_assert_cmpuint(strlen(reply), ==, 3 + 84 * 2);
+    g_free(reply);
+
+    daemon_test_send(&a, "send 4302\n");
+    g_assert(daemon_test_reply(daemon, &a, &reply));
+    g_assert(g_str_has_prefix(reply, "ok 000001000000060098c97156"));
+    g_free(reply);
+
+    // Past the end of the capture the request fails, the daemon keeps serving
+    daemon_test_send(&a, "send 4302\nping\n");
+    g_assert(daemon_test_reply(daemon, &a, &reply));
+    g_assert(g_str_has_prefix(reply, "error "));
+    g_free(reply);
+    daemon_test_expect(daemon, &a, "ok pong");
+
+    const validity90_daemon_stats *stats = validity90_daemon_get_stats(daemon);
+    g_assert_cmpuint(stats->requests, ==, 9);
+    g_assert_cmpuint(stats->failed, ==, 1);
+
+    daemon_test_close(&a);
+    daemon_test_close(&b);
+    validity90_daemon_free(daemon);
+    g_byte_array_free(sensor.record, TRUE);
+    validity90_tls_session_free(sensor.session);
+    validity90_transport_free(sensor.transport);
+    daemon_test_path_free(path);
+}
@@ -0,0 +1,55 @@
+/*
+ * Validity90 tests dump10 keys and replay
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "test/dump10.h"
+
+static guint8 dump10_certificate[0xb8];
+
+const validity90_handshake_keys dump10_keys = {
+    .ecdh_key = dump10_ecdh_key,
+    .server_key = dump10_server_key,
+    .ecdsa_key = dump10_ecdh_key,
+    .certificate = dump10_certificate,
+    .certificate_len = sizeof(dump10_certificate),
+};
+
+validity90_transport *dump10_open_session(gboolean timing, validity90_tls_session **session,
+                                          validity90_handshake **handshake) {
+    GError *error = NULL;
+
+    if (!g_file_test(DUMP10_PATH, G_FILE_TEST_EXISTS)) {
+        g_test_skip("no " DUMP10_PATH);
+        return NULL;
+    }
+
+    validity90_transport *transport = validity90_transport_replay_new(DUMP10_PATH, timing, &error);
+    g_assert_no_error(error);
+    validity90_handshake *opened = validity90_handshake_new(&dump10_keys, dump10_client_random);
+    g_assert(validity90_handshake_run(opened, transport, &error));
+    g_assert_no_error(error);
+    *session = validity90_handshake_steal_session(opened);
+
+    if (handshake != NULL) {
+        *handshake = opened;
+    } else {
+        validity90_handshake_free(opened);
+    }
+
+    return transport;
+}
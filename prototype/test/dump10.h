@@ -0,0 +1,61 @@
+/*
+ * Validity90 tests dump10 keys and replay
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef DUMP10_H
+#define DUMP10_H
+
+#include <glib.h>
+
+#include "validity90/handshake.h"
+
+// Init sequence, TLS handshake and scan setup of a 0090 in VirtualBox
+#define DUMP10_PATH "../dumps/dump10.pcapng"
+
+// Client random and ECDH key the prototype used for dump10, and the sensor key from its RSP6
+static const guint8 dump10_client_random[] = {
+    0x95, 0x6c, 0x41, 0xa9, 0x12, 0x86, 0x8a, 0xda, 0x9b, 0xb2, 0x5b, 0xb4, 0xbb, 0xd6, 0x1d, 0xde,
+    0x4f, 0xda, 0x23, 0x2a, 0x74, 0x7b, 0x2a, 0x93, 0xf8, 0xac, 0xc6, 0x69, 0x24, 0x70, 0xc4, 0x2a,
+};
+static const guint8 dump10_ecdh_key[] = {
+    0x1d, 0xd8, 0x36, 0x68, 0xe9, 0xb0, 0x7b, 0x93, 0x12, 0x38, 0x31, 0x23, 0x90, 0xc8, 0x87, 0xca,
+    0xdb, 0x82, 0x27, 0x39, 0xde, 0x7b, 0x43, 0xd2, 0x23, 0xd7, 0xcd, 0xd1, 0x3c, 0x77, 0x0e, 0xd2,
+    0xd1, 0x93, 0x70, 0x02, 0xaf, 0x3b, 0x18, 0x47, 0xc5, 0x30, 0x4c, 0x33, 0x60, 0xcf, 0xbf, 0xc5,
+    0x9b, 0x3c, 0x67, 0xd9, 0x45, 0x06, 0x38, 0xda, 0x92, 0xbe, 0x65, 0xbf, 0x81, 0x8c, 0xaa, 0x7e,
+    0x20, 0x14, 0x3b, 0x7b, 0x62, 0x64, 0x90, 0x07, 0x54, 0x4e, 0x7a, 0x98, 0xf9, 0x81, 0xbe, 0xc1,
+    0xf2, 0x1f, 0x9a, 0x29, 0x65, 0xb6, 0xcc, 0x29, 0x0c, 0x45, 0xd3, 0x87, 0xae, 0xbf, 0xa4, 0xd9,
+};
+static const guint8 dump10_server_key[] = {
+    0x5f, 0x71, 0x17, 0x6f, 0x76, 0x66, 0x55, 0x74, 0xa3, 0x86, 0x53, 0x53, 0x10, 0xf6, 0x98, 0x18,
+    0x6f, 0x42, 0x9b, 0xf0, 0x6e, 0xfa, 0x05, 0x9b, 0x0c, 0x3f, 0x99, 0xbc, 0xfe, 0xb5, 0xd6, 0xce,
+    0x3e, 0x61, 0x55, 0x91, 0xab, 0x00, 0x99, 0xb0, 0x4f, 0x6f, 0x4b, 0x68, 0xac, 0xbd, 0x67, 0x81,
+    0x65, 0xb8, 0x26, 0x75, 0x1d, 0x50, 0xe3, 0x87, 0xd0, 0xcc, 0xfd, 0x49, 0x5f, 0xf4, 0xce, 0xca,
+};
+
+// Handshake keys for dump10, the replayed sensor checks neither certificate nor signature
+extern const validity90_handshake_keys dump10_keys;
+
+/*
+ * Replay of dump10 positioned right after the handshake, its session in
+ * *session. The handshake is kept in *handshake unless that is NULL.
+ * Returns NULL and skips the test when the capture isn't there.
+ */
+validity90_transport *dump10_open_session(gboolean timing, validity90_tls_session **session,
+                                          validity90_handshake **handshake);
+
+#endif // DUMP10_H
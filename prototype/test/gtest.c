@@ -18,8 +18,11 @@
  */
 
 #include <glib.h>
-#include <gcrypt.h>
 #include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "validity90/crypto.h"
 
 // @TEST_INSERT_DEFINITION@
 
@@ -29,16 +32,10 @@ int main(int argc, char *argv[]) {
     g_test_init (&argc, &argv, NULL);
     g_test_bug_base ("http://bugzilla.gnome.org/show_bug.cgi?id=");
 
-    /* Version check should be the very first call because it
-    makes sure that important subsystems are initialized. */
-    if (!gcry_check_version (GCRYPT_VERSION)) {
-        fputs ("libgcrypt version mismatch\n", stderr);
+    if (!validity90_crypto_init()) {
+        fprintf (stderr, "%s initialization failed\n", validity90_crypto_backend());
         exit (2);
     }
-    /* Disable secure memory. */
-    gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
-    /* Tell Libgcrypt that initialization has completed. */
-    gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
 
     // @TEST_INSERT_DECLARATION@
 
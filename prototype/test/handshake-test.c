@@ -0,0 +1,402 @@
+/*
+ * Validity90 tests for the TLS handshake
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "validity90/crypto.h"
+#include "validity90/handshake.h"
+#include "validity90/utils.h"
+#include "dump10.h"
+
+// Sensor side of the handshake, just enough to check what the client sends
+typedef struct handshake_test_sensor {
+    guint8 ecdh_key[0x60];
+    guint8 ecdsa_key[0x60];
+    guint8 certificate[0xb8];
+    guint8 server_random[0x20];
+
+    validity90_sha256 *transcript;
+    guint8 master_secret[0x30];
+    guint8 key_block[0x120];
+    validity90_tls_session *session;
+    GByteArray *out;
+} handshake_test_sensor;
+
+static void handshake_test_sensor_init(handshake_test_sensor *sensor) {
+    memset(sensor, 0, sizeof(handshake_test_sensor));
+    g_assert(validity90_ec_p256_generate(sensor->ecdh_key));
+    g_assert(validity90_ec_p256_generate(sensor->ecdsa_key));
+    for (int i = 0; i < sizeof(sensor->certificate); i++) {
+        sensor->certificate[i] = i * 5 + 3;
+    }
+    g_assert((sensor->transcript = validity90_sha256_new()) != NULL);
+    sensor->out = g_byte_array_new();
+}
+
+static void handshake_test_sensor_clear(handshake_test_sensor *sensor) {
+    validity90_sha256_free(sensor->transcript);
+    validity90_tls_session_free(sensor->session);
+    g_byte_array_free(sensor->out, TRUE);
+}
+
+static validity90_handshake *handshake_test_client_new(handshake_test_sensor *sensor, const guint8 *client_ecdh_key,
+                                                       const guint8 *client_random) {
+    validity90_handshake_keys keys = {
+        .ecdh_key = client_ecdh_key,
+        .server_key = sensor->ecdh_key,
+        .ecdsa_key = sensor->ecdsa_key,
+        .certificate = sensor->certificate,
+        .certificate_len = sizeof(sensor->certificate),
+    };
+
+    return validity90_handshake_new(&keys, client_random);
+}
+
+static void handshake_test_hash(handshake_test_sensor *sensor, guint8 *hash) {
+    g_assert(validity90_sha256_peek(sensor->transcript, hash));
+}
+
+static void handshake_test_verify(handshake_test_sensor *sensor, const guint8 *hash, const guint8 *der) {
+    // Fixed layout: 30 46 02 21 00 r 02 21 00 s
+    g_assert_cmphex(der[0], ==, 0x30);
+    g_assert_cmphex(der[1], ==, 0x46);
+    g_assert_cmphex(der[2], ==, 0x02);
+    g_assert_cmphex(der[3], ==, 0x21);
+    g_assert_cmphex(der[4], ==, 0x00);
+    g_assert_cmphex(der[0x25], ==, 0x02);
+    g_assert_cmphex(der[0x26], ==, 0x21);
+    g_assert_cmphex(der[0x27], ==, 0x00);
+    // Minimal DER, the padding byte is only there for a top bit
+    g_assert_cmphex(der[5] & 0x80, ==, 0x80);
+    g_assert_cmphex(der[0x28] & 0x80, ==, 0x80);
+
+    g_assert(validity90_ecdsa_verify(sensor->ecdsa_key, hash, der + 5, der + 0x28));
+}
+
+static void handshake_test_server_hello(handshake_test_sensor *sensor, const guint8 *client_hello, gsize len) {
+    const guint8 body[] = {
+        0x02, 0x00, 0x00, 0x26, 0x03, 0x03,
+    };
+
+    // 44 00 00 00, record header, ClientHello
+    g_assert_cmpuint(len, ==, 4 + 5 + 0x43);
+    g_assert_cmphex(client_hello[4], ==, 0x16);
+    g_assert_cmphex(client_hello[9], ==, 0x01);
+    validity90_sha256_reset(sensor->transcript);
+    validity90_sha256_write(sensor->transcript, client_hello + 9, 0x43);
+
+    for (int i = 0; i < sizeof(sensor->server_random); i++) {
+        sensor->server_random[i] = g_random_int();
+    }
+
+    g_byte_array_set_size(sensor->out, 0);
+    g_byte_array_append(sensor->out, (const guint8*) "\x16\x03\x03\x00\x2a", 5);
+    g_byte_array_append(sensor->out, body, sizeof(body));
+    g_byte_array_append(sensor->out, sensor->server_random, sizeof(sensor->server_random));
+    g_byte_array_append(sensor->out, (const guint8*) "\x00\xc0\x05\x00", 4);
+    validity90_sha256_write(sensor->transcript, sensor->out->data + 5, sensor->out->len - 5);
+}
+
+// Checks the client flight like the sensor would and answers with its own Finished
+static void handshake_test_server_finished(handshake_test_sensor *sensor, const guint8 *client_random,
+                                           const guint8 *flight, gsize len) {
+    guint8 seed[0x40], hash[0x20], verify_data[0x0c], pre_master_secret[0x20], swapped[0x80];
+    guint8 finished[0x10] = { 0x14, 0x00, 0x00, 0x0c };
+    guint8 point[0x40];
+    guint8 *record, *plain;
+    gsize plain_len;
+
+    g_assert_cmpmem(flight, 4, "\x44\x00\x00\x00", 4);
+    g_assert_cmphex(flight[4], ==, 0x16);
+    gsize body_len = (flight[7] << 8) | flight[8];
+    const guint8 *body = flight + 9;
+
+    // Certificate as stored, then the client ECDH key
+    g_assert_cmpuint(body_len, ==, 0xc4 + 0x45 + 0x4c);
+    g_assert_cmpmem(body, 12, "\x0b\x00\x00\xc0\x00\x00\xb8\x00\x00\xb8\x00\x00", 12);
+    g_assert_cmpmem(body + 12, 0xb8, sensor->certificate, 0xb8);
+    g_assert_cmpmem(body + 0xc4, 5, "\x10\x00\x00\x41\x04", 5);
+    memcpy(point, body + 0xc4 + 5, 0x40);
+
+    validity90_sha256_write(sensor->transcript, body, 0xc4 + 0x45);
+    handshake_test_hash(sensor, hash);
+    g_assert_cmpmem(body + 0x109, 4, "\x0f\x00\x00\x48", 4);
+    handshake_test_verify(sensor, hash, body + 0x109 + 4);
+    validity90_sha256_write(sensor->transcript, body + 0x109, 0x4c);
+
+    // Same pre-master secret from the other side
+    g_assert(validity90_ecdh_p256(sensor->ecdh_key + 0x40, point, pre_master_secret));
+
+    memcpy(seed, client_random, 0x20);
+    memcpy(seed + 0x20, sensor->server_random, 0x20);
+    g_assert(validity90_tls_prf(pre_master_secret, 0x20, "master secret", seed, 0x40, 0x30, sensor->master_secret, NULL));
+    g_assert(validity90_tls_prf(sensor->master_secret, 0x30, "key expansion", seed, 0x40, 0x120, sensor->key_block, NULL));
+
+    // The sensor sends with the client's in keys
+    memcpy(swapped + VALIDITY90_TLS_MAC_OUT_OFFSET, sensor->key_block + VALIDITY90_TLS_MAC_IN_OFFSET, 0x20);
+    memcpy(swapped + VALIDITY90_TLS_MAC_IN_OFFSET, sensor->key_block + VALIDITY90_TLS_MAC_OUT_OFFSET, 0x20);
+    memcpy(swapped + VALIDITY90_TLS_KEY_OUT_OFFSET, sensor->key_block + VALIDITY90_TLS_KEY_IN_OFFSET, 0x20);
+    memcpy(swapped + VALIDITY90_TLS_KEY_IN_OFFSET, sensor->key_block + VALIDITY90_TLS_KEY_OUT_OFFSET, 0x20);
+    validity90_tls_session_free(sensor->session);
+    sensor->session = validity90_tls_session_new(swapped, sizeof(swapped), NULL);
+
+    const guint8 *ccs = body + body_len;
+    g_assert_cmpmem(ccs, 6, "\x14\x03\x03\x00\x01\x01", 6);
+    gsize record_len = len - (ccs + 6 - flight);
+    record = g_memdup(ccs + 6, record_len);
+    g_assert(validity90_tls_session_open_record(sensor->session, record, record_len, &plain, &plain_len, NULL));
+    g_assert_cmpuint(plain_len, ==, 0x10);
+    g_assert_cmpmem(plain, 4, "\x14\x00\x00\x0c", 4);
+
+    handshake_test_hash(sensor, hash);
+    g_assert(validity90_tls_prf(sensor->master_secret, 0x30, "client finished", hash, 0x20, 0x0c, verify_data, NULL));
+    g_assert_cmpmem(plain + 4, 0x0c, verify_data, 0x0c);
+    validity90_sha256_write(sensor->transcript, plain, plain_len);
+    g_free(record);
+
+    handshake_test_hash(sensor, hash);
+    g_assert(validity90_tls_prf(sensor->master_secret, 0x30, "server finished", hash, 0x20, 0x0c, finished + 4, NULL));
+
+    g_byte_array_set_size(sensor->out, 0);
+    g_byte_array_append(sensor->out, (const guint8*) "\x14\x03\x03\x00\x01\x01", 6);
+    g_assert(validity90_tls_session_seal_record(sensor->session, 0x16, finished, sizeof(finished), sensor->out, NULL));
+}
+
+static void handshake_test_complete(handshake_test_sensor *sensor, validity90_handshake *handshake,
+                                    const guint8 *client_random) {
+    const guint8 *out;
+    gsize out_len, key_block_len;
+    GError *error = NULL;
+
+    g_assert_cmpint(validity90_handshake_get_state(handshake), ==, VALIDITY90_HANDSHAKE_START);
+    g_assert(validity90_handshake_step(handshake, NULL, 0, &out, &out_len, &error));
+    g_assert_no_error(error);
+    g_assert_cmpmem(out + 15, 0x20, client_random, 0x20);
+    handshake_test_server_hello(sensor, out, out_len);
+
+    g_assert(validity90_handshake_step(handshake, sensor->out->data, sensor->out->len, &out, &out_len, &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(validity90_handshake_get_state(handshake), ==, VALIDITY90_HANDSHAKE_WAIT_SERVER_FINISHED);
+    handshake_test_server_finished(sensor, client_random, out, out_len);
+
+    g_assert(validity90_handshake_step(handshake, sensor->out->data, sensor->out->len, &out, &out_len, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(out_len, ==, 0);
+    g_assert_cmpint(validity90_handshake_get_state(handshake), ==, VALIDITY90_HANDSHAKE_DONE);
+
+    const guint8 *key_block = validity90_handshake_get_key_block(handshake, &key_block_len);
+    g_assert_cmpmem(key_block, key_block_len, sensor->key_block, sizeof(sensor->key_block));
+}
+
+// @TEST_DEF /handshake/sensor
+void HANDSHAKE_SENSOR() {
+    handshake_test_sensor sensor;
+    guint8 client_ecdh_key[0x60], client_random[0x20];
+    guint8 *plain;
+    gsize plain_len;
+
+    handshake_test_sensor_init(&sensor);
+    g_assert(validity90_ec_p256_generate(client_ecdh_key));
+    memset(client_random, 0x11, sizeof(client_random));
+
+    validity90_handshake *handshake = handshake_test_client_new(&sensor, client_ecdh_key, client_random);
+    handshake_test_complete(&sensor, handshake, client_random);
+
+    // The session is established on both sides
+    validity90_tls_session *session = validity90_handshake_steal_session(handshake);
+    g_assert(session != NULL);
+    g_byte_array_set_size(sensor.out, 0);
+    g_assert(validity90_tls_session_seal_record(sensor.session, 0x17, (const guint8*) "\x01\x02\x03", 3, sensor.out, NULL));
+    g_assert(validity90_tls_session_open_record(session, sensor.out->data, sensor.out->len, &plain, &plain_len, NULL));
+    g_assert_cmpmem(plain, plain_len, "\x01\x02\x03", 3);
+    validity90_tls_session_free(session);
+
+    const validity90_handshake_timing *timing = validity90_handshake_get_timing(handshake);
+    g_assert_cmpint(timing->ecdh_us, >, 0);
+    g_assert_cmpint(timing->sign_us, >, 0);
+    g_assert_cmpint(timing->total_us, >=, timing->ecdh_us + timing->prf_us + timing->sign_us);
+    g_assert_cmpint(timing->io_us, ==, 0);
+
+    // Again on the same keys, as after a resume
+    memset(client_random, 0x22, sizeof(client_random));
+    validity90_handshake_reset(handshake, client_random);
+    handshake_test_complete(&sensor, handshake, client_random);
+
+    validity90_handshake_free(handshake);
+    handshake_test_sensor_clear(&sensor);
+}
+
+// @TEST_DEF /handshake/interleaved
+void HANDSHAKE_INTERLEAVED() {
+    handshake_test_sensor sensor1, sensor2;
+    guint8 client_ecdh_key[0x60], random1[0x20], random2[0x20];
+    const guint8 *out1, *out2;
+    gsize out1_len, out2_len;
+
+    handshake_test_sensor_init(&sensor1);
+    handshake_test_sensor_init(&sensor2);
+    g_assert(validity90_ec_p256_generate(client_ecdh_key));
+    memset(random1, 0x33, sizeof(random1));
+    memset(random2, 0x44, sizeof(random2));
+
+    validity90_handshake *handshake1 = handshake_test_client_new(&sensor1, client_ecdh_key, random1);
+    validity90_handshake *handshake2 = handshake_test_client_new(&sensor2, client_ecdh_key, random2);
+
+    // Nothing is shared between handshakes
+    g_assert(validity90_handshake_step(handshake1, NULL, 0, &out1, &out1_len, NULL));
+    g_assert(validity90_handshake_step(handshake2, NULL, 0, &out2, &out2_len, NULL));
+    handshake_test_server_hello(&sensor1, out1, out1_len);
+    handshake_test_server_hello(&sensor2, out2, out2_len);
+
+    g_assert(validity90_handshake_step(handshake2, sensor2.out->data, sensor2.out->len, &out2, &out2_len, NULL));
+    g_assert(validity90_handshake_step(handshake1, sensor1.out->data, sensor1.out->len, &out1, &out1_len, NULL));
+    handshake_test_server_finished(&sensor1, random1, out1, out1_len);
+    handshake_test_server_finished(&sensor2, random2, out2, out2_len);
+
+    g_assert(validity90_handshake_step(handshake1, sensor1.out->data, sensor1.out->len, &out1, &out1_len, NULL));
+    g_assert(validity90_handshake_step(handshake2, sensor2.out->data, sensor2.out->len, &out2, &out2_len, NULL));
+    g_assert_cmpint(validity90_handshake_get_state(handshake1), ==, VALIDITY90_HANDSHAKE_DONE);
+    g_assert_cmpint(validity90_handshake_get_state(handshake2), ==, VALIDITY90_HANDSHAKE_DONE);
+
+    validity90_handshake_free(handshake1);
+    validity90_handshake_free(handshake2);
+    handshake_test_sensor_clear(&sensor1);
+    handshake_test_sensor_clear(&sensor2);
+}
+
+// @TEST_DEF /handshake/errors
+void HANDSHAKE_ERRORS() {
+    handshake_test_sensor sensor, other;
+    guint8 client_ecdh_key[0x60], client_random[0x20] = { 0 };
+    const guint8 *out;
+    gsize out_len;
+    GError *error = NULL;
+
+    handshake_test_sensor_init(&sensor);
+    handshake_test_sensor_init(&other);
+    g_assert(validity90_ec_p256_generate(client_ecdh_key));
+
+    // Not a ServerHello
+    validity90_handshake *handshake = handshake_test_client_new(&sensor, client_ecdh_key, client_random);
+    g_assert(validity90_handshake_step(handshake, NULL, 0, &out, &out_len, NULL));
+    g_assert(!validity90_handshake_step(handshake, (const guint8*) "\x16\x03\x03\x00\x01\x0e", 6, &out, &out_len, &error));
+    g_assert_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_INVALID_MESSAGE);
+    g_clear_error(&error);
+    g_assert_cmpint(validity90_handshake_get_state(handshake), ==, VALIDITY90_HANDSHAKE_FAILED);
+
+    g_assert(!validity90_handshake_step(handshake, NULL, 0, &out, &out_len, &error));
+    g_assert_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_STATE);
+    g_clear_error(&error);
+
+    // Finished from a sensor with other keys
+    validity90_handshake_reset(handshake, client_random);
+    g_assert(validity90_handshake_step(handshake, NULL, 0, &out, &out_len, NULL));
+    handshake_test_server_hello(&sensor, out, out_len);
+    g_assert(validity90_handshake_step(handshake, sensor.out->data, sensor.out->len, &out, &out_len, NULL));
+
+    validity90_handshake *other_handshake = handshake_test_client_new(&other, client_ecdh_key, client_random);
+    handshake_test_complete(&other, other_handshake, client_random);
+
+    g_assert(!validity90_handshake_step(handshake, other.out->data, other.out->len, &out, &out_len, &error));
+    g_assert_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_BAD_RECORD_MAC);
+    g_clear_error(&error);
+
+    validity90_handshake_free(other_handshake);
+    validity90_handshake_free(handshake);
+    handshake_test_sensor_clear(&sensor);
+    handshake_test_sensor_clear(&other);
+}
+
+// @TEST_DEF /handshake/replay
+void HANDSHAKE_REPLAY() {
+    validity90_tls_session *session;
+    validity90_handshake *handshake;
+
+    // The captured sensor Finished opens with the keys derived here
+    validity90_transport *transport = dump10_open_session(FALSE, &session, &handshake);
+    if (transport == NULL) {
+        return;
+    }
+    g_assert_cmpint(validity90_handshake_get_state(handshake), ==, VALIDITY90_HANDSHAKE_DONE);
+    g_assert_cmpint(validity90_handshake_get_timing(handshake)->io_us, >, 0);
+
+    validity90_handshake_free(handshake);
+    validity90_tls_session_free(session);
+    validity90_transport_free(transport);
+}
+
+// @TEST_DEF /handshake/signature
+void HANDSHAKE_SIGNATURE() {
+    handshake_test_sensor sensor;
+    guint8 client_ecdh_key[0x60], client_random[0x20] = { 0 };
+
+    handshake_test_sensor_init(&sensor);
+    g_assert(validity90_ec_p256_generate(client_ecdh_key));
+    validity90_handshake *handshake = handshake_test_client_new(&sensor, client_ecdh_key, client_random);
+
+    // Three in four signatures come out with a short r or s and have to be made again
+    for (int i = 0; i < 32; i++) {
+        client_random[0] = i;
+        validity90_handshake_reset(handshake, client_random);
+        handshake_test_complete(&sensor, handshake, client_random);
+    }
+
+    validity90_handshake_free(handshake);
+    handshake_test_sensor_clear(&sensor);
+}
+
+// @TEST_DEF /handshake/perf
+void HANDSHAKE_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    handshake_test_sensor sensor;
+    guint8 client_ecdh_key[0x60], client_random[0x20] = { 0 };
+    validity90_handshake_timing sum = { 0 };
+    const int runs = 1000;
+
+    handshake_test_sensor_init(&sensor);
+    g_assert(validity90_ec_p256_generate(client_ecdh_key));
+    validity90_handshake *handshake = handshake_test_client_new(&sensor, client_ecdh_key, client_random);
+
+    for (int i = 0; i < runs; i++) {
+        client_random[0] = i;
+        validity90_handshake_reset(handshake, client_random);
+        handshake_test_complete(&sensor, handshake, client_random);
+
+        const validity90_handshake_timing *timing = validity90_handshake_get_timing(handshake);
+        sum.ecdh_us += timing->ecdh_us;
+        sum.prf_us += timing->prf_us;
+        sum.sign_us += timing->sign_us;
+        sum.total_us += timing->total_us;
+    }
+
+    // Total includes the test sensor's own work between the steps
+    g_test_message("ecdh: %.1f us", (gdouble) sum.ecdh_us / runs);
+    g_test_message("prf: %.1f us", (gdouble) sum.prf_us / runs);
+    g_test_message("sign: %.1f us", (gdouble) sum.sign_us / runs);
+    g_test_message("handshake with the test sensor: %.1f us", (gdouble) sum.total_us / runs);
+    g_test_minimized_result((gdouble) (sum.ecdh_us + sum.prf_us + sum.sign_us) / runs,
+                            "client crypto: %.1f us", (gdouble) (sum.ecdh_us + sum.prf_us + sum.sign_us) / runs);
+
+    validity90_handshake_free(handshake);
+    handshake_test_sensor_clear(&sensor);
+}
@@ -0,0 +1,287 @@
+/*
+ * Validity90 tests for image dumping
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <png.h>
+
+#include "validity90/image.h"
+
+#define IMAGE_TEST_LEN (VALIDITY90_IMAGE_WIDTH * VALIDITY90_IMAGE_HEIGHT)
+
+static void image_test_fill(guint8 *image, guint seed) {
+    for (int y = 0; y < VALIDITY90_IMAGE_HEIGHT; y++) {
+        for (int x = 0; x < VALIDITY90_IMAGE_WIDTH; x++) {
+            image[y * VALIDITY90_IMAGE_WIDTH + x] = x * 3 + y * 5 + seed;
+        }
+    }
+}
+
+static void image_test_assert_png(const char *path, const guint8 *expected) {
+    png_image png;
+    guint8 pixels[IMAGE_TEST_LEN];
+
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    g_assert(png_image_begin_read_from_file(&png, path));
+    g_assert_cmpuint(png.width, ==, VALIDITY90_IMAGE_WIDTH);
+    g_assert_cmpuint(png.height, ==, VALIDITY90_IMAGE_HEIGHT);
+
+    png.format = PNG_FORMAT_GRAY;
+    g_assert(png_image_finish_read(&png, NULL, pixels, 0, NULL));
+    g_assert(memcmp(pixels, expected, IMAGE_TEST_LEN) == 0);
+}
+
+static void image_test_assert_raw(const char *path, const guint8 *expected) {
+    gchar *contents;
+    gsize len;
+
+    g_assert(g_file_get_contents(path, &contents, &len, NULL));
+    g_assert_cmpuint(len, ==, IMAGE_TEST_LEN);
+    g_assert(memcmp(contents, expected, IMAGE_TEST_LEN) == 0);
+    g_free(contents);
+}
+
+static void image_test_remove(const char *dir, const char *name) {
+    gchar *path = g_build_filename(dir, name, NULL);
+
+    g_remove(path);
+    g_free(path);
+}
+
+// @TEST_DEF /image/png
+void IMAGE_PNG() {
+    gchar *dir = g_dir_make_tmp("validity90-image-XXXXXX", NULL);
+    gchar *path = g_build_filename(dir, "img.png", NULL);
+    guint8 image[IMAGE_TEST_LEN];
+    GError *error = NULL;
+
+    image_test_fill(image, 0);
+
+    // Every row has its own pixels, not a float stride of the buffer
+    g_assert(validity90_image_write_png(path, image, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT, -1, &error));
+    g_assert_no_error(error);
+    image_test_assert_png(path, image);
+
+    image_test_fill(image, 7);
+    g_assert(validity90_image_write_png(path, image, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT, 1, &error));
+    g_assert_no_error(error);
+    image_test_assert_png(path, image);
+    g_remove(path);
+    g_free(path);
+
+    path = g_build_filename(dir, "missing", "img.png", NULL);
+    g_assert(!validity90_image_write_png(path, image, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT, -1, &error));
+    g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+    g_clear_error(&error);
+    g_free(path);
+
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+// @TEST_DEF /image/dumper
+void IMAGE_DUMPER() {
+    gchar *dir = g_dir_make_tmp("validity90-image-XXXXXX", NULL);
+    gchar *first = g_build_filename(dir, "first", NULL);
+    gchar *second = g_build_filename(dir, "second", NULL);
+    guint8 image1[IMAGE_TEST_LEN], image2[IMAGE_TEST_LEN];
+    GError *error = NULL;
+
+    image_test_fill(image1, 1);
+    image_test_fill(image2, 2);
+
+    validity90_image_dumper *dumper = validity90_image_dumper_new(1);
+    validity90_image_dumper_push(dumper, first, image1, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT);
+    validity90_image_dumper_push(dumper, second, image2, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT);
+    // Pushed images are copies
+    memset(image1, 0, sizeof(image1));
+    image_test_fill(image1, 1);
+    g_assert(validity90_image_dumper_free(dumper, &error));
+    g_assert_no_error(error);
+
+    gchar *path = g_strconcat(first, ".png", NULL);
+    image_test_assert_png(path, image1);
+    g_free(path);
+    path = g_strconcat(first, ".raw", NULL);
+    image_test_assert_raw(path, image1);
+    g_free(path);
+    path = g_strconcat(second, ".png", NULL);
+    image_test_assert_png(path, image2);
+    g_free(path);
+    path = g_strconcat(second, ".raw", NULL);
+    image_test_assert_raw(path, image2);
+    g_free(path);
+
+    // Failures are reported once the dumper is done
+    dumper = validity90_image_dumper_new(1);
+    path = g_build_filename(dir, "missing", "img", NULL);
+    validity90_image_dumper_push(dumper, path, image1, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT);
+    g_assert(!validity90_image_dumper_free(dumper, &error));
+    g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+    g_clear_error(&error);
+    g_free(path);
+
+    image_test_remove(dir, "first.png");
+    image_test_remove(dir, "first.raw");
+    image_test_remove(dir, "second.png");
+    image_test_remove(dir, "second.raw");
+    g_rmdir(dir);
+    g_free(first);
+    g_free(second);
+    g_free(dir);
+}
+
+typedef struct image_test_rows {
+    guint calls;
+    guint first_row;
+    guint rows;
+} image_test_rows;
+
+static void image_test_rows_cb(const guint8 *image, guint width, guint first_row, guint rows, gpointer user_data) {
+    image_test_rows *seen = user_data;
+
+    // Rows come in order and only once
+    g_assert_cmpuint(first_row, ==, seen->first_row + seen->rows);
+    seen->calls++;
+    seen->first_row = first_row;
+    seen->rows = rows;
+}
+
+// @TEST_DEF /image/assembler
+void IMAGE_ASSEMBLER() {
+    // 4x3 image, 2 more bytes per sensor line, headers of 3 and 2 bytes
+    const validity90_image_geometry geometry = {
+        .width = 4, .height = 3, .stride = 6, .first_header_len = 3, .header_len = 2,
+    };
+    const guint8 chunk1[] = { 0x00, 0x00, 0xaa, 1, 2, 3, 4, 0xee, 0xee, 5, 6, 7 };
+    const guint8 chunk2[] = { 0x00, 0x00, 8, 0xee, 0xee };
+    const guint8 chunk3[] = { 0x00, 0x00, 9, 10, 11, 12, 0xee, 0xee };
+    const guint8 expected[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+    const guint8 failed[] = { 0x04, 0x03 };
+    image_test_rows seen = { 0 };
+    GError *error = NULL;
+
+    validity90_image_assembler *assembler = validity90_image_assembler_new(&geometry);
+    validity90_image_assembler_set_rows_cb(assembler, image_test_rows_cb, &seen);
+
+    g_assert(validity90_image_assembler_push(assembler, chunk1, sizeof(chunk1), &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(seen.calls, ==, 1);
+    g_assert_cmpuint(seen.rows, ==, 1);
+
+    // The second line ends in this chunk
+    g_assert(validity90_image_assembler_push(assembler, chunk2, sizeof(chunk2), &error));
+    g_assert_cmpuint(seen.calls, ==, 2);
+    g_assert_cmpuint(seen.first_row, ==, 1);
+    g_assert_cmpuint(seen.rows, ==, 1);
+    g_assert(!validity90_image_assembler_is_complete(assembler));
+
+    g_assert(validity90_image_assembler_push(assembler, chunk3, sizeof(chunk3), &error));
+    g_assert_cmpuint(seen.calls, ==, 3);
+    g_assert(validity90_image_assembler_is_complete(assembler));
+    g_assert(memcmp(validity90_image_assembler_get_image(assembler), expected, sizeof(expected)) == 0);
+
+    g_assert(!validity90_image_assembler_push(assembler, chunk3, sizeof(chunk3), &error));
+    g_assert_error(error, VALIDITY90_IMAGE_ERROR, VALIDITY90_IMAGE_ERR_OVERFLOW);
+    g_clear_error(&error);
+
+    // Nothing is copied from a chunk with a failed status
+    validity90_image_assembler_reset(assembler);
+    g_assert(!validity90_image_assembler_push(assembler, failed, sizeof(failed), &error));
+    g_assert_error(error, VALIDITY90_IMAGE_ERROR, VALIDITY90_IMAGE_ERR_CHUNK);
+    g_clear_error(&error);
+    g_assert_cmpuint(validity90_image_assembler_get_rows(assembler), ==, 0);
+
+    // The first chunk after the reset has the first header again
+    seen = (image_test_rows) { 0 };
+    g_assert(validity90_image_assembler_push(assembler, chunk1, sizeof(chunk1), &error));
+    g_assert_cmpuint(seen.rows, ==, 1);
+    validity90_image_assembler_free(assembler);
+
+    // 0090 lines are the image rows, what the readout copied from the fixed offsets before
+    const validity90_image_geometry *g0090 = &validity90_image_geometry_0090;
+    const gsize splits[] = { 0, 7000, 15000, IMAGE_TEST_LEN };
+    guint8 image[IMAGE_TEST_LEN];
+    guint8 chunk[IMAGE_TEST_LEN + 0x12];
+
+    image_test_fill(image, 1);
+    assembler = validity90_image_assembler_new(g0090);
+    for (int i = 0; i < G_N_ELEMENTS(splits) - 1; i++) {
+        gsize header_len = i == 0 ? g0090->first_header_len : g0090->header_len;
+        gsize len = splits[i + 1] - splits[i];
+
+        memset(chunk, 0, header_len);
+        memcpy(chunk + header_len, image + splits[i], len);
+        g_assert(validity90_image_assembler_push(assembler, chunk, header_len + len, &error));
+        g_assert_no_error(error);
+        g_assert_cmpuint(validity90_image_assembler_get_rows(assembler), ==, splits[i + 1] / VALIDITY90_IMAGE_WIDTH);
+    }
+    g_assert(validity90_image_assembler_is_complete(assembler));
+    g_assert(memcmp(validity90_image_assembler_get_image(assembler), image, IMAGE_TEST_LEN) == 0);
+    validity90_image_assembler_free(assembler);
+}
+
+// @TEST_DEF /image/perf
+void IMAGE_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    gchar *dir = g_dir_make_tmp("validity90-image-XXXXXX", NULL);
+    gchar *name = g_build_filename(dir, "img", NULL);
+    gchar *png = g_strconcat(name, ".png", NULL);
+    gchar *raw = g_strconcat(name, ".raw", NULL);
+    guint8 image[IMAGE_TEST_LEN];
+    const int runs = 200;
+
+    image_test_fill(image, 0);
+
+    // What a scan used to wait for
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        g_assert(validity90_image_write_png(png, image, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT, -1, NULL));
+        g_assert(validity90_image_write_raw(raw, image, sizeof(image), NULL));
+    }
+    gdouble sync_time = g_test_timer_elapsed();
+
+    validity90_image_dumper *dumper = validity90_image_dumper_new(1);
+    gint64 started = g_get_monotonic_time();
+
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        validity90_image_dumper_push(dumper, name, image, VALIDITY90_IMAGE_WIDTH, VALIDITY90_IMAGE_HEIGHT);
+    }
+    gdouble push_time = g_test_timer_elapsed();
+    g_assert(validity90_image_dumper_free(dumper, NULL));
+    gdouble dump_time = (g_get_monotonic_time() - started) / 1e6;
+
+    g_test_message("synchronous png + raw: %.1f us", sync_time / runs * 1e6);
+    g_test_message("background png + raw: %.1f us", dump_time / runs * 1e6);
+    g_test_minimized_result(push_time / runs * 1e6, "scan path: %.2f us", push_time / runs * 1e6);
+
+    g_remove(png);
+    g_remove(raw);
+    g_rmdir(dir);
+    g_free(png);
+    g_free(raw);
+    g_free(name);
+    g_free(dir);
+}
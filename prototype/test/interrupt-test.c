@@ -0,0 +1,215 @@
+/*
+ * Validity90 tests for interrupt events
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "validity90/interrupt.h"
+#include "validity90/transport.h"
+
+// Enrollment of a 0090, dump10 has no interrupts. A finger is scanned after command 43, then every 5 commands.
+#define INTERRUPT_TEST_PATH "../dumps/dumpF1.pcapng"
+#define INTERRUPT_TEST_SCAN_COMMANDS 43
+#define INTERRUPT_TEST_NEXT_SCAN_COMMANDS 5
+#define INTERRUPT_TEST_TRANSFERS 4
+
+typedef struct interrupt_test_event {
+    guint8 data[5];
+    validity90_event_type type;
+} interrupt_test_event;
+
+// @TEST_DEF /interrupt/decode
+void INTERRUPT_DECODE() {
+    const interrupt_test_event events[] = {
+        { { 0x00, 0x00, 0x00, 0x00, 0x00 }, VALIDITY90_EVENT_WAITING_FINGER },
+        { { 0x02, 0x00, 0x40, 0x10, 0x00 }, VALIDITY90_EVENT_FINGER_DOWN },
+        { { 0x02, 0x00, 0x40, 0x06, 0x06 }, VALIDITY90_EVENT_FINGER_DOWN },
+        { { 0x03, 0x40, 0x01, 0x00, 0x00 }, VALIDITY90_EVENT_SCAN_STARTED },
+        { { 0x03, 0x41, 0x03, 0x00, 0x40 }, VALIDITY90_EVENT_SCAN_COMPLETED },
+        { { 0x03, 0x43, 0x04, 0x00, 0x41 }, VALIDITY90_EVENT_SCAN_SUCCEEDED },
+        { { 0x03, 0x42, 0x04, 0x00, 0x40 }, VALIDITY90_EVENT_SCAN_SUCCEEDED_LOW_QUALITY },
+        { { 0x03, 0x60, 0x07, 0x00, 0x40 }, VALIDITY90_EVENT_SCAN_FAILED_TOO_SHORT },
+        { { 0x03, 0x61, 0x07, 0x00, 0x41 }, VALIDITY90_EVENT_SCAN_FAILED_TOO_SHORT },
+        { { 0x03, 0x20, 0x07, 0x00, 0x00 }, VALIDITY90_EVENT_SCAN_FAILED_TOO_FAST },
+
+        // Match results and anything else stay unknown
+        { { 0x03, 0x00, 0x01, 0x00, 0x00 }, VALIDITY90_EVENT_UNKNOWN },
+        { { 0x03, 0x43, 0x04, 0x00, 0x40 }, VALIDITY90_EVENT_UNKNOWN },
+        { { 0xff, 0xff, 0xff, 0xff, 0xff }, VALIDITY90_EVENT_UNKNOWN },
+    };
+
+    for (int i = 0; i < G_N_ELEMENTS(events); i++) {
+        g_assert_cmpint(validity90_interrupt_decode(events[i].data, G_N_ELEMENTS(events[i].data)), ==, events[i].type);
+    }
+
+    // Same prefix, different length
+    g_assert_cmpint(validity90_interrupt_decode(events[0].data, 4), ==, VALIDITY90_EVENT_UNKNOWN);
+
+    for (int i = 0; i < VALIDITY90_EVENT_COUNT; i++) {
+        g_assert(validity90_event_type_name(i) != NULL);
+    }
+}
+
+/*
+ * Replay of dumpF1 up to the events of its first scan. The commands aren't
+ * verbatim ones, so the replay takes them in order. Returns NULL and skips
+ * the test when the capture isn't there.
+ */
+static validity90_transport *interrupt_test_open(gboolean timing) {
+    GError *error = NULL;
+
+    if (!g_file_test(INTERRUPT_TEST_PATH, G_FILE_TEST_EXISTS)) {
+        g_test_skip("no " INTERRUPT_TEST_PATH);
+        return NULL;
+    }
+
+    validity90_transport *transport = validity90_transport_replay_new(INTERRUPT_TEST_PATH, timing, &error);
+    g_assert_no_error(error);
+
+    return transport;
+}
+
+static void interrupt_test_commands(validity90_transport *transport, guint count) {
+    const guint8 cmd[] = { 0x00 };
+    GError *error = NULL;
+
+    for (guint i = 0; i < count; i++) {
+        g_assert(validity90_transport_write(transport, 0x01, cmd, sizeof(cmd), 0, &error));
+        g_assert_no_error(error);
+    }
+}
+
+typedef struct interrupt_test_seen {
+    GArray *types;
+    guint waiting;
+    guint succeeded;
+} interrupt_test_seen;
+
+static void interrupt_test_waiting_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    interrupt_test_seen *seen = user_data;
+
+    g_assert_cmpint(event->type, ==, VALIDITY90_EVENT_WAITING_FINGER);
+    seen->waiting++;
+}
+
+static void interrupt_test_succeeded_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    interrupt_test_seen *seen = user_data;
+
+    g_assert_cmpint(event->type, ==, VALIDITY90_EVENT_SCAN_SUCCEEDED);
+    seen->succeeded++;
+    validity90_interrupts_quit(irq);
+}
+
+static void interrupt_test_any_cb(validity90_interrupts *irq, const validity90_event *event, gpointer user_data) {
+    interrupt_test_seen *seen = user_data;
+
+    g_assert_cmpuint(event->len, ==, 5);
+    g_assert_cmpint(event->type, ==, validity90_interrupt_decode(event->data, event->len));
+    g_array_append_val(seen->types, event->type);
+}
+
+static void interrupt_test_transfer_cb(struct libusb_transfer *transfer) {
+    guint *completed = transfer->user_data;
+
+    (*completed)++;
+}
+
+// @TEST_DEF /interrupt/replay/dispatch
+void INTERRUPT_REPLAY_DISPATCH() {
+    validity90_transport *transport = interrupt_test_open(FALSE);
+    if (transport == NULL) {
+        return;
+    }
+
+    const validity90_event_type others[] = {
+        VALIDITY90_EVENT_FINGER_DOWN, VALIDITY90_EVENT_SCAN_STARTED, VALIDITY90_EVENT_SCAN_COMPLETED,
+    };
+    validity90_interrupts *irq = validity90_interrupts_new(transport, INTERRUPT_TEST_TRANSFERS);
+    interrupt_test_seen seen = { .types = g_array_new(FALSE, FALSE, sizeof(validity90_event_type)) };
+    GError *error = NULL;
+
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_WAITING_FINGER, interrupt_test_waiting_cb, &seen);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_SCAN_SUCCEEDED, interrupt_test_succeeded_cb, &seen);
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_ANY, interrupt_test_any_cb, &seen);
+
+    // All transfers wait for the events of the scan, which need more of them than are in flight
+    g_assert(validity90_interrupts_start(irq, &error));
+    g_assert_no_error(error);
+    interrupt_test_commands(transport, INTERRUPT_TEST_SCAN_COMMANDS);
+
+    // Typed handlers get their events, the others go to the catch-all one, up to the quit
+    g_assert(validity90_interrupts_run(irq, 0, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(seen.waiting, ==, 1);
+    g_assert_cmpuint(seen.succeeded, ==, 1);
+    g_assert_cmpuint(seen.types->len, ==, G_N_ELEMENTS(others));
+    g_assert(memcmp(seen.types->data, others, sizeof(others)) == 0);
+
+    // Freeing returns the transfers still in flight to their callback
+    validity90_interrupts_free(irq);
+
+    // so the next event goes to a new transfer and not to a reaped one
+    struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+    guint8 buff[0x100];
+    guint completed = 0;
+
+    libusb_fill_interrupt_transfer(transfer, NULL, 0x83, buff, sizeof(buff), interrupt_test_transfer_cb, &completed, 0);
+    interrupt_test_commands(transport, INTERRUPT_TEST_NEXT_SCAN_COMMANDS);
+    g_assert(validity90_transport_submit(transport, transfer, &error));
+    g_assert(validity90_transport_handle_events(transport, NULL, NULL, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(completed, ==, 1);
+    g_assert_cmpint(transfer->status, ==, LIBUSB_TRANSFER_COMPLETED);
+    g_assert_cmpint(validity90_interrupt_decode(buff, transfer->actual_length), ==, VALIDITY90_EVENT_WAITING_FINGER);
+
+    libusb_free_transfer(transfer);
+    g_array_free(seen.types, TRUE);
+    validity90_transport_free(transport);
+}
+
+// @TEST_DEF /interrupt/replay/timeout
+void INTERRUPT_REPLAY_TIMEOUT() {
+    validity90_transport *transport = interrupt_test_open(TRUE);
+    if (transport == NULL) {
+        return;
+    }
+
+    validity90_interrupts *irq = validity90_interrupts_new(transport, INTERRUPT_TEST_TRANSFERS);
+    interrupt_test_seen seen = { 0 };
+    GError *error = NULL;
+
+    validity90_interrupts_set_handler(irq, VALIDITY90_EVENT_WAITING_FINGER, interrupt_test_waiting_cb, &seen);
+
+    g_assert(validity90_interrupts_start(irq, &error));
+    g_assert_no_error(error);
+    interrupt_test_commands(transport, INTERRUPT_TEST_SCAN_COMMANDS);
+
+    // The sensor waits right away, the finger only comes 1.3 s later
+    g_assert(!validity90_interrupts_run(irq, 200, &error));
+    g_assert_error(error, VALIDITY90_INTERRUPT_ERROR, VALIDITY90_INTERRUPT_ERR_TIMEOUT);
+    g_clear_error(&error);
+    g_assert_cmpuint(seen.waiting, ==, 1);
+
+    // Cancelled transfers are reaped without waiting for the finger
+    gint64 start = g_get_monotonic_time();
+    validity90_interrupts_free(irq);
+    g_assert_cmpint(g_get_monotonic_time() - start, <, 500 * 1000);
+
+    validity90_transport_free(transport);
+}
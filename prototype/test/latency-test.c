@@ -0,0 +1,158 @@
+/*
+ * Validity90 tests for the USB latency profiler
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "validity90/latency.h"
+#include "dump10.h"
+
+static void latency_test_out(validity90_latency *latency, gint64 ts_us, guint8 opcode) {
+    validity90_latency_out(latency, ts_us, &opcode, 1);
+}
+
+// Zeros never look like a TLS record
+static void latency_test_in(validity90_latency *latency, gint64 ts_us, gsize len) {
+    guint8 data[0x80] = { 0 };
+
+    validity90_latency_in(latency, ts_us, data, len);
+}
+
+static const validity90_latency_series *latency_test_series(validity90_latency *latency, validity90_latency_kind kind,
+                                                            guint8 code) {
+    guint count;
+    const validity90_latency_series *series = validity90_latency_get_series(latency, &count);
+
+    for (guint i = 0; i < count; i++) {
+        if (series[i].key.kind == kind && series[i].key.code == code) {
+            return &series[i];
+        }
+    }
+    g_assert_not_reached();
+}
+
+// @TEST_DEF /latency/pairing
+void LATENCY_PAIRING() {
+    validity90_latency *latency = validity90_latency_new();
+    const guint8 irq[] = { 0x02, 0x00, 0x00, 0x00, 0x00 };
+    const validity90_latency_series *series;
+    validity90_latency_summary summary;
+    guint count;
+
+    latency_test_out(latency, 0, 0x01);
+    latency_test_in(latency, 100, 38);
+
+    // A full packet is followed by the rest of the response
+    latency_test_out(latency, 150, 0x19);
+    latency_test_in(latency, 200, 0x40);
+    latency_test_in(latency, 260, 10);
+
+    // Pipelined, answered in order
+    latency_test_out(latency, 300, 0x3e);
+    latency_test_out(latency, 310, 0x3e);
+    latency_test_in(latency, 400, 10);
+    latency_test_in(latency, 450, 10);
+
+    // Waiting for the sensor, then the host took its time
+    validity90_latency_interrupt(latency, 500, irq, sizeof(irq));
+    latency_test_out(latency, 520, 0x40);
+
+    // A response of whole packets ends with the next command
+    latency_test_in(latency, 600, 0x40);
+    latency_test_out(latency, 700, 0x43);
+    latency_test_in(latency, 750, 10);
+    validity90_latency_flush(latency);
+
+    validity90_latency_get_series(latency, &count);
+    g_assert_cmpuint(count, ==, 6);
+    g_assert_cmpint(latency_test_series(latency, VALIDITY90_LATENCY_COMMAND, 0x01)->max_us, ==, 100);
+    g_assert_cmpint(latency_test_series(latency, VALIDITY90_LATENCY_COMMAND, 0x19)->max_us, ==, 110);
+    g_assert_cmpint(latency_test_series(latency, VALIDITY90_LATENCY_COMMAND, 0x40)->max_us, ==, 80);
+    g_assert_cmpint(latency_test_series(latency, VALIDITY90_LATENCY_COMMAND, 0x43)->max_us, ==, 50);
+    g_assert_cmpint(latency_test_series(latency, VALIDITY90_LATENCY_INTERRUPT, 0x02)->max_us, ==, 190);
+
+    series = latency_test_series(latency, VALIDITY90_LATENCY_COMMAND, 0x3e);
+    g_assert_cmpuint(series->count, ==, 2);
+    g_assert_cmpint(series->min_us, ==, 100);
+    g_assert_cmpint(series->p50_us, ==, 100);
+    g_assert_cmpint(series->p99_us, ==, 140);
+    g_assert_cmpint(series->total_us, ==, 240);
+
+    validity90_latency_get_summary(latency, &summary);
+    g_assert_cmpuint(summary.commands, ==, 6);
+    g_assert_cmpuint(summary.answered, ==, 6);
+    g_assert_cmpuint(summary.interrupts, ==, 1);
+    g_assert_cmpint(summary.span_us, ==, 750);
+    g_assert_cmpint(summary.busy_us, ==, 490);
+    g_assert_cmpint(summary.wait_us, ==, 50);
+    g_assert_cmpint(summary.idle_us, ==, 210);
+    g_assert_cmpuint(summary.gaps, ==, 4);
+    g_assert_cmpint(summary.gap_p50_us, ==, 40);
+    g_assert_cmpint(summary.gap_p99_us, ==, 100);
+
+    const validity90_latency_gap *gaps = validity90_latency_get_gaps(latency, &count);
+    g_assert_cmpuint(count, ==, 4);
+    g_assert_cmpint(gaps[0].start_us, ==, 600);
+    g_assert_cmpint(gaps[0].gap_us, ==, 100);
+    g_assert_cmpuint(gaps[0].after.code, ==, 0x40);
+    g_assert_cmpuint(gaps[0].before.code, ==, 0x43);
+    g_assert_cmpint(gaps[1].gap_us, ==, 50);
+    g_assert_cmpint(gaps[3].start_us, ==, 500);
+    g_assert_cmpint(gaps[3].gap_us, ==, 20);
+
+    validity90_latency_free(latency);
+}
+
+// @TEST_DEF /latency/dump
+void LATENCY_DUMP() {
+    GError *error = NULL;
+    validity90_latency_summary summary;
+    guint count;
+
+    if (!g_file_test(DUMP10_PATH, G_FILE_TEST_EXISTS)) {
+        g_test_skip("no " DUMP10_PATH);
+        return;
+    }
+
+    validity90_latency *latency = validity90_latency_new();
+    g_assert(validity90_latency_profile_file(latency, DUMP10_PATH, &error));
+    g_assert_no_error(error);
+
+    // Probe, init steps 2-6, the handshake and the scan setup, one after the other
+    validity90_latency_get_summary(latency, &summary);
+    g_assert_cmpuint(summary.commands, ==, 16);
+    g_assert_cmpuint(summary.answered, ==, 16);
+    g_assert_cmpuint(summary.gaps, ==, 15);
+    g_assert_cmpint(summary.busy_us + summary.wait_us + summary.idle_us, ==, summary.span_us);
+
+    g_assert_cmpuint(latency_test_series(latency, VALIDITY90_LATENCY_COMMAND, 0x01)->count, ==, 1);
+    g_assert_cmpuint(latency_test_series(latency, VALIDITY90_LATENCY_COMMAND, 0x3e)->count, ==, 2);
+    // ClientHello and the client flight, the session keys aren't in the capture
+    g_assert_cmpuint(latency_test_series(latency, VALIDITY90_LATENCY_RECORD, 0x16)->count, ==, 2);
+    g_assert_cmpuint(latency_test_series(latency, VALIDITY90_LATENCY_RECORD, 0x17)->count, ==, 7);
+
+    const validity90_latency_gap *gaps = validity90_latency_get_gaps(latency, &count);
+    g_assert_cmpuint(count, ==, VALIDITY90_LATENCY_MAX_GAPS);
+    for (guint i = 1; i < count; i++) {
+        g_assert_cmpint(gaps[i - 1].gap_us, >=, gaps[i].gap_us);
+    }
+    g_assert_cmpint(gaps[0].gap_us, ==, summary.gap_max_us);
+
+    validity90_latency_free(latency);
+}
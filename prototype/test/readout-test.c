@@ -0,0 +1,269 @@
+/*
+ * Validity90 tests for the image readout
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "validity90/readout.h"
+
+#define READOUT_TEST_CHUNKS 3
+
+// 4x6 image, 2 more bytes per sensor line, headers of 3 and 2 bytes
+static const validity90_image_geometry readout_test_geometry = {
+    .width = 4, .height = 6, .stride = 6, .first_header_len = 3, .header_len = 2,
+};
+
+// Lines split over the chunks, so they only add up in order
+static const gsize readout_test_splits[READOUT_TEST_CHUNKS + 1] = { 0, 10, 23, 36 };
+
+static void readout_test_key_block(guint8 *key_block, gboolean sensor) {
+    guint8 client[VALIDITY90_TLS_KEY_BLOCK_SIZE];
+
+    for (int i = 0; i < VALIDITY90_TLS_KEY_BLOCK_SIZE; i++) {
+        client[i] = i * 7 + 1;
+    }
+
+    memcpy(key_block, client, sizeof(client));
+    if (sensor) {
+        memcpy(key_block + VALIDITY90_TLS_MAC_OUT_OFFSET, client + VALIDITY90_TLS_MAC_IN_OFFSET, 0x20);
+        memcpy(key_block + VALIDITY90_TLS_MAC_IN_OFFSET, client + VALIDITY90_TLS_MAC_OUT_OFFSET, 0x20);
+        memcpy(key_block + VALIDITY90_TLS_KEY_OUT_OFFSET, client + VALIDITY90_TLS_KEY_IN_OFFSET, 0x20);
+        memcpy(key_block + VALIDITY90_TLS_KEY_IN_OFFSET, client + VALIDITY90_TLS_KEY_OUT_OFFSET, 0x20);
+    }
+}
+
+static validity90_tls_session *readout_test_session(gboolean sensor) {
+    guint8 key_block[VALIDITY90_TLS_KEY_BLOCK_SIZE];
+    GError *error = NULL;
+
+    readout_test_key_block(key_block, sensor);
+    validity90_tls_session *session = validity90_tls_session_new(key_block, sizeof(key_block), &error);
+    g_assert_no_error(error);
+
+    return session;
+}
+
+// Sensor byte i of the image is i, the columns past width included
+static void readout_test_chunk(guint i, GByteArray *chunk) {
+    gsize header_len = i == 0 ? readout_test_geometry.first_header_len : readout_test_geometry.header_len;
+
+    g_byte_array_set_size(chunk, 0);
+    for (gsize j = 0; j < header_len; j++) {
+        g_byte_array_append(chunk, (const guint8 *) "", 1);
+    }
+    for (gsize j = readout_test_splits[i]; j < readout_test_splits[i + 1]; j++) {
+        guint8 byte = j;
+        g_byte_array_append(chunk, &byte, 1);
+    }
+}
+
+static void readout_test_put32(GByteArray *out, guint32 value) {
+    guint8 le[] = { value, value >> 8, value >> 16, value >> 24 };
+
+    g_byte_array_append(out, le, sizeof(le));
+}
+
+// One usbmon (LINKTYPE_USB_LINUX_MMAPPED) packet of the sensor, bulk OUT submission or bulk IN completion
+static void readout_test_packet(GByteArray *pcap, guint ts, guint8 ep, const guint8 *data, gsize len) {
+    guint8 header[64] = { 0 };
+    gsize padded = (sizeof(header) + len + 3) & ~3;
+
+    header[8] = ep & 0x80 ? 'C' : 'S';
+    header[9] = 3;
+    header[10] = ep;
+    header[11] = 5;
+    header[12] = 1;
+
+    readout_test_put32(pcap, 6);
+    readout_test_put32(pcap, 32 + padded);
+    readout_test_put32(pcap, 0);
+    readout_test_put32(pcap, 0);
+    readout_test_put32(pcap, ts);
+    readout_test_put32(pcap, sizeof(header) + len);
+    readout_test_put32(pcap, sizeof(header) + len);
+    g_byte_array_append(pcap, header, sizeof(header));
+    g_byte_array_append(pcap, data, len);
+    g_byte_array_set_size(pcap, pcap->len + padded - sizeof(header) - len);
+    readout_test_put32(pcap, 32 + padded);
+}
+
+/*
+ * Capture of a readout: every buffer read command answered with a chunk of
+ * the image, sealed by the sensor. Returns the path of the capture.
+ */
+static gchar *readout_test_capture(void) {
+    validity90_tls_session *sensor = readout_test_session(TRUE);
+    const guint8 cmd[] = { 0x17, 0x03, 0x03, 0x00, 0x00 };
+    GByteArray *pcap = g_byte_array_new();
+    GByteArray *chunk = g_byte_array_new();
+    GByteArray *record = g_byte_array_new();
+    GError *error = NULL;
+    gchar *path;
+
+    readout_test_put32(pcap, 0x0A0D0D0A);
+    readout_test_put32(pcap, 28);
+    readout_test_put32(pcap, 0x1A2B3C4D);
+    readout_test_put32(pcap, 1);
+    readout_test_put32(pcap, 0xffffffff);
+    readout_test_put32(pcap, 0xffffffff);
+    readout_test_put32(pcap, 28);
+
+    readout_test_put32(pcap, 1);
+    readout_test_put32(pcap, 20);
+    readout_test_put32(pcap, 220);
+    readout_test_put32(pcap, 0x40000);
+    readout_test_put32(pcap, 20);
+
+    // The client seals its own commands, written data isn't compared
+    for (guint i = 0; i < READOUT_TEST_CHUNKS; i++) {
+        readout_test_chunk(i, chunk);
+        g_byte_array_set_size(record, 0);
+        g_assert(validity90_tls_session_seal_record(sensor, 0x17, chunk->data, chunk->len, record, &error));
+        g_assert_no_error(error);
+
+        readout_test_packet(pcap, i * 100, 0x01, cmd, sizeof(cmd));
+        readout_test_packet(pcap, i * 100 + 50, 0x81, record->data, record->len);
+    }
+
+    gint fd = g_file_open_tmp("readout-test-XXXXXX.pcapng", &path, &error);
+    g_assert_no_error(error);
+    g_close(fd, NULL);
+    g_assert(g_file_set_contents(path, (const gchar *) pcap->data, pcap->len, &error));
+    g_assert_no_error(error);
+
+    g_byte_array_free(record, TRUE);
+    g_byte_array_free(chunk, TRUE);
+    g_byte_array_free(pcap, TRUE);
+    validity90_tls_session_free(sensor);
+
+    return path;
+}
+
+typedef struct readout_test_rows {
+    guint calls;
+    guint rows;
+} readout_test_rows;
+
+static void readout_test_rows_cb(const guint8 *image, guint width, guint first_row, guint rows, gpointer user_data) {
+    readout_test_rows *seen = user_data;
+
+    // Rows come in order and only once
+    g_assert_cmpuint(first_row, ==, seen->rows);
+    seen->calls++;
+    seen->rows += rows;
+}
+
+// @TEST_DEF /readout/chunks
+void READOUT_CHUNKS() {
+    const validity90_image_geometry *geometry = &readout_test_geometry;
+    guint8 expected[geometry->width * geometry->height];
+    readout_test_rows seen = { 0 };
+    GError *error = NULL;
+
+    for (guint row = 0; row < geometry->height; row++) {
+        for (guint column = 0; column < geometry->width; column++) {
+            expected[row * geometry->width + column] = row * geometry->stride + column;
+        }
+    }
+
+    gchar *path = readout_test_capture();
+    validity90_transport *transport = validity90_transport_replay_new(path, FALSE, &error);
+    g_assert_no_error(error);
+    validity90_tls_session *session = readout_test_session(FALSE);
+    validity90_image_assembler *assembler = validity90_image_assembler_new(geometry);
+    validity90_image_assembler_set_rows_cb(assembler, readout_test_rows_cb, &seen);
+
+    g_assert(validity90_readout_image(transport, session, READOUT_TEST_CHUNKS, assembler, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(seen.calls, ==, READOUT_TEST_CHUNKS);
+    g_assert_cmpuint(seen.rows, ==, geometry->height);
+    g_assert_cmpmem(validity90_image_assembler_get_image(assembler), sizeof(expected), expected, sizeof(expected));
+
+    // A chunk short
+    validity90_transport_free(transport);
+    transport = validity90_transport_replay_new(path, FALSE, &error);
+    g_assert_no_error(error);
+    seen = (readout_test_rows) { 0 };
+    g_assert(!validity90_readout_image(transport, session, READOUT_TEST_CHUNKS - 1, assembler, &error));
+    g_assert_error(error, VALIDITY90_READOUT_ERROR, VALIDITY90_READOUT_ERR_INCOMPLETE);
+    g_clear_error(&error);
+    g_assert_cmpuint(seen.rows, ==, readout_test_splits[READOUT_TEST_CHUNKS - 1] / geometry->stride);
+
+    validity90_image_assembler_free(assembler);
+    validity90_tls_session_free(session);
+    validity90_transport_free(transport);
+    g_unlink(path);
+    g_free(path);
+}
+
+// @TEST_DEF /readout/failures
+void READOUT_FAILURES() {
+    const validity90_image_geometry *geometry = &readout_test_geometry;
+    validity90_replay_fault faults[] = { VALIDITY90_REPLAY_FAULT_STALL, VALIDITY90_REPLAY_FAULT_CORRUPT };
+    GByteArray *chunk = g_byte_array_new();
+    GError *error = NULL;
+    guint8 buff[0x100];
+    gsize len;
+
+    gchar *path = readout_test_capture();
+    validity90_tls_session *session = readout_test_session(FALSE);
+    validity90_image_assembler *assembler = validity90_image_assembler_new(geometry);
+
+    for (int i = 0; i < G_N_ELEMENTS(faults); i++) {
+        readout_test_rows seen = { 0 };
+        guint8 *plain;
+        gsize plain_len;
+
+        validity90_transport *transport = validity90_transport_replay_new(path, FALSE, &error);
+        g_assert_no_error(error);
+        validity90_image_assembler_set_rows_cb(assembler, readout_test_rows_cb, &seen);
+
+        // The second chunk fails
+        validity90_transport_replay_inject(transport, 1, faults[i]);
+        g_assert(!validity90_readout_image(transport, session, READOUT_TEST_CHUNKS, assembler, &error));
+        if (faults[i] == VALIDITY90_REPLAY_FAULT_STALL) {
+            g_assert_error(error, VALIDITY90_READOUT_ERROR, VALIDITY90_READOUT_ERR_TRANSFER);
+        } else {
+            g_assert_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_BAD_RECORD_MAC);
+        }
+        g_clear_error(&error);
+        g_assert_cmpuint(seen.rows, ==, readout_test_splits[1] / geometry->stride);
+
+        // The last command was cancelled before it went out, its response is still there
+        g_assert(!validity90_transport_read(transport, 0x81, buff, sizeof(buff), &len, 0, &error));
+        g_assert_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED);
+        g_clear_error(&error);
+
+        g_assert(validity90_transport_write(transport, 0x01, (const guint8 *) "", 1, 0, &error));
+        g_assert(validity90_transport_read(transport, 0x81, buff, sizeof(buff), &len, 0, &error));
+        g_assert(validity90_tls_session_open_record(session, buff, len, &plain, &plain_len, &error));
+        g_assert_no_error(error);
+        readout_test_chunk(READOUT_TEST_CHUNKS - 1, chunk);
+        g_assert_cmpmem(plain, plain_len, chunk->data, chunk->len);
+
+        validity90_transport_free(transport);
+    }
+
+    validity90_image_assembler_free(assembler);
+    validity90_tls_session_free(session);
+    g_byte_array_free(chunk, TRUE);
+    g_unlink(path);
+    g_free(path);
+}
@@ -0,0 +1,204 @@
+/*
+ * Validity90 tests for the session recovery
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "validity90/recovery.h"
+#include "validity90/scan.h"
+#include "dump10.h"
+
+typedef struct recovery_test {
+    validity90_transport *transport;
+    validity90_handshake *handshake;
+    validity90_tls_session *session;
+    validity90_sequence *probe;
+    validity90_recovery *recovery;
+    validity90_scanner *scanner;
+} recovery_test;
+
+// Replay positioned right after the handshake, FALSE without the capture
+static gboolean recovery_test_open(recovery_test *test, gboolean timing) {
+    test->transport = dump10_open_session(timing, &test->session, &test->handshake);
+    if (test->transport == NULL) {
+        return FALSE;
+    }
+
+    test->probe = validity90_sequence_compile(init_sequence_probe, G_N_ELEMENTS(init_sequence_probe));
+    test->recovery = validity90_recovery_new(test->transport, test->handshake, dump10_client_random, test->probe,
+                                             FIELD_SENSOR_STATE);
+    test->scanner = validity90_scanner_new(test->transport, test->session);
+
+    return TRUE;
+}
+
+static void recovery_test_close(recovery_test *test) {
+    validity90_scanner_free(test->scanner);
+    validity90_recovery_free(test->recovery);
+    validity90_sequence_free(test->probe);
+    validity90_tls_session_free(test->session);
+    validity90_handshake_free(test->handshake);
+    validity90_transport_free(test->transport);
+}
+
+// The scan setup fails with fault after reads good reads, the next setup goes over the new session
+static void recovery_test_fault(recovery_test *test, guint reads, validity90_replay_fault fault,
+                                validity90_recovery_action action) {
+    GError *error = NULL;
+
+    validity90_transport_replay_inject(test->transport, reads, fault);
+    g_assert(!validity90_scanner_prepare(test->scanner, &error));
+    g_assert_cmpint(validity90_recovery_classify(error), ==, action);
+
+    g_assert(validity90_recovery_run(test->recovery, error, &test->session, NULL));
+    g_clear_error(&error);
+    validity90_scanner_forget(test->scanner, test->session);
+}
+
+static void recovery_test_prepare(recovery_test *test) {
+    GError *error = NULL;
+
+    g_assert(validity90_scanner_prepare(test->scanner, &error));
+    g_assert_no_error(error);
+}
+
+// @TEST_DEF /recovery/handshake
+void RECOVERY_HANDSHAKE() {
+    recovery_test test;
+
+    if (!recovery_test_open(&test, FALSE)) {
+        return;
+    }
+    const validity90_recovery_stats *stats = validity90_recovery_get_stats(test.recovery);
+
+    // A record that doesn't open only needs a new session
+    recovery_test_fault(&test, 1, VALIDITY90_REPLAY_FAULT_CORRUPT, VALIDITY90_RECOVERY_HANDSHAKE);
+    g_assert_cmpuint(stats->recovered, ==, 1);
+    g_assert_cmpuint(stats->handshakes, ==, 1);
+    g_assert_cmpuint(stats->resets, ==, 0);
+
+    // The sensor doesn't take the handshake, it is reset
+    GError *error = NULL;
+    validity90_transport_replay_inject(test.transport, 0, VALIDITY90_REPLAY_FAULT_CORRUPT);
+    g_assert(!validity90_scanner_prepare(test.scanner, &error));
+    validity90_transport_replay_inject(test.transport, 0, VALIDITY90_REPLAY_FAULT_STALL);
+    g_assert(validity90_recovery_run(test.recovery, error, &test.session, NULL));
+    g_clear_error(&error);
+    validity90_scanner_forget(test.scanner, test.session);
+    recovery_test_prepare(&test);
+    g_assert_cmpuint(stats->recovered, ==, 2);
+    g_assert_cmpuint(stats->handshakes, ==, 2);
+    g_assert_cmpuint(stats->resets, ==, 1);
+    g_assert_cmpuint(stats->failed, ==, 0);
+
+    recovery_test_close(&test);
+}
+
+// @TEST_DEF /recovery/reset
+void RECOVERY_RESET() {
+    recovery_test test;
+    GError *error = NULL;
+
+    if (!recovery_test_open(&test, FALSE)) {
+        return;
+    }
+    const validity90_recovery_stats *stats = validity90_recovery_get_stats(test.recovery);
+
+    // Probe and handshake only, init steps 2-6 are skipped
+    recovery_test_fault(&test, 2, VALIDITY90_REPLAY_FAULT_STALL, VALIDITY90_RECOVERY_RESET);
+    g_assert_cmpuint(stats->recovered, ==, 1);
+    g_assert_cmpuint(stats->handshakes, ==, 1);
+    g_assert_cmpuint(stats->resets, ==, 1);
+    g_assert_cmpint(stats->max_us, >, 0);
+    recovery_test_prepare(&test);
+
+    // The state is the last byte of the probe response
+    GError *cause = g_error_new(VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_USB, "LIBUSB_ERROR_PIPE");
+    validity90_transport_replay_inject(test.transport, 0, VALIDITY90_REPLAY_FAULT_CORRUPT);
+    g_assert(!validity90_recovery_run(test.recovery, cause, &test.session, &error));
+    g_assert_error(error, VALIDITY90_RECOVERY_ERROR, VALIDITY90_RECOVERY_ERR_NOT_READY);
+    g_clear_error(&error);
+    g_clear_error(&cause);
+    g_assert_cmpuint(stats->failed, ==, 1);
+
+    // The sensor said no, a new session doesn't change that
+    g_set_error(&error, VALIDITY90_SCAN_ERROR, VALIDITY90_SCAN_ERR_RESPONSE, "status 0403");
+    g_assert_cmpint(validity90_recovery_classify(error), ==, VALIDITY90_RECOVERY_NONE);
+    cause = error;
+    error = NULL;
+    g_assert(!validity90_recovery_run(test.recovery, cause, &test.session, &error));
+    g_assert_error(error, VALIDITY90_RECOVERY_ERROR, VALIDITY90_RECOVERY_ERR_UNRECOVERABLE);
+    g_clear_error(&error);
+    g_clear_error(&cause);
+    g_assert_cmpuint(stats->recovered, ==, 1);
+
+    recovery_test_close(&test);
+}
+
+// @TEST_DEF /recovery/perf
+void RECOVERY_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    recovery_test test;
+    GError *error = NULL;
+    const int faults = 6;
+
+    // With the captured delays of the sensor
+    if (!recovery_test_open(&test, TRUE)) {
+        return;
+    }
+    const validity90_recovery_stats *stats = validity90_recovery_get_stats(test.recovery);
+
+    // What a restart of the process goes through before its handshake
+    validity90_sequence *init = validity90_sequence_compile(init_sequence, G_N_ELEMENTS(init_sequence));
+    validity90_transport *transport = validity90_transport_replay_new(DUMP10_PATH, TRUE, &error);
+    g_assert_no_error(error);
+    validity90_handshake *handshake = validity90_handshake_new(&dump10_keys, dump10_client_random);
+
+    g_test_timer_start();
+    g_assert(validity90_sequence_run(test.probe, transport, NULL, NULL, &error));
+    g_assert(validity90_sequence_run(init, transport, NULL, NULL, &error));
+    g_assert(validity90_handshake_run(handshake, transport, &error));
+    g_assert_no_error(error);
+    gdouble restart = g_test_timer_elapsed();
+
+    validity90_handshake_free(handshake);
+    validity90_transport_free(transport);
+    validity90_sequence_free(init);
+
+    for (int i = 0; i < faults; i++) {
+        if (i % 2 == 0) {
+            recovery_test_fault(&test, i, VALIDITY90_REPLAY_FAULT_CORRUPT, VALIDITY90_RECOVERY_HANDSHAKE);
+        } else {
+            recovery_test_fault(&test, i, VALIDITY90_REPLAY_FAULT_STALL, VALIDITY90_RECOVERY_RESET);
+        }
+    }
+    recovery_test_prepare(&test);
+    g_assert_cmpuint(stats->recovered, ==, faults);
+
+    gdouble mttr = stats->total_us / 1000.0 / stats->recovered;
+    g_test_message("restart: %.1f ms without the USB reset, recovery worst: %.1f ms, %u resets",
+                   restart * 1000, stats->max_us / 1000.0, stats->resets);
+    g_test_minimized_result(mttr, "mean time to recover: %.1f ms", mttr);
+
+    recovery_test_close(&test);
+}
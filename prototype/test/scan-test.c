@@ -0,0 +1,134 @@
+/*
+ * Validity90 tests for the scan setup
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "validity90/scan.h"
+#include "dump10.h"
+
+static const guint8 scan_test_led[] = { 0x39, 0x20, 0xbf, 0x02, 0x00, 0xff, 0xff, 0x00 };
+static const guint8 scan_test_blink[] = { 0x39, 0xee, 0x02, 0x00, 0x00, 0x4b, 0x00, 0x00 };
+
+// @TEST_DEF /scan/setup
+void SCAN_SETUP() {
+    validity90_tls_session *session;
+    GError *error = NULL;
+
+    validity90_transport *transport = dump10_open_session(FALSE, &session, NULL);
+    if (transport == NULL) {
+        return;
+    }
+    validity90_scanner *scanner = validity90_scanner_new(transport, session);
+    const validity90_scanner_stats *stats = validity90_scanner_get_stats(scanner);
+
+    // The capture has the full setup and nothing after it
+    g_assert(validity90_scanner_prepare(scanner, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(stats->sent, ==, VALIDITY90_SCAN_SETUP_COMMANDS);
+
+    g_assert(validity90_scanner_prepare(scanner, &error));
+    g_assert(validity90_scanner_prepare(scanner, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(stats->sent, ==, VALIDITY90_SCAN_SETUP_COMMANDS);
+    g_assert_cmpuint(stats->skipped, ==, 2 * VALIDITY90_SCAN_SETUP_COMMANDS);
+
+    // Only after a reset it is sent again
+    validity90_scanner_forget(scanner, session);
+    g_assert(!validity90_scanner_prepare(scanner, &error));
+    g_assert_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED);
+    g_clear_error(&error);
+
+    validity90_scanner_free(scanner);
+    validity90_tls_session_free(session);
+    validity90_transport_free(transport);
+}
+
+// @TEST_DEF /scan/led
+void SCAN_LED() {
+    validity90_tls_session *session;
+    GError *error = NULL;
+
+    validity90_transport *transport = dump10_open_session(FALSE, &session, NULL);
+    if (transport == NULL) {
+        return;
+    }
+    validity90_scanner *scanner = validity90_scanner_new(transport, session);
+    const validity90_scanner_stats *stats = validity90_scanner_get_stats(scanner);
+
+    // Any script gets one of the captured responses, all of them with status 0
+    g_assert(validity90_scanner_set_led(scanner, scan_test_led, sizeof(scan_test_led), TRUE, &error));
+    g_assert(validity90_scanner_set_led(scanner, scan_test_led, sizeof(scan_test_led), TRUE, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(stats->sent, ==, 1);
+    g_assert_cmpuint(stats->skipped, ==, 1);
+
+    // Blinks always go out and the steady script has to follow again
+    g_assert(validity90_scanner_set_led(scanner, scan_test_blink, sizeof(scan_test_blink), FALSE, &error));
+    g_assert(validity90_scanner_set_led(scanner, scan_test_blink, sizeof(scan_test_blink), FALSE, &error));
+    g_assert(validity90_scanner_set_led(scanner, scan_test_led, sizeof(scan_test_led), TRUE, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(stats->sent, ==, 4);
+
+    validity90_scanner_set_fast(scanner, FALSE);
+    g_assert(validity90_scanner_set_led(scanner, scan_test_led, sizeof(scan_test_led), TRUE, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(stats->sent, ==, 5);
+    g_assert_cmpuint(stats->skipped, ==, 1);
+
+    validity90_scanner_free(scanner);
+    validity90_tls_session_free(session);
+    validity90_transport_free(transport);
+}
+
+// @TEST_DEF /scan/perf
+void SCAN_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    validity90_tls_session *session;
+    GError *error = NULL;
+    const int scans = 5;
+
+    // With the captured delays of the sensor
+    validity90_transport *transport = dump10_open_session(TRUE, &session, NULL);
+    if (transport == NULL) {
+        return;
+    }
+    validity90_scanner *scanner = validity90_scanner_new(transport, session);
+
+    g_test_timer_start();
+    g_assert(validity90_scanner_prepare(scanner, &error));
+    g_assert_no_error(error);
+    gdouble full = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (int i = 0; i < scans; i++) {
+        g_assert(validity90_scanner_prepare(scanner, &error));
+    }
+    gdouble fast = g_test_timer_elapsed() / scans;
+
+    g_test_message("full setup: %.1f ms, %u commands", full * 1000, VALIDITY90_SCAN_SETUP_COMMANDS);
+    g_test_minimized_result(fast * 1000, "fast setup: %.4f ms", fast * 1000);
+
+    validity90_scanner_free(scanner);
+    validity90_tls_session_free(session);
+    validity90_transport_free(transport);
+}
@@ -0,0 +1,197 @@
+/*
+ * Validity90 tests for command sequences
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "validity90/sequence.h"
+#include "dump10.h"
+
+// @TEST_DEF /sequence/check
+void SEQUENCE_CHECK() {
+    const guint8 msg[] = { 0xaa };
+    const guint32 rsp[] = { 0x00, M(1), M(1), 0x05, MASK_VARIABLE, 0x07 };
+    const validity90_step_def steps[] = {
+        VALIDITY90_STEP(msg, rsp),
+        VALIDITY90_STEP_ANY(msg),
+    };
+    validity90_sequence *seq = validity90_sequence_compile(steps, G_N_ELEMENTS(steps));
+    validity90_step_result result;
+    const guint8 *field;
+    gsize field_len;
+
+    g_assert_cmpuint(validity90_sequence_get_steps_count(seq), ==, 2);
+
+    guint8 good[] = { 0x00, 0x12, 0x34, 0x05, 0xff, 0x07 };
+    validity90_sequence_check(seq, 0, good, sizeof(good), &result);
+    g_assert_cmpint(result.mismatch, ==, -1);
+    g_assert_cmpuint(result.msg_len, ==, 1);
+    g_assert_cmpuint(result.msg[0], ==, 0xaa);
+    g_assert_cmpuint(result.expected_len, ==, sizeof(good));
+
+    g_assert(validity90_sequence_get_field(seq, &result, 1, &field, &field_len));
+    g_assert_cmpuint(field_len, ==, 2);
+    g_assert(field == good + 1);
+    // Variable without an id isn't a field
+    g_assert(!validity90_sequence_get_field(seq, &result, 0, &field, &field_len));
+    g_assert(!validity90_sequence_get_field(seq, &result, 2, &field, &field_len));
+
+    guint8 bad[] = { 0x00, 0x12, 0x34, 0x06, 0xff, 0x07 };
+    validity90_sequence_check(seq, 0, bad, sizeof(bad), &result);
+    g_assert_cmpint(result.mismatch, ==, 3);
+
+    bad[3] = 0x05;
+    bad[5] = 0x08;
+    validity90_sequence_check(seq, 0, bad, sizeof(bad), &result);
+    g_assert_cmpint(result.mismatch, ==, 5);
+
+    // Matching prefix of a short response
+    validity90_sequence_check(seq, 0, good, 3, &result);
+    g_assert_cmpint(result.mismatch, ==, 3);
+    g_assert(validity90_sequence_get_field(seq, &result, 1, &field, &field_len));
+    validity90_sequence_check(seq, 0, good, 2, &result);
+    g_assert(!validity90_sequence_get_field(seq, &result, 1, &field, &field_len));
+
+    validity90_sequence_check(seq, 1, bad, sizeof(bad), &result);
+    g_assert_cmpint(result.mismatch, ==, -1);
+
+    validity90_sequence_free(seq);
+}
+
+typedef struct sequence_test_output {
+    guint steps;
+    guint mismatches;
+    gint state;
+    gsize last_len;
+} sequence_test_output;
+
+static void sequence_test_step_cb(validity90_sequence *seq, const validity90_step_result *result, gpointer user_data) {
+    sequence_test_output *output = user_data;
+    const guint8 *field;
+    gsize field_len;
+
+    g_assert_cmpuint(result->step, ==, output->steps);
+    output->steps++;
+    output->mismatches += result->mismatch >= 0;
+    output->last_len = result->rsp_len;
+
+    if (validity90_sequence_get_field(seq, result, FIELD_SENSOR_STATE, &field, &field_len)) {
+        output->state = field[0];
+    }
+}
+
+// @TEST_DEF /sequence/replay
+void SEQUENCE_REPLAY() {
+    if (!g_file_test(DUMP10_PATH, G_FILE_TEST_EXISTS)) {
+        g_test_skip("no " DUMP10_PATH);
+        return;
+    }
+
+    validity90_transport *transport = validity90_transport_replay_new(DUMP10_PATH, FALSE, NULL);
+    validity90_sequence *probe = validity90_sequence_compile(init_sequence_probe, G_N_ELEMENTS(init_sequence_probe));
+    validity90_sequence *init = validity90_sequence_compile(init_sequence, G_N_ELEMENTS(init_sequence));
+    sequence_test_output output = { .state = -1 };
+    GError *error = NULL;
+
+    g_assert(validity90_sequence_run(probe, transport, sequence_test_step_cb, &output, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(output.steps, ==, 1);
+    g_assert_cmpint(output.state, ==, 0x07);
+
+    output.steps = 0;
+    g_assert(validity90_sequence_run(init, transport, sequence_test_step_cb, &output, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(output.steps, ==, G_N_ELEMENTS(init_sequence));
+    // RSP6
+    g_assert_cmpuint(output.last_len, ==, 4104);
+
+    // Byte 0x18 of init_sequence_rsp2 differs on this sensor, reported but not fatal
+    g_assert_cmpuint(output.mismatches, ==, 1);
+
+    validity90_sequence_free(probe);
+    validity90_sequence_free(init);
+    validity90_transport_free(transport);
+}
+
+static gboolean sequence_test_compare_dwords(const guint8 *data, gsize data_len, const guint32 *expected, gsize exp_len) {
+    if (data_len != exp_len) {
+        return FALSE;
+    }
+    for (int i = 0; i < data_len; i++) {
+        if (data[i] != expected[i] && !(expected[i] & MASK_VARIABLE)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// @TEST_DEF /sequence/perf
+void SEQUENCE_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    validity90_sequence *init = validity90_sequence_compile(init_sequence, G_N_ELEMENTS(init_sequence));
+    const int runs = 10000;
+    guint8 rsp6[G_N_ELEMENTS(init_sequence_rsp6)];
+    validity90_step_result result;
+    gboolean matched = TRUE;
+
+    for (int i = 0; i < G_N_ELEMENTS(rsp6); i++) {
+        rsp6[i] = init_sequence_rsp6[i];
+    }
+
+    // The byte per byte dword walk the prototype used to do
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        matched &= sequence_test_compare_dwords(rsp6, sizeof(rsp6), init_sequence_rsp6, G_N_ELEMENTS(init_sequence_rsp6));
+    }
+    gdouble dword_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        validity90_sequence_check(init, 4, rsp6, sizeof(rsp6), &result);
+        matched &= result.mismatch < 0;
+    }
+    gdouble check_time = g_test_timer_elapsed();
+    g_assert(matched);
+
+    g_test_message("RSP6 dword compare: %.2f us", dword_time / runs * 1e6);
+    g_test_minimized_result(check_time / runs * 1e6, "RSP6 compiled check: %.2f us", check_time / runs * 1e6);
+
+    if (g_file_test(DUMP10_PATH, G_FILE_TEST_EXISTS)) {
+        validity90_sequence *probe = validity90_sequence_compile(init_sequence_probe, G_N_ELEMENTS(init_sequence_probe));
+
+        g_test_timer_start();
+        for (int i = 0; i < runs / 10; i++) {
+            validity90_transport *transport = validity90_transport_replay_new(DUMP10_PATH, FALSE, NULL);
+
+            g_assert(validity90_sequence_run(probe, transport, NULL, NULL, NULL));
+            g_assert(validity90_sequence_run(init, transport, NULL, NULL, NULL));
+            validity90_transport_free(transport);
+        }
+        gdouble replay_time = g_test_timer_elapsed();
+
+        g_test_minimized_result(replay_time / (runs / 10) * 1e6, "init replay: %.1f us", replay_time / (runs / 10) * 1e6);
+        validity90_sequence_free(probe);
+    }
+
+    validity90_sequence_free(init);
+}
@@ -0,0 +1,231 @@
+/*
+ * Validity90 tests for TLS record layer
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "validity90/tls.h"
+#include "test/alloc-count.h"
+
+static void tls_test_key_block(guint8 *key_block) {
+    for (int i = 0; i < VALIDITY90_TLS_KEY_BLOCK_SIZE; i++) {
+        key_block[i] = i;
+    }
+}
+
+// @TEST_DEF /tls/session/encrypt
+void TLS_SESSION_ENCRYPT() {
+    guint8 key_block[VALIDITY90_TLS_KEY_BLOCK_SIZE];
+    tls_test_key_block(key_block);
+
+    guint8 data[] = { 0x51, 0x00, 0x20, 0x00, 0x00 };
+
+    // Output of the old per-record mac_then_encrypt for the same input
+    guint8 expected_result[] = {
+        0x4b, 0x77, 0x62, 0xff, 0xa9, 0x03, 0xc1, 0x1e, 0x6f, 0xd8, 0x35, 0x93, 0x17, 0x2d, 0x54, 0xef,
+        0x09, 0x5c, 0x85, 0x7b, 0x4f, 0x65, 0xec, 0xa7, 0xdd, 0xcb, 0x3c, 0xa3, 0xff, 0x84, 0xc2, 0xf2,
+        0xd3, 0x4b, 0xb3, 0x68, 0xc1, 0x7c, 0x1a, 0x74, 0x48, 0xb9, 0xe8, 0x28, 0x4a, 0x34, 0xb6, 0x73,
+        0xba, 0x80, 0xb7, 0xc4, 0x31, 0xce, 0x08, 0xa1, 0x15, 0xa9, 0x50, 0xf6, 0x79, 0x1a, 0x1c, 0x76,
+    };
+
+    validity90_tls_session *session = validity90_tls_session_new(key_block, G_N_ELEMENTS(key_block), NULL);
+    g_assert(session != NULL);
+
+    // Same session for both records, the second must not depend on the first
+    GByteArray *out = g_byte_array_new();
+    for (int i = 0; i < 2; i++) {
+        g_byte_array_set_size(out, 0);
+        g_assert(validity90_tls_session_encrypt(session, 0x17, data, G_N_ELEMENTS(data), out, NULL));
+        g_assert_cmpmem(out->data, out->len, expected_result, G_N_ELEMENTS(expected_result));
+    }
+
+    g_byte_array_free(out, TRUE);
+    validity90_tls_session_free(session);
+}
+
+// Key block and the first two responses from logs/90succ1
+static const guint8 log_key_block[] = {
+    0x3f, 0x16, 0x3f, 0xfd, 0x01, 0x33, 0x7f, 0xe6, 0x74, 0x87, 0x6a, 0x4f, 0x94, 0x9f, 0x53, 0x84,
+    0x8c, 0x02, 0x53, 0x73, 0x99, 0x2e, 0xca, 0x36, 0xc9, 0x82, 0x26, 0x19, 0xa5, 0x29, 0xb1, 0x9d,
+    0x1d, 0x81, 0xb6, 0x44, 0x95, 0xe7, 0x9c, 0xd5, 0xc3, 0x80, 0x42, 0xbe, 0xee, 0xa2, 0xff, 0xd5,
+    0x97, 0xcd, 0x7c, 0x2b, 0x12, 0xa2, 0x2d, 0x59, 0x45, 0xa7, 0x19, 0x66, 0x93, 0xe8, 0x0d, 0xc3,
+    0xc1, 0xc7, 0x8b, 0x85, 0x78, 0x40, 0x48, 0x13, 0xd2, 0x50, 0xff, 0x71, 0x4a, 0xb8, 0x9c, 0x2e,
+    0x0f, 0x74, 0x51, 0xb5, 0xe3, 0x8b, 0x8b, 0x0c, 0xc2, 0x96, 0xb5, 0x5c, 0x83, 0x6f, 0x72, 0x3f,
+    0xfb, 0x32, 0x0d, 0x9a, 0xe8, 0xb5, 0xd5, 0x2c, 0x0f, 0x82, 0xf5, 0x5e, 0x05, 0xbb, 0xa0, 0x2e,
+    0xdf, 0x52, 0x83, 0xa2, 0x9e, 0x52, 0xbe, 0x3f, 0x20, 0x33, 0x69, 0x3c, 0x62, 0x11, 0xf4, 0x8a,
+};
+
+static const guint8 log_record1[] = {
+    0x17, 0x03, 0x03, 0x00, 0x40, 0x6a, 0xbf, 0x8c, 0xb3, 0xab, 0x15, 0xc0, 0x79, 0xa4, 0x54, 0xc7,
+    0x9a, 0x55, 0x58, 0x79, 0x98, 0xb4, 0xff, 0xff, 0x60, 0xcb, 0x23, 0xf3, 0xf2, 0xc6, 0xf2, 0x8c,
+    0xf7, 0xb6, 0xf3, 0x6c, 0xf6, 0xe6, 0xe7, 0xa8, 0xf2, 0xf6, 0x53, 0x51, 0x1b, 0x98, 0xc0, 0x4c,
+    0x66, 0x75, 0x59, 0x13, 0x96, 0xcf, 0x87, 0x15, 0x5e, 0xd4, 0x8d, 0x4d, 0x62, 0xc9, 0x40, 0xf3,
+    0x4f, 0x2a, 0xca, 0xd9, 0x30,
+};
+
+static const guint8 log_record2[] = {
+    0x17, 0x03, 0x03, 0x00, 0x40, 0x38, 0xf3, 0x08, 0x85, 0x15, 0x1c, 0x4e, 0xcd, 0x41, 0xba, 0xaa,
+    0x99, 0xec, 0xa7, 0x5f, 0xf5, 0x3d, 0xc0, 0xb1, 0x13, 0xcb, 0xa5, 0xae, 0xfe, 0x2f, 0xda, 0x88,
+    0x95, 0xe9, 0x2b, 0x53, 0x2d, 0xba, 0x41, 0x55, 0xd4, 0x1f, 0x7b, 0xbe, 0x40, 0x42, 0x12, 0xe2,
+    0xcb, 0xcd, 0xea, 0x95, 0x27, 0x73, 0x8c, 0x73, 0xfa, 0x1d, 0x28, 0x33, 0xba, 0xce, 0xc8, 0x33,
+    0xfa, 0x13, 0x60, 0x02, 0xdd,
+};
+
+// @TEST_DEF /tls/session/open-record
+void TLS_SESSION_OPEN_RECORD() {
+    guint8 expected_result1[] = { 0x00, 0x00 };
+    guint8 expected_result2[] = { 0x00, 0x00, 0x02, 0x00, 0x00, 0x00 };
+    guint8 record[G_N_ELEMENTS(log_record1)];
+    guint8 *plain = NULL;
+    gsize plain_len = 0;
+
+    validity90_tls_session *session = validity90_tls_session_new(log_key_block, G_N_ELEMENTS(log_key_block), NULL);
+    g_assert(session != NULL);
+
+    memcpy(record, log_record1, sizeof(record));
+    alloc_count_start();
+    g_assert(validity90_tls_session_open_record(session, record, sizeof(record), &plain, &plain_len, NULL));
+    g_assert_cmpuint(alloc_count_stop(), ==, 0);
+    g_assert(plain >= record && plain + plain_len <= record + sizeof(record));
+    g_assert_cmpmem(plain, plain_len, expected_result1, G_N_ELEMENTS(expected_result1));
+
+    memcpy(record, log_record2, sizeof(record));
+    g_assert(validity90_tls_session_open_record(session, record, sizeof(record), &plain, &plain_len, NULL));
+    g_assert_cmpmem(plain, plain_len, expected_result2, G_N_ELEMENTS(expected_result2));
+
+    validity90_tls_session_free(session);
+}
+
+// @TEST_DEF /tls/session/open-record/fail
+void TLS_SESSION_OPEN_RECORD_FAIL() {
+    guint8 record[G_N_ELEMENTS(log_record1)];
+    guint8 *plain = NULL;
+    gsize plain_len = 0;
+    GError *error = NULL;
+
+    validity90_tls_session *session = validity90_tls_session_new(log_key_block, G_N_ELEMENTS(log_key_block), NULL);
+    g_assert(session != NULL);
+
+    // Flipped bit in the first ciphertext block garbles the MACed content
+    memcpy(record, log_record1, sizeof(record));
+    record[0x15] ^= 0x01;
+    g_assert(!validity90_tls_session_open_record(session, record, sizeof(record), &plain, &plain_len, &error));
+    g_assert_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_BAD_RECORD_MAC);
+    g_clear_error(&error);
+
+    // Wrong record type is covered by the MAC too
+    memcpy(record, log_record1, sizeof(record));
+    record[0] = 0x16;
+    g_assert(!validity90_tls_session_open_record(session, record, sizeof(record), &plain, &plain_len, &error));
+    g_assert_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_BAD_RECORD_MAC);
+    g_clear_error(&error);
+
+    // Header length beyond the buffer
+    memcpy(record, log_record1, sizeof(record));
+    g_assert(!validity90_tls_session_open_record(session, record, sizeof(record) - 1, &plain, &plain_len, &error));
+    g_assert_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_INVALID_RECORD);
+    g_clear_error(&error);
+
+    validity90_tls_session_free(session);
+}
+
+// @TEST_DEF /tls/session/round-trip
+void TLS_SESSION_ROUND_TRIP() {
+    guint8 key_block[VALIDITY90_TLS_KEY_BLOCK_SIZE];
+    tls_test_key_block(key_block);
+
+    // Loop our own records back: in keys equal to out keys
+    memcpy(key_block + VALIDITY90_TLS_MAC_IN_OFFSET, key_block + VALIDITY90_TLS_MAC_OUT_OFFSET, VALIDITY90_TLS_MAC_SIZE);
+    memcpy(key_block + VALIDITY90_TLS_KEY_IN_OFFSET, key_block + VALIDITY90_TLS_KEY_OUT_OFFSET, 0x20);
+
+    validity90_tls_session *session = validity90_tls_session_new(key_block, G_N_ELEMENTS(key_block), NULL);
+    g_assert(session != NULL);
+
+    // Sizes around block and decrypt chunk boundaries, up to a full image chunk
+    gsize sizes[] = { 0, 1, 0x0f, 0x10, 0x11, 0xfff, 0x1000, 0x1001, 0x2fe0, 0x3000 };
+    guint8 *data = g_malloc(0x3000);
+    for (gsize i = 0; i < 0x3000; i++) {
+        data[i] = i * 7;
+    }
+
+    GByteArray *record = g_byte_array_new();
+    for (int i = 0; i < G_N_ELEMENTS(sizes); i++) {
+        guint8 *plain = NULL;
+        gsize plain_len = 0;
+
+        g_byte_array_set_size(record, 0);
+        g_assert(validity90_tls_session_seal_record(session, 0x17, data, sizes[i], record, NULL));
+
+        g_assert(validity90_tls_session_open_record(session, record->data, record->len, &plain, &plain_len, NULL));
+        g_assert_cmpmem(plain, plain_len, data, sizes[i]);
+    }
+
+    g_byte_array_free(record, TRUE);
+    g_free(data);
+    validity90_tls_session_free(session);
+}
+
+// @TEST_DEF /tls/session/perf
+void TLS_SESSION_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    guint8 key_block[VALIDITY90_TLS_KEY_BLOCK_SIZE];
+    tls_test_key_block(key_block);
+
+    guint8 data[0x40] = { 0x51, 0x00, 0x20, 0x00, 0x00 };
+    const int records = 20000;
+    GByteArray *out = g_byte_array_sized_new(0x100);
+
+    // Before: keying HMAC and AES state for every record
+    alloc_count_start();
+    g_test_timer_start();
+    for (int i = 0; i < records; i++) {
+        validity90_tls_session *session = validity90_tls_session_new(key_block, G_N_ELEMENTS(key_block), NULL);
+        g_byte_array_set_size(out, 0);
+        validity90_tls_session_encrypt(session, 0x17, data, G_N_ELEMENTS(data), out, NULL);
+        validity90_tls_session_free(session);
+    }
+    gdouble per_record_time = g_test_timer_elapsed();
+    gsize per_record_allocs = alloc_count_stop();
+
+    // After: one session keyed up front
+    validity90_tls_session *session = validity90_tls_session_new(key_block, G_N_ELEMENTS(key_block), NULL);
+    alloc_count_start();
+    g_test_timer_start();
+    for (int i = 0; i < records; i++) {
+        g_byte_array_set_size(out, 0);
+        validity90_tls_session_encrypt(session, 0x17, data, G_N_ELEMENTS(data), out, NULL);
+    }
+    gdouble session_time = g_test_timer_elapsed();
+    gsize session_allocs = alloc_count_stop();
+    validity90_tls_session_free(session);
+
+    g_test_message("per-record keying: %.0f records/sec, %.2f allocations/record",
+                   records / per_record_time, (gdouble) per_record_allocs / records);
+    g_test_maximized_result(records / session_time, "session: %.0f records/sec", records / session_time);
+    g_test_minimized_result((gdouble) session_allocs / records, "session: %.2f allocations/record",
+                            (gdouble) session_allocs / records);
+
+    g_assert_cmpuint(session_allocs, ==, 0);
+
+    g_byte_array_free(out, TRUE);
+}
@@ -0,0 +1,239 @@
+/*
+ * Validity90 tests for USB transport
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "validity90/transport.h"
+#include "dump10.h"
+
+static validity90_transport *transport_test_open(gboolean timing) {
+    GError *error = NULL;
+
+    if (!g_file_test(DUMP10_PATH, G_FILE_TEST_EXISTS)) {
+        g_test_skip("no " DUMP10_PATH);
+        return NULL;
+    }
+
+    validity90_transport *transport = validity90_transport_replay_new(DUMP10_PATH, timing, &error);
+    g_assert_no_error(error);
+
+    return transport;
+}
+
+static void transport_test_exchange(validity90_transport *transport, const guint8 *cmd, gsize cmd_len, gsize rsp_len,
+                                    const guint8 *rsp_prefix, gsize rsp_prefix_len) {
+    guint8 buff[0x10000];
+    GError *error = NULL;
+    gsize len = 0;
+
+    g_assert(validity90_transport_write(transport, 0x01, cmd, cmd_len, 0, &error));
+    g_assert_no_error(error);
+    g_assert(validity90_transport_read(transport, 0x81, buff, sizeof(buff), &len, 0, &error));
+    g_assert_no_error(error);
+
+    g_assert_cmpuint(len, ==, rsp_len);
+    g_assert(memcmp(buff, rsp_prefix, rsp_prefix_len) == 0);
+}
+
+// @TEST_DEF /transport/replay/init
+void TRANSPORT_REPLAY_INIT() {
+    validity90_transport *transport = transport_test_open(FALSE);
+    if (transport == NULL) {
+        return;
+    }
+
+    const guint8 msg1[] = { 0x01 }, rsp1[] = { 0x00, 0x00, 0xf0, 0xb0 };
+    const guint8 msg2[] = { 0x19 }, rsp2[] = { 0x00, 0x00, 0x00, 0x03 };
+    const guint8 msg3[] = { 0x43, 0x02 }, rsp3[] = { 0x00, 0x00, 0x01, 0x00 };
+    const guint8 msg5[] = { 0x3e }, rsp5[] = { 0x00, 0x00, 0xef, 0x00 };
+    const guint8 msg6[] = { 0x40, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00 };
+    const guint8 rsp6[] = { 0x00, 0x00, 0x00, 0x10 };
+    guint8 msg4[485] = { 0 };
+    guint8 buff[0x100];
+    GError *error = NULL;
+    gsize len;
+
+    transport_test_exchange(transport, msg1, sizeof(msg1), 38, rsp1, sizeof(rsp1));
+    // 64 + 4 bytes completions are one response
+    transport_test_exchange(transport, msg2, sizeof(msg2), 68, rsp2, sizeof(rsp2));
+    transport_test_exchange(transport, msg3, sizeof(msg3), 84, rsp3, sizeof(rsp3));
+    // Doesn't match the captured command, taken in order
+    transport_test_exchange(transport, msg4, sizeof(msg4), 2, rsp1, 2);
+    transport_test_exchange(transport, msg5, sizeof(msg5), 76, rsp5, sizeof(rsp5));
+    // The capture repeats 3e, the replay skips to the command sent
+    transport_test_exchange(transport, msg6, sizeof(msg6), 4104, rsp6, sizeof(rsp6));
+
+    // Nothing captured before the next command
+    g_assert(!validity90_transport_read(transport, 0x81, buff, sizeof(buff), &len, 0, &error));
+    g_assert_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED);
+    g_clear_error(&error);
+
+    validity90_transport_free(transport);
+
+    g_assert(validity90_transport_replay_new("../dumps/missing.pcapng", FALSE, &error) == NULL);
+    g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+    g_clear_error(&error);
+}
+
+static void transport_test_transfer_cb(struct libusb_transfer *transfer) {
+    guint *completed = transfer->user_data;
+
+    (*completed)++;
+}
+
+// @TEST_DEF /transport/replay/async
+void TRANSPORT_REPLAY_ASYNC() {
+    validity90_transport *transport = transport_test_open(FALSE);
+    if (transport == NULL) {
+        return;
+    }
+
+    struct libusb_transfer *out = libusb_alloc_transfer(0);
+    struct libusb_transfer *in = libusb_alloc_transfer(0);
+    guint8 cmd[] = { 0x01 }, buff[0x100];
+    GError *error = NULL;
+    guint completed = 0;
+
+    libusb_fill_bulk_transfer(out, NULL, 0x01, cmd, sizeof(cmd), transport_test_transfer_cb, &completed, 0);
+    libusb_fill_bulk_transfer(in, NULL, 0x81, buff, sizeof(buff), transport_test_transfer_cb, &completed, 0);
+
+    // The response can't come before its command
+    g_assert(validity90_transport_submit(transport, in, &error));
+    g_assert(!validity90_transport_handle_events(transport, NULL, NULL, &error));
+    g_assert_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED);
+    g_clear_error(&error);
+    g_assert_cmpuint(completed, ==, 0);
+
+    g_assert(validity90_transport_submit(transport, out, &error));
+    g_assert(validity90_transport_handle_events(transport, NULL, NULL, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(completed, ==, 2);
+    g_assert_cmpint(out->status, ==, LIBUSB_TRANSFER_COMPLETED);
+    g_assert_cmpint(in->status, ==, LIBUSB_TRANSFER_COMPLETED);
+    g_assert_cmpint(in->actual_length, ==, 38);
+
+    // Cancelled transfers are returned on the next event handling
+    g_assert(validity90_transport_submit(transport, in, &error));
+    validity90_transport_cancel(transport, in);
+    g_assert_cmpuint(completed, ==, 2);
+    g_assert(validity90_transport_handle_events(transport, NULL, NULL, &error));
+    g_assert_cmpuint(completed, ==, 3);
+    g_assert_cmpint(in->status, ==, LIBUSB_TRANSFER_CANCELLED);
+
+    libusb_free_transfer(out);
+    libusb_free_transfer(in);
+    validity90_transport_free(transport);
+}
+
+// @TEST_DEF /transport/replay/faults
+void TRANSPORT_REPLAY_FAULTS() {
+    validity90_transport *transport = transport_test_open(FALSE);
+    if (transport == NULL) {
+        return;
+    }
+
+    const guint8 msg1[] = { 0x01 }, rsp1[] = { 0x00, 0x00, 0xf0, 0xb0 };
+    const guint8 msg2[] = { 0x19 }, rsp2[] = { 0x00, 0x00, 0x00, 0x03 };
+    guint8 buff[0x100], first[0x100];
+    GError *error = NULL;
+    gsize len;
+
+    transport_test_exchange(transport, msg1, sizeof(msg1), 38, rsp1, sizeof(rsp1));
+
+    validity90_transport_replay_inject(transport, 1, VALIDITY90_REPLAY_FAULT_STALL);
+    transport_test_exchange(transport, msg2, sizeof(msg2), 68, rsp2, sizeof(rsp2));
+    g_assert(validity90_transport_write(transport, 0x01, msg1, sizeof(msg1), 0, &error));
+    g_assert(!validity90_transport_read(transport, 0x81, buff, sizeof(buff), &len, 0, &error));
+    g_assert_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_USB);
+    g_clear_error(&error);
+
+    // Sent again after a reset, the capture starts over
+    g_assert(validity90_transport_reset(transport, &error));
+    transport_test_exchange(transport, msg1, sizeof(msg1), 38, rsp1, sizeof(rsp1));
+    transport_test_exchange(transport, msg2, sizeof(msg2), 68, rsp2, sizeof(rsp2));
+
+    g_assert(validity90_transport_write(transport, 0x01, msg1, sizeof(msg1), 0, &error));
+    g_assert(validity90_transport_read(transport, 0x81, first, sizeof(first), &len, 0, &error));
+    validity90_transport_replay_inject(transport, 0, VALIDITY90_REPLAY_FAULT_CORRUPT);
+    g_assert(validity90_transport_write(transport, 0x01, msg1, sizeof(msg1), 0, &error));
+    g_assert(validity90_transport_read(transport, 0x81, buff, sizeof(buff), &len, 0, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(len, ==, 38);
+    g_assert(memcmp(buff, first, len - 1) == 0);
+    g_assert_cmpuint(buff[len - 1], ==, first[len - 1] ^ 0xff);
+
+    validity90_transport_free(transport);
+}
+
+// @TEST_DEF /transport/replay/timing
+void TRANSPORT_REPLAY_TIMING() {
+    validity90_transport *transport = transport_test_open(TRUE);
+    if (transport == NULL) {
+        return;
+    }
+
+    const guint8 msg1[] = { 0x01 }, rsp1[] = { 0x00, 0x00, 0xf0, 0xb0 };
+
+    // Captured 94 ms after the command
+    g_test_timer_start();
+    transport_test_exchange(transport, msg1, sizeof(msg1), 38, rsp1, sizeof(rsp1));
+    g_assert_cmpfloat(g_test_timer_elapsed(), >=, 0.09);
+
+    validity90_transport_free(transport);
+}
+
+// @TEST_DEF /transport/replay/perf
+void TRANSPORT_REPLAY_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    const guint8 msg1[] = { 0x01 }, msg2[] = { 0x19 }, msg3[] = { 0x43, 0x02 }, msg5[] = { 0x3e };
+    const guint8 msg6[] = { 0x40, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00 };
+    guint8 msg4[485] = { 0 };
+    const guint8 *cmds[] = { msg1, msg2, msg3, msg4, msg5, msg6 };
+    const gsize cmd_lens[] = { sizeof(msg1), sizeof(msg2), sizeof(msg3), sizeof(msg4), sizeof(msg5), sizeof(msg6) };
+    guint8 buff[0x10000];
+    const int runs = 1000;
+    gsize bytes = 0, len;
+
+    validity90_transport *transport = transport_test_open(FALSE);
+    if (transport == NULL) {
+        return;
+    }
+    validity90_transport_free(transport);
+
+    // Whole init sequence, capture loading included
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        transport = validity90_transport_replay_new(DUMP10_PATH, FALSE, NULL);
+
+        for (int j = 0; j < G_N_ELEMENTS(cmds); j++) {
+            g_assert(validity90_transport_write(transport, 0x01, cmds[j], cmd_lens[j], 0, NULL));
+            g_assert(validity90_transport_read(transport, 0x81, buff, sizeof(buff), &len, 0, NULL));
+            bytes += cmd_lens[j] + len;
+        }
+        validity90_transport_free(transport);
+    }
+    gdouble time = g_test_timer_elapsed();
+
+    g_test_message("replay throughput: %.1f MB/s", bytes / time / 1e6);
+    g_test_minimized_result(time / runs * 1e6, "init replay: %.1f us", time / runs * 1e6);
+}
@@ -19,7 +19,9 @@
 
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "validity90/crypto.h"
 #include "validity90/utils.h"
 #include "validity90/validity90.h"
 
@@ -181,3 +183,371 @@ void UTILS_TLS_PRF_TEST6() {
     g_assert_cmpmem(master_key_aes, required_len, expected_result, G_N_ELEMENTS(expected_result));
 }
 
+// Well known TLS 1.2 PRF SHA256 vector
+static const guint8 utils_test_prf_secret[] = {
+    0x9b, 0xbe, 0x43, 0x6b, 0xa9, 0x40, 0xf0, 0x17, 0xb1, 0x76, 0x52, 0x84, 0x9a, 0x71, 0xdb, 0x35,
+};
+static const guint8 utils_test_prf_seed[] = {
+    0xa0, 0xba, 0x9f, 0x93, 0x6c, 0xda, 0x31, 0x18, 0x27, 0xa6, 0xf7, 0x96, 0xff, 0xd5, 0x19, 0x8c,
+};
+static const guint8 utils_test_prf_expected[] = {
+    0xe3, 0xf2, 0x29, 0xba, 0x72, 0x7b, 0xe1, 0x7b, 0x8d, 0x12, 0x26, 0x20, 0x55, 0x7c, 0xd4, 0x53,
+    0xc2, 0xaa, 0xb2, 0x1d, 0x07, 0xc3, 0xd4, 0x95, 0x32, 0x9b, 0x52, 0xd4, 0xe6, 0x1e, 0xdb, 0x5a,
+    0x6b, 0x30, 0x17, 0x91, 0xe9, 0x0d, 0x35, 0xc9, 0xc9, 0xa4, 0x6b, 0x4e, 0x14, 0xba, 0xf9, 0xaf,
+    0x0f, 0xa0, 0x22, 0xf7, 0x07, 0x7d, 0xef, 0x17, 0xab, 0xfd, 0x37, 0x97, 0xc0, 0x56, 0x4b, 0xab,
+    0x4f, 0xbc, 0x91, 0x66, 0x6e, 0x9d, 0xef, 0x9b, 0x97, 0xfc, 0xe3, 0x4f, 0x79, 0x67, 0x89, 0xba,
+    0xa4, 0x80, 0x82, 0xd1, 0x22, 0xee, 0x42, 0xc5, 0xa7, 0x2e, 0x5a, 0x51, 0x10, 0xff, 0xf7, 0x01,
+    0x87, 0x34, 0x7b, 0x66,
+};
+
+// @TEST_DEF /utils/tls_prf/engine
+void UTILS_TLS_PRF_ENGINE() {
+    guint8 out[G_N_ELEMENTS(utils_test_prf_expected)];
+    GError *error = NULL;
+
+    g_assert(validity90_tls_prf(utils_test_prf_secret, G_N_ELEMENTS(utils_test_prf_secret), "test label",
+                                utils_test_prf_seed, G_N_ELEMENTS(utils_test_prf_seed), sizeof(out), out, NULL));
+    g_assert_cmpmem(out, sizeof(out), utils_test_prf_expected, G_N_ELEMENTS(utils_test_prf_expected));
+
+    validity90_tls_prf_engine *engine = validity90_tls_prf_engine_new(utils_test_prf_secret,
+                                                                      G_N_ELEMENTS(utils_test_prf_secret), &error);
+    g_assert_no_error(error);
+
+    // Lengths that end inside a block and on its edge
+    for (gsize len = 1; len <= sizeof(out); len += 0x1f) {
+        memset(out, 0, sizeof(out));
+        g_assert(validity90_tls_prf_engine_derive(engine, "test label", utils_test_prf_seed,
+                                                  G_N_ELEMENTS(utils_test_prf_seed), len, out, &error));
+        g_assert_no_error(error);
+        g_assert_cmpmem(out, len, utils_test_prf_expected, len);
+        for (gsize i = len; i < sizeof(out); i++) {
+            g_assert_cmpuint(out[i], ==, 0);
+        }
+    }
+
+    // No label is the raw PRF
+    guint8 label_seed[10 + G_N_ELEMENTS(utils_test_prf_seed)];
+    memcpy(label_seed, "test label", 10);
+    memcpy(label_seed + 10, utils_test_prf_seed, G_N_ELEMENTS(utils_test_prf_seed));
+    g_assert(validity90_tls_prf_engine_derive(engine, NULL, label_seed, sizeof(label_seed), sizeof(out), out, NULL));
+    g_assert_cmpmem(out, sizeof(out), utils_test_prf_expected, G_N_ELEMENTS(utils_test_prf_expected));
+    g_assert(validity90_tls_prf_raw(utils_test_prf_secret, G_N_ELEMENTS(utils_test_prf_secret), label_seed,
+                                    sizeof(label_seed), sizeof(out), out, NULL));
+    g_assert_cmpmem(out, sizeof(out), utils_test_prf_expected, G_N_ELEMENTS(utils_test_prf_expected));
+
+    validity90_tls_prf_engine_free(engine);
+}
+
+// @TEST_DEF /utils/tls_prf/batch
+void UTILS_TLS_PRF_BATCH() {
+    // Everything the handshake derives from the master secret
+    guint8 master_secret[0x30], seed[0x40], handshake_hash[0x20];
+    guint8 key_block[0x120], client_finished[0x0c], server_finished[0x0c];
+    guint8 expected[0x120];
+    GError *error = NULL;
+
+    for (int i = 0; i < sizeof(master_secret); i++) {
+        master_secret[i] = i * 7 + 1;
+    }
+    for (int i = 0; i < sizeof(seed); i++) {
+        seed[i] = i * 13 + 5;
+    }
+    for (int i = 0; i < sizeof(handshake_hash); i++) {
+        handshake_hash[i] = i * 3 + 9;
+    }
+
+    validity90_tls_prf_output outputs[] = {
+        { "key expansion", seed, sizeof(seed), sizeof(key_block), key_block },
+        { "client finished", handshake_hash, sizeof(handshake_hash), sizeof(client_finished), client_finished },
+        { "server finished", handshake_hash, sizeof(handshake_hash), sizeof(server_finished), server_finished },
+    };
+
+    validity90_tls_prf_engine *engine = validity90_tls_prf_engine_new(master_secret, sizeof(master_secret), NULL);
+    g_assert(validity90_tls_prf_engine_derive_batch(engine, outputs, G_N_ELEMENTS(outputs), &error));
+    g_assert_no_error(error);
+    validity90_tls_prf_engine_free(engine);
+
+    for (int i = 0; i < G_N_ELEMENTS(outputs); i++) {
+        g_assert(validity90_tls_prf(master_secret, sizeof(master_secret), outputs[i].label, outputs[i].seed,
+                                    outputs[i].seed_len, outputs[i].required_len, expected, NULL));
+        g_assert_cmpmem(outputs[i].out_buff, outputs[i].required_len, expected, outputs[i].required_len);
+    }
+    g_assert(memcmp(client_finished, server_finished, sizeof(client_finished)) != 0);
+
+    // Keys longer than a block are hashed first
+    guint8 long_secret[0x50];
+    memset(long_secret, 0xa5, sizeof(long_secret));
+    engine = validity90_tls_prf_engine_new(long_secret, sizeof(long_secret), NULL);
+    g_assert(validity90_tls_prf_engine_derive(engine, "GWK", seed, 0x14, 0x20, key_block, NULL));
+    g_assert(validity90_tls_prf(long_secret, sizeof(long_secret), "GWK", seed, 0x14, 0x20, expected, NULL));
+    g_assert_cmpmem(key_block, 0x20, expected, 0x20);
+    validity90_tls_prf_engine_free(engine);
+}
+
+// @TEST_DEF /utils/tls_prf/perf
+void UTILS_TLS_PRF_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    const int runs = 20000;
+    guint8 master_secret[0x30] = { 0x01 }, seed[0x40] = { 0x02 }, handshake_hash[0x20] = { 0x03 };
+    guint8 key_block[0x120], client_finished[0x0c];
+    validity90_tls_prf_output outputs[] = {
+        { "key expansion", seed, sizeof(seed), sizeof(key_block), key_block },
+        { "client finished", handshake_hash, sizeof(handshake_hash), sizeof(client_finished), client_finished },
+    };
+
+    // Each derivation keys the HMAC again
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        for (int j = 0; j < G_N_ELEMENTS(outputs); j++) {
+            g_assert(validity90_tls_prf(master_secret, sizeof(master_secret), outputs[j].label, outputs[j].seed,
+                                        outputs[j].seed_len, outputs[j].required_len, outputs[j].out_buff, NULL));
+        }
+    }
+    gdouble one_shot_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        validity90_tls_prf_engine *engine = validity90_tls_prf_engine_new(master_secret, sizeof(master_secret), NULL);
+        g_assert(validity90_tls_prf_engine_derive_batch(engine, outputs, G_N_ELEMENTS(outputs), NULL));
+        validity90_tls_prf_engine_free(engine);
+    }
+    gdouble batch_time = g_test_timer_elapsed();
+
+    // Block throughput once keyed
+    validity90_tls_prf_engine *engine = validity90_tls_prf_engine_new(master_secret, sizeof(master_secret), NULL);
+    g_test_timer_start();
+    for (int i = 0; i < runs; i++) {
+        g_assert(validity90_tls_prf_engine_derive(engine, "key expansion", seed, sizeof(seed), sizeof(key_block),
+                                                  key_block, NULL));
+    }
+    gdouble keyed_time = g_test_timer_elapsed();
+    validity90_tls_prf_engine_free(engine);
+
+    g_test_message("one shot: %.2f us per handshake", one_shot_time / runs * 1e6);
+    g_test_message("engine + batch: %.2f us per handshake", batch_time / runs * 1e6);
+    g_test_maximized_result(runs * sizeof(key_block) / keyed_time / 1e6, "keyed PRF: %.1f MB/s",
+                            runs * sizeof(key_block) / keyed_time / 1e6);
+}
+
+
+// @TEST_DEF /utils/bstream/view
+void UTILS_BSTREAM_VIEW() {
+    const guint8 data[] = {
+        0x01, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12, 0x01, 0x00, 0x02, 0x00, 0xaa, 0xbb,
+    };
+    bstream stream;
+    guint8 u8;
+    guint16 u16, u16s[2];
+    guint32 u32;
+    const guint8 *slice;
+
+    bstream_init(&stream, data, G_N_ELEMENTS(data));
+
+    g_assert(bstream_read_uint8(&stream, &u8));
+    g_assert_cmphex(u8, ==, 0x01);
+    g_assert(bstream_read_uint16(&stream, &u16));
+    g_assert_cmphex(u16, ==, 0x1234);
+    g_assert(bstream_read_uint32(&stream, &u32));
+    g_assert_cmphex(u32, ==, 0x12345678);
+    g_assert(bstream_read_uint16_array(&stream, u16s, G_N_ELEMENTS(u16s)));
+    g_assert_cmphex(u16s[0], ==, 0x0001);
+    g_assert_cmphex(u16s[1], ==, 0x0002);
+
+    // Slices borrow the buffer, even the last byte is reachable
+    g_assert(!bstream_read_slice(&stream, 3, &slice));
+    g_assert(bstream_read_slice(&stream, 2, &slice));
+    g_assert(slice == data + 11);
+    g_assert_cmpuint(bstream_remaining(&stream), ==, 0);
+
+    g_assert(!bstream_read_uint8(&stream, &u8));
+    g_assert(!bstream_read_uint32_array(&stream, &u32, 1));
+}
+
+static const guint8 utils_test_aes_key[0x20] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+// PKCS#7 padded, out must hold plain_len rounded up to the next block
+static gsize utils_test_aes_encrypt(const guint8 *iv, const guint8 *plain, gsize plain_len, guint8 *out) {
+    validity90_aes_cbc *cipher;
+    gsize out_len = (plain_len / 0x10 + 1) * 0x10;
+    guint8 pad = out_len - plain_len;
+
+    memcpy(out, plain, plain_len);
+    memset(out + plain_len, pad, pad);
+
+    g_assert((cipher = validity90_aes_cbc_new(utils_test_aes_key, sizeof(utils_test_aes_key))) != NULL);
+    g_assert(validity90_aes_cbc_set_iv(cipher, iv));
+    g_assert(validity90_aes_cbc_encrypt(cipher, out, out, out_len));
+    validity90_aes_cbc_free(cipher);
+
+    return out_len;
+}
+
+// @TEST_DEF /utils/aes/padding
+void UTILS_AES_PADDING() {
+    guint8 block[0x20];
+    gsize len = 0;
+
+    memset(block, 0xaa, sizeof(block));
+    block[0x1f] = 0x01;
+    g_assert(validity90_check_aes_padding(block, sizeof(block), &len));
+    g_assert_cmpuint(len, ==, 0x1f);
+
+    memset(block + 0x10, 0x10, 0x10);
+    g_assert(validity90_check_aes_padding(block, sizeof(block), &len));
+    g_assert_cmpuint(len, ==, 0x10);
+
+    // One wrong byte anywhere in the padding
+    block[0x10] = 0x0f;
+    len = 0;
+    g_assert(!validity90_check_aes_padding(block, sizeof(block), &len));
+    g_assert_cmpuint(len, ==, 0);
+
+    // Longer than a block or than the data
+    memset(block, 0x11, sizeof(block));
+    g_assert(!validity90_check_aes_padding(block, sizeof(block), NULL));
+    memset(block, 0x10, 0x08);
+    g_assert(!validity90_check_aes_padding(block, 0x08, NULL));
+}
+
+// @TEST_DEF /utils/aes/decryptor
+void UTILS_AES_DECRYPTOR() {
+    const gsize plain_lens[] = { 0, 0x10, 0x1f, 0x1234 };
+    guint8 ivs[G_N_ELEMENTS(plain_lens)][0x10];
+    guint8 *plain[G_N_ELEMENTS(plain_lens)];
+    guint8 *cipher[G_N_ELEMENTS(plain_lens)];
+    guint8 *out[G_N_ELEMENTS(plain_lens)];
+    validity90_aes_record records[G_N_ELEMENTS(plain_lens)];
+    GError *error = NULL;
+
+    for (int i = 0; i < G_N_ELEMENTS(plain_lens); i++) {
+        validity90_crypto_random(ivs[i], 0x10);
+        plain[i] = g_malloc(plain_lens[i] + 1);
+        for (gsize j = 0; j < plain_lens[i]; j++) {
+            plain[i][j] = i + j;
+        }
+        cipher[i] = g_malloc(plain_lens[i] + 0x10);
+        out[i] = g_malloc(plain_lens[i] + 0x10);
+
+        records[i] = (validity90_aes_record) {
+            .iv = ivs[i],
+            .ciphertext = cipher[i],
+            .ciphertext_len = utils_test_aes_encrypt(ivs[i], plain[i], plain_lens[i], cipher[i]),
+            // In place works too
+            .out_buff = i == 2 ? cipher[i] : out[i],
+        };
+    }
+
+    // Same as the one shot call on IV || ciphertext
+    guint8 *joined = g_malloc(records[3].ciphertext_len + 0x10);
+    GByteArray *one_shot = NULL;
+    memcpy(joined, ivs[3], 0x10);
+    memcpy(joined + 0x10, cipher[3], records[3].ciphertext_len);
+    g_assert(validity90_aes_decrypt(joined, records[3].ciphertext_len + 0x10, utils_test_aes_key,
+                                    sizeof(utils_test_aes_key), &one_shot, &error));
+    g_assert_no_error(error);
+    g_assert_cmpmem(one_shot->data, one_shot->len, plain[3], plain_lens[3]);
+    g_byte_array_free(one_shot, TRUE);
+    g_free(joined);
+
+    validity90_aes_decryptor *decryptor = validity90_aes_decryptor_new(utils_test_aes_key, sizeof(utils_test_aes_key),
+                                                                       &error);
+    g_assert_no_error(error);
+    g_assert(validity90_aes_decryptor_decrypt_batch(decryptor, records, G_N_ELEMENTS(records), &error));
+    g_assert_no_error(error);
+
+    for (int i = 0; i < G_N_ELEMENTS(plain_lens); i++) {
+        g_assert_cmpmem(records[i].out_buff, records[i].out_len, plain[i], plain_lens[i]);
+    }
+
+    // Flipping the IV flips the plaintext, the last byte is the padding of a one block record
+    ivs[1][0x0f] ^= 0x01;
+    records[1].out_buff = out[1];
+    g_assert(validity90_aes_decryptor_decrypt(decryptor, &records[1], &error));
+    g_assert_no_error(error);
+    ivs[0][0x0f] ^= 0x01;
+    g_assert(!validity90_aes_decryptor_decrypt_batch(decryptor, records, G_N_ELEMENTS(records), &error));
+    g_assert_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_PADDING_FAILED);
+    g_assert(g_str_has_prefix(error->message, "Record 0: "));
+    g_clear_error(&error);
+
+    records[0].ciphertext_len = 0x18;
+    g_assert(!validity90_aes_decryptor_decrypt(decryptor, &records[0], &error));
+    g_assert_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_DECRYPTION_FAILED);
+    g_clear_error(&error);
+
+    validity90_aes_decryptor_free(decryptor);
+    for (int i = 0; i < G_N_ELEMENTS(plain_lens); i++) {
+        g_free(plain[i]);
+        g_free(cipher[i]);
+        g_free(out[i]);
+    }
+}
+
+// @TEST_DEF /utils/aes/perf
+void UTILS_AES_PERF() {
+    if (!g_test_perf()) {
+        return;
+    }
+
+    // Same amount of data for every payload size
+    const gsize total = 0x400000;
+    guint8 iv[0x10] = { 0 };
+    guint8 *cipher = g_malloc(total * 2);
+    guint8 *joined = g_malloc(0x10000 + 0x20);
+    guint8 *out = g_malloc(0x10000 + 0x10);
+
+    for (gsize size = 0x10; size <= 0x10000; size *= 4) {
+        guint count = total / size;
+        gsize cipher_len = 0, out_len;
+        validity90_aes_record *records = g_new(validity90_aes_record, count);
+        guint8 *plain = g_malloc0(size);
+
+        for (guint i = 0; i < count; i++) {
+            records[i] = (validity90_aes_record) {
+                .iv = iv,
+                .ciphertext = cipher + i * (size + 0x10),
+                .ciphertext_len = utils_test_aes_encrypt(iv, plain, size, cipher + i * (size + 0x10)),
+                .out_buff = out,
+            };
+        }
+        cipher_len = records[0].ciphertext_len;
+        memcpy(joined, iv, 0x10);
+        memcpy(joined + 0x10, cipher, cipher_len);
+
+        // Cipher set up for every record
+        g_test_timer_start();
+        for (guint i = 0; i < count; i++) {
+            g_assert(validity90_aes_decrypt_into(joined, cipher_len + 0x10, utils_test_aes_key,
+                                                 sizeof(utils_test_aes_key), out, &out_len, NULL));
+        }
+        gdouble one_shot_time = g_test_timer_elapsed();
+
+        validity90_aes_decryptor *decryptor = validity90_aes_decryptor_new(utils_test_aes_key,
+                                                                           sizeof(utils_test_aes_key), NULL);
+        g_test_timer_start();
+        g_assert(validity90_aes_decryptor_decrypt_batch(decryptor, records, count, NULL));
+        gdouble batch_time = g_test_timer_elapsed();
+        validity90_aes_decryptor_free(decryptor);
+
+        g_test_message("%6lu B: one shot %.1f MB/s, %.2f us per record", size, total / one_shot_time / 1e6,
+                       one_shot_time / count * 1e6);
+        g_test_message("%6lu B: batch %.1f MB/s, %.2f us per record", size, total / batch_time / 1e6,
+                       batch_time / count * 1e6);
+        if (size == 0x10) {
+            g_test_minimized_result(batch_time / count * 1e6, "16 B record: %.2f us", batch_time / count * 1e6);
+        }
+
+        g_free(plain);
+        g_free(records);
+    }
+
+    g_free(cipher);
+    g_free(joined);
+    g_free(out);
+}
@@ -0,0 +1,213 @@
+/*
+ * Validity90 USB latency profiler
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "validity90/latency.h"
+#include "validity90/utils.h"
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-k KEY_BLOCK | -m MASTER_SECRET] CAPTURE.pcapng...\n"
+            "\n"
+            "Pairs every bulk command of the sensor in a usbmon capture with its response and\n"
+            "the interrupts after it, and prints the round trip per opcode in ms: count, min,\n"
+            "p50, p99, max and total. Idle gaps are the times nothing was outstanding and no\n"
+            "interrupt was awaited, the largest ones show where commands could be queued earlier.\n"
+            "Opcodes of TLS application data need the session keys, as for decrypt-capture.\n"
+            "With several captures, e.g. the vendor driver's and the prototype's, their p50 are\n"
+            "compared last.\n",
+            name);
+}
+
+static const char *key_name(validity90_latency_key key, char *buff, gsize buff_size) {
+    static const char *kinds[] = {
+        [VALIDITY90_LATENCY_COMMAND] = "cmd",
+        [VALIDITY90_LATENCY_RECORD] = "tls",
+        [VALIDITY90_LATENCY_INTERRUPT] = "irq",
+    };
+
+    g_snprintf(buff, buff_size, "%s:%02x", kinds[key.kind], key.code);
+    return buff;
+}
+
+static void print_report(const char *path, validity90_latency *latency) {
+    validity90_latency_summary summary;
+    const validity90_latency_series *series;
+    const validity90_latency_gap *gaps;
+    guint series_count, gaps_count;
+    char name[16], after[16];
+
+    validity90_latency_get_summary(latency, &summary);
+    series = validity90_latency_get_series(latency, &series_count);
+    gaps = validity90_latency_get_gaps(latency, &gaps_count);
+
+    printf("%s: %u commands (%u answered), %u interrupts in %.3f ms\n", path, summary.commands, summary.answered,
+           summary.interrupts, summary.span_us / 1e3);
+    printf("  busy %.3f ms, waiting for interrupts %.3f ms, idle %.3f ms in %u gaps (p50 %.3f, p99 %.3f, max %.3f)\n",
+           summary.busy_us / 1e3, summary.wait_us / 1e3, summary.idle_us / 1e3, summary.gaps,
+           summary.gap_p50_us / 1e3, summary.gap_p99_us / 1e3, summary.gap_max_us / 1e3);
+
+    printf("  %-7s %6s %9s %9s %9s %9s %10s\n", "", "count", "min", "p50", "p99", "max", "total");
+    for (guint i = 0; i < series_count; i++) {
+        const validity90_latency_series *s = &series[i];
+
+        printf("  %-7s %6u %9.3f %9.3f %9.3f %9.3f %10.3f\n", key_name(s->key, name, sizeof(name)), s->count,
+               s->min_us / 1e3, s->p50_us / 1e3, s->p99_us / 1e3, s->max_us / 1e3, s->total_us / 1e3);
+    }
+
+    if (gaps_count > 0) {
+        printf("  largest idle gaps:\n");
+    }
+    for (guint i = 0; i < gaps_count; i++) {
+        printf("  %11.6f s %9.3f ms after %s before %s\n", gaps[i].start_us / 1e6, gaps[i].gap_us / 1e3,
+               key_name(gaps[i].after, after, sizeof(after)), key_name(gaps[i].before, name, sizeof(name)));
+    }
+    puts("");
+}
+
+static const validity90_latency_series *find_series(validity90_latency *latency, validity90_latency_key key) {
+    guint count;
+    const validity90_latency_series *series = validity90_latency_get_series(latency, &count);
+
+    for (guint i = 0; i < count; i++) {
+        if (series[i].key.kind == key.kind && series[i].key.code == key.code) {
+            return &series[i];
+        }
+    }
+    return NULL;
+}
+
+// p50 of every opcode of the first capture next to the same opcode in the others
+static void print_comparison(char **paths, validity90_latency **latencies, guint count) {
+    guint series_count;
+    const validity90_latency_series *series = validity90_latency_get_series(latencies[0], &series_count);
+    GArray *keys = g_array_new(FALSE, FALSE, sizeof(validity90_latency_key));
+    char name[16];
+
+    // find_series rebuilds the series, the keys of the first capture are copied before
+    for (guint i = 0; i < series_count; i++) {
+        g_array_append_val(keys, series[i].key);
+    }
+
+    printf("p50 ms  ");
+    for (guint c = 0; c < count; c++) {
+        printf(" %s", paths[c]);
+    }
+    puts("");
+
+    for (guint i = 0; i < keys->len; i++) {
+        validity90_latency_key key = g_array_index(keys, validity90_latency_key, i);
+
+        printf("%-7s", key_name(key, name, sizeof(name)));
+        for (guint c = 0; c < count; c++) {
+            const validity90_latency_series *s = find_series(latencies[c], key);
+
+            if (s != NULL) {
+                printf(" %9.3f", s->p50_us / 1e3);
+            } else {
+                printf(" %9s", "-");
+            }
+        }
+        puts("");
+    }
+
+    g_array_free(keys, TRUE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *key_block_hex = NULL, *master_secret_hex = NULL;
+    guint8 *key_block = NULL, *master_secret = NULL;
+    gsize key_block_len = 0, master_secret_len = 0;
+    GPtrArray *paths = g_ptr_array_new();
+    GPtrArray *latencies = g_ptr_array_new_with_free_func((GDestroyNotify) validity90_latency_free);
+    GError *error = NULL;
+    int ret = EXIT_FAILURE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            key_block_hex = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            master_secret_hex = argv[++i];
+        } else if (argv[i][0] != '-') {
+            g_ptr_array_add(paths, argv[i]);
+        } else {
+            usage(argv[0]);
+            goto end;
+        }
+    }
+    if (paths->len == 0 || (key_block_hex != NULL && master_secret_hex != NULL)) {
+        usage(argv[0]);
+        goto end;
+    }
+
+    if (key_block_hex != NULL && !validity90_parse_hex(key_block_hex, &key_block, &key_block_len)) {
+        fprintf(stderr, "Key block is not hex\n");
+        goto end;
+    }
+    if (master_secret_hex != NULL && !validity90_parse_hex(master_secret_hex, &master_secret, &master_secret_len)) {
+        fprintf(stderr, "Master secret is not hex\n");
+        goto end;
+    }
+
+    for (guint i = 0; i < paths->len; i++) {
+        const char *path = g_ptr_array_index(paths, i);
+        validity90_latency *latency = validity90_latency_new();
+        validity90_capture_decoder *decoder = validity90_latency_get_decoder(latency);
+
+        g_ptr_array_add(latencies, latency);
+
+        if (key_block != NULL && !validity90_capture_decoder_set_key_block(decoder, key_block, key_block_len, &error)) {
+            fprintf(stderr, "Bad key block: %s\n", error->message);
+            goto end;
+        }
+        if (master_secret != NULL) {
+            validity90_capture_decoder_set_master_secret(decoder, master_secret, master_secret_len);
+        }
+
+        if (!validity90_latency_profile_file(latency, path, &error)) {
+            fprintf(stderr, "%s\n", error->message);
+            goto end;
+        }
+        print_report(path, latency);
+    }
+
+    if (paths->len > 1) {
+        print_comparison((char **) paths->pdata, (validity90_latency **) latencies->pdata, paths->len);
+    }
+    ret = EXIT_SUCCESS;
+
+end:
+    g_clear_error(&error);
+    if (key_block != NULL) {
+        memset(key_block, 0, key_block_len);
+    }
+    if (master_secret != NULL) {
+        memset(master_secret, 0, master_secret_len);
+    }
+    g_free(key_block);
+    g_free(master_secret);
+    g_ptr_array_free(latencies, TRUE);
+    g_ptr_array_free(paths, TRUE);
+
+    return ret;
+}
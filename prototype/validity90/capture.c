@@ -0,0 +1,421 @@
+/*
+ * Validity90 capture decoding
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "capture.h"
+#include "tls.h"
+#include "utils.h"
+
+GQuark validity90_capture_error_quark (void) {
+  return g_quark_from_static_string ("validity-capture-error-quark");
+}
+
+#define CAPTURE_EP_OUT 0x01
+#define CAPTURE_EP_IN 0x81
+// Responses longer than this come in several completions
+#define CAPTURE_MAX_PACKET_SIZE 0x40
+
+#define CAPTURE_TLS_CHANGE_CIPHER_SPEC 0x14
+#define CAPTURE_TLS_HANDSHAKE 0x16
+#define CAPTURE_TLS_APPLICATION_DATA 0x17
+
+#define CAPTURE_HELLO_CLIENT 0x01
+#define CAPTURE_HELLO_SERVER 0x02
+// Handshake type, length and version come before the random
+#define CAPTURE_HELLO_RANDOM_OFFSET 0x06
+#define CAPTURE_RANDOM_SIZE 0x20
+
+#define CAPTURE_KEY_BLOCK_SIZE 0x120
+
+// The client sends its handshake records after this
+static const guint8 capture_handshake_prefix[] = { 0x44, 0x00, 0x00, 0x00 };
+
+typedef struct capture_direction {
+    gboolean in;
+
+    // Tail of a record, or a plain response, waiting for the next transfers
+    GByteArray *pending;
+    gint64 pending_ts;
+    gboolean pending_plain;
+
+    // Records after a change cipher spec are encrypted
+    gboolean encrypted;
+    // Opens the records of this direction as if they were received
+    validity90_tls_session *session;
+} capture_direction;
+
+struct validity90_capture_decoder {
+    validity90_capture_cb cb;
+    gpointer user_data;
+
+    capture_direction out;
+    capture_direction in;
+
+    guint8 *master_secret;
+    gsize master_secret_len;
+    guint8 client_random[CAPTURE_RANDOM_SIZE];
+    guint8 server_random[CAPTURE_RANDOM_SIZE];
+    gboolean has_client_random;
+    gboolean has_server_random;
+
+    // Records are opened in place, so they are copied here first
+    GByteArray *scratch;
+
+    guint packets;
+    guint messages;
+    guint decrypted;
+    guint encrypted;
+};
+
+validity90_capture_decoder *validity90_capture_decoder_new(validity90_capture_cb cb, gpointer user_data) {
+    validity90_capture_decoder *decoder = g_malloc0(sizeof(validity90_capture_decoder));
+
+    decoder->cb = cb;
+    decoder->user_data = user_data;
+    decoder->out.pending = g_byte_array_new();
+    decoder->in.in = TRUE;
+    decoder->in.pending = g_byte_array_new();
+    decoder->scratch = g_byte_array_new();
+
+    return decoder;
+}
+
+void validity90_capture_decoder_free(validity90_capture_decoder *decoder) {
+    if (decoder == NULL) {
+        return;
+    }
+    g_byte_array_free(decoder->out.pending, TRUE);
+    g_byte_array_free(decoder->in.pending, TRUE);
+    g_clear_pointer(&decoder->out.session, validity90_tls_session_free);
+    g_clear_pointer(&decoder->in.session, validity90_tls_session_free);
+    if (decoder->master_secret != NULL) {
+        memset(decoder->master_secret, 0, decoder->master_secret_len);
+        g_free(decoder->master_secret);
+    }
+    memset(decoder->scratch->data, 0, decoder->scratch->len);
+    g_byte_array_free(decoder->scratch, TRUE);
+    g_free(decoder);
+}
+
+gboolean validity90_capture_decoder_set_key_block(validity90_capture_decoder *decoder, const guint8 *key_block,
+                                                  gsize key_block_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    validity90_tls_session *in, *out;
+    guint8 swapped[VALIDITY90_TLS_KEY_BLOCK_SIZE];
+
+    if ((in = validity90_tls_session_new(key_block, key_block_len, error)) == NULL) {
+        return FALSE;
+    }
+
+    // Host keys in the place of the sensor ones, so OUT records open like IN ones
+    memcpy(swapped, key_block, sizeof(swapped));
+    memcpy(swapped + VALIDITY90_TLS_MAC_IN_OFFSET, key_block + VALIDITY90_TLS_MAC_OUT_OFFSET, VALIDITY90_TLS_MAC_SIZE);
+    memcpy(swapped + VALIDITY90_TLS_MAC_OUT_OFFSET, key_block + VALIDITY90_TLS_MAC_IN_OFFSET, VALIDITY90_TLS_MAC_SIZE);
+    memcpy(swapped + VALIDITY90_TLS_KEY_IN_OFFSET, key_block + VALIDITY90_TLS_KEY_OUT_OFFSET, 0x20);
+    memcpy(swapped + VALIDITY90_TLS_KEY_OUT_OFFSET, key_block + VALIDITY90_TLS_KEY_IN_OFFSET, 0x20);
+    out = validity90_tls_session_new(swapped, sizeof(swapped), error);
+    memset(swapped, 0, sizeof(swapped));
+    if (out == NULL) {
+        validity90_tls_session_free(in);
+        return FALSE;
+    }
+
+    g_clear_pointer(&decoder->in.session, validity90_tls_session_free);
+    g_clear_pointer(&decoder->out.session, validity90_tls_session_free);
+    decoder->in.session = in;
+    decoder->out.session = out;
+
+    return TRUE;
+}
+
+void validity90_capture_decoder_set_master_secret(validity90_capture_decoder *decoder, const guint8 *master_secret,
+                                                  gsize master_secret_len) {
+    g_free(decoder->master_secret);
+    decoder->master_secret = g_memdup(master_secret, master_secret_len);
+    decoder->master_secret_len = master_secret_len;
+}
+
+static void capture_emit(validity90_capture_decoder *decoder, gint64 ts_us, gboolean in, validity90_capture_kind kind,
+                         guint8 type, const guint8 *data, gsize data_len) {
+    validity90_capture_message message = {
+        .ts_us = ts_us,
+        .in = in,
+        .kind = kind,
+        .type = type,
+        .data = data,
+        .data_len = data_len,
+    };
+
+    decoder->messages++;
+    decoder->decrypted += kind == VALIDITY90_CAPTURE_DECRYPTED;
+    decoder->encrypted += kind == VALIDITY90_CAPTURE_ENCRYPTED;
+
+    if (decoder->cb != NULL) {
+        decoder->cb(&message, decoder->user_data);
+    }
+}
+
+static void capture_expand_keys(validity90_capture_decoder *decoder) {
+    guint8 seed[CAPTURE_RANDOM_SIZE * 2];
+    guint8 key_block[CAPTURE_KEY_BLOCK_SIZE];
+
+    memcpy(seed, decoder->client_random, CAPTURE_RANDOM_SIZE);
+    memcpy(seed + CAPTURE_RANDOM_SIZE, decoder->server_random, CAPTURE_RANDOM_SIZE);
+
+    if (validity90_tls_prf(decoder->master_secret, decoder->master_secret_len, "key expansion", seed, sizeof(seed),
+                           sizeof(key_block), key_block, NULL)) {
+        validity90_capture_decoder_set_key_block(decoder, key_block, sizeof(key_block), NULL);
+    }
+    memset(key_block, 0, sizeof(key_block));
+}
+
+static void capture_handshake(validity90_capture_decoder *decoder, const guint8 *body, gsize body_len) {
+    if (body_len < CAPTURE_HELLO_RANDOM_OFFSET + CAPTURE_RANDOM_SIZE) {
+        return;
+    }
+
+    if (body[0] == CAPTURE_HELLO_CLIENT) {
+        // A new session, nothing is encrypted until its change cipher specs
+        memcpy(decoder->client_random, body + CAPTURE_HELLO_RANDOM_OFFSET, CAPTURE_RANDOM_SIZE);
+        decoder->has_client_random = TRUE;
+        decoder->has_server_random = FALSE;
+        decoder->out.encrypted = FALSE;
+        decoder->in.encrypted = FALSE;
+    } else if (body[0] == CAPTURE_HELLO_SERVER && decoder->has_client_random) {
+        memcpy(decoder->server_random, body + CAPTURE_HELLO_RANDOM_OFFSET, CAPTURE_RANDOM_SIZE);
+        decoder->has_server_random = TRUE;
+
+        if (decoder->master_secret != NULL) {
+            capture_expand_keys(decoder);
+        }
+    }
+}
+
+static void capture_record(validity90_capture_decoder *decoder, capture_direction *dir, gint64 ts_us,
+                           const guint8 *record, gsize record_len) {
+    const guint8 *body = record + VALIDITY90_TLS_HEADER_SIZE;
+    gsize body_len = record_len - VALIDITY90_TLS_HEADER_SIZE;
+    guint8 type = record[0];
+
+    if (!dir->encrypted || type == CAPTURE_TLS_CHANGE_CIPHER_SPEC) {
+        capture_emit(decoder, ts_us, dir->in, VALIDITY90_CAPTURE_TLS, type, body, body_len);
+
+        if (type == CAPTURE_TLS_CHANGE_CIPHER_SPEC) {
+            dir->encrypted = TRUE;
+        } else if (type == CAPTURE_TLS_HANDSHAKE) {
+            capture_handshake(decoder, body, body_len);
+        }
+        return;
+    }
+
+    if (dir->session != NULL) {
+        guint8 *plain;
+        gsize plain_len;
+
+        g_byte_array_set_size(decoder->scratch, record_len);
+        memcpy(decoder->scratch->data, record, record_len);
+
+        if (validity90_tls_session_open_record(dir->session, decoder->scratch->data, record_len,
+                                               &plain, &plain_len, NULL)) {
+            capture_emit(decoder, ts_us, dir->in, VALIDITY90_CAPTURE_DECRYPTED, type, plain, plain_len);
+            return;
+        }
+    }
+
+    capture_emit(decoder, ts_us, dir->in, VALIDITY90_CAPTURE_ENCRYPTED, type, body, body_len);
+}
+
+static gboolean capture_is_record_header(const guint8 *data, gsize data_len) {
+    return data_len >= VALIDITY90_TLS_HEADER_SIZE &&
+           data[0] >= CAPTURE_TLS_CHANGE_CIPHER_SPEC && data[0] <= CAPTURE_TLS_APPLICATION_DATA &&
+           data[1] == 0x03 && data[2] == 0x03;
+}
+
+/* Returns how much of data is whole records, the rest waits for more transfers */
+static gsize capture_records(validity90_capture_decoder *decoder, capture_direction *dir, gint64 ts_us,
+                             const guint8 *data, gsize data_len) {
+    gsize pos = 0;
+
+    while (data_len - pos >= VALIDITY90_TLS_HEADER_SIZE) {
+        if (!capture_is_record_header(data + pos, data_len - pos)) {
+            // Lost track of the records
+            capture_emit(decoder, ts_us, dir->in, VALIDITY90_CAPTURE_PLAIN, 0, data + pos, data_len - pos);
+            return data_len;
+        }
+
+        gsize record_len = VALIDITY90_TLS_HEADER_SIZE + ((data[pos + 3] << 8) | data[pos + 4]);
+        if (record_len > data_len - pos) {
+            break;
+        }
+        capture_record(decoder, dir, ts_us, data + pos, record_len);
+        pos += record_len;
+    }
+
+    return pos;
+}
+
+static void capture_flush(validity90_capture_decoder *decoder, capture_direction *dir) {
+    if (dir->pending->len > 0) {
+        capture_emit(decoder, dir->pending_ts, dir->in, VALIDITY90_CAPTURE_PLAIN, 0,
+                     dir->pending->data, dir->pending->len);
+        g_byte_array_set_size(dir->pending, 0);
+    }
+    dir->pending_plain = FALSE;
+}
+
+void validity90_capture_decoder_feed(validity90_capture_decoder *decoder, gint64 ts_us, gboolean in,
+                                     const guint8 *data, gsize data_len) {
+    capture_direction *dir = in ? &decoder->in : &decoder->out;
+
+    decoder->packets++;
+
+    // A command ends the response before it
+    if (!in && decoder->in.pending_plain) {
+        capture_flush(decoder, &decoder->in);
+    }
+
+    if (dir->pending_plain) {
+        g_byte_array_append(dir->pending, data, data_len);
+        if (data_len % CAPTURE_MAX_PACKET_SIZE != 0) {
+            capture_flush(decoder, dir);
+        }
+        return;
+    }
+
+    if (dir->pending->len > 0) {
+        g_byte_array_append(dir->pending, data, data_len);
+        gsize consumed = capture_records(decoder, dir, dir->pending_ts, dir->pending->data, dir->pending->len);
+        g_byte_array_remove_range(dir->pending, 0, consumed);
+        return;
+    }
+
+    if (!in && data_len > sizeof(capture_handshake_prefix) &&
+        memcmp(data, capture_handshake_prefix, sizeof(capture_handshake_prefix)) == 0 &&
+        capture_is_record_header(data + sizeof(capture_handshake_prefix), data_len - sizeof(capture_handshake_prefix))) {
+        data += sizeof(capture_handshake_prefix);
+        data_len -= sizeof(capture_handshake_prefix);
+    }
+
+    if (!capture_is_record_header(data, data_len)) {
+        if (in && data_len > 0 && data_len % CAPTURE_MAX_PACKET_SIZE == 0) {
+            g_byte_array_append(dir->pending, data, data_len);
+            dir->pending_ts = ts_us;
+            dir->pending_plain = TRUE;
+        } else {
+            capture_emit(decoder, ts_us, in, VALIDITY90_CAPTURE_PLAIN, 0, data, data_len);
+        }
+        return;
+    }
+
+    // Whole records are decoded straight from the transfer, only a split tail is copied
+    gsize consumed = capture_records(decoder, dir, ts_us, data, data_len);
+    if (consumed < data_len) {
+        g_byte_array_append(dir->pending, data + consumed, data_len - consumed);
+        dir->pending_ts = ts_us;
+    }
+}
+
+void validity90_capture_decoder_flush(validity90_capture_decoder *decoder) {
+    capture_flush(decoder, &decoder->out);
+    capture_flush(decoder, &decoder->in);
+}
+
+gboolean validity90_capture_walk_file(const gchar *path, validity90_capture_packet_cb cb, gpointer user_data,
+                                      GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    validity90_pcapng *pcap;
+    validity90_usb_packet packet;
+    GError *local_error = NULL;
+    gboolean found = FALSE;
+    guint16 busnum = 0;
+    guint8 devnum = 0;
+
+    if ((pcap = validity90_pcapng_open(path, error)) == NULL) {
+        return FALSE;
+    }
+
+    while (validity90_pcapng_next(pcap, &packet, &local_error)) {
+        gboolean in = (packet.ep & 0x80) != 0;
+
+        if (packet.data_len == 0 ||
+            (packet.xfer_type != VALIDITY90_USB_XFER_BULK && packet.xfer_type != VALIDITY90_USB_XFER_INTERRUPT)) {
+            continue;
+        }
+        // Data goes out with the submission and comes in with the completion
+        if (in ? packet.event != 'C' || packet.status != 0 : packet.event != 'S') {
+            continue;
+        }
+
+        // The sensor is whoever gets the first command
+        if (!found && packet.ep == CAPTURE_EP_OUT) {
+            found = TRUE;
+            busnum = packet.busnum;
+            devnum = packet.devnum;
+        }
+        if (found && packet.busnum == busnum && packet.devnum == devnum) {
+            cb(&packet, user_data);
+        }
+    }
+    validity90_pcapng_free(pcap);
+
+    if (local_error != NULL) {
+        g_propagate_error(error, local_error);
+        return FALSE;
+    }
+    if (!found) {
+        g_set_error(error, VALIDITY90_CAPTURE_ERROR, VALIDITY90_CAPTURE_ERR_NO_SENSOR,
+                    "Capture: no sensor traffic in %s", path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void capture_decode_packet(const validity90_usb_packet *packet, gpointer user_data) {
+    validity90_capture_decoder *decoder = user_data;
+
+    if (packet->ep == CAPTURE_EP_OUT || packet->ep == CAPTURE_EP_IN) {
+        validity90_capture_decoder_feed(decoder, packet->ts_us, packet->ep == CAPTURE_EP_IN, packet->data,
+                                        packet->data_len);
+    }
+}
+
+gboolean validity90_capture_decode_file(validity90_capture_decoder *decoder, const gchar *path,
+                                        validity90_capture_stats *stats, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    gboolean result = validity90_capture_walk_file(path, capture_decode_packet, decoder, error);
+
+    validity90_capture_decoder_flush(decoder);
+    if (!result) {
+        return FALSE;
+    }
+
+    if (stats != NULL) {
+        stats->packets = decoder->packets;
+        stats->messages = decoder->messages;
+        stats->decrypted = decoder->decrypted;
+        stats->encrypted = decoder->encrypted;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,116 @@
+/*
+ * Validity90 capture decoding
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <glib.h>
+
+#include "pcapng.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_CAPTURE_ERROR validity90_capture_error_quark()
+
+GQuark validity90_capture_error_quark(void);
+
+enum validity90_capture_error_codes {
+    VALIDITY90_CAPTURE_ERR_NO_SENSOR,
+};
+
+typedef enum validity90_capture_kind {
+    // Not TLS: commands before the handshake and their responses
+    VALIDITY90_CAPTURE_PLAIN,
+    // TLS record sent in clear, data is the record body
+    VALIDITY90_CAPTURE_TLS,
+    // Encrypted TLS record, data is the plaintext
+    VALIDITY90_CAPTURE_DECRYPTED,
+    // Encrypted TLS record without keys or with a bad MAC, data is the record body
+    VALIDITY90_CAPTURE_ENCRYPTED,
+} validity90_capture_kind;
+
+typedef struct validity90_capture_message {
+    gint64 ts_us;
+    // From the sensor to the host
+    gboolean in;
+    validity90_capture_kind kind;
+    // TLS content type, 0 for plain messages
+    guint8 type;
+
+    // Only valid during the callback
+    const guint8 *data;
+    gsize data_len;
+} validity90_capture_message;
+
+typedef void (*validity90_capture_cb)(const validity90_capture_message *message, gpointer user_data);
+
+/*
+ * Turns the bulk traffic of a sensor back into messages: plain commands
+ * and responses, and TLS records reassembled across transfers, decrypted
+ * once keys are known.
+ */
+typedef struct validity90_capture_decoder validity90_capture_decoder;
+
+validity90_capture_decoder *validity90_capture_decoder_new(validity90_capture_cb cb, gpointer user_data);
+void validity90_capture_decoder_free(validity90_capture_decoder *decoder);
+
+/* Session keys as the prototype prints them after the handshake */
+gboolean validity90_capture_decoder_set_key_block(validity90_capture_decoder *decoder, const guint8 *key_block,
+                                                  gsize key_block_len, GError **error);
+
+/* The key block is then expanded with the hello randoms of the capture */
+void validity90_capture_decoder_set_master_secret(validity90_capture_decoder *decoder, const guint8 *master_secret,
+                                                  gsize master_secret_len);
+
+/* data of one bulk transfer: an OUT submission or an IN completion */
+void validity90_capture_decoder_feed(validity90_capture_decoder *decoder, gint64 ts_us, gboolean in,
+                                     const guint8 *data, gsize data_len);
+
+/* Messages still waiting for the rest of their transfers */
+void validity90_capture_decoder_flush(validity90_capture_decoder *decoder);
+
+typedef struct validity90_capture_stats {
+    guint packets;
+    guint messages;
+    guint decrypted;
+    guint encrypted;
+} validity90_capture_stats;
+
+typedef void (*validity90_capture_packet_cb)(const validity90_usb_packet *packet, gpointer user_data);
+
+/*
+ * Walks the bulk and interrupt traffic of a usbmon capture: OUT submissions
+ * and successful IN completions that carry data, of the sensor only. The
+ * sensor is whoever gets the first command, VALIDITY90_CAPTURE_ERR_NO_SENSOR
+ * when nobody does.
+ */
+gboolean validity90_capture_walk_file(const gchar *path, validity90_capture_packet_cb cb, gpointer user_data,
+                                      GError **error);
+
+/* Feeds every bulk transfer of the first sensor found in the capture */
+gboolean validity90_capture_decode_file(validity90_capture_decoder *decoder, const gchar *path,
+                                        validity90_capture_stats *stats, GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // CAPTURE_H
@@ -0,0 +1,368 @@
+/*
+ * Validity90 crypto backend on libgcrypt
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include <gcrypt.h>
+
+#include "crypto.h"
+
+#define P256_PUBLIC_KEY "(public-key(ecc(curve \"NIST P-256\")(q %b)))"
+
+const gchar *validity90_crypto_backend(void) {
+    return "gcrypt";
+}
+
+gboolean validity90_crypto_init(void) {
+    if (!gcry_check_version(GCRYPT_VERSION)) {
+        return FALSE;
+    }
+    // Nothing here needs to stay out of swap, the pool only costs startup time
+    gcry_control(GCRYCTL_DISABLE_SECMEM, 0);
+    gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+    return TRUE;
+}
+
+void validity90_crypto_random(guint8 *buff, gsize len) {
+    gcry_create_nonce(buff, len);
+}
+
+void validity90_sha256_buffers(const validity90_crypto_buffer *buffers, guint buffers_count, guint8 *out) {
+    gcry_buffer_t buffs[buffers_count];
+
+    for (guint i = 0; i < buffers_count; i++) {
+        buffs[i] = (gcry_buffer_t) {
+            .size = buffers[i].len, .off = 0, .len = buffers[i].len, .data = (guint8*) buffers[i].data,
+        };
+    }
+    gcry_md_hash_buffers(GCRY_MD_SHA256, 0, out, buffs, buffers_count);
+}
+
+void validity90_sha256_buffer(const guint8 *data, gsize len, guint8 *out) {
+    gcry_md_hash_buffer(GCRY_MD_SHA256, out, data, len);
+}
+
+/*
+ * The SHA256, HMAC and AES handles are gcrypt's own, cast, so none of them
+ * costs an allocation on top of gcrypt's.
+ */
+#define MD(sha) ((gcry_md_hd_t) (sha))
+#define CIPHER(aes) ((gcry_cipher_hd_t) (aes))
+
+validity90_sha256 *validity90_sha256_new(void) {
+    gcry_md_hd_t md = NULL;
+
+    if (gcry_md_open(&md, GCRY_MD_SHA256, 0) != 0) {
+        return NULL;
+    }
+
+    return (validity90_sha256*) md;
+}
+
+void validity90_sha256_free(validity90_sha256 *sha) {
+    gcry_md_close(MD(sha));
+}
+
+void validity90_sha256_reset(validity90_sha256 *sha) {
+    gcry_md_reset(MD(sha));
+}
+
+void validity90_sha256_write(validity90_sha256 *sha, const guint8 *data, gsize len) {
+    gcry_md_write(MD(sha), data, len);
+}
+
+void validity90_sha256_final(validity90_sha256 *sha, guint8 *out) {
+    memcpy(out, gcry_md_read(MD(sha), GCRY_MD_SHA256), VALIDITY90_SHA256_SIZE);
+}
+
+gboolean validity90_sha256_peek(validity90_sha256 *sha, guint8 *out) {
+    gcry_md_hd_t fork = NULL;
+
+    if (gcry_md_copy(&fork, MD(sha)) != 0) {
+        return FALSE;
+    }
+    memcpy(out, gcry_md_read(fork, GCRY_MD_SHA256), VALIDITY90_SHA256_SIZE);
+    gcry_md_close(fork);
+
+    return TRUE;
+}
+
+// gcrypt keeps the keyed inner and outer states, a reset goes back to them
+validity90_hmac *validity90_hmac_new(const guint8 *key, gsize key_len) {
+    gcry_md_hd_t md = NULL;
+
+    if (gcry_md_open(&md, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC) != 0) {
+        return NULL;
+    }
+    if (gcry_md_setkey(md, key, key_len) != 0) {
+        gcry_md_close(md);
+        return NULL;
+    }
+
+    return (validity90_hmac*) md;
+}
+
+void validity90_hmac_free(validity90_hmac *hmac) {
+    gcry_md_close(MD(hmac));
+}
+
+void validity90_hmac_reset(validity90_hmac *hmac) {
+    gcry_md_reset(MD(hmac));
+}
+
+void validity90_hmac_write(validity90_hmac *hmac, const guint8 *data, gsize len) {
+    gcry_md_write(MD(hmac), data, len);
+}
+
+void validity90_hmac_final(validity90_hmac *hmac, guint8 *out) {
+    memcpy(out, gcry_md_read(MD(hmac), GCRY_MD_SHA256), VALIDITY90_SHA256_SIZE);
+}
+
+validity90_aes_cbc *validity90_aes_cbc_new(const guint8 *key, gsize key_len) {
+    gcry_cipher_hd_t cipher = NULL;
+
+    // gcrypt's AES takes 128 and 192 bit keys too, whatever the algo
+    if (key_len != VALIDITY90_AES_KEY_SIZE) {
+        return NULL;
+    }
+    if (gcry_cipher_open(&cipher, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CBC, 0) != 0) {
+        return NULL;
+    }
+    if (gcry_cipher_setkey(cipher, key, key_len) != 0) {
+        gcry_cipher_close(cipher);
+        return NULL;
+    }
+
+    return (validity90_aes_cbc*) cipher;
+}
+
+void validity90_aes_cbc_free(validity90_aes_cbc *aes) {
+    gcry_cipher_close(CIPHER(aes));
+}
+
+gboolean validity90_aes_cbc_set_iv(validity90_aes_cbc *aes, const guint8 *iv) {
+    return gcry_cipher_setiv(CIPHER(aes), iv, VALIDITY90_AES_BLOCK_SIZE) == 0;
+}
+
+gboolean validity90_aes_cbc_encrypt(validity90_aes_cbc *aes, const guint8 *in, guint8 *out, gsize len) {
+    if (in == out) {
+        return gcry_cipher_encrypt(CIPHER(aes), out, len, NULL, 0) == 0;
+    }
+    return gcry_cipher_encrypt(CIPHER(aes), out, len, in, len) == 0;
+}
+
+gboolean validity90_aes_cbc_decrypt(validity90_aes_cbc *aes, const guint8 *in, guint8 *out, gsize len) {
+    if (in == out) {
+        return gcry_cipher_decrypt(CIPHER(aes), out, len, NULL, 0) == 0;
+    }
+    return gcry_cipher_decrypt(CIPHER(aes), out, len, in, len) == 0;
+}
+
+// Unsigned big-endian, zero padded on the left
+static gboolean mpi_put(gcry_mpi_t value, guint8 *out, gsize size) {
+    gsize len = 0;
+
+    if (value == NULL || gcry_mpi_get_nbits(value) > size * 8 ||
+        gcry_mpi_print(GCRYMPI_FMT_USG, out, size, &len, value) != 0) {
+        return FALSE;
+    }
+    memmove(out + size - len, out, len);
+    memset(out, 0, size - len);
+
+    return TRUE;
+}
+
+static gboolean sexp_put_mpi(gcry_sexp_t sexp, const char *name, guint8 *out, gsize size) {
+    gcry_sexp_t token = gcry_sexp_find_token(sexp, name, 0);
+    gcry_mpi_t value = token != NULL ? gcry_sexp_nth_mpi(token, 1, GCRYMPI_FMT_USG) : NULL;
+    gboolean result = mpi_put(value, out, size);
+
+    gcry_mpi_release(value);
+    gcry_sexp_release(token);
+
+    return result;
+}
+
+static void point_uncompressed(const guint8 *point, guint8 *out) {
+    out[0] = 0x04;
+    memcpy(out + 1, point, VALIDITY90_EC_POINT_SIZE);
+}
+
+// pk_encrypt takes any point, one off the curve would leak bits of d
+static gboolean point_on_curve(gcry_sexp_t key) {
+    gcry_ctx_t ctx = NULL;
+    gcry_mpi_point_t q = NULL;
+    gboolean result = gcry_mpi_ec_new(&ctx, key, NULL) == 0 &&
+                      (q = gcry_mpi_ec_get_point("q", ctx, 1)) != NULL &&
+                      gcry_mpi_ec_curve_point(q, ctx);
+
+    gcry_mpi_point_release(q);
+    gcry_ctx_release(ctx);
+
+    return result;
+}
+
+gboolean validity90_ecdh_p256(const guint8 *d, const guint8 *point, guint8 *secret) {
+    gboolean result = FALSE;
+    guint8 q[1 + VALIDITY90_EC_POINT_SIZE];
+    gcry_mpi_t scalar = NULL;
+    gcry_sexp_t key = NULL, data = NULL, shared = NULL, s = NULL;
+    const guint8 *shared_point;
+    gsize shared_point_len;
+
+    point_uncompressed(point, q);
+    if (gcry_mpi_scan(&scalar, GCRYMPI_FMT_USG, d, VALIDITY90_EC_SCALAR_SIZE, NULL) != 0 ||
+        gcry_sexp_build(&key, NULL, P256_PUBLIC_KEY, sizeof(q), q) != 0 ||
+        !point_on_curve(key) ||
+        gcry_sexp_build(&data, NULL, "(data(flags raw)(value %m))", scalar) != 0) {
+        goto end;
+    }
+
+    // s = d * Q as an uncompressed point
+    if (gcry_pk_encrypt(&shared, data, key) != 0) {
+        goto end;
+    }
+    s = gcry_sexp_find_token(shared, "s", 0);
+    shared_point = s != NULL ? (const guint8*) gcry_sexp_nth_data(s, 1, &shared_point_len) : NULL;
+    if (shared_point == NULL || shared_point_len != sizeof(q)) {
+        goto end;
+    }
+    memcpy(secret, shared_point + 1, VALIDITY90_EC_SCALAR_SIZE);
+    result = TRUE;
+
+end:
+    gcry_mpi_release(scalar);
+    gcry_sexp_release(key);
+    gcry_sexp_release(data);
+    gcry_sexp_release(shared);
+    gcry_sexp_release(s);
+
+    return result;
+}
+
+gboolean validity90_ec_p256_generate(guint8 *key) {
+    gboolean result = FALSE;
+    gcry_sexp_t params = NULL, pair = NULL, q = NULL;
+    const guint8 *point;
+    gsize point_len;
+
+    if (gcry_sexp_build(&params, NULL, "(genkey(ecc(curve \"NIST P-256\")))") != 0 ||
+        gcry_pk_genkey(&pair, params) != 0) {
+        goto end;
+    }
+    q = gcry_sexp_find_token(pair, "q", 0);
+    point = q != NULL ? (const guint8*) gcry_sexp_nth_data(q, 1, &point_len) : NULL;
+    if (point == NULL || point_len != 1 + VALIDITY90_EC_POINT_SIZE) {
+        goto end;
+    }
+    memcpy(key, point + 1, VALIDITY90_EC_POINT_SIZE);
+    result = sexp_put_mpi(pair, "d", key + VALIDITY90_EC_POINT_SIZE, VALIDITY90_EC_SCALAR_SIZE);
+
+end:
+    gcry_sexp_release(params);
+    gcry_sexp_release(pair);
+    gcry_sexp_release(q);
+
+    return result;
+}
+
+struct validity90_ecdsa_key {
+    gcry_sexp_t sexp;
+};
+
+validity90_ecdsa_key *validity90_ecdsa_key_new(const guint8 *key) {
+    validity90_ecdsa_key *ecdsa = g_malloc0(sizeof(validity90_ecdsa_key));
+    guint8 q[1 + VALIDITY90_EC_POINT_SIZE];
+
+    point_uncompressed(key, q);
+    if (gcry_sexp_build(&ecdsa->sexp, NULL, "(private-key(ecc(curve \"NIST P-256\")(q %b)(d %b)))",
+                        sizeof(q), q, VALIDITY90_EC_SCALAR_SIZE, key + VALIDITY90_EC_POINT_SIZE) != 0) {
+        g_free(ecdsa);
+        return NULL;
+    }
+
+    return ecdsa;
+}
+
+void validity90_ecdsa_key_free(validity90_ecdsa_key *key) {
+    if (key == NULL) {
+        return;
+    }
+    gcry_sexp_release(key->sexp);
+    g_free(key);
+}
+
+gboolean validity90_ecdsa_sign(validity90_ecdsa_key *key, const guint8 *hash, guint8 *r, guint8 *s) {
+    gcry_sexp_t data = NULL, sig = NULL;
+    gboolean result = FALSE;
+
+    if (gcry_sexp_build(&data, NULL, "(data(flags raw)(value %b))", VALIDITY90_SHA256_SIZE, hash) == 0 &&
+        gcry_pk_sign(&sig, data, key->sexp) == 0) {
+        result = sexp_put_mpi(sig, "r", r, VALIDITY90_EC_SCALAR_SIZE) &&
+                 sexp_put_mpi(sig, "s", s, VALIDITY90_EC_SCALAR_SIZE);
+    }
+
+    gcry_sexp_release(data);
+    gcry_sexp_release(sig);
+
+    return result;
+}
+
+gboolean validity90_ecdsa_negate_s(validity90_ecdsa_key *key, guint8 *s) {
+    gcry_ctx_t ctx = NULL;
+    gcry_mpi_t order = NULL, value = NULL;
+    gboolean result = FALSE;
+
+    if (gcry_mpi_ec_new(&ctx, key->sexp, NULL) == 0 && (order = gcry_mpi_ec_get_mpi("n", ctx, 1)) != NULL &&
+        gcry_mpi_scan(&value, GCRYMPI_FMT_USG, s, VALIDITY90_EC_SCALAR_SIZE, NULL) == 0) {
+        gcry_mpi_sub(value, order, value);
+        result = mpi_put(value, s, VALIDITY90_EC_SCALAR_SIZE);
+    }
+
+    gcry_mpi_release(order);
+    gcry_mpi_release(value);
+    gcry_ctx_release(ctx);
+
+    return result;
+}
+
+gboolean validity90_ecdsa_verify(const guint8 *point, const guint8 *hash, const guint8 *r, const guint8 *s) {
+    guint8 q[1 + VALIDITY90_EC_POINT_SIZE];
+    gcry_mpi_t r_mpi = NULL, s_mpi = NULL;
+    gcry_sexp_t key = NULL, data = NULL, sig = NULL;
+    gboolean result = FALSE;
+
+    point_uncompressed(point, q);
+    if (gcry_mpi_scan(&r_mpi, GCRYMPI_FMT_USG, r, VALIDITY90_EC_SCALAR_SIZE, NULL) == 0 &&
+        gcry_mpi_scan(&s_mpi, GCRYMPI_FMT_USG, s, VALIDITY90_EC_SCALAR_SIZE, NULL) == 0 &&
+        gcry_sexp_build(&key, NULL, P256_PUBLIC_KEY, sizeof(q), q) == 0 &&
+        gcry_sexp_build(&data, NULL, "(data(flags raw)(value %b))", VALIDITY90_SHA256_SIZE, hash) == 0 &&
+        gcry_sexp_build(&sig, NULL, "(sig-val(ecdsa(r %m)(s %m)))", r_mpi, s_mpi) == 0) {
+        result = gcry_pk_verify(sig, data, key) == 0;
+    }
+
+    gcry_mpi_release(r_mpi);
+    gcry_mpi_release(s_mpi);
+    gcry_sexp_release(key);
+    gcry_sexp_release(data);
+    gcry_sexp_release(sig);
+
+    return result;
+}
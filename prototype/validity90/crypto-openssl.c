@@ -0,0 +1,360 @@
+/*
+ * Validity90 crypto backend on OpenSSL's libcrypto
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+// The EC_KEY, HMAC_CTX and SHA256_CTX calls work from 1.1 on, 3.0 only deprecates them
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "crypto.h"
+
+const gchar *validity90_crypto_backend(void) {
+    return "openssl";
+}
+
+gboolean validity90_crypto_init(void) {
+    // No config file and no error strings, nothing here prints them
+    return OPENSSL_init_crypto(OPENSSL_INIT_NO_LOAD_CONFIG | OPENSSL_INIT_NO_LOAD_CRYPTO_STRINGS, NULL) == 1;
+}
+
+void validity90_crypto_random(guint8 *buff, gsize len) {
+    if (RAND_bytes(buff, len) != 1) {
+        g_error("Crypto: no random bytes");
+    }
+}
+
+// The low level SHA256 calls keep the context on the stack
+void validity90_sha256_buffers(const validity90_crypto_buffer *buffers, guint buffers_count, guint8 *out) {
+    SHA256_CTX ctx;
+
+    SHA256_Init(&ctx);
+    for (guint i = 0; i < buffers_count; i++) {
+        SHA256_Update(&ctx, buffers[i].data, buffers[i].len);
+    }
+    SHA256_Final(out, &ctx);
+}
+
+void validity90_sha256_buffer(const guint8 *data, gsize len, guint8 *out) {
+    validity90_crypto_buffer buffer = { data, len };
+
+    // SHA256() goes through an EVP fetch and allocates since 3.0
+    validity90_sha256_buffers(&buffer, 1, out);
+}
+
+struct validity90_sha256 {
+    SHA256_CTX ctx;
+};
+
+validity90_sha256 *validity90_sha256_new(void) {
+    validity90_sha256 *sha = g_malloc0(sizeof(validity90_sha256));
+
+    SHA256_Init(&sha->ctx);
+
+    return sha;
+}
+
+void validity90_sha256_free(validity90_sha256 *sha) {
+    if (sha == NULL) {
+        return;
+    }
+    memset(sha, 0, sizeof(validity90_sha256));
+    g_free(sha);
+}
+
+void validity90_sha256_reset(validity90_sha256 *sha) {
+    SHA256_Init(&sha->ctx);
+}
+
+void validity90_sha256_write(validity90_sha256 *sha, const guint8 *data, gsize len) {
+    SHA256_Update(&sha->ctx, data, len);
+}
+
+void validity90_sha256_final(validity90_sha256 *sha, guint8 *out) {
+    SHA256_Final(out, &sha->ctx);
+}
+
+gboolean validity90_sha256_peek(validity90_sha256 *sha, guint8 *out) {
+    // A plain struct, the fork stays on the stack
+    SHA256_CTX fork = sha->ctx;
+
+    SHA256_Final(out, &fork);
+    memset(&fork, 0, sizeof(fork));
+
+    return TRUE;
+}
+
+struct validity90_hmac {
+    HMAC_CTX *ctx;
+};
+
+validity90_hmac *validity90_hmac_new(const guint8 *key, gsize key_len) {
+    validity90_hmac *hmac = g_malloc0(sizeof(validity90_hmac));
+
+    hmac->ctx = HMAC_CTX_new();
+    if (hmac->ctx == NULL || HMAC_Init_ex(hmac->ctx, key, key_len, EVP_sha256(), NULL) != 1) {
+        validity90_hmac_free(hmac);
+        return NULL;
+    }
+
+    return hmac;
+}
+
+void validity90_hmac_free(validity90_hmac *hmac) {
+    if (hmac == NULL) {
+        return;
+    }
+    g_clear_pointer(&hmac->ctx, HMAC_CTX_free);
+    g_free(hmac);
+}
+
+void validity90_hmac_reset(validity90_hmac *hmac) {
+    // Same key, starts over from the keyed inner state
+    HMAC_Init_ex(hmac->ctx, NULL, 0, NULL, NULL);
+}
+
+void validity90_hmac_write(validity90_hmac *hmac, const guint8 *data, gsize len) {
+    HMAC_Update(hmac->ctx, data, len);
+}
+
+void validity90_hmac_final(validity90_hmac *hmac, guint8 *out) {
+    unsigned int len = VALIDITY90_SHA256_SIZE;
+
+    HMAC_Final(hmac->ctx, out, &len);
+}
+
+/*
+ * EVP keys a context for one direction, both are keyed up front so nothing
+ * allocates after new. A new IV alone keeps the key schedule.
+ */
+struct validity90_aes_cbc {
+    // Indexed by the EVP enc flag: 0 decrypts, 1 encrypts
+    EVP_CIPHER_CTX *ctx[2];
+    guint8 iv[VALIDITY90_AES_BLOCK_SIZE];
+    gboolean restart[2];
+};
+
+validity90_aes_cbc *validity90_aes_cbc_new(const guint8 *key, gsize key_len) {
+    if (key_len != VALIDITY90_AES_KEY_SIZE) {
+        return NULL;
+    }
+
+    validity90_aes_cbc *aes = g_malloc0(sizeof(validity90_aes_cbc));
+
+    for (int enc = 0; enc < 2; enc++) {
+        if ((aes->ctx[enc] = EVP_CIPHER_CTX_new()) == NULL ||
+            EVP_CipherInit_ex(aes->ctx[enc], EVP_aes_256_cbc(), NULL, key, aes->iv, enc) != 1 ||
+            EVP_CIPHER_CTX_set_padding(aes->ctx[enc], 0) != 1) {
+            validity90_aes_cbc_free(aes);
+            return NULL;
+        }
+    }
+
+    return aes;
+}
+
+void validity90_aes_cbc_free(validity90_aes_cbc *aes) {
+    if (aes == NULL) {
+        return;
+    }
+    EVP_CIPHER_CTX_free(aes->ctx[0]);
+    EVP_CIPHER_CTX_free(aes->ctx[1]);
+    g_free(aes);
+}
+
+gboolean validity90_aes_cbc_set_iv(validity90_aes_cbc *aes, const guint8 *iv) {
+    memcpy(aes->iv, iv, VALIDITY90_AES_BLOCK_SIZE);
+    aes->restart[0] = aes->restart[1] = TRUE;
+
+    return TRUE;
+}
+
+static gboolean aes_cbc_update(validity90_aes_cbc *aes, int enc, const guint8 *in, guint8 *out, gsize len) {
+    int out_len = 0;
+
+    if (len % VALIDITY90_AES_BLOCK_SIZE != 0 || len > G_MAXINT) {
+        return FALSE;
+    }
+    if (aes->restart[enc] && EVP_CipherInit_ex(aes->ctx[enc], NULL, NULL, NULL, aes->iv, enc) != 1) {
+        return FALSE;
+    }
+    aes->restart[enc] = FALSE;
+
+    return EVP_CipherUpdate(aes->ctx[enc], out, &out_len, in, len) == 1 && out_len == len;
+}
+
+gboolean validity90_aes_cbc_encrypt(validity90_aes_cbc *aes, const guint8 *in, guint8 *out, gsize len) {
+    return aes_cbc_update(aes, 1, in, out, len);
+}
+
+gboolean validity90_aes_cbc_decrypt(validity90_aes_cbc *aes, const guint8 *in, guint8 *out, gsize len) {
+    return aes_cbc_update(aes, 0, in, out, len);
+}
+
+static EC_KEY *ec_key_new(const guint8 *point, const guint8 *d) {
+    EC_KEY *key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    BIGNUM *x = BN_bin2bn(point, VALIDITY90_EC_SCALAR_SIZE, NULL);
+    BIGNUM *y = BN_bin2bn(point + VALIDITY90_EC_SCALAR_SIZE, VALIDITY90_EC_SCALAR_SIZE, NULL);
+    BIGNUM *scalar = d != NULL ? BN_bin2bn(d, VALIDITY90_EC_SCALAR_SIZE, NULL) : NULL;
+
+    // Also checks the point is on the curve
+    if (key == NULL || x == NULL || y == NULL || (d != NULL && scalar == NULL) ||
+        EC_KEY_set_public_key_affine_coordinates(key, x, y) != 1 ||
+        (scalar != NULL && EC_KEY_set_private_key(key, scalar) != 1)) {
+        g_clear_pointer(&key, EC_KEY_free);
+    }
+
+    BN_free(x);
+    BN_free(y);
+    BN_clear_free(scalar);
+
+    return key;
+}
+
+gboolean validity90_ecdh_p256(const guint8 *d, const guint8 *point, guint8 *secret) {
+    gboolean result = FALSE;
+    EC_KEY *peer = ec_key_new(point, NULL);
+    BIGNUM *scalar = BN_bin2bn(d, VALIDITY90_EC_SCALAR_SIZE, NULL);
+    BIGNUM *x = BN_new();
+    EC_POINT *shared = NULL;
+
+    if (peer == NULL || scalar == NULL || x == NULL) {
+        goto end;
+    }
+
+    const EC_GROUP *group = EC_KEY_get0_group(peer);
+    shared = EC_POINT_new(group);
+    if (shared == NULL ||
+        EC_POINT_mul(group, shared, NULL, EC_KEY_get0_public_key(peer), scalar, NULL) != 1 ||
+        EC_POINT_get_affine_coordinates(group, shared, x, NULL, NULL) != 1 ||
+        BN_bn2binpad(x, secret, VALIDITY90_EC_SCALAR_SIZE) != VALIDITY90_EC_SCALAR_SIZE) {
+        goto end;
+    }
+    result = TRUE;
+
+end:
+    EC_KEY_free(peer);
+    BN_clear_free(scalar);
+    BN_clear_free(x);
+    EC_POINT_clear_free(shared);
+
+    return result;
+}
+
+gboolean validity90_ec_p256_generate(guint8 *key) {
+    gboolean result = FALSE;
+    EC_KEY *pair = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    BIGNUM *x = BN_new();
+    BIGNUM *y = BN_new();
+
+    if (pair != NULL && x != NULL && y != NULL && EC_KEY_generate_key(pair) == 1 &&
+        EC_POINT_get_affine_coordinates(EC_KEY_get0_group(pair), EC_KEY_get0_public_key(pair), x, y, NULL) == 1) {
+        result = BN_bn2binpad(x, key, VALIDITY90_EC_SCALAR_SIZE) == VALIDITY90_EC_SCALAR_SIZE &&
+                 BN_bn2binpad(y, key + VALIDITY90_EC_SCALAR_SIZE, VALIDITY90_EC_SCALAR_SIZE) == VALIDITY90_EC_SCALAR_SIZE &&
+                 BN_bn2binpad(EC_KEY_get0_private_key(pair), key + VALIDITY90_EC_POINT_SIZE,
+                              VALIDITY90_EC_SCALAR_SIZE) == VALIDITY90_EC_SCALAR_SIZE;
+    }
+
+    EC_KEY_free(pair);
+    BN_free(x);
+    BN_free(y);
+
+    return result;
+}
+
+struct validity90_ecdsa_key {
+    EC_KEY *key;
+};
+
+validity90_ecdsa_key *validity90_ecdsa_key_new(const guint8 *key) {
+    EC_KEY *ec = ec_key_new(key, key + VALIDITY90_EC_POINT_SIZE);
+
+    if (ec == NULL) {
+        return NULL;
+    }
+
+    validity90_ecdsa_key *ecdsa = g_malloc0(sizeof(validity90_ecdsa_key));
+    ecdsa->key = ec;
+
+    return ecdsa;
+}
+
+void validity90_ecdsa_key_free(validity90_ecdsa_key *key) {
+    if (key == NULL) {
+        return;
+    }
+    EC_KEY_free(key->key);
+    g_free(key);
+}
+
+gboolean validity90_ecdsa_sign(validity90_ecdsa_key *key, const guint8 *hash, guint8 *r, guint8 *s) {
+    ECDSA_SIG *sig = ECDSA_do_sign(hash, VALIDITY90_SHA256_SIZE, key->key);
+    const BIGNUM *sig_r, *sig_s;
+    gboolean result = FALSE;
+
+    if (sig != NULL) {
+        ECDSA_SIG_get0(sig, &sig_r, &sig_s);
+        result = BN_bn2binpad(sig_r, r, VALIDITY90_EC_SCALAR_SIZE) == VALIDITY90_EC_SCALAR_SIZE &&
+                 BN_bn2binpad(sig_s, s, VALIDITY90_EC_SCALAR_SIZE) == VALIDITY90_EC_SCALAR_SIZE;
+    }
+    ECDSA_SIG_free(sig);
+
+    return result;
+}
+
+gboolean validity90_ecdsa_negate_s(validity90_ecdsa_key *key, guint8 *s) {
+    const BIGNUM *order = EC_GROUP_get0_order(EC_KEY_get0_group(key->key));
+    BIGNUM *value = BN_bin2bn(s, VALIDITY90_EC_SCALAR_SIZE, NULL);
+    gboolean result = value != NULL && BN_sub(value, order, value) == 1 &&
+                      BN_bn2binpad(value, s, VALIDITY90_EC_SCALAR_SIZE) == VALIDITY90_EC_SCALAR_SIZE;
+
+    BN_free(value);
+
+    return result;
+}
+
+gboolean validity90_ecdsa_verify(const guint8 *point, const guint8 *hash, const guint8 *r, const guint8 *s) {
+    EC_KEY *key = ec_key_new(point, NULL);
+    ECDSA_SIG *sig = ECDSA_SIG_new();
+    BIGNUM *sig_r = BN_bin2bn(r, VALIDITY90_EC_SCALAR_SIZE, NULL);
+    BIGNUM *sig_s = BN_bin2bn(s, VALIDITY90_EC_SCALAR_SIZE, NULL);
+    gboolean result = FALSE;
+
+    if (key != NULL && sig != NULL && sig_r != NULL && sig_s != NULL && ECDSA_SIG_set0(sig, sig_r, sig_s) == 1) {
+        // Owned by sig now
+        sig_r = sig_s = NULL;
+        result = ECDSA_do_verify(hash, VALIDITY90_SHA256_SIZE, sig, key) == 1;
+    }
+
+    BN_free(sig_r);
+    BN_free(sig_s);
+    ECDSA_SIG_free(sig);
+    EC_KEY_free(key);
+
+    return result;
+}
@@ -0,0 +1,122 @@
+/*
+ * Validity90 crypto backend
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <glib.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * Everything the sensor protocol needs from a crypto library: SHA256,
+ * HMAC-SHA256, AES-256-CBC without padding, P-256 ECDH and ECDSA and random
+ * bytes. Exactly one backend is compiled in, make CRYPTO=gcrypt (the default)
+ * or CRYPTO=openssl.
+ *
+ * Calls only fail on bad input or a broken backend. They return FALSE or NULL
+ * and leave the error to the caller's own domain.
+ */
+
+#define VALIDITY90_SHA256_SIZE 0x20
+#define VALIDITY90_AES_KEY_SIZE 0x20
+#define VALIDITY90_AES_BLOCK_SIZE 0x10
+
+/* Big-endian, public points are X || Y and private keys X || Y || d */
+#define VALIDITY90_EC_SCALAR_SIZE 0x20
+#define VALIDITY90_EC_POINT_SIZE 0x40
+#define VALIDITY90_EC_KEY_SIZE 0x60
+
+const gchar *validity90_crypto_backend(void);
+
+/* Once per process, before anything else here */
+gboolean validity90_crypto_init(void);
+
+/* Not for keys, IVs and the like */
+void validity90_crypto_random(guint8 *buff, gsize len);
+
+typedef struct validity90_crypto_buffer {
+    const guint8 *data;
+    gsize len;
+} validity90_crypto_buffer;
+
+/* SHA256 over the buffers in order, nothing allocated */
+void validity90_sha256_buffers(const validity90_crypto_buffer *buffers, guint buffers_count, guint8 *out);
+void validity90_sha256_buffer(const guint8 *data, gsize len, guint8 *out);
+
+typedef struct validity90_sha256 validity90_sha256;
+
+validity90_sha256 *validity90_sha256_new(void);
+void validity90_sha256_free(validity90_sha256 *sha);
+
+void validity90_sha256_reset(validity90_sha256 *sha);
+void validity90_sha256_write(validity90_sha256 *sha, const guint8 *data, gsize len);
+/* Ends the hash, the next write needs a reset first */
+void validity90_sha256_final(validity90_sha256 *sha, guint8 *out);
+/* Hash of everything written so far, sha goes on */
+gboolean validity90_sha256_peek(validity90_sha256 *sha, guint8 *out);
+
+/* Keyed once, every reset goes back to the keyed state */
+typedef struct validity90_hmac validity90_hmac;
+
+validity90_hmac *validity90_hmac_new(const guint8 *key, gsize key_len);
+void validity90_hmac_free(validity90_hmac *hmac);
+
+void validity90_hmac_reset(validity90_hmac *hmac);
+void validity90_hmac_write(validity90_hmac *hmac, const guint8 *data, gsize len);
+/* Ends the MAC, the next write needs a reset first */
+void validity90_hmac_final(validity90_hmac *hmac, guint8 *out);
+
+/*
+ * AES-256-CBC keyed once. Every message starts with set_iv, encrypt and
+ * decrypt calls after it chain on. in may be out, lengths are whole blocks.
+ */
+typedef struct validity90_aes_cbc validity90_aes_cbc;
+
+validity90_aes_cbc *validity90_aes_cbc_new(const guint8 *key, gsize key_len);
+void validity90_aes_cbc_free(validity90_aes_cbc *aes);
+
+gboolean validity90_aes_cbc_set_iv(validity90_aes_cbc *aes, const guint8 *iv);
+gboolean validity90_aes_cbc_encrypt(validity90_aes_cbc *aes, const guint8 *in, guint8 *out, gsize len);
+gboolean validity90_aes_cbc_decrypt(validity90_aes_cbc *aes, const guint8 *in, guint8 *out, gsize len);
+
+/* X coordinate of d * point */
+gboolean validity90_ecdh_p256(const guint8 *d, const guint8 *point, guint8 *secret);
+
+/* A fresh X || Y || d */
+gboolean validity90_ec_p256_generate(guint8 *key);
+
+typedef struct validity90_ecdsa_key validity90_ecdsa_key;
+
+validity90_ecdsa_key *validity90_ecdsa_key_new(const guint8 *key);
+void validity90_ecdsa_key_free(validity90_ecdsa_key *key);
+
+/* hash is signed as is, r and s come out zero padded to VALIDITY90_EC_SCALAR_SIZE */
+gboolean validity90_ecdsa_sign(validity90_ecdsa_key *key, const guint8 *hash, guint8 *r, guint8 *s);
+/* s becomes n - s, with the same r the other valid signature of the hash */
+gboolean validity90_ecdsa_negate_s(validity90_ecdsa_key *key, guint8 *s);
+gboolean validity90_ecdsa_verify(const guint8 *point, const guint8 *hash, const guint8 *r, const guint8 *s);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // CRYPTO_H
@@ -0,0 +1,407 @@
+/*
+ * Validity90 reader daemon
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <glib/gstdio.h>
+
+#include "daemon.h"
+
+GQuark validity90_daemon_error_quark (void) {
+  return g_quark_from_static_string ("validity-daemon-error-quark");
+}
+
+#define DAEMON_BACKLOG 16
+#define DAEMON_READ_SIZE 0x1000
+
+typedef struct daemon_client {
+    int fd;
+    GString *in;
+    GString *out;
+    // The client shut down its side, it is closed once its replies are out
+    gboolean eof;
+    // Reading or writing failed, its requests are dropped
+    gboolean failed;
+    guint pending;
+} daemon_client;
+
+typedef struct daemon_request {
+    daemon_client *client;
+    gchar *line;
+} daemon_request;
+
+typedef struct daemon_handler {
+    validity90_daemon_cb cb;
+    gpointer user_data;
+} daemon_handler;
+
+struct validity90_daemon {
+    gchar *path;
+    int fd;
+
+    GHashTable *handlers;
+    GPtrArray *clients;
+    // Requests of every client in arrival order
+    GQueue requests;
+
+    GArray *pollfds;
+    GString *reply;
+
+    gboolean quit;
+    validity90_daemon_stats stats;
+};
+
+static void daemon_request_free(daemon_request *request) {
+    g_free(request->line);
+    g_free(request);
+}
+
+static void daemon_client_close(validity90_daemon *daemon, daemon_client *client) {
+    // Whatever it still had queued is dropped, nobody would read the replies
+    for (GList *link = daemon->requests.head; link != NULL;) {
+        GList *next = link->next;
+        daemon_request *request = link->data;
+
+        if (request->client == client) {
+            g_queue_delete_link(&daemon->requests, link);
+            daemon_request_free(request);
+        }
+        link = next;
+    }
+
+    close(client->fd);
+    g_string_free(client->in, TRUE);
+    g_string_free(client->out, TRUE);
+    g_ptr_array_remove(daemon->clients, client);
+    g_free(client);
+}
+
+// Whether a daemon listens on addr, one with a full backlog too
+static gboolean daemon_answers(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    gboolean answers;
+
+    if (fd < 0) {
+        return FALSE;
+    }
+    answers = connect(fd, (const struct sockaddr*) addr, sizeof(*addr)) == 0 || errno == EAGAIN;
+    close(fd);
+
+    return answers;
+}
+
+validity90_daemon *validity90_daemon_new(const gchar *path, GError **error) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    GStatBuf st;
+    int fd;
+
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_SOCKET,
+                    "Daemon: socket path %s is too long", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    // Left behind by a daemon that didn't exit cleanly, unless it still answers
+    if (g_lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (daemon_answers(&addr)) {
+            g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_RUNNING,
+                        "Daemon: another daemon is running on %s", path);
+            return NULL;
+        }
+        g_unlink(path);
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_SOCKET,
+                    "Daemon: can't bind %s: %s", path, g_strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    // Nobody can connect before listen, so nobody gets in before the chmod
+    if (g_chmod(path, 0600) != 0 || listen(fd, DAEMON_BACKLOG) != 0) {
+        g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_SOCKET,
+                    "Daemon: can't listen on %s: %s", path, g_strerror(errno));
+        close(fd);
+        g_unlink(path);
+        return NULL;
+    }
+
+    validity90_daemon *daemon = g_malloc0(sizeof(validity90_daemon));
+    daemon->path = g_strdup(path);
+    daemon->fd = fd;
+    daemon->handlers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    daemon->clients = g_ptr_array_new();
+    g_queue_init(&daemon->requests);
+    daemon->pollfds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+    daemon->reply = g_string_sized_new(VALIDITY90_DAEMON_MAX_LINE);
+
+    return daemon;
+}
+
+void validity90_daemon_free(validity90_daemon *daemon) {
+    if (daemon == NULL) {
+        return;
+    }
+    while (daemon->clients->len > 0) {
+        daemon_client_close(daemon, g_ptr_array_index(daemon->clients, 0));
+    }
+    close(daemon->fd);
+    g_unlink(daemon->path);
+
+    g_free(daemon->path);
+    g_hash_table_destroy(daemon->handlers);
+    g_ptr_array_free(daemon->clients, TRUE);
+    g_array_free(daemon->pollfds, TRUE);
+    g_string_free(daemon->reply, TRUE);
+    g_free(daemon);
+}
+
+void validity90_daemon_set_handler(validity90_daemon *daemon, const gchar *command, validity90_daemon_cb cb,
+                                   gpointer user_data) {
+    if (cb == NULL) {
+        g_hash_table_remove(daemon->handlers, command);
+        return;
+    }
+
+    daemon_handler *handler = g_malloc(sizeof(daemon_handler));
+    handler->cb = cb;
+    handler->user_data = user_data;
+    g_hash_table_replace(daemon->handlers, g_strdup(command), handler);
+}
+
+static void daemon_accept(validity90_daemon *daemon) {
+    int fd;
+
+    while ((fd = accept(daemon->fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        daemon_client *client = g_malloc0(sizeof(daemon_client));
+        client->fd = fd;
+        client->in = g_string_sized_new(VALIDITY90_DAEMON_MAX_LINE);
+        client->out = g_string_sized_new(VALIDITY90_DAEMON_MAX_LINE);
+        g_ptr_array_add(daemon->clients, client);
+        daemon->stats.clients++;
+    }
+}
+
+static gboolean daemon_client_flush(daemon_client *client) {
+    while (client->out->len > 0) {
+        ssize_t sent = send(client->fd, client->out->str, client->out->len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        g_string_erase(client->out, 0, sent);
+    }
+
+    return TRUE;
+}
+
+// Queues every complete line, FALSE when the client has to go
+static gboolean daemon_client_read(validity90_daemon *daemon, daemon_client *client) {
+    gchar buff[DAEMON_READ_SIZE];
+    gchar *newline;
+
+    for (;;) {
+        ssize_t len = recv(client->fd, buff, sizeof(buff), 0);
+        if (len == 0) {
+            client->eof = TRUE;
+            break;
+        }
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+        g_string_append_len(client->in, buff, len);
+    }
+
+    while ((newline = memchr(client->in->str, '\n', client->in->len)) != NULL) {
+        gsize line_len = newline - client->in->str;
+        if (line_len > 0 && client->in->str[line_len - 1] == '\r') {
+            line_len--;
+        }
+        if (line_len > 0) {
+            daemon_request *request = g_malloc(sizeof(daemon_request));
+            request->client = client;
+            request->line = g_strndup(client->in->str, line_len);
+            g_queue_push_tail(&daemon->requests, request);
+            client->pending++;
+        }
+        g_string_erase(client->in, 0, newline - client->in->str + 1);
+    }
+    daemon->stats.max_queued = MAX(daemon->stats.max_queued, g_queue_get_length(&daemon->requests));
+
+    if (client->in->len > VALIDITY90_DAEMON_MAX_LINE) {
+        g_string_append(client->out, "error Request too long\n");
+        daemon_client_flush(client);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void daemon_handle(validity90_daemon *daemon, daemon_request *request) {
+    GString *out = request->client->out;
+    GError *error = NULL;
+    gboolean ok;
+
+    gchar *args = strchr(request->line, ' ');
+    if (args != NULL) {
+        *args++ = '\0';
+        args = g_strchug(args);
+    } else {
+        args = "";
+    }
+
+    g_string_truncate(daemon->reply, 0);
+    if (strcmp(request->line, "ping") == 0) {
+        g_string_append(daemon->reply, "pong");
+        ok = TRUE;
+    } else {
+        daemon_handler *handler = g_hash_table_lookup(daemon->handlers, request->line);
+        if (handler != NULL) {
+            ok = handler->cb(daemon, args, daemon->reply, handler->user_data, &error);
+        } else {
+            g_set_error(&error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_REQUEST,
+                        "Unknown command %s", request->line);
+            ok = FALSE;
+        }
+    }
+
+    daemon->stats.requests++;
+    if (ok) {
+        g_string_append(out, "ok");
+        if (daemon->reply->len > 0) {
+            g_string_append_c(out, ' ');
+            g_string_append_len(out, daemon->reply->str, daemon->reply->len);
+        }
+    } else {
+        daemon->stats.failed++;
+        gsize start = out->len;
+        g_string_append_printf(out, "error %s", error != NULL ? error->message : "Failed");
+        // One line per reply, whatever the message has in it
+        g_strdelimit(out->str + start, "\r\n", ' ');
+    }
+    g_string_append_c(out, '\n');
+    g_clear_error(&error);
+}
+
+gboolean validity90_daemon_iterate(validity90_daemon *daemon, gint timeout_ms, GError **error) {
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    struct pollfd listen_fd = { .fd = daemon->fd, .events = POLLIN };
+    g_array_set_size(daemon->pollfds, 0);
+    g_array_append_val(daemon->pollfds, listen_fd);
+    for (guint i = 0; i < daemon->clients->len; i++) {
+        daemon_client *client = g_ptr_array_index(daemon->clients, i);
+        struct pollfd client_fd = {
+            .fd = client->fd,
+            .events = (client->eof ? 0 : POLLIN) | (client->out->len > 0 ? POLLOUT : 0),
+        };
+        g_array_append_val(daemon->pollfds, client_fd);
+    }
+
+    int ready = poll((struct pollfd*) daemon->pollfds->data, daemon->pollfds->len,
+                     g_queue_is_empty(&daemon->requests) ? timeout_ms : 0);
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return TRUE;
+        }
+        g_set_error(error, VALIDITY90_DAEMON_ERROR, VALIDITY90_DAEMON_ERR_SOCKET,
+                    "Daemon: poll failed: %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    // Clients in the order they connected, so requests read at once queue up in that order
+    for (guint i = 0; i < daemon->clients->len; i++) {
+        daemon_client *client = g_ptr_array_index(daemon->clients, i);
+        short revents = g_array_index(daemon->pollfds, struct pollfd, i + 1).revents;
+
+        if ((revents & (POLLIN | POLLHUP | POLLERR)) != 0 && !client->eof) {
+            client->failed = !daemon_client_read(daemon, client);
+        }
+        if ((revents & POLLOUT) != 0 && !client->failed) {
+            client->failed = !daemon_client_flush(client);
+        }
+    }
+
+    if ((g_array_index(daemon->pollfds, struct pollfd, 0).revents & POLLIN) != 0) {
+        daemon_accept(daemon);
+    }
+
+    // One at a time, a request can block for long and the clients are looked at again in between
+    daemon_request *request;
+    if (!daemon->quit && (request = g_queue_pop_head(&daemon->requests)) != NULL) {
+        daemon_client *client = request->client;
+
+        client->pending--;
+        if (!client->failed) {
+            daemon_handle(daemon, request);
+            client->failed = !daemon_client_flush(client);
+        }
+        daemon_request_free(request);
+    }
+
+    for (guint i = daemon->clients->len; i-- > 0;) {
+        daemon_client *client = g_ptr_array_index(daemon->clients, i);
+        if (client->failed || (client->eof && client->pending == 0 && client->out->len == 0)) {
+            daemon_client_close(daemon, client);
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_daemon_run(validity90_daemon *daemon, GError **error) {
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    daemon->quit = FALSE;
+    while (!daemon->quit) {
+        if (!validity90_daemon_iterate(daemon, -1, error)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void validity90_daemon_quit(validity90_daemon *daemon) {
+    daemon->quit = TRUE;
+}
+
+const validity90_daemon_stats *validity90_daemon_get_stats(validity90_daemon *daemon) {
+    return &daemon->stats;
+}
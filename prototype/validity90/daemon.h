@@ -0,0 +1,103 @@
+/*
+ * Validity90 reader daemon
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <glib.h>
+
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_DAEMON_ERROR validity90_daemon_error_quark()
+
+GQuark validity90_daemon_error_quark(void);
+
+enum validity90_daemon_error_codes {
+    VALIDITY90_DAEMON_ERR_SOCKET,
+    VALIDITY90_DAEMON_ERR_REQUEST,
+    // Another daemon answers on the socket path
+    VALIDITY90_DAEMON_ERR_RUNNING,
+};
+
+/* Longest request line, a client sending more is disconnected */
+#define VALIDITY90_DAEMON_MAX_LINE 256
+
+/*
+ * Serves requests to an open sensor over a UNIX socket.
+ *
+ * The handlers keep the open sensor and its TLS session for as long as the
+ * daemon runs, so clients don't pay for init and the handshake. Requests are lines of "command [args]", answered with
+ * "ok [reply]" or "error message". A client can send any number of requests
+ * without waiting: requests of all clients go into one queue and are run on
+ * the session one at a time in the order they arrived, every client gets its
+ * replies in the order it sent the requests. "ping" is always there, other
+ * commands come from handlers.
+ *
+ * Handlers run on the thread of the poll loop and block it, so each one has
+ * to bound its waits: every exchange on the sensor, and a scan waiting for
+ * the finger, gives up after a timeout. Only one
+ * request runs per iteration, so clients are accepted, read and answered
+ * between two requests, but never during one, and nothing is pipelined on
+ * the session itself.
+ *
+ * The socket is only accessible by its owner.
+ */
+typedef struct validity90_daemon validity90_daemon;
+
+/* args is the rest of the line, reply goes after "ok", error after "error" */
+typedef gboolean (*validity90_daemon_cb)(validity90_daemon *daemon, const gchar *args, GString *reply,
+                                         gpointer user_data, GError **error);
+
+typedef struct validity90_daemon_stats {
+    guint clients;
+    guint64 requests;
+    guint64 failed;
+    guint max_queued;
+} validity90_daemon_stats;
+
+/*
+ * A stale socket at path is replaced, fails with VALIDITY90_DAEMON_ERR_RUNNING
+ * when a daemon still answers on it.
+ */
+validity90_daemon *validity90_daemon_new(const gchar *path, GError **error);
+void validity90_daemon_free(validity90_daemon *daemon);
+
+void validity90_daemon_set_handler(validity90_daemon *daemon, const gchar *command, validity90_daemon_cb cb,
+                                   gpointer user_data);
+
+/*
+ * Waits up to timeout_ms (-1 forever) for clients, then runs the first queued
+ * request. Doesn't wait while requests are queued.
+ */
+gboolean validity90_daemon_iterate(validity90_daemon *daemon, gint timeout_ms, GError **error);
+
+/* Iterates until validity90_daemon_quit, usually called from a handler */
+gboolean validity90_daemon_run(validity90_daemon *daemon, GError **error);
+void validity90_daemon_quit(validity90_daemon *daemon);
+
+const validity90_daemon_stats *validity90_daemon_get_stats(validity90_daemon *daemon);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // DAEMON_H
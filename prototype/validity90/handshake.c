@@ -0,0 +1,516 @@
+/*
+ * Validity90 TLS handshake
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "crypto.h"
+#include "handshake.h"
+#include "utils.h"
+
+GQuark validity90_handshake_error_quark (void) {
+  return g_quark_from_static_string ("validity-handshake-error-quark");
+}
+
+// Every message to the sensor starts with it
+static const guint8 handshake_prefix[] = { 0x44, 0x00, 0x00, 0x00 };
+
+// ClientHello after the random: session id, cipher suites, compression and extensions
+static const guint8 client_hello_tail[] = {
+    0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x04, 0xc0, 0x05, 0x00, 0x3d, 0x00, 0x00,
+    0x0a, 0x00, 0x04, 0x00, 0x02, 0x00, 0x17, 0x00,
+    0x0b, 0x00, 0x02, 0x01, 0x00,
+};
+
+static const guint8 change_cipher_spec[] = { 0x14, 0x03, 0x03, 0x00, 0x01, 0x01 };
+
+#define HANDSHAKE_KEY_BLOCK_SIZE 0x120
+#define HANDSHAKE_MASTER_SECRET_SIZE 0x30
+#define HANDSHAKE_VERIFY_DATA_SIZE 0x0c
+// DER with r and s as 0x21 byte integers: 30 46 02 21 00 r 02 21 00 s
+#define HANDSHAKE_SIGNATURE_SIZE 0x48
+
+#define TLS_TYPE_CHANGE_CIPHER_SPEC 0x14
+#define TLS_TYPE_HANDSHAKE 0x16
+
+#define TLS_HS_CLIENT_HELLO 0x01
+#define TLS_HS_SERVER_HELLO 0x02
+#define TLS_HS_CERTIFICATE 0x0b
+#define TLS_HS_CERTIFICATE_VERIFY 0x0f
+#define TLS_HS_CLIENT_KEY_EXCHANGE 0x10
+#define TLS_HS_FINISHED 0x14
+
+struct validity90_handshake {
+    validity90_handshake_state state;
+
+    guint8 client_random[VALIDITY90_HANDSHAKE_RANDOM_SIZE];
+    guint8 server_random[VALIDITY90_HANDSHAKE_RANDOM_SIZE];
+    guint8 ecdh_key[0x60];
+    guint8 server_key[0x40];
+    guint8 ecdsa_key[0x60];
+    GByteArray *certificate;
+    // Loaded on the first signature, kept over resets
+    validity90_ecdsa_key *sign_key;
+
+    // Every handshake message so far, forked for CertificateVerify and Finished
+    validity90_sha256 *transcript;
+
+    guint8 key_block[HANDSHAKE_KEY_BLOCK_SIZE];
+    validity90_tls_session *session;
+
+    // Next message to the sensor, responses while running, a record being opened
+    GByteArray *out;
+    GByteArray *in;
+    GByteArray *scratch;
+
+    validity90_handshake_timing timing;
+    gint64 started;
+};
+
+validity90_handshake *validity90_handshake_new(const validity90_handshake_keys *keys,
+                                               const guint8 *client_random) {
+    validity90_handshake *handshake = g_malloc0(sizeof(validity90_handshake));
+
+    memcpy(handshake->ecdh_key, keys->ecdh_key, sizeof(handshake->ecdh_key));
+    memcpy(handshake->server_key, keys->server_key, sizeof(handshake->server_key));
+    memcpy(handshake->ecdsa_key, keys->ecdsa_key, sizeof(handshake->ecdsa_key));
+    handshake->certificate = g_byte_array_sized_new(keys->certificate_len);
+    g_byte_array_append(handshake->certificate, keys->certificate, keys->certificate_len);
+
+    handshake->out = g_byte_array_sized_new(0x200);
+    handshake->in = g_byte_array_sized_new(0x200);
+    handshake->scratch = g_byte_array_sized_new(0x80);
+
+    validity90_handshake_reset(handshake, client_random);
+
+    return handshake;
+}
+
+void validity90_handshake_free(validity90_handshake *handshake) {
+    if (handshake == NULL) {
+        return;
+    }
+    g_clear_pointer(&handshake->transcript, validity90_sha256_free);
+    g_clear_pointer(&handshake->sign_key, validity90_ecdsa_key_free);
+    g_clear_pointer(&handshake->session, validity90_tls_session_free);
+    g_byte_array_free(handshake->certificate, TRUE);
+    g_byte_array_free(handshake->out, TRUE);
+    g_byte_array_free(handshake->in, TRUE);
+    g_byte_array_free(handshake->scratch, TRUE);
+
+    memset(handshake, 0, sizeof(validity90_handshake));
+    g_free(handshake);
+}
+
+void validity90_handshake_reset(validity90_handshake *handshake, const guint8 *client_random) {
+    handshake->state = VALIDITY90_HANDSHAKE_START;
+    memcpy(handshake->client_random, client_random, VALIDITY90_HANDSHAKE_RANDOM_SIZE);
+    memset(handshake->server_random, 0, VALIDITY90_HANDSHAKE_RANDOM_SIZE);
+    memset(handshake->key_block, 0, HANDSHAKE_KEY_BLOCK_SIZE);
+    memset(&handshake->timing, 0, sizeof(handshake->timing));
+
+    g_clear_pointer(&handshake->session, validity90_tls_session_free);
+    if (handshake->transcript != NULL) {
+        validity90_sha256_reset(handshake->transcript);
+    }
+    g_byte_array_set_size(handshake->out, 0);
+}
+
+validity90_handshake_state validity90_handshake_get_state(validity90_handshake *handshake) {
+    return handshake->state;
+}
+
+const validity90_handshake_timing *validity90_handshake_get_timing(validity90_handshake *handshake) {
+    return &handshake->timing;
+}
+
+const guint8 *validity90_handshake_get_key_block(validity90_handshake *handshake, gsize *key_block_len) {
+    g_return_val_if_fail (handshake->state == VALIDITY90_HANDSHAKE_DONE, NULL);
+
+    *key_block_len = HANDSHAKE_KEY_BLOCK_SIZE;
+    return handshake->key_block;
+}
+
+validity90_tls_session *validity90_handshake_steal_session(validity90_handshake *handshake) {
+    g_return_val_if_fail (handshake->state == VALIDITY90_HANDSHAKE_DONE, NULL);
+
+    return g_steal_pointer(&handshake->session);
+}
+
+static void append_uint16(GByteArray *out, guint16 value) {
+    guint8 bytes[] = { value >> 8, value & 0xFF };
+    g_byte_array_append(out, bytes, sizeof(bytes));
+}
+
+static void append_uint24(GByteArray *out, guint32 value) {
+    guint8 bytes[] = { (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF };
+    g_byte_array_append(out, bytes, sizeof(bytes));
+}
+
+// Record header with its length filled in by record_end
+static guint record_begin(GByteArray *out, guint8 type) {
+    guint8 header[VALIDITY90_TLS_HEADER_SIZE] = { type, 0x03, 0x03, 0x00, 0x00 };
+    guint start = out->len;
+
+    g_byte_array_append(out, header, sizeof(header));
+    return start;
+}
+
+static void record_end(GByteArray *out, guint start) {
+    gsize len = out->len - start - VALIDITY90_TLS_HEADER_SIZE;
+
+    out->data[start + 3] = (len >> 8) & 0xFF;
+    out->data[start + 4] = len & 0xFF;
+}
+
+static void handshake_message_begin(GByteArray *out, guint8 type, gsize len) {
+    g_byte_array_append(out, &type, 1);
+    append_uint24(out, len);
+}
+
+static gboolean transcript_fork(validity90_handshake *handshake, guint8 *hash, GError **error) {
+    // The running hash goes on
+    if (!validity90_sha256_peek(handshake->transcript, hash)) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_CRYPTO,
+                    "Handshake: transcript copy failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean ecdh_pre_master_secret(validity90_handshake *handshake, guint8 *pre_master_secret, GError **error) {
+    // The X coordinate of d * Q
+    if (!validity90_ecdh_p256(handshake->ecdh_key + VALIDITY90_EC_POINT_SIZE, handshake->server_key,
+                              pre_master_secret)) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_KEY,
+                    "Handshake: ECDH failed, keys aren't on the curve");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// A 0x21 byte integer, minimal DER only when value has its top bit set
+static void der_put_integer(guint8 *out, const guint8 *value) {
+    out[0] = 0x02;
+    out[1] = 0x21;
+    out[2] = 0x00;
+    memcpy(out + 3, value, VALIDITY90_EC_SCALAR_SIZE);
+}
+
+static gboolean ecdsa_sign(validity90_handshake *handshake, const guint8 *hash, guint8 *signature, GError **error) {
+    guint8 r[VALIDITY90_EC_SCALAR_SIZE], s[VALIDITY90_EC_SCALAR_SIZE];
+
+    if (handshake->sign_key == NULL &&
+        (handshake->sign_key = validity90_ecdsa_key_new(handshake->ecdsa_key)) == NULL) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_KEY,
+                    "Handshake: can't load ECDSA key");
+        return FALSE;
+    }
+
+    /*
+     * The sensor has only ever been sent the 0x48 byte layout, which is only
+     * minimal DER with the top bits of r and s set. n - s is as valid as s and
+     * has it set whenever s doesn't (but for 1 in 2^32), r only gets there by
+     * signing again: two signatures on average.
+     */
+    do {
+        if (!validity90_ecdsa_sign(handshake->sign_key, hash, r, s) ||
+            (!(s[0] & 0x80) && !validity90_ecdsa_negate_s(handshake->sign_key, s))) {
+            g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_CRYPTO,
+                        "Handshake: ECDSA sign failed");
+            return FALSE;
+        }
+    } while (!(r[0] & 0x80) || !(s[0] & 0x80));
+
+    signature[0] = 0x30;
+    signature[1] = HANDSHAKE_SIGNATURE_SIZE - 2;
+    der_put_integer(signature + 2, r);
+    der_put_integer(signature + 2 + 2 + 0x21, s);
+
+    return TRUE;
+}
+
+static gboolean handshake_client_hello(validity90_handshake *handshake, GError **error) {
+    if (handshake->transcript == NULL &&
+        (handshake->transcript = validity90_sha256_new()) == NULL) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_CRYPTO,
+                    "Handshake: transcript hash open failed");
+        return FALSE;
+    }
+
+    GByteArray *out = handshake->out;
+    g_byte_array_append(out, handshake_prefix, sizeof(handshake_prefix));
+    guint record = record_begin(out, TLS_TYPE_HANDSHAKE);
+    guint message = out->len;
+
+    handshake_message_begin(out, TLS_HS_CLIENT_HELLO,
+                            2 + VALIDITY90_HANDSHAKE_RANDOM_SIZE + sizeof(client_hello_tail));
+    append_uint16(out, 0x0303);
+    g_byte_array_append(out, handshake->client_random, VALIDITY90_HANDSHAKE_RANDOM_SIZE);
+    g_byte_array_append(out, client_hello_tail, sizeof(client_hello_tail));
+    record_end(out, record);
+
+    validity90_sha256_write(handshake->transcript, out->data + message, out->len - message);
+
+    return TRUE;
+}
+
+static gboolean handshake_server_hello(validity90_handshake *handshake, const guint8 *in, gsize in_len,
+                                       GError **error) {
+    gsize body_len = in_len >= VALIDITY90_TLS_HEADER_SIZE ? (in[3] << 8) | in[4] : 0;
+
+    if (in_len < VALIDITY90_TLS_HEADER_SIZE || in[0] != TLS_TYPE_HANDSHAKE ||
+        body_len > in_len - VALIDITY90_TLS_HEADER_SIZE || body_len < 4 + 2 + VALIDITY90_HANDSHAKE_RANDOM_SIZE ||
+        in[VALIDITY90_TLS_HEADER_SIZE] != TLS_HS_SERVER_HELLO) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_INVALID_MESSAGE,
+                    "Handshake: invalid ServerHello");
+        return FALSE;
+    }
+
+    const guint8 *body = in + VALIDITY90_TLS_HEADER_SIZE;
+    memcpy(handshake->server_random, body + 4 + 2, VALIDITY90_HANDSHAKE_RANDOM_SIZE);
+    validity90_sha256_write(handshake->transcript, body, body_len);
+
+    return TRUE;
+}
+
+static gboolean handshake_client_flight(validity90_handshake *handshake, GError **error) {
+    gboolean result = FALSE;
+    guint8 pre_master_secret[0x20], master_secret[HANDSHAKE_MASTER_SECRET_SIZE];
+    guint8 seed[2 * VALIDITY90_HANDSHAKE_RANDOM_SIZE], hash[0x20];
+    guint8 finished[4 + HANDSHAKE_VERIFY_DATA_SIZE];
+    validity90_tls_prf_engine *prf = NULL;
+    GByteArray *out = handshake->out;
+    gint64 started;
+
+    started = g_get_monotonic_time();
+    if (!ecdh_pre_master_secret(handshake, pre_master_secret, error)) {
+        goto end;
+    }
+    handshake->timing.ecdh_us += g_get_monotonic_time() - started;
+
+    started = g_get_monotonic_time();
+    memcpy(seed, handshake->client_random, VALIDITY90_HANDSHAKE_RANDOM_SIZE);
+    memcpy(seed + VALIDITY90_HANDSHAKE_RANDOM_SIZE, handshake->server_random, VALIDITY90_HANDSHAKE_RANDOM_SIZE);
+    if (!validity90_tls_prf(pre_master_secret, sizeof(pre_master_secret), "master secret", seed, sizeof(seed),
+                            sizeof(master_secret), master_secret, error) ||
+        (prf = validity90_tls_prf_engine_new(master_secret, sizeof(master_secret), error)) == NULL ||
+        !validity90_tls_prf_engine_derive(prf, "key expansion", seed, sizeof(seed), HANDSHAKE_KEY_BLOCK_SIZE,
+                                          handshake->key_block, error)) {
+        goto end;
+    }
+    handshake->timing.prf_us += g_get_monotonic_time() - started;
+
+    if ((handshake->session = validity90_tls_session_new(handshake->key_block, HANDSHAKE_KEY_BLOCK_SIZE,
+                                                         error)) == NULL) {
+        goto end;
+    }
+
+    g_byte_array_append(out, handshake_prefix, sizeof(handshake_prefix));
+    guint record = record_begin(out, TLS_TYPE_HANDSHAKE);
+    guint messages = out->len;
+
+    // The certificate comes from RSP6 and is sent as the sensor stored it
+    gsize cert_len = handshake->certificate->len;
+    handshake_message_begin(out, TLS_HS_CERTIFICATE, 3 + 3 + 2 + cert_len);
+    append_uint24(out, cert_len);
+    append_uint24(out, cert_len);
+    append_uint16(out, 0x0000);
+    g_byte_array_append(out, handshake->certificate->data, cert_len);
+
+    handshake_message_begin(out, TLS_HS_CLIENT_KEY_EXCHANGE, 0x41);
+    g_byte_array_append(out, (const guint8*) "\x04", 1);
+    g_byte_array_append(out, handshake->ecdh_key, 0x40);
+
+    validity90_sha256_write(handshake->transcript, out->data + messages, out->len - messages);
+    if (!transcript_fork(handshake, hash, error)) {
+        goto end;
+    }
+
+    guint verify = out->len;
+    handshake_message_begin(out, TLS_HS_CERTIFICATE_VERIFY, HANDSHAKE_SIGNATURE_SIZE);
+    g_byte_array_set_size(out, out->len + HANDSHAKE_SIGNATURE_SIZE);
+
+    started = g_get_monotonic_time();
+    if (!ecdsa_sign(handshake, hash, out->data + out->len - HANDSHAKE_SIGNATURE_SIZE, error)) {
+        goto end;
+    }
+    handshake->timing.sign_us += g_get_monotonic_time() - started;
+    record_end(out, record);
+
+    validity90_sha256_write(handshake->transcript, out->data + verify, out->len - verify);
+    if (!transcript_fork(handshake, hash, error)) {
+        goto end;
+    }
+
+    g_byte_array_append(out, change_cipher_spec, sizeof(change_cipher_spec));
+
+    finished[0] = TLS_HS_FINISHED;
+    finished[1] = finished[2] = 0x00;
+    finished[3] = HANDSHAKE_VERIFY_DATA_SIZE;
+
+    started = g_get_monotonic_time();
+    if (!validity90_tls_prf_engine_derive(prf, "client finished", hash, sizeof(hash), HANDSHAKE_VERIFY_DATA_SIZE,
+                                          finished + 4, error)) {
+        goto end;
+    }
+    handshake->timing.prf_us += g_get_monotonic_time() - started;
+
+    validity90_sha256_write(handshake->transcript, finished, sizeof(finished));
+    if (!validity90_tls_session_seal_record(handshake->session, TLS_TYPE_HANDSHAKE, finished, sizeof(finished),
+                                            out, error)) {
+        goto end;
+    }
+    result = TRUE;
+
+end:
+    validity90_tls_prf_engine_free(prf);
+    memset(pre_master_secret, 0, sizeof(pre_master_secret));
+    memset(master_secret, 0, sizeof(master_secret));
+
+    return result;
+}
+
+static gboolean handshake_server_finished(validity90_handshake *handshake, const guint8 *in, gsize in_len,
+                                          GError **error) {
+    guint8 *plain;
+    gsize plain_len;
+
+    if (in_len < sizeof(change_cipher_spec) || memcmp(in, change_cipher_spec, sizeof(change_cipher_spec)) != 0) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_INVALID_MESSAGE,
+                    "Handshake: no ChangeCipherSpec from the sensor");
+        return FALSE;
+    }
+    in += sizeof(change_cipher_spec);
+    in_len -= sizeof(change_cipher_spec);
+
+    if (in_len < 1 || in[0] != TLS_TYPE_HANDSHAKE) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_INVALID_MESSAGE,
+                    "Handshake: no Finished from the sensor");
+        return FALSE;
+    }
+
+    // Opened in place, the response stays as it came
+    g_byte_array_set_size(handshake->scratch, 0);
+    g_byte_array_append(handshake->scratch, in, in_len);
+
+    if (!validity90_tls_session_open_record(handshake->session, handshake->scratch->data, in_len, &plain,
+                                            &plain_len, error)) {
+        g_prefix_error(error, "Handshake: sensor Finished: ");
+        return FALSE;
+    }
+
+    /*
+     * The MAC proves both sides have the same keys. The verify data isn't
+     * compared: it covers our CertificateVerify, which a replayed sensor
+     * never saw.
+     */
+    if (plain_len != 4 + HANDSHAKE_VERIFY_DATA_SIZE || plain[0] != TLS_HS_FINISHED ||
+        plain[3] != HANDSHAKE_VERIFY_DATA_SIZE) {
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_SERVER_FINISHED,
+                    "Handshake: invalid Finished from the sensor");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_handshake_step(validity90_handshake *handshake, const guint8 *in, gsize in_len,
+                                   const guint8 **out, gsize *out_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    gboolean result = FALSE;
+
+    g_byte_array_set_size(handshake->out, 0);
+
+    switch (handshake->state) {
+    case VALIDITY90_HANDSHAKE_START:
+        handshake->started = g_get_monotonic_time();
+        if (!handshake_client_hello(handshake, error)) {
+            break;
+        }
+        handshake->state = VALIDITY90_HANDSHAKE_WAIT_SERVER_HELLO;
+        result = TRUE;
+        break;
+
+    case VALIDITY90_HANDSHAKE_WAIT_SERVER_HELLO:
+        if (!handshake_server_hello(handshake, in, in_len, error) ||
+            !handshake_client_flight(handshake, error)) {
+            break;
+        }
+        handshake->state = VALIDITY90_HANDSHAKE_WAIT_SERVER_FINISHED;
+        result = TRUE;
+        break;
+
+    case VALIDITY90_HANDSHAKE_WAIT_SERVER_FINISHED:
+        if (!handshake_server_finished(handshake, in, in_len, error)) {
+            break;
+        }
+        handshake->state = VALIDITY90_HANDSHAKE_DONE;
+        handshake->timing.total_us = g_get_monotonic_time() - handshake->started;
+        result = TRUE;
+        break;
+
+    default:
+        g_set_error(error, VALIDITY90_HANDSHAKE_ERROR, VALIDITY90_HANDSHAKE_ERR_STATE,
+                    "Handshake: nothing to do in state %d", handshake->state);
+        return FALSE;
+    }
+
+    if (!result) {
+        handshake->state = VALIDITY90_HANDSHAKE_FAILED;
+        g_byte_array_set_size(handshake->out, 0);
+    }
+    *out = handshake->out->data;
+    *out_len = handshake->out->len;
+
+    return result;
+}
+
+gboolean validity90_handshake_run(validity90_handshake *handshake, validity90_transport *transport, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    const guint8 *out;
+    gsize out_len, in_len = 0;
+    gint64 started;
+
+    g_byte_array_set_size(handshake->in, 0x1000);
+
+    if (!validity90_handshake_step(handshake, NULL, 0, &out, &out_len, error)) {
+        return FALSE;
+    }
+    while (out_len > 0) {
+        started = g_get_monotonic_time();
+        if (!validity90_transport_write(transport, 0x01, out, out_len, 10000, error) ||
+            !validity90_transport_read(transport, 0x81, handshake->in->data, handshake->in->len, &in_len,
+                                       10000, error)) {
+            handshake->state = VALIDITY90_HANDSHAKE_FAILED;
+            return FALSE;
+        }
+        handshake->timing.io_us += g_get_monotonic_time() - started;
+
+        if (!validity90_handshake_step(handshake, handshake->in->data, in_len, &out, &out_len, error)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,116 @@
+/*
+ * Validity90 TLS handshake
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include <glib.h>
+
+#include "tls.h"
+#include "transport.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_HANDSHAKE_ERROR validity90_handshake_error_quark()
+
+GQuark validity90_handshake_error_quark(void);
+
+enum validity90_handshake_error_codes {
+    VALIDITY90_HANDSHAKE_ERR_STATE,
+    VALIDITY90_HANDSHAKE_ERR_KEY,
+    VALIDITY90_HANDSHAKE_ERR_CRYPTO,
+    VALIDITY90_HANDSHAKE_ERR_INVALID_MESSAGE,
+    VALIDITY90_HANDSHAKE_ERR_SERVER_FINISHED,
+};
+
+#define VALIDITY90_HANDSHAKE_RANDOM_SIZE 0x20
+
+/* Keys are big-endian X || Y (|| d) P-256 components, as in rsp6_info */
+typedef struct validity90_handshake_keys {
+    // Client ECDH key, X || Y || d
+    const guint8 *ecdh_key;
+    // Sensor ECDH public key, X || Y
+    const guint8 *server_key;
+    // Client ECDSA key the certificate is for, X || Y || d
+    const guint8 *ecdsa_key;
+    const guint8 *certificate;
+    gsize certificate_len;
+} validity90_handshake_keys;
+
+typedef enum validity90_handshake_state {
+    VALIDITY90_HANDSHAKE_START,
+    VALIDITY90_HANDSHAKE_WAIT_SERVER_HELLO,
+    VALIDITY90_HANDSHAKE_WAIT_SERVER_FINISHED,
+    VALIDITY90_HANDSHAKE_DONE,
+    VALIDITY90_HANDSHAKE_FAILED,
+} validity90_handshake_state;
+
+/* Accumulated over the steps of one handshake, io_us only with _run */
+typedef struct validity90_handshake_timing {
+    gint64 ecdh_us;
+    gint64 prf_us;
+    gint64 sign_us;
+    gint64 io_us;
+    gint64 total_us;
+} validity90_handshake_timing;
+
+/*
+ * Client side of the sensor handshake as a state machine: every step takes
+ * the sensor's response to the previous message and gives the next one to
+ * send. All state, the running transcript hash and the message buffers
+ * belong to the handshake, so several can run at once and one can be reset
+ * and run again on the same keys.
+ */
+typedef struct validity90_handshake validity90_handshake;
+
+/* Keys are copied */
+validity90_handshake *validity90_handshake_new(const validity90_handshake_keys *keys,
+                                               const guint8 *client_random);
+void validity90_handshake_free(validity90_handshake *handshake);
+
+/* Back to START for a new handshake, buffers are kept */
+void validity90_handshake_reset(validity90_handshake *handshake, const guint8 *client_random);
+
+validity90_handshake_state validity90_handshake_get_state(validity90_handshake *handshake);
+
+/*
+ * in is the response to the last message, nothing for the first step. out is
+ * the next message, valid until the next step, out_len is 0 once DONE.
+ */
+gboolean validity90_handshake_step(validity90_handshake *handshake, const guint8 *in, gsize in_len,
+                                   const guint8 **out, gsize *out_len, GError **error);
+
+/* All steps over the bulk endpoints */
+gboolean validity90_handshake_run(validity90_handshake *handshake, validity90_transport *transport, GError **error);
+
+const validity90_handshake_timing *validity90_handshake_get_timing(validity90_handshake *handshake);
+
+/* Once DONE: the expanded key block, as decrypt-capture -k takes it */
+const guint8 *validity90_handshake_get_key_block(validity90_handshake *handshake, gsize *key_block_len);
+
+/* Once DONE: the established session, owned by the caller */
+validity90_tls_session *validity90_handshake_steal_session(validity90_handshake *handshake);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // HANDSHAKE_H
@@ -0,0 +1,339 @@
+/*
+ * Validity90 image dumping
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <png.h>
+
+#include "image.h"
+
+GQuark validity90_image_error_quark (void) {
+  return g_quark_from_static_string ("validity-image-error-quark");
+}
+
+static void image_png_error(png_structp png_ptr, png_const_charp message) {
+    GError **error = png_get_error_ptr(png_ptr);
+
+    g_set_error(error, VALIDITY90_IMAGE_ERROR, VALIDITY90_IMAGE_ERR_PNG, "PNG: %s", message);
+    png_longjmp(png_ptr, 1);
+}
+
+static void image_png_warning(png_structp png_ptr, png_const_charp message) {
+}
+
+gboolean validity90_image_write_png(const char *path, const guint8 *image, guint width, guint height,
+                                    gint compression, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    GError *local_error = NULL;
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+    FILE *fp;
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        int errsv = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not open %s for writing: %s", path, g_strerror(errsv));
+        return FALSE;
+    }
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, &local_error, image_png_error, image_png_warning);
+    if (png_ptr == NULL) {
+        g_set_error(&local_error, VALIDITY90_IMAGE_ERROR, VALIDITY90_IMAGE_ERR_PNG, "PNG: can't allocate write struct");
+        goto end;
+    }
+    info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == NULL) {
+        g_set_error(&local_error, VALIDITY90_IMAGE_ERROR, VALIDITY90_IMAGE_ERR_PNG, "PNG: can't allocate info struct");
+        goto end;
+    }
+
+    // local_error is set by image_png_error
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        goto end;
+    }
+
+    png_init_io(png_ptr, fp);
+    if (compression >= 0) {
+        png_set_compression_level(png_ptr, compression);
+    }
+    png_set_IHDR(png_ptr, info_ptr, width, height,
+                 8, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+
+    for (guint y = 0; y < height; y++) {
+        png_write_row(png_ptr, image + (gsize) width * y);
+    }
+
+    png_write_end(png_ptr, NULL);
+
+end:
+    if (png_ptr != NULL) {
+        png_destroy_write_struct(&png_ptr, info_ptr != NULL ? &info_ptr : NULL);
+    }
+    if (fclose(fp) != 0 && local_error == NULL) {
+        int errsv = errno;
+        g_set_error(&local_error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not write %s: %s", path, g_strerror(errsv));
+    }
+
+    if (local_error != NULL) {
+        g_propagate_error(error, local_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_image_write_raw(const char *path, const guint8 *image, gsize len, GError **error) {
+    return g_file_set_contents(path, (const gchar *) image, len, error);
+}
+
+typedef struct image_dump {
+    char *name;
+    guint width;
+    guint height;
+    guint8 image[0];
+} image_dump;
+
+struct validity90_image_dumper {
+    GThread *thread;
+    GAsyncQueue *queue;
+    gint compression;
+
+    // Only touched by the thread until it is joined
+    GError *error;
+};
+
+// Pushed by validity90_image_dumper_free to stop the thread
+static image_dump image_dump_quit;
+
+static gboolean image_dump_write(validity90_image_dumper *dumper, image_dump *dump, GError **error) {
+    gboolean ok;
+    char *path;
+
+    path = g_strconcat(dump->name, ".png", NULL);
+    ok = validity90_image_write_png(path, dump->image, dump->width, dump->height, dumper->compression, error);
+    g_free(path);
+    if (!ok) {
+        return FALSE;
+    }
+
+    path = g_strconcat(dump->name, ".raw", NULL);
+    ok = validity90_image_write_raw(path, dump->image, (gsize) dump->width * dump->height, error);
+    g_free(path);
+
+    return ok;
+}
+
+static gpointer image_dumper_thread(gpointer user_data) {
+    validity90_image_dumper *dumper = user_data;
+    image_dump *dump;
+
+    while ((dump = g_async_queue_pop(dumper->queue)) != &image_dump_quit) {
+        GError *error = NULL;
+
+        if (!image_dump_write(dumper, dump, &error)) {
+            if (dumper->error == NULL) {
+                dumper->error = error;
+            } else {
+                g_error_free(error);
+            }
+        }
+        g_free(dump->name);
+        g_free(dump);
+    }
+
+    return NULL;
+}
+
+validity90_image_dumper *validity90_image_dumper_new(gint compression) {
+    validity90_image_dumper *dumper = g_malloc0(sizeof(validity90_image_dumper));
+
+    dumper->compression = compression;
+    dumper->queue = g_async_queue_new();
+    dumper->thread = g_thread_new("validity90-image-dumper", image_dumper_thread, dumper);
+
+    return dumper;
+}
+
+void validity90_image_dumper_push(validity90_image_dumper *dumper, const char *name,
+                                  const guint8 *image, guint width, guint height) {
+    gsize len = (gsize) width * height;
+    image_dump *dump = g_malloc(sizeof(image_dump) + len);
+
+    dump->name = g_strdup(name);
+    dump->width = width;
+    dump->height = height;
+    memcpy(dump->image, image, len);
+
+    g_async_queue_push(dumper->queue, dump);
+}
+
+gboolean validity90_image_dumper_free(validity90_image_dumper *dumper, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    GError *local_error;
+
+    g_async_queue_push(dumper->queue, &image_dump_quit);
+    g_thread_join(dumper->thread);
+    g_async_queue_unref(dumper->queue);
+
+    local_error = dumper->error;
+    g_free(dumper);
+
+    if (local_error != NULL) {
+        g_propagate_error(error, local_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Chunk header sizes of the buffer read (0x51) responses, the first one carries extra info
+const validity90_image_geometry validity90_image_geometry_0090 = {
+    .width = VALIDITY90_IMAGE_WIDTH,
+    .height = VALIDITY90_IMAGE_HEIGHT,
+    .stride = VALIDITY90_IMAGE_WIDTH,
+    .first_header_len = 0x12,
+    .header_len = 0x06,
+};
+
+struct validity90_image_assembler {
+    validity90_image_geometry geometry;
+    guint8 *image;
+
+    // Sensor bytes of the image received so far, stride per line
+    gsize received;
+    guint chunks;
+    guint rows;
+
+    validity90_image_rows_cb rows_cb;
+    gpointer rows_user_data;
+};
+
+validity90_image_assembler *validity90_image_assembler_new(const validity90_image_geometry *geometry) {
+    g_return_val_if_fail (geometry->width > 0 && geometry->height > 0 && geometry->stride >= geometry->width, NULL);
+
+    validity90_image_assembler *assembler = g_malloc0(sizeof(validity90_image_assembler));
+
+    assembler->geometry = *geometry;
+    assembler->image = g_malloc0((gsize) geometry->width * geometry->height);
+
+    return assembler;
+}
+
+void validity90_image_assembler_free(validity90_image_assembler *assembler) {
+    if (assembler == NULL) {
+        return;
+    }
+    g_free(assembler->image);
+    g_free(assembler);
+}
+
+void validity90_image_assembler_set_rows_cb(validity90_image_assembler *assembler, validity90_image_rows_cb cb,
+                                            gpointer user_data) {
+    assembler->rows_cb = cb;
+    assembler->rows_user_data = user_data;
+}
+
+void validity90_image_assembler_reset(validity90_image_assembler *assembler) {
+    assembler->received = 0;
+    assembler->chunks = 0;
+    assembler->rows = 0;
+}
+
+gboolean validity90_image_assembler_push(validity90_image_assembler *assembler, const guint8 *chunk, gsize len,
+                                         GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    const validity90_image_geometry *geometry = &assembler->geometry;
+    gsize header_len = assembler->chunks == 0 ? geometry->first_header_len : geometry->header_len;
+    gsize size = (gsize) geometry->stride * geometry->height;
+
+    if (len < header_len || len < 2 || chunk[0] != 0 || chunk[1] != 0) {
+        g_set_error(error, VALIDITY90_IMAGE_ERROR, VALIDITY90_IMAGE_ERR_CHUNK,
+                    "Image: bad chunk %u, len: %lu, status: %02x%02x", assembler->chunks, len,
+                    len > 0 ? chunk[0] : 0xff, len > 1 ? chunk[1] : 0xff);
+        return FALSE;
+    }
+
+    const guint8 *data = chunk + header_len;
+    gsize data_len = len - header_len;
+
+    if (data_len > size - assembler->received) {
+        g_set_error(error, VALIDITY90_IMAGE_ERROR, VALIDITY90_IMAGE_ERR_OVERFLOW,
+                    "Image: chunk %u doesn't fit the %ux%u image, len: %lu", assembler->chunks,
+                    geometry->width, geometry->height, len);
+        return FALSE;
+    }
+    assembler->chunks++;
+
+    if (geometry->stride == geometry->width) {
+        memcpy(assembler->image + assembler->received, data, data_len);
+        assembler->received += data_len;
+    } else {
+        // Lines split over chunks end up in place, the columns past width are skipped
+        while (data_len > 0) {
+            gsize line = assembler->received / geometry->stride;
+            gsize column = assembler->received % geometry->stride;
+            gsize n = MIN(data_len, geometry->stride - column);
+
+            if (column < geometry->width) {
+                memcpy(assembler->image + line * geometry->width + column, data,
+                       MIN(n, geometry->width - column));
+            }
+            assembler->received += n;
+            data += n;
+            data_len -= n;
+        }
+    }
+
+    guint rows = assembler->received / geometry->stride;
+    if (rows > assembler->rows) {
+        guint first_row = assembler->rows;
+
+        assembler->rows = rows;
+        if (assembler->rows_cb != NULL) {
+            assembler->rows_cb(assembler->image, geometry->width, first_row, rows - first_row,
+                               assembler->rows_user_data);
+        }
+    }
+
+    return TRUE;
+}
+
+const validity90_image_geometry *validity90_image_assembler_get_geometry(validity90_image_assembler *assembler) {
+    return &assembler->geometry;
+}
+
+guint validity90_image_assembler_get_rows(validity90_image_assembler *assembler) {
+    return assembler->rows;
+}
+
+gboolean validity90_image_assembler_is_complete(validity90_image_assembler *assembler) {
+    return assembler->rows == assembler->geometry.height;
+}
+
+const guint8 *validity90_image_assembler_get_image(validity90_image_assembler *assembler) {
+    return assembler->image;
+}
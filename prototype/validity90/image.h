@@ -0,0 +1,112 @@
+/*
+ * Validity90 image dumping
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <glib.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_IMAGE_ERROR validity90_image_error_quark()
+
+GQuark validity90_image_error_quark(void);
+
+enum validity90_image_error_codes {
+    VALIDITY90_IMAGE_ERR_PNG,
+    VALIDITY90_IMAGE_ERR_CHUNK,
+    VALIDITY90_IMAGE_ERR_OVERFLOW,
+};
+
+// 0090 and 0097
+#define VALIDITY90_IMAGE_WIDTH 144
+#define VALIDITY90_IMAGE_HEIGHT 144
+
+/* Layout of the image in the buffer read (0x51) responses of a sensor */
+typedef struct validity90_image_geometry {
+    guint width;
+    guint height;
+    // Sensor bytes per line, the ones past width are dropped
+    guint stride;
+    // Before the image data of the first and every other chunk, the 16 bit status comes first
+    gsize first_header_len;
+    gsize header_len;
+} validity90_image_geometry;
+
+extern const validity90_image_geometry validity90_image_geometry_0090;
+
+/* rows complete rows from first_row on, the image is width bytes per row */
+typedef void (*validity90_image_rows_cb)(const guint8 *image, guint width, guint first_row, guint rows,
+                                         gpointer user_data);
+
+/*
+ * Puts the chunks of one image together in order: every chunk header is
+ * checked and the data after it written row by row straight into an image
+ * allocated once for the geometry. Rows are handed to the rows callback as
+ * soon as they are complete, the image stays valid until the next reset.
+ */
+typedef struct validity90_image_assembler validity90_image_assembler;
+
+/* geometry is copied */
+validity90_image_assembler *validity90_image_assembler_new(const validity90_image_geometry *geometry);
+void validity90_image_assembler_free(validity90_image_assembler *assembler);
+
+void validity90_image_assembler_set_rows_cb(validity90_image_assembler *assembler, validity90_image_rows_cb cb,
+                                            gpointer user_data);
+
+/* For the next image, nothing is reallocated */
+void validity90_image_assembler_reset(validity90_image_assembler *assembler);
+
+/* chunk is a decrypted response, the first one after a reset has the first header */
+gboolean validity90_image_assembler_push(validity90_image_assembler *assembler, const guint8 *chunk, gsize len,
+                                         GError **error);
+
+const validity90_image_geometry *validity90_image_assembler_get_geometry(validity90_image_assembler *assembler);
+/* Complete rows so far, the image is done at geometry height */
+guint validity90_image_assembler_get_rows(validity90_image_assembler *assembler);
+gboolean validity90_image_assembler_is_complete(validity90_image_assembler *assembler);
+/* width * height bytes, only the complete rows are written */
+const guint8 *validity90_image_assembler_get_image(validity90_image_assembler *assembler);
+
+/* 8 bit greyscale, compression is a zlib level, -1 for the libpng default */
+gboolean validity90_image_write_png(const char *path, const guint8 *image, guint width, guint height,
+                                    gint compression, GError **error);
+gboolean validity90_image_write_raw(const char *path, const guint8 *image, gsize len, GError **error);
+
+/*
+ * Writes <name>.png and <name>.raw of every pushed image from a thread of
+ * its own, so whoever pushes never waits for the disk. Images are copied on
+ * push and written in order.
+ */
+typedef struct validity90_image_dumper validity90_image_dumper;
+
+validity90_image_dumper *validity90_image_dumper_new(gint compression);
+void validity90_image_dumper_push(validity90_image_dumper *dumper, const char *name,
+                                  const guint8 *image, guint width, guint height);
+
+/* Waits for the pending images, error is the first failed write if any */
+gboolean validity90_image_dumper_free(validity90_image_dumper *dumper, GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // IMAGE_H
@@ -0,0 +1,289 @@
+/*
+ * Validity90 interrupt events
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+
+#include "interrupt.h"
+
+GQuark validity90_interrupt_error_quark (void) {
+  return g_quark_from_static_string ("validity-interrupt-error-quark");
+}
+
+#define INTERRUPT_EP 0x83
+#define INTERRUPT_BUFF_SIZE 0x100
+#define INTERRUPT_EVENT_SIZE 5
+
+#define EVENT_KEY(a, b, c, d, e) \
+    (((guint64) (a) << 32) | ((guint64) (b) << 24) | ((c) << 16) | ((d) << 8) | (e))
+
+typedef struct interrupt_event_entry {
+    guint64 key;
+    validity90_event_type type;
+} interrupt_event_entry;
+
+// Sorted by key
+static const interrupt_event_entry interrupt_events[] = {
+    { EVENT_KEY(0x00, 0x00, 0x00, 0x00, 0x00), VALIDITY90_EVENT_WAITING_FINGER },
+    { EVENT_KEY(0x02, 0x00, 0x40, 0x06, 0x06), VALIDITY90_EVENT_FINGER_DOWN },
+    { EVENT_KEY(0x02, 0x00, 0x40, 0x10, 0x00), VALIDITY90_EVENT_FINGER_DOWN },
+    { EVENT_KEY(0x03, 0x20, 0x07, 0x00, 0x00), VALIDITY90_EVENT_SCAN_FAILED_TOO_FAST },
+    { EVENT_KEY(0x03, 0x40, 0x01, 0x00, 0x00), VALIDITY90_EVENT_SCAN_STARTED },
+    { EVENT_KEY(0x03, 0x41, 0x03, 0x00, 0x40), VALIDITY90_EVENT_SCAN_COMPLETED },
+    { EVENT_KEY(0x03, 0x42, 0x04, 0x00, 0x40), VALIDITY90_EVENT_SCAN_SUCCEEDED_LOW_QUALITY },
+    { EVENT_KEY(0x03, 0x43, 0x04, 0x00, 0x41), VALIDITY90_EVENT_SCAN_SUCCEEDED },
+    { EVENT_KEY(0x03, 0x60, 0x07, 0x00, 0x40), VALIDITY90_EVENT_SCAN_FAILED_TOO_SHORT },
+    { EVENT_KEY(0x03, 0x61, 0x07, 0x00, 0x41), VALIDITY90_EVENT_SCAN_FAILED_TOO_SHORT },
+};
+
+static const char *interrupt_event_names[] = {
+    [VALIDITY90_EVENT_UNKNOWN] = "unknown",
+    [VALIDITY90_EVENT_WAITING_FINGER] = "waiting-finger",
+    [VALIDITY90_EVENT_FINGER_DOWN] = "finger-down",
+    [VALIDITY90_EVENT_SCAN_STARTED] = "scan-started",
+    [VALIDITY90_EVENT_SCAN_COMPLETED] = "scan-completed",
+    [VALIDITY90_EVENT_SCAN_SUCCEEDED] = "scan-succeeded",
+    [VALIDITY90_EVENT_SCAN_SUCCEEDED_LOW_QUALITY] = "scan-succeeded-low-quality",
+    [VALIDITY90_EVENT_SCAN_FAILED_TOO_SHORT] = "scan-failed-too-short",
+    [VALIDITY90_EVENT_SCAN_FAILED_TOO_FAST] = "scan-failed-too-fast",
+};
+
+validity90_event_type validity90_interrupt_decode(const guint8 *data, gsize len) {
+    if (len != INTERRUPT_EVENT_SIZE) {
+        return VALIDITY90_EVENT_UNKNOWN;
+    }
+
+    guint64 key = EVENT_KEY(data[0], data[1], data[2], data[3], data[4]);
+    gsize lo = 0, hi = G_N_ELEMENTS(interrupt_events);
+
+    while (lo < hi) {
+        gsize mid = (lo + hi) / 2;
+
+        if (interrupt_events[mid].key == key) {
+            return interrupt_events[mid].type;
+        } else if (interrupt_events[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return VALIDITY90_EVENT_UNKNOWN;
+}
+
+const char *validity90_event_type_name(validity90_event_type type) {
+    if (type >= G_N_ELEMENTS(interrupt_event_names)) {
+        return NULL;
+    }
+    return interrupt_event_names[type];
+}
+
+typedef struct interrupt_handler {
+    validity90_event_cb cb;
+    gpointer user_data;
+} interrupt_handler;
+
+struct validity90_interrupts {
+    validity90_transport *transport;
+
+    guint transfers_count;
+    guint in_flight;
+    gboolean stopping;
+    gboolean quit;
+
+    struct libusb_transfer *transfers[VALIDITY90_INTERRUPTS_MAX_TRANSFERS];
+    guint8 *buff;
+
+    interrupt_handler handlers[VALIDITY90_EVENT_COUNT + 1];
+    GError *error;
+};
+
+static void interrupts_cancel(validity90_interrupts *irq) {
+    irq->stopping = TRUE;
+
+    // Cancelled transfers are returned through their callback
+    for (int i = 0; i < irq->transfers_count; i++) {
+        validity90_transport_cancel(irq->transport, irq->transfers[i]);
+    }
+}
+
+static void interrupts_fail(validity90_interrupts *irq, GError *error) {
+    if (irq->error != NULL) {
+        g_error_free(error);
+    } else {
+        irq->error = error;
+    }
+    interrupts_cancel(irq);
+}
+
+static void interrupts_dispatch(validity90_interrupts *irq, const guint8 *data, gsize len) {
+    validity90_event event = {
+        .type = validity90_interrupt_decode(data, len),
+        .data = data,
+        .len = len,
+    };
+
+    interrupt_handler *handler = &irq->handlers[event.type];
+    if (handler->cb == NULL) {
+        handler = &irq->handlers[VALIDITY90_EVENT_ANY];
+    }
+    if (handler->cb != NULL) {
+        handler->cb(irq, &event, handler->user_data);
+    }
+}
+
+static void interrupts_transfer_cb(struct libusb_transfer *transfer) {
+    validity90_interrupts *irq = transfer->user_data;
+    GError *error = NULL;
+
+    irq->in_flight--;
+
+    switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+        if (!irq->stopping) {
+            interrupts_dispatch(irq, transfer->buffer, transfer->actual_length);
+        }
+        break;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        break;
+    case LIBUSB_TRANSFER_CANCELLED:
+        return;
+    default:
+        interrupts_fail(irq, g_error_new(VALIDITY90_INTERRUPT_ERROR, VALIDITY90_INTERRUPT_ERR_TRANSFER,
+                                         "Interrupts: transfer failed, status: %d", transfer->status));
+        return;
+    }
+
+    // A handler may have stopped the reader
+    if (irq->stopping) {
+        return;
+    }
+
+    if (!validity90_transport_submit(irq->transport, transfer, &error)) {
+        interrupts_fail(irq, error);
+        return;
+    }
+    irq->in_flight++;
+}
+
+validity90_interrupts *validity90_interrupts_new(validity90_transport *transport, guint transfers) {
+    g_return_val_if_fail (transfers > 0 && transfers <= VALIDITY90_INTERRUPTS_MAX_TRANSFERS, NULL);
+
+    validity90_interrupts *irq = g_malloc0(sizeof(validity90_interrupts));
+
+    irq->transport = transport;
+    irq->transfers_count = transfers;
+    irq->buff = g_malloc(INTERRUPT_BUFF_SIZE * transfers);
+
+    for (int i = 0; i < transfers; i++) {
+        irq->transfers[i] = libusb_alloc_transfer(0);
+        libusb_fill_interrupt_transfer(irq->transfers[i], NULL, INTERRUPT_EP, irq->buff + i * INTERRUPT_BUFF_SIZE,
+                                       INTERRUPT_BUFF_SIZE, interrupts_transfer_cb, irq, 0);
+    }
+
+    return irq;
+}
+
+void validity90_interrupts_free(validity90_interrupts *irq) {
+    if (irq == NULL) {
+        return;
+    }
+
+    interrupts_cancel(irq);
+    while (irq->in_flight > 0) {
+        GError *error = NULL;
+
+        if (!validity90_transport_handle_events(irq->transport, NULL, NULL, &error)) {
+            g_warning("Interrupts: can't reap cancelled transfers: %s", error->message);
+            g_error_free(error);
+            // Leaking is better than freeing transfers the transport still owns
+            return;
+        }
+    }
+
+    for (int i = 0; i < irq->transfers_count; i++) {
+        libusb_free_transfer(irq->transfers[i]);
+    }
+    g_clear_error(&irq->error);
+    g_free(irq->buff);
+    g_free(irq);
+}
+
+void validity90_interrupts_set_handler(validity90_interrupts *irq, guint type, validity90_event_cb cb, gpointer user_data) {
+    g_return_if_fail (type <= VALIDITY90_EVENT_ANY);
+
+    irq->handlers[type].cb = cb;
+    irq->handlers[type].user_data = user_data;
+}
+
+gboolean validity90_interrupts_start(validity90_interrupts *irq, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+    g_return_val_if_fail (irq->in_flight == 0, FALSE);
+
+    irq->stopping = FALSE;
+    g_clear_error(&irq->error);
+
+    for (int i = 0; i < irq->transfers_count; i++) {
+        if (!validity90_transport_submit(irq->transport, irq->transfers[i], error)) {
+            interrupts_cancel(irq);
+            return FALSE;
+        }
+        irq->in_flight++;
+    }
+
+    return TRUE;
+}
+
+void validity90_interrupts_quit(validity90_interrupts *irq) {
+    irq->quit = TRUE;
+}
+
+gboolean validity90_interrupts_run(validity90_interrupts *irq, guint timeout_ms, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    gint64 deadline = g_get_monotonic_time() + (gint64) timeout_ms * 1000;
+
+    irq->quit = FALSE;
+
+    while (!irq->quit && irq->error == NULL) {
+        struct timeval tv = { 1, 0 };
+
+        if (timeout_ms > 0) {
+            gint64 remaining = deadline - g_get_monotonic_time();
+            if (remaining <= 0) {
+                g_set_error(error, VALIDITY90_INTERRUPT_ERROR, VALIDITY90_INTERRUPT_ERR_TIMEOUT,
+                            "Interrupts: no event within %u ms", timeout_ms);
+                return FALSE;
+            }
+            tv.tv_sec = remaining / G_USEC_PER_SEC;
+            tv.tv_usec = remaining % G_USEC_PER_SEC;
+        }
+
+        if (!validity90_transport_handle_events(irq->transport, &tv, &irq->quit, error)) {
+            return FALSE;
+        }
+    }
+
+    if (irq->error != NULL) {
+        g_propagate_error(error, irq->error);
+        irq->error = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,104 @@
+/*
+ * Validity90 interrupt events
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <glib.h>
+#include <libusb.h>
+
+#include "transport.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_INTERRUPT_ERROR validity90_interrupt_error_quark()
+
+GQuark validity90_interrupt_error_quark(void);
+
+enum validity90_interrupt_error_codes {
+    VALIDITY90_INTERRUPT_ERR_TRANSFER,
+    VALIDITY90_INTERRUPT_ERR_TIMEOUT,
+};
+
+typedef enum validity90_event_type {
+    VALIDITY90_EVENT_UNKNOWN,
+    VALIDITY90_EVENT_WAITING_FINGER,
+    VALIDITY90_EVENT_FINGER_DOWN,
+    VALIDITY90_EVENT_SCAN_STARTED,
+    VALIDITY90_EVENT_SCAN_COMPLETED,
+    VALIDITY90_EVENT_SCAN_SUCCEEDED,
+    // Sent by 0097 on success and by the others on a low quality scan
+    VALIDITY90_EVENT_SCAN_SUCCEEDED_LOW_QUALITY,
+    VALIDITY90_EVENT_SCAN_FAILED_TOO_SHORT,
+    VALIDITY90_EVENT_SCAN_FAILED_TOO_FAST,
+
+    VALIDITY90_EVENT_COUNT,
+} validity90_event_type;
+
+/* Handler slot that receives every event without a handler of its own */
+#define VALIDITY90_EVENT_ANY VALIDITY90_EVENT_COUNT
+
+typedef struct validity90_event {
+    validity90_event_type type;
+    const guint8 *data;
+    gsize len;
+} validity90_event;
+
+/* Classifies a raw interrupt through a sorted table of the known 5 byte events */
+validity90_event_type validity90_interrupt_decode(const guint8 *data, gsize len);
+
+const char *validity90_event_type_name(validity90_event_type type);
+
+/*
+ * Asynchronous reader of the interrupt endpoint (0x83).
+ *
+ * Keeps `transfers` interrupt transfers queued, each one is decoded and
+ * dispatched to the handler of its event type as soon as it completes and
+ * then resubmitted. Events are driven by the transport, so one thread calling
+ * validity90_transport_handle_events() serves any number of readers;
+ * validity90_interrupts_run() is a shortcut for the single reader case.
+ */
+typedef struct validity90_interrupts validity90_interrupts;
+
+typedef void (*validity90_event_cb)(validity90_interrupts *irq, const validity90_event *event, gpointer user_data);
+
+#define VALIDITY90_INTERRUPTS_MAX_TRANSFERS 8
+
+validity90_interrupts *validity90_interrupts_new(validity90_transport *transport, guint transfers);
+/* Cancels queued transfers and waits for them to be returned */
+void validity90_interrupts_free(validity90_interrupts *irq);
+
+/* type is a validity90_event_type or VALIDITY90_EVENT_ANY, cb NULL removes the handler */
+void validity90_interrupts_set_handler(validity90_interrupts *irq, guint type, validity90_event_cb cb, gpointer user_data);
+
+gboolean validity90_interrupts_start(validity90_interrupts *irq, GError **error);
+
+/* Makes validity90_interrupts_run() return, to be called from a handler */
+void validity90_interrupts_quit(validity90_interrupts *irq);
+
+/* Handles events until quit or a failed transfer, timeout_ms 0 waits forever */
+gboolean validity90_interrupts_run(validity90_interrupts *irq, guint timeout_ms, GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // INTERRUPT_H
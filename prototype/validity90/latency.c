@@ -0,0 +1,335 @@
+/*
+ * Validity90 USB latency profiler
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "latency.h"
+
+#define LATENCY_EP_OUT 0x01
+#define LATENCY_EP_IN 0x81
+#define LATENCY_EP_INTERRUPT 0x83
+// Responses longer than this come in several completions, the last one is short
+#define LATENCY_MAX_PACKET_SIZE 0x40
+
+#define LATENCY_KINDS (VALIDITY90_LATENCY_INTERRUPT + 1)
+
+typedef struct latency_command {
+    gint64 ts_us;
+    validity90_latency_key key;
+} latency_command;
+
+struct validity90_latency {
+    validity90_capture_decoder *decoder;
+
+    // Key of the command being fed to the decoder, from its first message
+    validity90_latency_key label;
+    gboolean labelled;
+
+    // Sent and not answered yet, oldest first
+    GQueue outstanding;
+    // The oldest one got part of its response
+    gboolean partial;
+    gint64 partial_ts;
+
+    gboolean started;
+    gint64 first_ts;
+    gint64 last_ts;
+    gint64 last_command_ts;
+    gint64 busy_since;
+
+    // Since the last command was answered
+    gboolean answered_any;
+    validity90_latency_key idle_after;
+    gint64 idle_since;
+    gint64 last_interrupt_ts;
+
+    GArray *samples[LATENCY_KINDS][256];
+    GArray *gap_samples;
+    validity90_latency_gap gaps[VALIDITY90_LATENCY_MAX_GAPS];
+    guint gap_count;
+
+    GArray *series;
+    validity90_latency_summary summary;
+};
+
+static void latency_label_cb(const validity90_capture_message *message, gpointer user_data) {
+    validity90_latency *latency = user_data;
+
+    // The handshake flight is one transfer of several records
+    if (message->in || latency->labelled) {
+        return;
+    }
+    latency->labelled = TRUE;
+
+    if ((message->kind == VALIDITY90_CAPTURE_PLAIN || message->kind == VALIDITY90_CAPTURE_DECRYPTED) &&
+        message->data_len > 0) {
+        latency->label.kind = VALIDITY90_LATENCY_COMMAND;
+        latency->label.code = message->data[0];
+    } else {
+        latency->label.kind = VALIDITY90_LATENCY_RECORD;
+        latency->label.code = message->type;
+    }
+}
+
+validity90_latency *validity90_latency_new(void) {
+    validity90_latency *latency = g_malloc0(sizeof(validity90_latency));
+
+    latency->decoder = validity90_capture_decoder_new(latency_label_cb, latency);
+    g_queue_init(&latency->outstanding);
+    latency->gap_samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    latency->series = g_array_new(FALSE, FALSE, sizeof(validity90_latency_series));
+
+    return latency;
+}
+
+void validity90_latency_free(validity90_latency *latency) {
+    validity90_capture_decoder_free(latency->decoder);
+    g_queue_foreach(&latency->outstanding, (GFunc) g_free, NULL);
+    g_queue_clear(&latency->outstanding);
+
+    for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+        for (int code = 0; code < 256; code++) {
+            if (latency->samples[kind][code] != NULL) {
+                g_array_free(latency->samples[kind][code], TRUE);
+            }
+        }
+    }
+    g_array_free(latency->gap_samples, TRUE);
+    g_array_free(latency->series, TRUE);
+    g_free(latency);
+}
+
+validity90_capture_decoder *validity90_latency_get_decoder(validity90_latency *latency) {
+    return latency->decoder;
+}
+
+static void latency_sample(validity90_latency *latency, validity90_latency_key key, gint64 us) {
+    GArray **samples = &latency->samples[key.kind][key.code];
+
+    if (*samples == NULL) {
+        *samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    }
+    g_array_append_val(*samples, us);
+}
+
+static void latency_seen(validity90_latency *latency, gint64 ts_us) {
+    if (!latency->started) {
+        latency->started = TRUE;
+        latency->first_ts = ts_us;
+    }
+    latency->last_ts = MAX(latency->last_ts, ts_us);
+}
+
+static void latency_gap(validity90_latency *latency, gint64 ts_us, validity90_latency_key before) {
+    validity90_latency_gap gap = {
+        .after = latency->idle_after,
+        .before = before,
+    };
+    gint64 idle_since = latency->idle_since;
+
+    // The host had nothing to send while the sensor was still to report
+    if (latency->last_interrupt_ts > idle_since) {
+        latency->summary.wait_us += latency->last_interrupt_ts - idle_since;
+        idle_since = latency->last_interrupt_ts;
+    }
+
+    gap.start_us = idle_since - latency->first_ts;
+    gap.gap_us = ts_us - idle_since;
+    latency->summary.idle_us += gap.gap_us;
+    g_array_append_val(latency->gap_samples, gap.gap_us);
+
+    // Insertion into the few largest
+    guint pos = latency->gap_count;
+    while (pos > 0 && latency->gaps[pos - 1].gap_us < gap.gap_us) {
+        pos--;
+    }
+    if (pos < VALIDITY90_LATENCY_MAX_GAPS) {
+        guint moved = MIN(latency->gap_count, VALIDITY90_LATENCY_MAX_GAPS - 1) - pos;
+
+        memmove(latency->gaps + pos + 1, latency->gaps + pos, moved * sizeof(validity90_latency_gap));
+        latency->gaps[pos] = gap;
+        latency->gap_count = MIN(latency->gap_count + 1, VALIDITY90_LATENCY_MAX_GAPS);
+    }
+}
+
+static void latency_answer(validity90_latency *latency, gint64 ts_us) {
+    latency_command *command = g_queue_pop_head(&latency->outstanding);
+
+    latency->partial = FALSE;
+    latency_sample(latency, command->key, ts_us - command->ts_us);
+    latency->summary.answered++;
+
+    if (g_queue_is_empty(&latency->outstanding)) {
+        latency->summary.busy_us += ts_us - latency->busy_since;
+        latency->answered_any = TRUE;
+        latency->idle_after = command->key;
+        latency->idle_since = ts_us;
+    }
+    g_free(command);
+}
+
+void validity90_latency_out(validity90_latency *latency, gint64 ts_us, const guint8 *data, gsize data_len) {
+    latency_command *command = g_malloc(sizeof(latency_command));
+
+    latency_seen(latency, ts_us);
+
+    // A command ends the response before it, like in the decoder
+    if (latency->partial) {
+        latency_answer(latency, latency->partial_ts);
+    }
+
+    // A record split over transfers is only decoded with its last one
+    latency->labelled = FALSE;
+    latency->label.kind = VALIDITY90_LATENCY_RECORD;
+    latency->label.code = data_len > 0 ? data[0] : 0;
+    validity90_capture_decoder_feed(latency->decoder, ts_us, FALSE, data, data_len);
+
+    command->ts_us = ts_us;
+    command->key = latency->label;
+
+    if (g_queue_is_empty(&latency->outstanding)) {
+        if (latency->answered_any) {
+            latency_gap(latency, ts_us, command->key);
+        }
+        latency->busy_since = ts_us;
+    }
+    g_queue_push_tail(&latency->outstanding, command);
+    latency->summary.commands++;
+    latency->last_command_ts = ts_us;
+}
+
+void validity90_latency_in(validity90_latency *latency, gint64 ts_us, const guint8 *data, gsize data_len) {
+    latency_seen(latency, ts_us);
+    validity90_capture_decoder_feed(latency->decoder, ts_us, TRUE, data, data_len);
+
+    // Nothing asked for it
+    if (g_queue_is_empty(&latency->outstanding)) {
+        return;
+    }
+
+    if (data_len > 0 && data_len % LATENCY_MAX_PACKET_SIZE == 0) {
+        latency->partial = TRUE;
+        latency->partial_ts = ts_us;
+        return;
+    }
+    latency_answer(latency, ts_us);
+}
+
+void validity90_latency_interrupt(validity90_latency *latency, gint64 ts_us, const guint8 *data, gsize data_len) {
+    validity90_latency_key key = { .kind = VALIDITY90_LATENCY_INTERRUPT };
+
+    if (data_len == 0 || latency->summary.commands == 0) {
+        return;
+    }
+    latency_seen(latency, ts_us);
+
+    key.code = data[0];
+    latency_sample(latency, key, ts_us - latency->last_command_ts);
+    latency->summary.interrupts++;
+    latency->last_interrupt_ts = ts_us;
+}
+
+void validity90_latency_flush(validity90_latency *latency) {
+    if (latency->partial) {
+        latency_answer(latency, latency->partial_ts);
+    }
+    validity90_capture_decoder_flush(latency->decoder);
+}
+
+static void latency_profile_packet(const validity90_usb_packet *packet, gpointer user_data) {
+    validity90_latency *latency = user_data;
+
+    if (packet->ep == LATENCY_EP_OUT) {
+        validity90_latency_out(latency, packet->ts_us, packet->data, packet->data_len);
+    } else if (packet->ep == LATENCY_EP_IN) {
+        validity90_latency_in(latency, packet->ts_us, packet->data, packet->data_len);
+    } else if (packet->ep == LATENCY_EP_INTERRUPT) {
+        validity90_latency_interrupt(latency, packet->ts_us, packet->data, packet->data_len);
+    }
+}
+
+gboolean validity90_latency_profile_file(validity90_latency *latency, const gchar *path, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    gboolean result = validity90_capture_walk_file(path, latency_profile_packet, latency, error);
+
+    validity90_latency_flush(latency);
+
+    return result;
+}
+
+static gint latency_compare(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Nearest rank of sorted samples
+static gint64 latency_percentile(GArray *sorted, guint percent) {
+    guint rank = (sorted->len * percent + 99) / 100;
+
+    return g_array_index(sorted, gint64, MAX(rank, 1) - 1);
+}
+
+const validity90_latency_series *validity90_latency_get_series(validity90_latency *latency, guint *count) {
+    g_array_set_size(latency->series, 0);
+
+    for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+        for (int code = 0; code < 256; code++) {
+            GArray *samples = latency->samples[kind][code];
+            validity90_latency_series series = { .key = { .kind = kind, .code = code } };
+
+            if (samples == NULL) {
+                continue;
+            }
+            g_array_sort(samples, latency_compare);
+
+            series.count = samples->len;
+            series.min_us = g_array_index(samples, gint64, 0);
+            series.p50_us = latency_percentile(samples, 50);
+            series.p99_us = latency_percentile(samples, 99);
+            series.max_us = g_array_index(samples, gint64, samples->len - 1);
+            for (guint i = 0; i < samples->len; i++) {
+                series.total_us += g_array_index(samples, gint64, i);
+            }
+            g_array_append_val(latency->series, series);
+        }
+    }
+
+    *count = latency->series->len;
+    return (const validity90_latency_series *) latency->series->data;
+}
+
+const validity90_latency_gap *validity90_latency_get_gaps(validity90_latency *latency, guint *count) {
+    *count = latency->gap_count;
+    return latency->gaps;
+}
+
+void validity90_latency_get_summary(validity90_latency *latency, validity90_latency_summary *summary) {
+    *summary = latency->summary;
+    summary->span_us = latency->last_ts - latency->first_ts;
+
+    if (latency->gap_samples->len > 0) {
+        g_array_sort(latency->gap_samples, latency_compare);
+        summary->gaps = latency->gap_samples->len;
+        summary->gap_p50_us = latency_percentile(latency->gap_samples, 50);
+        summary->gap_p99_us = latency_percentile(latency->gap_samples, 99);
+        summary->gap_max_us = g_array_index(latency->gap_samples, gint64, latency->gap_samples->len - 1);
+    }
+}
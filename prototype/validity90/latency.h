@@ -0,0 +1,122 @@
+/*
+ * Validity90 USB latency profiler
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <glib.h>
+
+#include "capture.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* The largest idle gaps that are kept with their place in the capture */
+#define VALIDITY90_LATENCY_MAX_GAPS 8
+
+typedef enum validity90_latency_kind {
+    // Plain or decrypted command, code is the opcode
+    VALIDITY90_LATENCY_COMMAND,
+    // TLS record that wasn't decrypted, code is the content type
+    VALIDITY90_LATENCY_RECORD,
+    // Interrupt, code is the event type, timed from the last command sent
+    VALIDITY90_LATENCY_INTERRUPT,
+} validity90_latency_kind;
+
+typedef struct validity90_latency_key {
+    validity90_latency_kind kind;
+    guint8 code;
+} validity90_latency_key;
+
+/* Command round trips from the OUT submission to the end of the response */
+typedef struct validity90_latency_series {
+    validity90_latency_key key;
+    guint count;
+    gint64 min_us;
+    gint64 p50_us;
+    gint64 p99_us;
+    gint64 max_us;
+    gint64 total_us;
+} validity90_latency_series;
+
+/* Nothing outstanding and no interrupt to wait for, the next command could have been queued earlier */
+typedef struct validity90_latency_gap {
+    // From the first command of the capture
+    gint64 start_us;
+    gint64 gap_us;
+    validity90_latency_key after;
+    validity90_latency_key before;
+} validity90_latency_gap;
+
+typedef struct validity90_latency_summary {
+    guint commands;
+    guint answered;
+    guint interrupts;
+
+    // First command to the last transfer
+    gint64 span_us;
+    // At least one command outstanding
+    gint64 busy_us;
+    // Idle, up to the last interrupt that came in
+    gint64 wait_us;
+    // Idle, in the gaps
+    gint64 idle_us;
+
+    guint gaps;
+    gint64 gap_p50_us;
+    gint64 gap_p99_us;
+    gint64 gap_max_us;
+} validity90_latency_summary;
+
+/*
+ * Pairs the bulk commands of a sensor with their responses and interrupts,
+ * in usbmon captures of the vendor driver or of the prototype. Commands are
+ * answered in order, so pipelined ones are paired first in, first out.
+ */
+typedef struct validity90_latency validity90_latency;
+
+validity90_latency *validity90_latency_new(void);
+void validity90_latency_free(validity90_latency *latency);
+
+/* Commands are told apart by opcode once the decoder has the session keys */
+validity90_capture_decoder *validity90_latency_get_decoder(validity90_latency *latency);
+
+/* A bulk OUT submission, a bulk IN completion and an interrupt completion */
+void validity90_latency_out(validity90_latency *latency, gint64 ts_us, const guint8 *data, gsize data_len);
+void validity90_latency_in(validity90_latency *latency, gint64 ts_us, const guint8 *data, gsize data_len);
+void validity90_latency_interrupt(validity90_latency *latency, gint64 ts_us, const guint8 *data, gsize data_len);
+
+/* Ends a response still waiting for the rest of its transfers */
+void validity90_latency_flush(validity90_latency *latency);
+
+/* Profiles the first sensor found in the capture, same as validity90_capture_decode_file */
+gboolean validity90_latency_profile_file(validity90_latency *latency, const gchar *path, GError **error);
+
+/* Ordered by kind and code, valid until the next call */
+const validity90_latency_series *validity90_latency_get_series(validity90_latency *latency, guint *count);
+/* Largest first */
+const validity90_latency_gap *validity90_latency_get_gaps(validity90_latency *latency, guint *count);
+void validity90_latency_get_summary(validity90_latency *latency, validity90_latency_summary *summary);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // LATENCY_H
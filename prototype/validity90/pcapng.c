@@ -0,0 +1,228 @@
+/*
+ * Validity90 usbmon capture reader
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "utils.h"
+#include "pcapng.h"
+
+GQuark validity90_pcapng_error_quark (void) {
+  return g_quark_from_static_string ("validity-pcapng-error-quark");
+}
+
+#define PCAPNG_BLOCK_SHB 0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_EPB 0x00000006
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+#define LINKTYPE_USB_LINUX 189
+#define LINKTYPE_USB_LINUX_MMAPPED 220
+
+#define USBMON_HEADER_SIZE 48
+#define USBMON_MMAPPED_HEADER_SIZE 64
+
+#define PCAPNG_MAX_INTERFACES 16
+
+typedef struct pcapng_interface {
+    guint16 linktype;
+    // Timestamp units per second
+    guint64 ts_units;
+} pcapng_interface;
+
+struct validity90_pcapng {
+    // Mapped rather than read, large traces are paged in as they are walked
+    GMappedFile *file;
+    const guint8 *data;
+    gsize data_len;
+    gsize pos;
+
+    pcapng_interface interfaces[PCAPNG_MAX_INTERFACES];
+    guint interfaces_count;
+};
+
+validity90_pcapng *validity90_pcapng_open(const gchar *path, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    validity90_pcapng *pcap = g_malloc0(sizeof(validity90_pcapng));
+
+    if ((pcap->file = g_mapped_file_new(path, FALSE, error)) == NULL) {
+        g_free(pcap);
+        return NULL;
+    }
+    pcap->data = (const guint8 *) g_mapped_file_get_contents(pcap->file);
+    pcap->data_len = g_mapped_file_get_length(pcap->file);
+
+    guint32 block_type = 0, magic = 0;
+    bstream stream;
+    bstream_init(&stream, pcap->data, pcap->data_len);
+
+    if (!bstream_read_uint32(&stream, &block_type) || block_type != PCAPNG_BLOCK_SHB ||
+        !bstream_read_uint32(&stream, &magic) || !bstream_read_uint32(&stream, &magic)) {
+        g_set_error(error, VALIDITY90_PCAPNG_ERROR, VALIDITY90_PCAPNG_ERR_FORMAT, "PCAPNG: %s is not a pcapng file", path);
+        validity90_pcapng_free(pcap);
+        return NULL;
+    }
+    if (magic != PCAPNG_BYTE_ORDER_MAGIC) {
+        g_set_error(error, VALIDITY90_PCAPNG_ERROR, VALIDITY90_PCAPNG_ERR_UNSUPPORTED,
+                    "PCAPNG: %s is big-endian, not supported", path);
+        validity90_pcapng_free(pcap);
+        return NULL;
+    }
+
+    return pcap;
+}
+
+void validity90_pcapng_free(validity90_pcapng *pcap) {
+    if (pcap == NULL) {
+        return;
+    }
+    g_mapped_file_unref(pcap->file);
+    g_free(pcap);
+}
+
+void validity90_pcapng_rewind(validity90_pcapng *pcap) {
+    pcap->pos = 0;
+    pcap->interfaces_count = 0;
+}
+
+static void pcapng_parse_idb(validity90_pcapng *pcap, const guint8 *body, gsize body_len) {
+    pcapng_interface interface = { .ts_units = G_USEC_PER_SEC };
+    guint16 linktype, opt[2];
+    bstream stream;
+
+    bstream_init(&stream, body, body_len);
+    if (!bstream_read_uint16(&stream, &linktype)) {
+        return;
+    }
+    interface.linktype = linktype;
+
+    // reserved, snaplen
+    bstream_set_pos(&stream, 8);
+    while (bstream_read_uint16_array(&stream, opt, 2) && opt[0] != PCAPNG_OPT_END) {
+        const guint8 *value;
+
+        if (!bstream_read_slice(&stream, (opt[1] + 3) & ~3, &value)) {
+            break;
+        }
+        if (opt[0] == PCAPNG_OPT_IF_TSRESOL && opt[1] == 1) {
+            guint8 exp = value[0] & 0x7f;
+
+            interface.ts_units = 1;
+            for (int i = 0; i < exp && interface.ts_units < G_MAXUINT64 / 10; i++) {
+                interface.ts_units *= (value[0] & 0x80) ? 2 : 10;
+            }
+        }
+    }
+
+    if (pcap->interfaces_count < PCAPNG_MAX_INTERFACES) {
+        pcap->interfaces[pcap->interfaces_count++] = interface;
+    }
+}
+
+static gboolean pcapng_parse_usbmon(const pcapng_interface *interface, guint64 ts,
+                                    const guint8 *data, gsize data_len, validity90_usb_packet *packet) {
+    gsize header_size = interface->linktype == LINKTYPE_USB_LINUX_MMAPPED ? USBMON_MMAPPED_HEADER_SIZE : USBMON_HEADER_SIZE;
+    guint32 words[2];
+    bstream stream;
+
+    if (data_len < header_size) {
+        return FALSE;
+    }
+
+    bstream_init(&stream, data, data_len);
+    bstream_read_uint32_array(&stream, words, 2);
+    packet->urb_id = words[0] | ((guint64) words[1] << 32);
+    packet->event = data[8];
+    packet->xfer_type = data[9];
+    packet->ep = data[10];
+    packet->devnum = data[11];
+
+    bstream_set_pos(&stream, 12);
+    bstream_read_uint16(&stream, &packet->busnum);
+    bstream_set_pos(&stream, 28);
+    bstream_read_uint32(&stream, (guint32 *) &packet->status);
+    bstream_read_uint32(&stream, &packet->urb_len);
+
+    packet->ts_us = interface->ts_units == G_USEC_PER_SEC ? ts : ts * G_USEC_PER_SEC / interface->ts_units;
+    packet->data = data + header_size;
+    packet->data_len = data_len - header_size;
+
+    return TRUE;
+}
+
+gboolean validity90_pcapng_next(validity90_pcapng *pcap, validity90_usb_packet *packet, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    bstream stream;
+    bstream_init(&stream, pcap->data, pcap->data_len);
+
+    while (TRUE) {
+        guint32 header[2];
+        const guint8 *body;
+
+        bstream_set_pos(&stream, pcap->pos);
+        if (bstream_remaining(&stream) == 0) {
+            return FALSE;
+        }
+
+        if (!bstream_read_uint32_array(&stream, header, 2) || header[1] < 12 || header[1] % 4 != 0 ||
+            !bstream_read_slice(&stream, header[1] - 12, &body)) {
+            g_set_error(error, VALIDITY90_PCAPNG_ERROR, VALIDITY90_PCAPNG_ERR_FORMAT,
+                        "PCAPNG: truncated block at %lx", pcap->pos);
+            return FALSE;
+        }
+        gsize body_len = header[1] - 12;
+        pcap->pos += header[1];
+
+        if (header[0] == PCAPNG_BLOCK_SHB) {
+            // New section, interface ids start over
+            pcap->interfaces_count = 0;
+        } else if (header[0] == PCAPNG_BLOCK_IDB) {
+            pcapng_parse_idb(pcap, body, body_len);
+        } else if (header[0] == PCAPNG_BLOCK_EPB) {
+            guint32 epb[5];
+            bstream epb_stream;
+
+            bstream_init(&epb_stream, body, body_len);
+            if (!bstream_read_uint32_array(&epb_stream, epb, G_N_ELEMENTS(epb)) ||
+                epb[3] > bstream_remaining(&epb_stream)) {
+                g_set_error(error, VALIDITY90_PCAPNG_ERROR, VALIDITY90_PCAPNG_ERR_FORMAT,
+                            "PCAPNG: truncated packet block at %lx", pcap->pos - header[1]);
+                return FALSE;
+            }
+            if (epb[0] >= pcap->interfaces_count) {
+                continue;
+            }
+
+            const pcapng_interface *interface = &pcap->interfaces[epb[0]];
+            if (interface->linktype != LINKTYPE_USB_LINUX && interface->linktype != LINKTYPE_USB_LINUX_MMAPPED) {
+                continue;
+            }
+
+            guint64 ts = ((guint64) epb[1] << 32) | epb[2];
+            if (pcapng_parse_usbmon(interface, ts, body + 20, epb[3], packet)) {
+                return TRUE;
+            }
+        }
+    }
+}
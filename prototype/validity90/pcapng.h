@@ -0,0 +1,79 @@
+/*
+ * Validity90 usbmon capture reader
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef PCAPNG_H
+#define PCAPNG_H
+
+#include <glib.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_PCAPNG_ERROR validity90_pcapng_error_quark()
+
+GQuark validity90_pcapng_error_quark(void);
+
+enum validity90_pcapng_error_codes {
+    VALIDITY90_PCAPNG_ERR_FORMAT,
+    VALIDITY90_PCAPNG_ERR_UNSUPPORTED,
+};
+
+/* usbmon transfer types */
+#define VALIDITY90_USB_XFER_ISO 0
+#define VALIDITY90_USB_XFER_INTERRUPT 1
+#define VALIDITY90_USB_XFER_CONTROL 2
+#define VALIDITY90_USB_XFER_BULK 3
+
+/* One usbmon event (URB submission or completion), data borrowed from the capture */
+typedef struct validity90_usb_packet {
+    gint64 ts_us;
+    guint64 urb_id;
+    gchar event;
+    guint8 xfer_type;
+    guint8 ep;
+    guint8 devnum;
+    guint16 busnum;
+    gint32 status;
+    guint32 urb_len;
+
+    const guint8 *data;
+    gsize data_len;
+} validity90_usb_packet;
+
+/*
+ * Reader of pcapng files with LINKTYPE_USB_LINUX (189) or
+ * LINKTYPE_USB_LINUX_MMAPPED (220) interfaces, as written by wireshark
+ * and dumpcap from usbmon. The file is mapped and packet data points into it.
+ */
+typedef struct validity90_pcapng validity90_pcapng;
+
+validity90_pcapng *validity90_pcapng_open(const gchar *path, GError **error);
+void validity90_pcapng_free(validity90_pcapng *pcap);
+
+/* Returns FALSE at the end of the capture, or with error set when it is malformed */
+gboolean validity90_pcapng_next(validity90_pcapng *pcap, validity90_usb_packet *packet, GError **error);
+
+void validity90_pcapng_rewind(validity90_pcapng *pcap);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // PCAPNG_H
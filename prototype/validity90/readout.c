@@ -0,0 +1,172 @@
+/*
+ * Validity90 image readout
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "readout.h"
+
+GQuark validity90_readout_error_quark (void) {
+  return g_quark_from_static_string ("validity-readout-error-quark");
+}
+
+#define READOUT_EP_OUT 0x01
+#define READOUT_EP_IN 0x81
+#define READOUT_TIMEOUT 10000
+#define READOUT_IN_BUFF_SIZE 0x10000
+
+static const guint8 read_buffer_cmd[] = { 0x51, 0x00, 0x20, 0x00, 0x00 };
+
+typedef struct readout_state {
+    validity90_transport *transport;
+    validity90_tls_session *session;
+
+    validity90_image_assembler *assembler;
+
+    guint chunks;
+    guint finished;
+
+    struct libusb_transfer *transfers[VALIDITY90_READOUT_MAX_CHUNKS * 2];
+    GError *error;
+} readout_state;
+
+static void readout_fail(readout_state *state, GError *error) {
+    if (state->error != NULL) {
+        g_error_free(error);
+        return;
+    }
+    state->error = error;
+
+    // Callbacks of the cancelled transfers still arrive and get counted
+    for (int i = 0; i < state->chunks * 2; i++) {
+        validity90_transport_cancel(state->transport, state->transfers[i]);
+    }
+}
+
+static gboolean readout_transfer_ok(readout_state *state, struct libusb_transfer *transfer) {
+    state->finished++;
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        return TRUE;
+    }
+    if (transfer->status != LIBUSB_TRANSFER_CANCELLED || state->error == NULL) {
+        readout_fail(state, g_error_new(VALIDITY90_READOUT_ERROR, VALIDITY90_READOUT_ERR_TRANSFER,
+                                        "Readout: transfer on ep %02x failed, status: %d",
+                                        transfer->endpoint, transfer->status));
+    }
+    return FALSE;
+}
+
+static void readout_out_cb(struct libusb_transfer *transfer) {
+    readout_transfer_ok(transfer->user_data, transfer);
+}
+
+static void readout_in_cb(struct libusb_transfer *transfer) {
+    readout_state *state = transfer->user_data;
+    GError *error = NULL;
+    guint8 *plain;
+    gsize plain_len;
+
+    if (!readout_transfer_ok(state, transfer) || state->error != NULL) {
+        return;
+    }
+
+    if (!validity90_tls_session_open_record(state->session, transfer->buffer, transfer->actual_length,
+                                            &plain, &plain_len, &error)) {
+        readout_fail(state, error);
+        return;
+    }
+
+    // Responses on one endpoint complete in order, so do the chunks
+    if (!validity90_image_assembler_push(state->assembler, plain, plain_len, &error)) {
+        readout_fail(state, error);
+    }
+}
+
+gboolean validity90_readout_image(validity90_transport *transport, validity90_tls_session *session, guint chunks,
+                                  validity90_image_assembler *assembler, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+    g_return_val_if_fail (chunks > 0 && chunks <= VALIDITY90_READOUT_MAX_CHUNKS, FALSE);
+
+    readout_state state = {
+        .transport = transport,
+        .session = session,
+        .assembler = assembler,
+        .chunks = chunks,
+    };
+    GError *local_error = NULL;
+    guint submitted = 0;
+
+    validity90_image_assembler_reset(assembler);
+
+    // No sequence numbers in this TLS flavour, one sealed command serves every chunk
+    GByteArray *cmd = g_byte_array_new();
+    if (!validity90_tls_session_seal_record(session, 0x17, read_buffer_cmd, G_N_ELEMENTS(read_buffer_cmd), cmd, error)) {
+        g_byte_array_free(cmd, TRUE);
+        return FALSE;
+    }
+    guint8 *in_buff = g_malloc(READOUT_IN_BUFF_SIZE * chunks);
+
+    for (int i = 0; i < chunks; i++) {
+        struct libusb_transfer *out = libusb_alloc_transfer(0);
+        struct libusb_transfer *in = libusb_alloc_transfer(0);
+
+        libusb_fill_bulk_transfer(out, NULL, READOUT_EP_OUT, cmd->data, cmd->len,
+                                  readout_out_cb, &state, READOUT_TIMEOUT);
+        libusb_fill_bulk_transfer(in, NULL, READOUT_EP_IN, in_buff + i * READOUT_IN_BUFF_SIZE, READOUT_IN_BUFF_SIZE,
+                                  readout_in_cb, &state, READOUT_TIMEOUT);
+        state.transfers[i * 2] = out;
+        state.transfers[i * 2 + 1] = in;
+    }
+
+    for (; submitted < chunks * 2; submitted++) {
+        if (!validity90_transport_submit(transport, state.transfers[submitted], &local_error)) {
+            readout_fail(&state, local_error);
+            break;
+        }
+    }
+
+    while (state.finished < submitted) {
+        if (!validity90_transport_handle_events(transport, NULL, NULL, &local_error)) {
+            readout_fail(&state, local_error);
+            local_error = NULL;
+        }
+    }
+
+    for (int i = 0; i < chunks * 2; i++) {
+        libusb_free_transfer(state.transfers[i]);
+    }
+    g_free(in_buff);
+    g_byte_array_free(cmd, TRUE);
+
+    if (state.error != NULL) {
+        g_propagate_error(error, state.error);
+        return FALSE;
+    }
+
+    if (!validity90_image_assembler_is_complete(assembler)) {
+        const validity90_image_geometry *geometry = validity90_image_assembler_get_geometry(assembler);
+
+        g_set_error(error, VALIDITY90_READOUT_ERROR, VALIDITY90_READOUT_ERR_INCOMPLETE,
+                    "Readout: %u of %u rows after %u chunks", validity90_image_assembler_get_rows(assembler),
+                    geometry->height, chunks);
+        return FALSE;
+    }
+
+    return TRUE;
+}
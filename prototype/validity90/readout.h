@@ -0,0 +1,59 @@
+/*
+ * Validity90 image readout
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef READOUT_H
+#define READOUT_H
+
+#include <glib.h>
+#include <libusb.h>
+
+#include "image.h"
+#include "tls.h"
+#include "transport.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_READOUT_ERROR validity90_readout_error_quark()
+
+GQuark validity90_readout_error_quark(void);
+
+enum validity90_readout_error_codes {
+    VALIDITY90_READOUT_ERR_TRANSFER,
+    // All chunks were read, the image isn't complete
+    VALIDITY90_READOUT_ERR_INCOMPLETE,
+};
+
+#define VALIDITY90_READOUT_MAX_CHUNKS 8
+
+/*
+ * Reads the scanned image with `chunks` buffer read (0x51) commands.
+ * All commands and their bulk IN transfers are queued up front and every
+ * response is decrypted and pushed to the assembler as soon as it completes.
+ * The assembler is reset first, its image is the result.
+ */
+gboolean validity90_readout_image(validity90_transport *transport, validity90_tls_session *session, guint chunks,
+                                  validity90_image_assembler *assembler, GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // READOUT_H
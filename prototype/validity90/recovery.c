@@ -0,0 +1,156 @@
+/*
+ * Validity90 session recovery
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "interrupt.h"
+#include "readout.h"
+#include "recovery.h"
+
+GQuark validity90_recovery_error_quark (void) {
+  return g_quark_from_static_string ("validity-recovery-error-quark");
+}
+
+struct validity90_recovery {
+    validity90_transport *transport;
+    validity90_handshake *handshake;
+    validity90_sequence *probe;
+    guint8 state_field;
+    guint8 client_random[VALIDITY90_HANDSHAKE_RANDOM_SIZE];
+
+    validity90_recovery_stats stats;
+};
+
+validity90_recovery *validity90_recovery_new(validity90_transport *transport, validity90_handshake *handshake,
+                                             const guint8 *client_random, validity90_sequence *probe,
+                                             guint8 state_field) {
+    validity90_recovery *recovery = g_malloc0(sizeof(validity90_recovery));
+
+    recovery->transport = transport;
+    recovery->handshake = handshake;
+    recovery->probe = probe;
+    recovery->state_field = state_field;
+    memcpy(recovery->client_random, client_random, VALIDITY90_HANDSHAKE_RANDOM_SIZE);
+
+    return recovery;
+}
+
+void validity90_recovery_free(validity90_recovery *recovery) {
+    g_free(recovery);
+}
+
+const validity90_recovery_stats *validity90_recovery_get_stats(validity90_recovery *recovery) {
+    return &recovery->stats;
+}
+
+validity90_recovery_action validity90_recovery_classify(const GError *cause) {
+    if (cause == NULL) {
+        return VALIDITY90_RECOVERY_NONE;
+    }
+    // Records that don't open mean both sides disagree on the keys
+    if (cause->domain == VALIDITY90_TLS_ERROR) {
+        return VALIDITY90_RECOVERY_HANDSHAKE;
+    }
+    if (cause->domain == VALIDITY90_TRANSPORT_ERROR || cause->domain == VALIDITY90_HANDSHAKE_ERROR ||
+        g_error_matches(cause, VALIDITY90_SEQUENCE_ERROR, VALIDITY90_SEQUENCE_ERR_TRANSFER) ||
+        g_error_matches(cause, VALIDITY90_READOUT_ERROR, VALIDITY90_READOUT_ERR_TRANSFER) ||
+        g_error_matches(cause, VALIDITY90_INTERRUPT_ERROR, VALIDITY90_INTERRUPT_ERR_TRANSFER)) {
+        return VALIDITY90_RECOVERY_RESET;
+    }
+
+    return VALIDITY90_RECOVERY_NONE;
+}
+
+typedef struct recovery_probe {
+    guint8 state_field;
+    gint state;
+} recovery_probe;
+
+static void recovery_probe_cb(validity90_sequence *seq, const validity90_step_result *result, gpointer user_data) {
+    recovery_probe *probe = user_data;
+    const guint8 *field;
+    gsize field_len;
+
+    if (validity90_sequence_get_field(seq, result, probe->state_field, &field, &field_len)) {
+        probe->state = field[0];
+    }
+}
+
+// Only the probe of the init, the pairing data of the other steps is still in the handshake
+static gboolean recovery_reset(validity90_recovery *recovery, GError **error) {
+    recovery_probe probe = { .state_field = recovery->state_field, .state = -1 };
+
+    if (!validity90_transport_reset(recovery->transport, error) ||
+        !validity90_sequence_run(recovery->probe, recovery->transport, recovery_probe_cb, &probe, error)) {
+        return FALSE;
+    }
+    recovery->stats.resets++;
+
+    if (probe.state != VALIDITY90_SENSOR_STATE_READY) {
+        g_set_error(error, VALIDITY90_RECOVERY_ERROR, VALIDITY90_RECOVERY_ERR_NOT_READY,
+                    "Recovery: sensor state is 0x%x after the reset, it needs the full init", probe.state);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean recovery_handshake(validity90_recovery *recovery, validity90_tls_session **session, GError **error) {
+    validity90_handshake_reset(recovery->handshake, recovery->client_random);
+    if (!validity90_handshake_run(recovery->handshake, recovery->transport, error)) {
+        return FALSE;
+    }
+
+    validity90_tls_session_free(*session);
+    *session = validity90_handshake_steal_session(recovery->handshake);
+    recovery->stats.handshakes++;
+
+    return TRUE;
+}
+
+gboolean validity90_recovery_run(validity90_recovery *recovery, const GError *cause,
+                                 validity90_tls_session **session, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    validity90_recovery_action action = validity90_recovery_classify(cause);
+    gint64 started = g_get_monotonic_time();
+    gboolean result;
+
+    if (action == VALIDITY90_RECOVERY_NONE) {
+        g_set_error(error, VALIDITY90_RECOVERY_ERROR, VALIDITY90_RECOVERY_ERR_UNRECOVERABLE,
+                    "Recovery: nothing to do for: %s", cause != NULL ? cause->message : "no error");
+        return FALSE;
+    }
+
+    // A sensor that doesn't take the new handshake gets the reset
+    result = (action == VALIDITY90_RECOVERY_HANDSHAKE && recovery_handshake(recovery, session, NULL)) ||
+             (recovery_reset(recovery, error) && recovery_handshake(recovery, session, error));
+
+    if (result) {
+        gint64 elapsed = g_get_monotonic_time() - started;
+
+        recovery->stats.recovered++;
+        recovery->stats.total_us += elapsed;
+        recovery->stats.max_us = MAX(recovery->stats.max_us, elapsed);
+    } else {
+        recovery->stats.failed++;
+    }
+
+    return result;
+}
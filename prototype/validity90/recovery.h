@@ -0,0 +1,95 @@
+/*
+ * Validity90 session recovery
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RECOVERY_H
+#define RECOVERY_H
+
+#include <glib.h>
+
+#include "handshake.h"
+#include "sequence.h"
+#include "tls.h"
+#include "transport.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_RECOVERY_ERROR validity90_recovery_error_quark()
+
+GQuark validity90_recovery_error_quark(void);
+
+enum validity90_recovery_error_codes {
+    // The error wasn't caused by the session or the transfers
+    VALIDITY90_RECOVERY_ERR_UNRECOVERABLE,
+    // The sensor lost its pairing and needs the full init
+    VALIDITY90_RECOVERY_ERR_NOT_READY,
+};
+
+/* Sensor state in the probe response once it's paired */
+#define VALIDITY90_SENSOR_STATE_READY 0x07
+
+typedef enum validity90_recovery_action {
+    VALIDITY90_RECOVERY_NONE,
+    // The session is broken, the sensor is fine: a new handshake
+    VALIDITY90_RECOVERY_HANDSHAKE,
+    // Transfers failed: USB reset, probe and a new handshake
+    VALIDITY90_RECOVERY_RESET,
+} validity90_recovery_action;
+
+typedef struct validity90_recovery_stats {
+    guint recovered;
+    guint handshakes;
+    guint resets;
+    guint failed;
+    gint64 total_us;
+    gint64 max_us;
+} validity90_recovery_stats;
+
+/*
+ * Brings a broken session back with the least work: the handshake is run
+ * again with the keys it already holds, and the sensor is only reset and
+ * probed when transfers failed or the new handshake did. Init steps 2-6
+ * that fetch the pairing data are never repeated; a sensor that isn't
+ * ready after a reset needs the full init of a new process.
+ */
+typedef struct validity90_recovery validity90_recovery;
+
+/* transport, handshake and probe stay the caller's, state_field is the probe field with the sensor state */
+validity90_recovery *validity90_recovery_new(validity90_transport *transport, validity90_handshake *handshake,
+                                             const guint8 *client_random, validity90_sequence *probe,
+                                             guint8 state_field);
+void validity90_recovery_free(validity90_recovery *recovery);
+
+validity90_recovery_action validity90_recovery_classify(const GError *cause);
+
+/*
+ * cause is the error the session failed with. On success *session is freed
+ * and replaced by the new one, whatever used it has to forget the old one.
+ */
+gboolean validity90_recovery_run(validity90_recovery *recovery, const GError *cause,
+                                 validity90_tls_session **session, GError **error);
+
+const validity90_recovery_stats *validity90_recovery_get_stats(validity90_recovery *recovery);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // RECOVERY_H
@@ -0,0 +1,227 @@
+/*
+ * Validity90 scan setup
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "scan.h"
+
+GQuark validity90_scan_error_quark (void) {
+  return g_quark_from_static_string ("validity-scan-error-quark");
+}
+
+#define SCAN_EP_OUT 0x01
+#define SCAN_EP_IN 0x81
+#define SCAN_TIMEOUT 10000
+#define SCAN_IN_BUFF_SIZE (1024 * 1024)
+
+// 32 bit write of 7 to 0x8000205c
+static const guint8 scan_register_write[] = { 0x08, 0x5c, 0x20, 0x00, 0x80, 0x07, 0x00, 0x00, 0x00, 0x04 };
+// Only reads, the full setup keeps them as the prototype always sent them
+static const guint8 scan_register_read[] = { 0x07, 0x80, 0x20, 0x00, 0x80, 0x04 };
+static const guint8 scan_probe[] = { 0x75 };
+static const guint8 scan_partitions[] = { 0x43, 0x02 };
+
+typedef struct scan_command {
+    const guint8 *cmd;
+    gsize len;
+} scan_command;
+
+static const scan_command scan_setup[VALIDITY90_SCAN_SETUP_COMMANDS] = {
+    { scan_register_write, sizeof(scan_register_write) },
+    { scan_register_read, sizeof(scan_register_read) },
+    { scan_probe, sizeof(scan_probe) },
+    { scan_probe, sizeof(scan_probe) },
+    { scan_probe, sizeof(scan_probe) },
+    { scan_partitions, sizeof(scan_partitions) },
+    { scan_partitions, sizeof(scan_partitions) },
+};
+
+struct validity90_scanner {
+    validity90_transport *transport;
+    validity90_tls_session *session;
+    gboolean fast;
+
+    // What the sensor holds
+    gboolean configured;
+    GByteArray *led;
+
+    // Scan matrix and its record, sealed with the current session
+    GByteArray *matrix;
+    GByteArray *matrix_record;
+
+    GByteArray *out;
+    guint8 *in;
+
+    validity90_scanner_stats stats;
+};
+
+validity90_scanner *validity90_scanner_new(validity90_transport *transport, validity90_tls_session *session) {
+    validity90_scanner *scanner = g_malloc0(sizeof(validity90_scanner));
+
+    scanner->transport = transport;
+    scanner->session = session;
+    scanner->fast = TRUE;
+    scanner->led = g_byte_array_new();
+    scanner->matrix = g_byte_array_new();
+    scanner->matrix_record = g_byte_array_new();
+    scanner->out = g_byte_array_new();
+    scanner->in = g_malloc(SCAN_IN_BUFF_SIZE);
+
+    return scanner;
+}
+
+void validity90_scanner_free(validity90_scanner *scanner) {
+    if (scanner == NULL) {
+        return;
+    }
+    g_byte_array_free(scanner->led, TRUE);
+    g_byte_array_free(scanner->matrix, TRUE);
+    g_byte_array_free(scanner->matrix_record, TRUE);
+    g_byte_array_free(scanner->out, TRUE);
+    g_free(scanner->in);
+    g_free(scanner);
+}
+
+void validity90_scanner_forget(validity90_scanner *scanner, validity90_tls_session *session) {
+    scanner->session = session;
+    scanner->configured = FALSE;
+    g_byte_array_set_size(scanner->led, 0);
+    g_byte_array_set_size(scanner->matrix, 0);
+    g_byte_array_set_size(scanner->matrix_record, 0);
+}
+
+void validity90_scanner_set_fast(validity90_scanner *scanner, gboolean fast) {
+    scanner->fast = fast;
+}
+
+const validity90_scanner_stats *validity90_scanner_get_stats(validity90_scanner *scanner) {
+    return &scanner->stats;
+}
+
+// Sends a sealed record and opens the response
+static gboolean scanner_send(validity90_scanner *scanner, const guint8 *record, gsize record_len,
+                             guint8 **rsp, gsize *rsp_len, GError **error) {
+    gint64 started = g_get_monotonic_time();
+    gsize len;
+
+    gboolean result =
+        validity90_transport_write(scanner->transport, SCAN_EP_OUT, record, record_len, SCAN_TIMEOUT, error) &&
+        validity90_transport_read(scanner->transport, SCAN_EP_IN, scanner->in, SCAN_IN_BUFF_SIZE, &len,
+                                  SCAN_TIMEOUT, error) &&
+        validity90_tls_session_open_record(scanner->session, scanner->in, len, rsp, rsp_len, error);
+
+    scanner->stats.io_us += g_get_monotonic_time() - started;
+    if (!result) {
+        validity90_scanner_forget(scanner, scanner->session);
+        return FALSE;
+    }
+    scanner->stats.sent++;
+
+    return TRUE;
+}
+
+gboolean validity90_scanner_exchange(validity90_scanner *scanner, const guint8 *cmd, gsize cmd_len,
+                                     guint8 **rsp, gsize *rsp_len, GError **error) {
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    g_byte_array_set_size(scanner->out, 0);
+    if (!validity90_tls_session_seal_record(scanner->session, 0x17, cmd, cmd_len, scanner->out, error)) {
+        return FALSE;
+    }
+
+    return scanner_send(scanner, scanner->out->data, scanner->out->len, rsp, rsp_len, error);
+}
+
+// Every setup command answers with a 16 bit status first, 0 for success
+static gboolean scanner_command(validity90_scanner *scanner, const guint8 *cmd, gsize cmd_len, GError **error) {
+    guint8 *rsp;
+    gsize rsp_len;
+
+    if (!validity90_scanner_exchange(scanner, cmd, cmd_len, &rsp, &rsp_len, error)) {
+        return FALSE;
+    }
+    if (rsp_len < 2 || rsp[0] != 0 || rsp[1] != 0) {
+        validity90_scanner_forget(scanner, scanner->session);
+        g_set_error(error, VALIDITY90_SCAN_ERROR, VALIDITY90_SCAN_ERR_RESPONSE,
+                    "Scan: command %02x failed, status: %02x%02x", cmd[0],
+                    rsp_len > 0 ? rsp[0] : 0xff, rsp_len > 1 ? rsp[1] : 0xff);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_scanner_set_led(validity90_scanner *scanner, const guint8 *script, gsize script_len,
+                                    gboolean steady, GError **error) {
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (steady && scanner->fast && scanner->led->len == script_len &&
+        memcmp(scanner->led->data, script, script_len) == 0) {
+        scanner->stats.skipped++;
+        return TRUE;
+    }
+
+    g_byte_array_set_size(scanner->led, 0);
+    if (!scanner_command(scanner, script, script_len, error)) {
+        return FALSE;
+    }
+    if (steady) {
+        g_byte_array_append(scanner->led, script, script_len);
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_scanner_prepare(validity90_scanner *scanner, GError **error) {
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    if (scanner->fast && scanner->configured) {
+        scanner->stats.skipped += G_N_ELEMENTS(scan_setup);
+        return TRUE;
+    }
+
+    for (int i = 0; i < G_N_ELEMENTS(scan_setup); i++) {
+        if (!scanner_command(scanner, scan_setup[i].cmd, scan_setup[i].len, error)) {
+            return FALSE;
+        }
+    }
+    scanner->configured = TRUE;
+
+    return TRUE;
+}
+
+gboolean validity90_scanner_arm(validity90_scanner *scanner, const guint8 *matrix, gsize matrix_len, GError **error) {
+    guint8 *rsp;
+    gsize rsp_len;
+
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    // No sequence numbers in this TLS flavour, the same record is good for every scan
+    if (scanner->matrix->len != matrix_len || memcmp(scanner->matrix->data, matrix, matrix_len) != 0) {
+        g_byte_array_set_size(scanner->matrix, 0);
+        g_byte_array_set_size(scanner->matrix_record, 0);
+        if (!validity90_tls_session_seal_record(scanner->session, 0x17, matrix, matrix_len,
+                                                scanner->matrix_record, error)) {
+            return FALSE;
+        }
+        g_byte_array_append(scanner->matrix, matrix, matrix_len);
+    }
+
+    return scanner_send(scanner, scanner->matrix_record->data, scanner->matrix_record->len, &rsp, &rsp_len, error);
+}
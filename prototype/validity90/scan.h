@@ -0,0 +1,92 @@
+/*
+ * Validity90 scan setup
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <glib.h>
+
+#include "tls.h"
+#include "transport.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_SCAN_ERROR validity90_scan_error_quark()
+
+GQuark validity90_scan_error_quark(void);
+
+enum validity90_scan_error_codes {
+    VALIDITY90_SCAN_ERR_RESPONSE,
+};
+
+/* Commands of the full setup before the scan matrix */
+#define VALIDITY90_SCAN_SETUP_COMMANDS 7
+
+typedef struct validity90_scanner_stats {
+    guint64 sent;
+    guint64 skipped;
+    gint64 io_us;
+} validity90_scanner_stats;
+
+/*
+ * Gets the sensor ready for scans and remembers what it holds.
+ *
+ * The first setup after a reset is the full one the prototype always did: the
+ * scan register write followed by the register, 0x75 and partition reads. Once
+ * it went through the write is known to hold and later setups send nothing.
+ * A steady LED script isn't sent again while it shows. The scan matrix arms
+ * the capture so it goes out for every scan, sealed once and sent as is
+ * while the session and the matrix stay the same.
+ *
+ * Any failed command forgets everything, the next setup is a full one again.
+ */
+typedef struct validity90_scanner validity90_scanner;
+
+/* transport and session stay the caller's */
+validity90_scanner *validity90_scanner_new(validity90_transport *transport, validity90_tls_session *session);
+void validity90_scanner_free(validity90_scanner *scanner);
+
+/* After a reset or a new handshake nothing is known about the sensor */
+void validity90_scanner_forget(validity90_scanner *scanner, validity90_tls_session *session);
+
+/* FALSE makes every setup a full one */
+void validity90_scanner_set_fast(validity90_scanner *scanner, gboolean fast);
+
+/* A steady script stays on, others (blinks) are always sent and leave the LED unknown */
+gboolean validity90_scanner_set_led(validity90_scanner *scanner, const guint8 *script, gsize script_len,
+                                    gboolean steady, GError **error);
+
+gboolean validity90_scanner_prepare(validity90_scanner *scanner, GError **error);
+
+/* Sends the scan matrix, the sensor waits for a finger after it */
+gboolean validity90_scanner_arm(validity90_scanner *scanner, const guint8 *matrix, gsize matrix_len, GError **error);
+
+/* Any other command, the response is valid until the next one */
+gboolean validity90_scanner_exchange(validity90_scanner *scanner, const guint8 *cmd, gsize cmd_len,
+                                     guint8 **rsp, gsize *rsp_len, GError **error);
+
+const validity90_scanner_stats *validity90_scanner_get_stats(validity90_scanner *scanner);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // SCAN_H
@@ -0,0 +1,313 @@
+/*
+ * Validity90 command sequences
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "sequence.h"
+
+GQuark validity90_sequence_error_quark (void) {
+  return g_quark_from_static_string ("validity-sequence-error-quark");
+}
+
+#define SEQUENCE_EP_OUT 0x01
+#define SEQUENCE_EP_IN 0x81
+#define SEQUENCE_TIMEOUT 10000
+#define SEQUENCE_RSP_BUFF_SIZE 0x10000
+
+typedef struct sequence_run {
+    gsize offset;
+    gsize len;
+    guint8 id;
+} sequence_run;
+
+typedef struct sequence_step {
+    gsize msg_offset;
+    gsize msg_len;
+    gsize rsp_offset;
+    gsize rsp_len;
+    gboolean check;
+    guint runs_first;
+    guint runs_count;
+} sequence_step;
+
+struct validity90_sequence {
+    sequence_step *steps;
+    guint steps_count;
+
+    sequence_run *runs;
+    // Messages and expected responses, variable bytes are zeroed
+    guint8 *data;
+
+    guint8 *rsp_buff;
+};
+
+validity90_sequence *validity90_sequence_compile(const validity90_step_def *steps, guint steps_count) {
+    validity90_sequence *seq = g_malloc0(sizeof(validity90_sequence));
+    GArray *runs = g_array_new(FALSE, FALSE, sizeof(sequence_run));
+    gsize data_len = 0, pos = 0;
+
+    for (int i = 0; i < steps_count; i++) {
+        data_len += steps[i].msg_len + steps[i].rsp_len;
+    }
+
+    seq->steps = g_new0(sequence_step, steps_count);
+    seq->steps_count = steps_count;
+    seq->data = g_malloc(data_len);
+
+    for (int i = 0; i < steps_count; i++) {
+        sequence_step *step = &seq->steps[i];
+
+        step->msg_offset = pos;
+        step->msg_len = steps[i].msg_len;
+        memcpy(seq->data + pos, steps[i].msg, steps[i].msg_len);
+        pos += steps[i].msg_len;
+
+        step->rsp_offset = pos;
+        step->rsp_len = steps[i].rsp_len;
+        step->check = steps[i].rsp != NULL;
+        step->runs_first = runs->len;
+
+        for (gsize j = 0; j < steps[i].rsp_len; j++) {
+            guint32 expected = steps[i].rsp[j];
+
+            if (!(expected & VALIDITY90_STEP_VARIABLE)) {
+                seq->data[pos + j] = expected;
+                continue;
+            }
+            seq->data[pos + j] = 0;
+
+            sequence_run *last = runs->len > step->runs_first ? &g_array_index(runs, sequence_run, runs->len - 1) : NULL;
+            if (last != NULL && last->offset + last->len == j && last->id == (guint8) expected) {
+                last->len++;
+            } else {
+                sequence_run run = { .offset = j, .len = 1, .id = expected };
+                g_array_append_val(runs, run);
+            }
+        }
+        step->runs_count = runs->len - step->runs_first;
+        pos += steps[i].rsp_len;
+    }
+
+    seq->runs = (sequence_run *) g_array_free(runs, FALSE);
+    seq->rsp_buff = g_malloc(SEQUENCE_RSP_BUFF_SIZE);
+
+    return seq;
+}
+
+void validity90_sequence_free(validity90_sequence *seq) {
+    if (seq == NULL) {
+        return;
+    }
+    g_free(seq->steps);
+    g_free(seq->runs);
+    g_free(seq->data);
+    g_free(seq->rsp_buff);
+    g_free(seq);
+}
+
+guint validity90_sequence_get_steps_count(validity90_sequence *seq) {
+    return seq->steps_count;
+}
+
+static gssize sequence_first_difference(const guint8 *a, const guint8 *b, gsize offset, gsize len) {
+    if (memcmp(a + offset, b + offset, len) == 0) {
+        return -1;
+    }
+    while (a[offset] == b[offset]) {
+        offset++;
+    }
+    return offset;
+}
+
+void validity90_sequence_check(validity90_sequence *seq, guint step_index, const guint8 *rsp, gsize rsp_len,
+                               validity90_step_result *result) {
+    const sequence_step *step = &seq->steps[step_index];
+    const guint8 *expected = seq->data + step->rsp_offset;
+    gsize len = MIN(rsp_len, step->rsp_len), pos = 0;
+
+    result->step = step_index;
+    result->msg = seq->data + step->msg_offset;
+    result->msg_len = step->msg_len;
+    result->rsp = rsp;
+    result->rsp_len = rsp_len;
+    result->expected_len = step->rsp_len;
+    result->mismatch = -1;
+
+    if (!step->check) {
+        return;
+    }
+
+    // Fixed stretches between the variable runs
+    for (int i = 0; i <= step->runs_count && pos < len; i++) {
+        const sequence_run *run = i < step->runs_count ? &seq->runs[step->runs_first + i] : NULL;
+        gsize end = run != NULL ? MIN(run->offset, len) : len;
+
+        if ((result->mismatch = sequence_first_difference(rsp, expected, pos, end - pos)) >= 0) {
+            return;
+        }
+        pos = run != NULL ? run->offset + run->len : len;
+    }
+
+    if (rsp_len != step->rsp_len) {
+        result->mismatch = len;
+    }
+}
+
+gboolean validity90_sequence_get_field(validity90_sequence *seq, const validity90_step_result *result, guint8 id,
+                                       const guint8 **data, gsize *len) {
+    const sequence_step *step = &seq->steps[result->step];
+
+    for (int i = 0; i < step->runs_count; i++) {
+        const sequence_run *run = &seq->runs[step->runs_first + i];
+
+        if (run->id == id && id != 0) {
+            if (run->offset + run->len > result->rsp_len) {
+                return FALSE;
+            }
+            *data = result->rsp + run->offset;
+            *len = run->len;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+typedef struct sequence_exec {
+    validity90_sequence *seq;
+    validity90_transport *transport;
+    validity90_step_cb cb;
+    gpointer user_data;
+
+    struct libusb_transfer *out;
+    struct libusb_transfer *in;
+    guint step;
+    guint in_flight;
+
+    GError *error;
+} sequence_exec;
+
+static void sequence_fail(sequence_exec *exec, GError *error) {
+    if (exec->error != NULL) {
+        g_error_free(error);
+        return;
+    }
+    exec->error = error;
+
+    // The cancelled transfers still complete and get counted
+    validity90_transport_cancel(exec->transport, exec->out);
+    validity90_transport_cancel(exec->transport, exec->in);
+}
+
+static void sequence_submit_step(sequence_exec *exec) {
+    const sequence_step *step = &exec->seq->steps[exec->step];
+    GError *error = NULL;
+
+    exec->out->buffer = exec->seq->data + step->msg_offset;
+    exec->out->length = step->msg_len;
+
+    if (!validity90_transport_submit(exec->transport, exec->out, &error)) {
+        sequence_fail(exec, error);
+        return;
+    }
+    exec->in_flight++;
+
+    // Queued right away, so the response is read as soon as it's there
+    if (!validity90_transport_submit(exec->transport, exec->in, &error)) {
+        sequence_fail(exec, error);
+        return;
+    }
+    exec->in_flight++;
+}
+
+static void sequence_transfer_done(sequence_exec *exec, struct libusb_transfer *transfer) {
+    exec->in_flight--;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED &&
+        (transfer->status != LIBUSB_TRANSFER_CANCELLED || exec->error == NULL)) {
+        sequence_fail(exec, g_error_new(VALIDITY90_SEQUENCE_ERROR, VALIDITY90_SEQUENCE_ERR_TRANSFER,
+                                        "Sequence: step %u transfer on ep %02x failed, status: %d",
+                                        exec->step, transfer->endpoint, transfer->status));
+    }
+
+    // Both transfers of the step are reusable only once they are back
+    if (exec->in_flight == 0 && exec->error == NULL && ++exec->step < exec->seq->steps_count) {
+        sequence_submit_step(exec);
+    }
+}
+
+static void sequence_out_cb(struct libusb_transfer *transfer) {
+    sequence_transfer_done(transfer->user_data, transfer);
+}
+
+static void sequence_in_cb(struct libusb_transfer *transfer) {
+    sequence_exec *exec = transfer->user_data;
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED && exec->error == NULL) {
+        validity90_step_result result;
+
+        validity90_sequence_check(exec->seq, exec->step, transfer->buffer, transfer->actual_length, &result);
+        if (exec->cb != NULL) {
+            exec->cb(exec->seq, &result, exec->user_data);
+        }
+    }
+
+    sequence_transfer_done(exec, transfer);
+}
+
+gboolean validity90_sequence_run(validity90_sequence *seq, validity90_transport *transport,
+                                 validity90_step_cb cb, gpointer user_data, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    sequence_exec exec = {
+        .seq = seq,
+        .transport = transport,
+        .cb = cb,
+        .user_data = user_data,
+    };
+    GError *local_error = NULL;
+
+    if (seq->steps_count == 0) {
+        return TRUE;
+    }
+
+    exec.out = libusb_alloc_transfer(0);
+    exec.in = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(exec.out, NULL, SEQUENCE_EP_OUT, NULL, 0, sequence_out_cb, &exec, SEQUENCE_TIMEOUT);
+    libusb_fill_bulk_transfer(exec.in, NULL, SEQUENCE_EP_IN, seq->rsp_buff, SEQUENCE_RSP_BUFF_SIZE,
+                              sequence_in_cb, &exec, SEQUENCE_TIMEOUT);
+
+    sequence_submit_step(&exec);
+    while (exec.in_flight > 0) {
+        if (!validity90_transport_handle_events(transport, NULL, NULL, &local_error)) {
+            sequence_fail(&exec, local_error);
+            local_error = NULL;
+        }
+    }
+
+    libusb_free_transfer(exec.out);
+    libusb_free_transfer(exec.in);
+
+    if (exec.error != NULL) {
+        g_propagate_error(error, exec.error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
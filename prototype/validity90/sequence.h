@@ -0,0 +1,105 @@
+/*
+ * Validity90 command sequences
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <glib.h>
+
+#include "transport.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_SEQUENCE_ERROR validity90_sequence_error_quark()
+
+GQuark validity90_sequence_error_quark(void);
+
+enum validity90_sequence_error_codes {
+    VALIDITY90_SEQUENCE_ERR_TRANSFER,
+};
+
+/*
+ * Expected responses are written as one dword per byte, bytes flagged with
+ * VALIDITY90_STEP_VARIABLE may differ and the low byte of a variable one is
+ * the id of the field it belongs to, 0 for none.
+ */
+#define VALIDITY90_STEP_VARIABLE (1 << 30)
+
+typedef struct validity90_step_def {
+    const guint8 *msg;
+    gsize msg_len;
+    // NULL accepts any response
+    const guint32 *rsp;
+    gsize rsp_len;
+} validity90_step_def;
+
+#define VALIDITY90_STEP(msg, rsp) { (msg), G_N_ELEMENTS(msg), (rsp), G_N_ELEMENTS(rsp) }
+#define VALIDITY90_STEP_ANY(msg) { (msg), G_N_ELEMENTS(msg), NULL, 0 }
+
+typedef struct validity90_step_result {
+    guint step;
+    const guint8 *msg;
+    gsize msg_len;
+    // Only valid during the step callback
+    const guint8 *rsp;
+    gsize rsp_len;
+    gsize expected_len;
+    // Offset of the first unexpected byte, -1 when the response matches
+    gssize mismatch;
+} validity90_step_result;
+
+/*
+ * A sequence compiled into one table: messages and expected responses
+ * back to back, with the variable bytes kept as a short list of runs. A
+ * response is checked by comparing the fixed stretches between the runs
+ * and the captured fields are the runs with an id, so they are read
+ * without scanning the response.
+ */
+typedef struct validity90_sequence validity90_sequence;
+
+typedef void (*validity90_step_cb)(validity90_sequence *seq, const validity90_step_result *result, gpointer user_data);
+
+validity90_sequence *validity90_sequence_compile(const validity90_step_def *steps, guint steps_count);
+void validity90_sequence_free(validity90_sequence *seq);
+
+guint validity90_sequence_get_steps_count(validity90_sequence *seq);
+
+void validity90_sequence_check(validity90_sequence *seq, guint step, const guint8 *rsp, gsize rsp_len,
+                               validity90_step_result *result);
+
+/* FALSE when the step has no such field or the response is too short for it */
+gboolean validity90_sequence_get_field(validity90_sequence *seq, const validity90_step_result *result, guint8 id,
+                                       const guint8 **data, gsize *len);
+
+/*
+ * Sends every step and checks its response. The response read is queued
+ * together with the message and the next step is queued from the completion
+ * of the previous one; cb, if any, sees every response. Mismatches are
+ * reported through cb only, the sequence goes on.
+ */
+gboolean validity90_sequence_run(validity90_sequence *seq, validity90_transport *transport,
+                                 validity90_step_cb cb, gpointer user_data, GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // SEQUENCE_H
@@ -0,0 +1,70 @@
+/*
+ * Validity90 fingerprint templates
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+#include <fprint.h>
+
+#include "template.h"
+
+GQuark validity90_template_error_quark (void) {
+  return g_quark_from_static_string ("validity-template-error-quark");
+}
+
+gboolean validity90_template_from_image(const guint8 *image, guint width, guint height, guint16 devtype,
+                                        guint8 **template, gsize *template_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    struct fp_img *img = fp_img_new_from_data(image, width, height);
+    struct fp_print_data *print = NULL;
+    unsigned char *data = NULL;
+    gboolean ret = FALSE;
+    gsize len;
+    int r;
+
+    if (img == NULL) {
+        g_set_error(error, VALIDITY90_TEMPLATE_ERROR, VALIDITY90_TEMPLATE_ERR_IMAGE,
+                    "Template: libfprint refused a %ux%u image", width, height);
+        return FALSE;
+    }
+
+    r = fp_img_to_print_data(img, VALIDITY90_TEMPLATE_DRIVER_ID, devtype, &print);
+    if (r < 0) {
+        g_set_error(error, VALIDITY90_TEMPLATE_ERROR, VALIDITY90_TEMPLATE_ERR_MINUTIAE,
+                    "Template: minutiae detection failed, code: %d", r);
+        goto end;
+    }
+
+    len = fp_print_data_get_data(print, &data);
+    if (len == 0) {
+        g_set_error(error, VALIDITY90_TEMPLATE_ERROR, VALIDITY90_TEMPLATE_ERR_MINUTIAE,
+                    "Template: can't serialize the print");
+        goto end;
+    }
+
+    // libfprint allocates with g_malloc
+    *template = data;
+    *template_len = len;
+    ret = TRUE;
+
+end:
+    fp_print_data_free(print);
+    fp_img_free(img);
+
+    return ret;
+}
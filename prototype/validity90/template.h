@@ -0,0 +1,53 @@
+/*
+ * Validity90 fingerprint templates
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <glib.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_TEMPLATE_ERROR validity90_template_error_quark()
+
+GQuark validity90_template_error_quark(void);
+
+enum validity90_template_error_codes {
+    VALIDITY90_TEMPLATE_ERR_MINUTIAE,
+    VALIDITY90_TEMPLATE_ERR_IMAGE,
+};
+
+// There is no libfprint driver for these sensors yet
+#define VALIDITY90_TEMPLATE_DRIVER_ID 0
+
+/*
+ * Extracts the minutiae of a scanned image with libfprint and returns the
+ * print as libfprint stores it, ready for fp_print_data_from_data(). Nothing
+ * touches the disk. The template is freed with g_free.
+ */
+gboolean validity90_template_from_image(const guint8 *image, guint width, guint height, guint16 devtype,
+                                        guint8 **template, gsize *template_len, GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // TEMPLATE_H
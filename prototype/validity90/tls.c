@@ -0,0 +1,268 @@
+/*
+ * Validity90 TLS record layer
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "crypto.h"
+#include "tls.h"
+
+GQuark validity90_tls_error_quark (void) {
+  return g_quark_from_static_string ("validity-tls-error-quark");
+}
+
+// IV the prototype has always sent, the sensor doesn't seem to care
+static const guint8 client_iv[VALIDITY90_TLS_IV_SIZE] = {
+    0x4b, 0x77, 0x62, 0xff, 0xa9, 0x03, 0xc1, 0x1e, 0x6f, 0xd8, 0x35, 0x93, 0x17, 0x2d, 0x54, 0xef
+};
+
+/*
+ * HMAC-SHA256 over two plain SHA256 handles with the key pads computed once.
+ * The backend's HMAC under gcrypt allocates a context copy on every read.
+ */
+typedef struct tls_mac {
+    validity90_sha256 *inner;
+    validity90_sha256 *outer;
+    guint8 ipad[0x40];
+    guint8 opad[0x40];
+} tls_mac;
+
+struct validity90_tls_session {
+    tls_mac mac_out;
+    tls_mac mac_in;
+    validity90_aes_cbc *cipher_out;
+    validity90_aes_cbc *cipher_in;
+};
+
+static gboolean tls_mac_open(tls_mac *mac, const guint8 *key, GError **error) {
+    if ((mac->inner = validity90_sha256_new()) == NULL ||
+        (mac->outer = validity90_sha256_new()) == NULL) {
+        g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_CRYPTO, "TLS: HMAC setup failed");
+        return FALSE;
+    }
+
+    memset(mac->ipad, 0x36, sizeof(mac->ipad));
+    memset(mac->opad, 0x5c, sizeof(mac->opad));
+    for (int i = 0; i < VALIDITY90_TLS_MAC_SIZE; i++) {
+        mac->ipad[i] ^= key[i];
+        mac->opad[i] ^= key[i];
+    }
+
+    return TRUE;
+}
+
+static void tls_mac_close(tls_mac *mac) {
+    g_clear_pointer(&mac->inner, validity90_sha256_free);
+    g_clear_pointer(&mac->outer, validity90_sha256_free);
+    memset(mac->ipad, 0, sizeof(mac->ipad));
+    memset(mac->opad, 0, sizeof(mac->opad));
+}
+
+static void tls_mac_begin(tls_mac *mac) {
+    validity90_sha256_reset(mac->inner);
+    validity90_sha256_write(mac->inner, mac->ipad, sizeof(mac->ipad));
+}
+
+static void tls_mac_finish(tls_mac *mac, guint8 *out) {
+    guint8 inner[VALIDITY90_TLS_MAC_SIZE];
+
+    validity90_sha256_final(mac->inner, inner);
+    validity90_sha256_reset(mac->outer);
+    validity90_sha256_write(mac->outer, mac->opad, sizeof(mac->opad));
+    validity90_sha256_write(mac->outer, inner, VALIDITY90_TLS_MAC_SIZE);
+    validity90_sha256_final(mac->outer, out);
+}
+
+static gboolean session_open_cipher(validity90_aes_cbc **cipher, const guint8 *key, GError **error) {
+    if ((*cipher = validity90_aes_cbc_new(key, VALIDITY90_AES_KEY_SIZE)) == NULL) {
+        g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_CRYPTO, "TLS: AES setup failed");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+validity90_tls_session *validity90_tls_session_new(const guint8 *key_block, gsize key_block_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    if (key_block_len < VALIDITY90_TLS_KEY_BLOCK_SIZE) {
+        g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_KEY_BLOCK,
+                    "TLS: key block too small: %lx", key_block_len);
+        return NULL;
+    }
+
+    validity90_tls_session *session = g_malloc0(sizeof(validity90_tls_session));
+
+    if (!tls_mac_open(&session->mac_out, key_block + VALIDITY90_TLS_MAC_OUT_OFFSET, error) ||
+        !tls_mac_open(&session->mac_in, key_block + VALIDITY90_TLS_MAC_IN_OFFSET, error) ||
+        !session_open_cipher(&session->cipher_out, key_block + VALIDITY90_TLS_KEY_OUT_OFFSET, error) ||
+        !session_open_cipher(&session->cipher_in, key_block + VALIDITY90_TLS_KEY_IN_OFFSET, error)) {
+        validity90_tls_session_free(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+void validity90_tls_session_free(validity90_tls_session *session) {
+    if (session == NULL) {
+        return;
+    }
+    tls_mac_close(&session->mac_out);
+    tls_mac_close(&session->mac_in);
+    g_clear_pointer(&session->cipher_out, validity90_aes_cbc_free);
+    g_clear_pointer(&session->cipher_in, validity90_aes_cbc_free);
+    g_free(session);
+}
+
+gboolean validity90_tls_session_encrypt(validity90_tls_session *session, guint8 type, const guint8 *data, gsize data_len,
+                                        GByteArray *out, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    guint8 header[VALIDITY90_TLS_HEADER_SIZE] = { type, 0x03, 0x03, (data_len >> 8) & 0xFF, data_len & 0xFF };
+    gsize pad_len = 0x10 - (data_len + VALIDITY90_TLS_MAC_SIZE) % 0x10;
+    gsize plain_len = data_len + VALIDITY90_TLS_MAC_SIZE + pad_len;
+    guint start = out->len;
+
+    // IV || data || hmac || padding, encrypted in place afterwards
+    g_byte_array_set_size(out, start + VALIDITY90_TLS_IV_SIZE + plain_len);
+    guint8 *iv = out->data + start;
+    guint8 *plain = iv + VALIDITY90_TLS_IV_SIZE;
+
+    memcpy(iv, client_iv, VALIDITY90_TLS_IV_SIZE);
+    memcpy(plain, data, data_len);
+
+    tls_mac_begin(&session->mac_out);
+    if (type != VALIDITY90_TLS_TYPE_RAW) {
+        validity90_sha256_write(session->mac_out.inner, header, VALIDITY90_TLS_HEADER_SIZE);
+    }
+    validity90_sha256_write(session->mac_out.inner, data, data_len);
+    tls_mac_finish(&session->mac_out, plain + data_len);
+
+    memset(plain + data_len + VALIDITY90_TLS_MAC_SIZE, pad_len - 1, pad_len);
+
+    if (!validity90_aes_cbc_set_iv(session->cipher_out, iv) ||
+        !validity90_aes_cbc_encrypt(session->cipher_out, plain, plain, plain_len)) {
+        g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_CRYPTO, "TLS: Encryption failed");
+        g_byte_array_set_size(out, start);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_tls_session_seal_record(validity90_tls_session *session, guint8 type, const guint8 *data, gsize data_len,
+                                            GByteArray *out, GError **error) {
+    guint start = out->len;
+
+    g_byte_array_set_size(out, start + VALIDITY90_TLS_HEADER_SIZE);
+    if (!validity90_tls_session_encrypt(session, type, data, data_len, out, error)) {
+        g_byte_array_set_size(out, start);
+        return FALSE;
+    }
+
+    gsize enc_len = out->len - start - VALIDITY90_TLS_HEADER_SIZE;
+    guint8 *header = out->data + start;
+    header[0] = type; header[1] = header[2] = 0x03; header[3] = (enc_len >> 8) & 0xFF; header[4] = enc_len & 0xFF;
+
+    return TRUE;
+}
+
+// Decrypt and MAC in chunks that stay in L1 between the two passes
+#define TLS_OPEN_CHUNK_SIZE 0x1000
+
+gboolean validity90_tls_session_open_record(validity90_tls_session *session, guint8 *record, gsize record_len,
+                                            guint8 **plain, gsize *plain_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    if (record_len < VALIDITY90_TLS_HEADER_SIZE ||
+        record[1] != 0x03 || record[2] != 0x03 ||
+        ((record[3] << 8) | record[4]) > record_len - VALIDITY90_TLS_HEADER_SIZE) {
+        g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_INVALID_RECORD, "TLS: Invalid record header");
+        return FALSE;
+    }
+
+    guint8 type = record[0];
+    gsize enc_len = (record[3] << 8) | record[4];
+    guint8 *iv = record + VALIDITY90_TLS_HEADER_SIZE;
+    guint8 *data = iv + VALIDITY90_TLS_IV_SIZE;
+
+    if (enc_len < VALIDITY90_TLS_IV_SIZE + VALIDITY90_TLS_MAC_SIZE + 0x10 || enc_len % 0x10 != 0) {
+        g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_INVALID_RECORD,
+                    "TLS: Invalid encrypted record length: %lx", enc_len);
+        return FALSE;
+    }
+
+    gsize data_len = enc_len - VALIDITY90_TLS_IV_SIZE;
+
+    // The last block alone tells the padding, CBC lets us decrypt it first
+    guint8 last_block[0x10];
+    if (!validity90_aes_cbc_set_iv(session->cipher_in, data + data_len - 0x20) ||
+        !validity90_aes_cbc_decrypt(session->cipher_in, data + data_len - 0x10, last_block, 0x10)) {
+        goto crypto_err;
+    }
+
+    // Bad padding still gets a full MAC pass so timing doesn't tell them apart
+    guint pad_len = last_block[0x0f] + 1;
+    guint bad = pad_len + VALIDITY90_TLS_MAC_SIZE > data_len;
+    if (bad) {
+        pad_len = 0;
+    }
+    gsize content_len = data_len - pad_len - VALIDITY90_TLS_MAC_SIZE;
+
+    guint8 header[VALIDITY90_TLS_HEADER_SIZE] = { type, 0x03, 0x03, (content_len >> 8) & 0xFF, content_len & 0xFF };
+    tls_mac_begin(&session->mac_in);
+    validity90_sha256_write(session->mac_in.inner, header, VALIDITY90_TLS_HEADER_SIZE);
+
+    if (!validity90_aes_cbc_set_iv(session->cipher_in, iv)) {
+        goto crypto_err;
+    }
+    for (gsize pos = 0; pos < data_len; pos += TLS_OPEN_CHUNK_SIZE) {
+        gsize chunk_len = MIN(TLS_OPEN_CHUNK_SIZE, data_len - pos);
+
+        if (!validity90_aes_cbc_decrypt(session->cipher_in, data + pos, data + pos, chunk_len)) {
+            goto crypto_err;
+        }
+        if (pos < content_len) {
+            validity90_sha256_write(session->mac_in.inner, data + pos, MIN(chunk_len, content_len - pos));
+        }
+    }
+
+    guint8 mac[VALIDITY90_TLS_MAC_SIZE];
+    tls_mac_finish(&session->mac_in, mac);
+
+    for (gsize i = 0; i < VALIDITY90_TLS_MAC_SIZE; i++) {
+        bad |= mac[i] ^ data[content_len + i];
+    }
+    for (gsize i = 0; i < pad_len; i++) {
+        bad |= data[data_len - 1 - i] ^ (pad_len - 1);
+    }
+
+    if (bad) {
+        g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_BAD_RECORD_MAC, "TLS: Bad record MAC");
+        return FALSE;
+    }
+
+    *plain = data;
+    *plain_len = content_len;
+
+    return TRUE;
+
+crypto_err:
+    g_set_error(error, VALIDITY90_TLS_ERROR, VALIDITY90_TLS_ERR_CRYPTO, "TLS: Decryption failed");
+    return FALSE;
+}
@@ -0,0 +1,85 @@
+/*
+ * Validity90 TLS record layer
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef TLS_H
+#define TLS_H
+
+#include <glib.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_TLS_ERROR validity90_tls_error_quark()
+
+GQuark validity90_tls_error_quark(void);
+
+enum validity90_tls_error_codes {
+    VALIDITY90_TLS_ERR_KEY_BLOCK,
+    VALIDITY90_TLS_ERR_CRYPTO,
+    VALIDITY90_TLS_ERR_INVALID_RECORD,
+    VALIDITY90_TLS_ERR_BAD_RECORD_MAC,
+};
+
+/*
+ * Key block layout, as produced by the "key expansion" PRF after the handshake
+ */
+#define VALIDITY90_TLS_KEY_BLOCK_SIZE 0x80
+
+#define VALIDITY90_TLS_MAC_OUT_OFFSET 0x00
+#define VALIDITY90_TLS_MAC_IN_OFFSET 0x20
+#define VALIDITY90_TLS_KEY_OUT_OFFSET 0x40
+#define VALIDITY90_TLS_KEY_IN_OFFSET 0x60
+
+#define VALIDITY90_TLS_HEADER_SIZE 0x05
+#define VALIDITY90_TLS_IV_SIZE 0x10
+#define VALIDITY90_TLS_MAC_SIZE 0x20
+
+/* Record type that is MACed without the 5 byte record header */
+#define VALIDITY90_TLS_TYPE_RAW 0xFF
+
+/*
+ * Established session: HMAC-SHA256 and AES-256-CBC state keyed once from
+ * the key block and reused for every record.
+ */
+typedef struct validity90_tls_session validity90_tls_session;
+
+validity90_tls_session *validity90_tls_session_new(const guint8 *key_block, gsize key_block_len, GError **error);
+void validity90_tls_session_free(validity90_tls_session *session);
+
+/* Appends IV || AES(data || HMAC || padding) to out */
+gboolean validity90_tls_session_encrypt(validity90_tls_session *session, guint8 type, const guint8 *data, gsize data_len,
+                                        GByteArray *out, GError **error);
+
+/* Appends a complete record: 5 byte header, IV and encrypted payload */
+gboolean validity90_tls_session_seal_record(validity90_tls_session *session, guint8 type, const guint8 *data, gsize data_len,
+                                            GByteArray *out, GError **error);
+
+/*
+ * Decrypts a received record (5 byte header included) in place and verifies
+ * its HMAC and padding. On success plain points into record, no copies made.
+ */
+gboolean validity90_tls_session_open_record(validity90_tls_session *session, guint8 *record, gsize record_len,
+                                            guint8 **plain, gsize *plain_len, GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // TLS_H
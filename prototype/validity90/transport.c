@@ -0,0 +1,666 @@
+/*
+ * Validity90 USB transport
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "pcapng.h"
+#include "transport.h"
+
+GQuark validity90_transport_error_quark (void) {
+  return g_quark_from_static_string ("validity-transport-error-quark");
+}
+
+typedef struct transport_ops {
+    void (*free)(validity90_transport *transport);
+    gboolean (*write)(validity90_transport *transport, guint8 ep, const guint8 *data, gsize len,
+                      guint timeout_ms, GError **error);
+    gboolean (*read)(validity90_transport *transport, guint8 ep, guint8 *buff, gsize size, gsize *len,
+                     guint timeout_ms, GError **error);
+    gboolean (*submit)(validity90_transport *transport, struct libusb_transfer *transfer, GError **error);
+    void (*cancel)(validity90_transport *transport, struct libusb_transfer *transfer);
+    gboolean (*handle_events)(validity90_transport *transport, struct timeval *tv, int *completed, GError **error);
+    gboolean (*reset)(validity90_transport *transport, GError **error);
+} transport_ops;
+
+struct validity90_transport {
+    const transport_ops *ops;
+};
+
+/*
+ * libusb backend
+ */
+typedef struct transport_usb {
+    validity90_transport parent;
+    libusb_device_handle *dev;
+} transport_usb;
+
+static void usb_free(validity90_transport *transport) {
+    g_free(transport);
+}
+
+static gboolean usb_write(validity90_transport *transport, guint8 ep, const guint8 *data, gsize len,
+                          guint timeout_ms, GError **error) {
+    transport_usb *usb = (transport_usb *) transport;
+    int transferred = 0;
+    int res = 0;
+
+    if ((res = libusb_bulk_transfer(usb->dev, ep, (guint8 *) data, len, &transferred, timeout_ms)) != 0) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_USB,
+                    "Transport: write to ep %02x failed: %s", ep, libusb_error_name(res));
+        return FALSE;
+    }
+    if (transferred != len) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_SHORT_WRITE,
+                    "Transport: short write to ep %02x, %d of %lu bytes", ep, transferred, len);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean usb_read(validity90_transport *transport, guint8 ep, guint8 *buff, gsize size, gsize *len,
+                         guint timeout_ms, GError **error) {
+    transport_usb *usb = (transport_usb *) transport;
+    int transferred = 0;
+    int res = 0;
+
+    if ((res = libusb_bulk_transfer(usb->dev, ep, buff, size, &transferred, timeout_ms)) != 0) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR,
+                    res == LIBUSB_ERROR_OVERFLOW ? VALIDITY90_TRANSPORT_ERR_OVERFLOW : VALIDITY90_TRANSPORT_ERR_USB,
+                    "Transport: read from ep %02x failed: %s", ep, libusb_error_name(res));
+        return FALSE;
+    }
+    *len = transferred;
+
+    return TRUE;
+}
+
+static gboolean usb_submit(validity90_transport *transport, struct libusb_transfer *transfer, GError **error) {
+    transport_usb *usb = (transport_usb *) transport;
+    int res = 0;
+
+    transfer->dev_handle = usb->dev;
+    if ((res = libusb_submit_transfer(transfer)) != 0) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_USB,
+                    "Transport: submit on ep %02x failed: %s", transfer->endpoint, libusb_error_name(res));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void usb_cancel(validity90_transport *transport, struct libusb_transfer *transfer) {
+    libusb_cancel_transfer(transfer);
+}
+
+static gboolean usb_handle_events(validity90_transport *transport, struct timeval *tv, int *completed, GError **error) {
+    int res = 0;
+
+    if (tv == NULL) {
+        res = libusb_handle_events_completed(NULL, completed);
+    } else {
+        res = libusb_handle_events_timeout_completed(NULL, tv, completed);
+    }
+    if (res != 0 && res != LIBUSB_ERROR_INTERRUPTED) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_USB,
+                    "Transport: event handling failed: %s", libusb_error_name(res));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean usb_reset(validity90_transport *transport, GError **error) {
+    transport_usb *usb = (transport_usb *) transport;
+    int res = 0;
+
+    // NOT_FOUND means the device came back as a new one, only a full open helps then
+    if ((res = libusb_reset_device(usb->dev)) != 0) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_USB,
+                    "Transport: reset failed: %s", libusb_error_name(res));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static const transport_ops usb_ops = {
+    .free = usb_free,
+    .write = usb_write,
+    .read = usb_read,
+    .submit = usb_submit,
+    .cancel = usb_cancel,
+    .handle_events = usb_handle_events,
+    .reset = usb_reset,
+};
+
+validity90_transport *validity90_transport_usb_new(libusb_device_handle *dev) {
+    transport_usb *usb = g_malloc0(sizeof(transport_usb));
+
+    usb->parent.ops = &usb_ops;
+    usb->dev = dev;
+
+    return &usb->parent;
+}
+
+/*
+ * Capture replay backend
+ */
+#define REPLAY_EP_OUT 0x01
+// usbmon splits long IN transfers into max packet sized completions
+#define REPLAY_MAX_PACKET_SIZE 0x40
+#define REPLAY_RESYNC_WINDOW 8
+
+typedef struct replay_record {
+    gint64 ts_us;
+    // OUT records captured before this one
+    guint out_seq;
+    gsize offset;
+    gsize len;
+} replay_record;
+
+typedef struct replay_queue {
+    GArray *records;
+    guint next;
+} replay_queue;
+
+typedef struct replay_pending {
+    struct libusb_transfer *transfer;
+    gboolean cancelled;
+} replay_pending;
+
+// One queue per endpoint number and direction
+#define REPLAY_QUEUES 0x20
+
+typedef struct transport_replay {
+    validity90_transport parent;
+
+    GByteArray *payload;
+    replay_queue queues[REPLAY_QUEUES];
+    guint outs_written;
+
+    gboolean timing;
+    gint64 anchor_time;
+    gint64 anchor_ts;
+
+    GQueue pending;
+
+    // Reads left before the injected fault, -1 for none
+    gint fault_reads;
+    validity90_replay_fault fault;
+} transport_replay;
+
+static replay_queue *replay_get_queue(transport_replay *replay, guint8 ep) {
+    return &replay->queues[(ep & 0x0f) | ((ep & LIBUSB_ENDPOINT_IN) ? 0x10 : 0)];
+}
+
+static replay_record *replay_peek(transport_replay *replay, guint8 ep) {
+    replay_queue *queue = replay_get_queue(replay, ep);
+
+    if (queue->next >= queue->records->len) {
+        return NULL;
+    }
+    return &g_array_index(queue->records, replay_record, queue->next);
+}
+
+static void replay_consume(transport_replay *replay, guint8 ep) {
+    replay_get_queue(replay, ep)->next++;
+}
+
+static replay_record *replay_find(transport_replay *replay, replay_queue *queue, guint from, guint to,
+                                  const guint8 *data, gsize len) {
+    for (guint i = from; i < queue->records->len && i < to; i++) {
+        replay_record *candidate = &g_array_index(queue->records, replay_record, i);
+
+        if (candidate->len == len && memcmp(replay->payload->data + candidate->offset, data, len) == 0) {
+            queue->next = i;
+            return candidate;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Takes the OUT record answering a write. Commands sent verbatim are looked
+ * up a few records ahead, so a client skipping commands of the capture stays
+ * in sync, and then from the start, so a client starting over gets the same
+ * conversation again. Everything else, like TLS records, is taken in order.
+ */
+static replay_record *replay_take_write(transport_replay *replay, guint8 ep, const guint8 *data, gsize len) {
+    replay_queue *queue = replay_get_queue(replay, ep);
+    guint next = queue->next;
+    replay_record *record = NULL;
+
+    if ((record = replay_find(replay, queue, next, next + REPLAY_RESYNC_WINDOW, data, len)) == NULL &&
+        (record = replay_find(replay, queue, 0, next, data, len)) != NULL) {
+        // Everything after the record again, the responses before it are skipped below
+        for (int i = 0; i < REPLAY_QUEUES; i++) {
+            if (&replay->queues[i] != queue) {
+                replay->queues[i].next = 0;
+            }
+        }
+        replay->outs_written = 0;
+    }
+    if (record == NULL && (record = replay_peek(replay, ep)) == NULL) {
+        return NULL;
+    }
+
+    // Responses to the skipped commands
+    if (record->out_seq > replay->outs_written) {
+        for (int i = 0; i < REPLAY_QUEUES; i++) {
+            replay_queue *in = &replay->queues[i];
+
+            while (i & 0x10 && in->next < in->records->len &&
+                   g_array_index(in->records, replay_record, in->next).out_seq <= record->out_seq) {
+                in->next++;
+            }
+        }
+    }
+
+    queue->next++;
+    replay->outs_written = record->out_seq + 1;
+    replay->anchor_time = g_get_monotonic_time();
+    replay->anchor_ts = record->ts_us;
+
+    return record;
+}
+
+// Counts the reads down to the injected fault, -1 once it happened
+static gboolean replay_fault_due(transport_replay *replay) {
+    return replay->fault_reads >= 0 && replay->fault_reads-- == 0;
+}
+
+static gint64 replay_due(transport_replay *replay, const replay_record *record) {
+    if (!replay->timing || record->ts_us <= replay->anchor_ts) {
+        return 0;
+    }
+    return replay->anchor_time + (record->ts_us - replay->anchor_ts);
+}
+
+static void replay_sleep_until(gint64 time) {
+    gint64 now = g_get_monotonic_time();
+
+    if (time > now) {
+        g_usleep(time - now);
+    }
+}
+
+static gboolean replay_find_device(validity90_pcapng *pcap, guint8 *devnum, guint16 *busnum, GError **error) {
+    validity90_usb_packet packet;
+
+    while (validity90_pcapng_next(pcap, &packet, error)) {
+        if (packet.event == 'S' && packet.xfer_type == VALIDITY90_USB_XFER_BULK &&
+            packet.ep == REPLAY_EP_OUT && packet.data_len > 0) {
+            *devnum = packet.devnum;
+            *busnum = packet.busnum;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean replay_load(transport_replay *replay, const gchar *path, GError **error) {
+    validity90_pcapng *pcap = NULL;
+    validity90_usb_packet packet;
+    GError *local_error = NULL;
+    replay_queue *last_queue = NULL;
+    gsize last_fragment_len = 0;
+    guint8 devnum = 0;
+    guint16 busnum = 0;
+    guint out_seq = 0;
+    gboolean result = FALSE;
+
+    if ((pcap = validity90_pcapng_open(path, error)) == NULL) {
+        return FALSE;
+    }
+
+    // The sensor is whatever receives the first command
+    if (!replay_find_device(pcap, &devnum, &busnum, &local_error)) {
+        if (local_error != NULL) {
+            g_propagate_error(error, local_error);
+        } else {
+            g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED,
+                        "Replay: no sensor commands in %s", path);
+        }
+        goto end;
+    }
+    validity90_pcapng_rewind(pcap);
+
+    while (validity90_pcapng_next(pcap, &packet, &local_error)) {
+        gboolean in = (packet.ep & LIBUSB_ENDPOINT_IN) != 0;
+
+        if (packet.devnum != devnum || packet.busnum != busnum || packet.data_len == 0 ||
+            (packet.xfer_type != VALIDITY90_USB_XFER_BULK && packet.xfer_type != VALIDITY90_USB_XFER_INTERRUPT)) {
+            continue;
+        }
+        // Data goes out with the submission and comes in with the completion
+        if (in ? packet.event != 'C' || packet.status != 0 : packet.event != 'S') {
+            continue;
+        }
+
+        replay_queue *queue = replay_get_queue(replay, packet.ep);
+
+        if (in && queue == last_queue && last_fragment_len % REPLAY_MAX_PACKET_SIZE == 0) {
+            // Continuation of the previous response
+            g_array_index(queue->records, replay_record, queue->records->len - 1).len += packet.data_len;
+        } else {
+            replay_record record = {
+                .ts_us = packet.ts_us,
+                .out_seq = out_seq,
+                .offset = replay->payload->len,
+                .len = packet.data_len,
+            };
+            g_array_append_val(queue->records, record);
+        }
+        g_byte_array_append(replay->payload, packet.data, packet.data_len);
+
+        last_queue = queue;
+        last_fragment_len = packet.data_len;
+        if (!in) {
+            out_seq++;
+        }
+    }
+    if (local_error != NULL) {
+        g_propagate_error(error, local_error);
+        goto end;
+    }
+
+    result = TRUE;
+
+end:
+    validity90_pcapng_free(pcap);
+
+    return result;
+}
+
+static void replay_free(validity90_transport *transport) {
+    transport_replay *replay = (transport_replay *) transport;
+
+    for (int i = 0; i < REPLAY_QUEUES; i++) {
+        g_array_free(replay->queues[i].records, TRUE);
+    }
+    g_queue_foreach(&replay->pending, (GFunc) g_free, NULL);
+    g_queue_clear(&replay->pending);
+    g_byte_array_free(replay->payload, TRUE);
+    g_free(replay);
+}
+
+static gboolean replay_write(validity90_transport *transport, guint8 ep, const guint8 *data, gsize len,
+                             guint timeout_ms, GError **error) {
+    transport_replay *replay = (transport_replay *) transport;
+
+    if (replay_take_write(replay, ep, data, len) == NULL) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED,
+                    "Replay: no write to ep %02x left in the capture", ep);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean replay_read(validity90_transport *transport, guint8 ep, guint8 *buff, gsize size, gsize *len,
+                            guint timeout_ms, GError **error) {
+    transport_replay *replay = (transport_replay *) transport;
+    replay_record *record = replay_peek(replay, ep);
+
+    if (record == NULL || record->out_seq > replay->outs_written) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED,
+                    "Replay: no response on ep %02x left for write %u", ep, replay->outs_written);
+        return FALSE;
+    }
+    if (record->len > size) {
+        g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_OVERFLOW,
+                    "Replay: response on ep %02x doesn't fit, len: %lx", ep, record->len);
+        return FALSE;
+    }
+
+    replay_sleep_until(replay_due(replay, record));
+
+    memcpy(buff, replay->payload->data + record->offset, record->len);
+    *len = record->len;
+    replay_consume(replay, ep);
+
+    if (replay_fault_due(replay)) {
+        if (replay->fault == VALIDITY90_REPLAY_FAULT_STALL) {
+            g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_USB,
+                        "Replay: injected stall on ep %02x", ep);
+            return FALSE;
+        }
+        buff[*len - 1] ^= 0xff;
+    }
+
+    return TRUE;
+}
+
+static gboolean replay_submit(validity90_transport *transport, struct libusb_transfer *transfer, GError **error) {
+    transport_replay *replay = (transport_replay *) transport;
+    replay_pending *pending = g_malloc0(sizeof(replay_pending));
+
+    pending->transfer = transfer;
+    g_queue_push_tail(&replay->pending, pending);
+
+    return TRUE;
+}
+
+static void replay_cancel(validity90_transport *transport, struct libusb_transfer *transfer) {
+    transport_replay *replay = (transport_replay *) transport;
+
+    for (GList *l = replay->pending.head; l != NULL; l = l->next) {
+        replay_pending *pending = l->data;
+
+        if (pending->transfer == transfer) {
+            pending->cancelled = TRUE;
+        }
+    }
+}
+
+/* Completes the first transfer that can complete now, or returns when its record is due */
+static gboolean replay_complete_one(transport_replay *replay, gint64 *next_due) {
+    gint64 now = g_get_monotonic_time();
+
+    for (GList *l = replay->pending.head; l != NULL; l = l->next) {
+        replay_pending *pending = l->data;
+        struct libusb_transfer *transfer = pending->transfer;
+        replay_record *record = NULL;
+
+        if (pending->cancelled) {
+            transfer->status = LIBUSB_TRANSFER_CANCELLED;
+            transfer->actual_length = 0;
+        } else if (transfer->endpoint & LIBUSB_ENDPOINT_IN) {
+            if ((record = replay_peek(replay, transfer->endpoint)) == NULL ||
+                record->out_seq > replay->outs_written) {
+                continue;
+            }
+
+            gint64 due = replay_due(replay, record);
+            if (due > now) {
+                *next_due = MIN(*next_due, due);
+                continue;
+            }
+
+            transfer->status = record->len > transfer->length ? LIBUSB_TRANSFER_OVERFLOW : LIBUSB_TRANSFER_COMPLETED;
+            transfer->actual_length = MIN(record->len, transfer->length);
+            memcpy(transfer->buffer, replay->payload->data + record->offset, transfer->actual_length);
+            replay_consume(replay, transfer->endpoint);
+
+            if (replay_fault_due(replay)) {
+                if (replay->fault == VALIDITY90_REPLAY_FAULT_STALL) {
+                    transfer->status = LIBUSB_TRANSFER_STALL;
+                    transfer->actual_length = 0;
+                } else if (transfer->actual_length > 0) {
+                    transfer->buffer[transfer->actual_length - 1] ^= 0xff;
+                }
+            }
+        } else if (replay_take_write(replay, transfer->endpoint, transfer->buffer, transfer->length) == NULL) {
+            continue;
+        } else {
+            transfer->status = LIBUSB_TRANSFER_COMPLETED;
+            transfer->actual_length = transfer->length;
+        }
+
+        // The callback may submit or cancel transfers
+        g_queue_delete_link(&replay->pending, l);
+        g_free(pending);
+        transfer->callback(transfer);
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean replay_handle_events(validity90_transport *transport, struct timeval *tv, int *completed, GError **error) {
+    transport_replay *replay = (transport_replay *) transport;
+    gint64 deadline = G_MAXINT64;
+    gboolean handled = FALSE;
+
+    if (tv != NULL) {
+        deadline = g_get_monotonic_time() + tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+    }
+
+    while (completed == NULL || !*completed) {
+        gint64 next_due = G_MAXINT64;
+
+        if (replay_complete_one(replay, &next_due)) {
+            handled = TRUE;
+            continue;
+        }
+        if (handled || g_queue_is_empty(&replay->pending)) {
+            break;
+        }
+        if (next_due == G_MAXINT64) {
+            // Nothing will ever arrive for the transfers left
+            g_set_error(error, VALIDITY90_TRANSPORT_ERROR, VALIDITY90_TRANSPORT_ERR_EXHAUSTED,
+                        "Replay: %u transfers pending with no response left in the capture",
+                        g_queue_get_length(&replay->pending));
+            return FALSE;
+        }
+
+        replay_sleep_until(MIN(next_due, deadline));
+        if (next_due > deadline) {
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean replay_reset(validity90_transport *transport, GError **error) {
+    transport_replay *replay = (transport_replay *) transport;
+
+    for (GList *l = replay->pending.head; l != NULL; l = l->next) {
+        ((replay_pending *) l->data)->cancelled = TRUE;
+    }
+
+    return TRUE;
+}
+
+static const transport_ops replay_ops = {
+    .free = replay_free,
+    .write = replay_write,
+    .read = replay_read,
+    .submit = replay_submit,
+    .cancel = replay_cancel,
+    .handle_events = replay_handle_events,
+    .reset = replay_reset,
+};
+
+validity90_transport *validity90_transport_replay_new(const gchar *path, gboolean timing, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    transport_replay *replay = g_malloc0(sizeof(transport_replay));
+
+    replay->parent.ops = &replay_ops;
+    replay->payload = g_byte_array_new();
+    for (int i = 0; i < REPLAY_QUEUES; i++) {
+        replay->queues[i].records = g_array_new(FALSE, FALSE, sizeof(replay_record));
+    }
+    g_queue_init(&replay->pending);
+    replay->fault_reads = -1;
+
+    if (!replay_load(replay, path, error)) {
+        replay_free(&replay->parent);
+        return NULL;
+    }
+
+    // Traffic captured before the first command is due right away
+    replay->timing = timing;
+    replay->anchor_time = g_get_monotonic_time();
+    replay->anchor_ts = G_MAXINT64;
+
+    return &replay->parent;
+}
+
+void validity90_transport_replay_inject(validity90_transport *transport, guint reads, validity90_replay_fault fault) {
+    g_return_if_fail (transport->ops == &replay_ops);
+
+    transport_replay *replay = (transport_replay *) transport;
+
+    replay->fault_reads = reads;
+    replay->fault = fault;
+}
+
+/*
+ * Dispatch
+ */
+void validity90_transport_free(validity90_transport *transport) {
+    if (transport == NULL) {
+        return;
+    }
+    transport->ops->free(transport);
+}
+
+gboolean validity90_transport_write(validity90_transport *transport, guint8 ep, const guint8 *data, gsize len,
+                                    guint timeout_ms, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    return transport->ops->write(transport, ep, data, len, timeout_ms, error);
+}
+
+gboolean validity90_transport_read(validity90_transport *transport, guint8 ep, guint8 *buff, gsize size, gsize *len,
+                                   guint timeout_ms, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    return transport->ops->read(transport, ep, buff, size, len, timeout_ms, error);
+}
+
+gboolean validity90_transport_submit(validity90_transport *transport, struct libusb_transfer *transfer, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    return transport->ops->submit(transport, transfer, error);
+}
+
+void validity90_transport_cancel(validity90_transport *transport, struct libusb_transfer *transfer) {
+    transport->ops->cancel(transport, transfer);
+}
+
+gboolean validity90_transport_handle_events(validity90_transport *transport, struct timeval *tv, int *completed,
+                                            GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    return transport->ops->handle_events(transport, tv, completed, error);
+}
+
+gboolean validity90_transport_reset(validity90_transport *transport, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    return transport->ops->reset(transport, error);
+}
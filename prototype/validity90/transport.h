@@ -0,0 +1,97 @@
+/*
+ * Validity90 USB transport
+ * Copyright (C) 2017-2018 Nikita Mikhailov <nikita.s.mikhailov@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <glib.h>
+#include <libusb.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define VALIDITY90_TRANSPORT_ERROR validity90_transport_error_quark()
+
+GQuark validity90_transport_error_quark(void);
+
+enum validity90_transport_error_codes {
+    VALIDITY90_TRANSPORT_ERR_USB,
+    VALIDITY90_TRANSPORT_ERR_SHORT_WRITE,
+    VALIDITY90_TRANSPORT_ERR_OVERFLOW,
+    // Replay has no record left that could answer the request
+    VALIDITY90_TRANSPORT_ERR_EXHAUSTED,
+};
+
+/*
+ * Endpoint I/O of the sensor.
+ *
+ * The usb backend talks to a device through libusb. The replay backend
+ * answers from a usbmon capture: every write consumes the next OUT record of
+ * its endpoint, skipping ahead to a record with the very same data if there
+ * is one close by, and every read returns the next IN record of its endpoint.
+ * A command sent verbatim that is only found earlier in the capture, like
+ * the probe after a reset or the ClientHello of a new handshake, starts the
+ * conversation over from there. Other written data is not compared. An IN record is only returned once all OUT
+ * records captured before it were written, so interrupts come back at the
+ * same point of the conversation as on the device. With timing enabled IN
+ * records are also delayed by their captured distance from the last OUT.
+ *
+ * Asynchronous transfers are regular libusb transfers, filled without a
+ * device handle and submitted through the transport.
+ */
+typedef struct validity90_transport validity90_transport;
+
+validity90_transport *validity90_transport_usb_new(libusb_device_handle *dev);
+validity90_transport *validity90_transport_replay_new(const gchar *path, gboolean timing, GError **error);
+void validity90_transport_free(validity90_transport *transport);
+
+typedef enum validity90_replay_fault {
+    // The read fails like on a stalled device, its response is lost
+    VALIDITY90_REPLAY_FAULT_STALL,
+    // The response comes with its last byte flipped
+    VALIDITY90_REPLAY_FAULT_CORRUPT,
+} validity90_replay_fault;
+
+/* Replay only: the read or IN transfer after the next reads ones gets fault */
+void validity90_transport_replay_inject(validity90_transport *transport, guint reads, validity90_replay_fault fault);
+
+/* USB port reset, the device keeps its configuration and claimed interface. Replay cancels pending transfers. */
+gboolean validity90_transport_reset(validity90_transport *transport, GError **error);
+
+gboolean validity90_transport_write(validity90_transport *transport, guint8 ep, const guint8 *data, gsize len,
+                                    guint timeout_ms, GError **error);
+gboolean validity90_transport_read(validity90_transport *transport, guint8 ep, guint8 *buff, gsize size, gsize *len,
+                                   guint timeout_ms, GError **error);
+
+gboolean validity90_transport_submit(validity90_transport *transport, struct libusb_transfer *transfer, GError **error);
+/* The transfer callback is still called, with LIBUSB_TRANSFER_CANCELLED */
+void validity90_transport_cancel(validity90_transport *transport, struct libusb_transfer *transfer);
+/*
+ * Completes transfers and calls their callbacks, waits up to tv (NULL for the
+ * libusb default) or until *completed is set when completed isn't NULL
+ */
+gboolean validity90_transport_handle_events(validity90_transport *transport, struct timeval *tv, int *completed,
+                                            GError **error);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // TRANSPORT_H
@@ -20,41 +20,33 @@
 #include <string.h>
 #include <stdio.h>
 
-#include <gcrypt.h>
-
+#include "crypto.h"
 #include "utils.h"
 
 GQuark validity90_utils_error_quark (void) {
   return g_quark_from_static_string ("validity-utils-error-quark");
 }
 
-struct bstream {
-    gsize pos;
-    gsize data_size;
-    guint8 *data;
-};
+void bstream_init(bstream *stream, const guint8 *data, const gsize data_size) {
+    stream->data = data;
+    stream->data_size = data_size;
+    stream->pos = 0;
+}
 
 bstream *bstream_create(const guint8 *data, const gsize data_size) {
     bstream *res = g_malloc(sizeof(bstream));
 
-    res->pos = 0;
-    res->data = g_malloc(data_size);
-    res->data_size = data_size;
-
-    memcpy(res->data, data, data_size);
+    bstream_init(res, data, data_size);
 
     return res;
 }
 
 void bstream_free(bstream *stream) {
-    if (stream && stream->data) {
-        g_free(stream->data);
-    }
     g_free(stream);
 }
 
 gsize bstream_remaining(bstream *stream) {
-    return stream->data_size - stream->pos;
+    return stream->pos < stream->data_size ? stream->data_size - stream->pos : 0;
 }
 
 void bstream_set_pos(bstream *stream, gsize pos) {
@@ -66,7 +58,7 @@ gsize bstream_get_pos(bstream *stream) {
 }
 
 gboolean bstream_read_uint8(bstream *stream, guint8 *res) {
-    if (stream->pos + 1 < stream->data_size) {
+    if (bstream_remaining(stream) >= 1) {
         *res = stream->data[stream->pos++];
         return TRUE;
     }
@@ -74,19 +66,55 @@ gboolean bstream_read_uint8(bstream *stream, guint8 *res) {
 }
 
 gboolean bstream_read_uint16(bstream *stream, guint16 *res) {
-    if (stream->pos + 2 < stream->data_size) {
-        *res = stream->data[stream->pos] | (stream->data[stream->pos + 1] << 8);
-        stream->pos += 2;
+    return bstream_read_uint16_array(stream, res, 1);
+}
+
+gboolean bstream_read_uint32(bstream *stream, guint32 *res) {
+    return bstream_read_uint32_array(stream, res, 1);
+}
+
+gboolean bstream_read_uint16_array(bstream *stream, guint16 *res, gsize count) {
+    if (bstream_remaining(stream) / 2 < count) {
+        return FALSE;
+    }
+
+    const guint8 *src = stream->data + stream->pos;
+    for (gsize i = 0; i < count; i++) {
+        res[i] = src[i * 2] | (src[i * 2 + 1] << 8);
+    }
+    stream->pos += count * 2;
+
+    return TRUE;
+}
+
+gboolean bstream_read_uint32_array(bstream *stream, guint32 *res, gsize count) {
+    if (bstream_remaining(stream) / 4 < count) {
+        return FALSE;
+    }
+
+    const guint8 *src = stream->data + stream->pos;
+    for (gsize i = 0; i < count; i++) {
+        res[i] = src[i * 4] | (src[i * 4 + 1] << 8) | (src[i * 4 + 2] << 16) | ((guint32) src[i * 4 + 3] << 24);
+    }
+    stream->pos += count * 4;
+
+    return TRUE;
+}
+
+gboolean bstream_read_slice(bstream *stream, gsize size, const guint8 **res) {
+    if (bstream_remaining(stream) >= size) {
+        *res = stream->data + stream->pos;
+        stream->pos += size;
         return TRUE;
     }
     return FALSE;
 }
 
 gboolean bstream_read_bytes(bstream *stream, gsize size, guint8 **res) {
-    if (stream->pos + size < stream->data_size) {
-        *res = g_malloc(size);
-        memcpy(*res, stream->data + stream->pos, size);
-        stream->pos += size;
+    const guint8 *slice;
+
+    if (bstream_read_slice(stream, size, &slice)) {
+        *res = g_memdup(slice, size);
         return TRUE;
     }
     return FALSE;
@@ -98,119 +126,278 @@ gboolean bstream_read_bytes(bstream *stream, gsize size, guint8 **res) {
 
 gboolean validity90_check_aes_padding(const guint8 *data, const gsize data_len, gsize *real_len) {
     guint8 pad_size = data[data_len - 1];
+    gsize check_len = MIN(data_len, 0x10);
+    guint bad = (pad_size > data_len) | (pad_size > 0x10);
+
+    // Every byte of the last block is looked at, the ones past the padding are masked out
+    for (gsize i = 0; i < check_len; i++) {
+        guint8 in_pad = ((gssize) i - pad_size) >> (sizeof(gssize) * 8 - 1);
+
+        bad |= in_pad & (data[data_len - 1 - i] ^ pad_size);
+    }
 
-    if (pad_size > data_len || pad_size > 0x10) {
+    if (bad) {
         return FALSE;
     }
 
     if (real_len != NULL) {
         *real_len = data_len - pad_size;
     }
+    return TRUE;
+}
 
-    for (int i = 0; i < pad_size; i++) {
-        if (data[data_len - 1 - i] != pad_size) {
-            return FALSE;
-        }
+struct validity90_aes_decryptor {
+    validity90_aes_cbc *cipher;
+};
+
+static gboolean aes_decryptor_init(validity90_aes_decryptor *decryptor, const guint8 *key, const gsize key_len,
+                                   GError **error) {
+    if ((decryptor->cipher = validity90_aes_cbc_new(key, key_len)) == NULL) {
+        g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_CIPHER_FAILED,
+                    "AES Decrypt: Cipher setup failed, key length: %lx", key_len);
+        return FALSE;
     }
+
     return TRUE;
 }
 
-gboolean validity90_aes_decrypt(const guint8 *data, const gsize data_len, const guint8 *key, const gsize key_len,
-                                GByteArray **out_data, GError **error) {
-    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+static void aes_decryptor_clear(validity90_aes_decryptor *decryptor) {
+    g_clear_pointer(&decryptor->cipher, validity90_aes_cbc_free);
+}
 
-    gcry_cipher_hd_t cipher = NULL;
-    gcry_error_t cmd_res = 0;
-    gboolean result = TRUE;
-    guint8 out_buff[data_len - 0x10];
+validity90_aes_decryptor *validity90_aes_decryptor_new(const guint8 *key, const gsize key_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-    if ((cmd_res = gcry_cipher_open(&cipher, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CBC, 0)) != 0) {
-        g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_CIPHER_FAILED,
-                    "AES Decrypt: Cipher open failed, ret: %x - %s", cmd_res, gcry_strerror(cmd_res));
-        result = FALSE;
-        goto end;
+    validity90_aes_decryptor *decryptor = g_malloc0(sizeof(validity90_aes_decryptor));
+
+    if (!aes_decryptor_init(decryptor, key, key_len, error)) {
+        validity90_aes_decryptor_free(decryptor);
+        return NULL;
     }
-    if ((cmd_res = gcry_cipher_setkey(cipher, key, key_len)) != 0) {
-        g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_CIPHER_FAILED,
-                    "AES Decrypt: Cipher setkey failed, ret: %x - %s", cmd_res, gcry_strerror(cmd_res));
-        result = FALSE;
-        goto end;
+
+    return decryptor;
+}
+
+void validity90_aes_decryptor_free(validity90_aes_decryptor *decryptor) {
+    if (decryptor == NULL) {
+        return;
+    }
+    aes_decryptor_clear(decryptor);
+    g_free(decryptor);
+}
+
+gboolean validity90_aes_decryptor_decrypt(validity90_aes_decryptor *decryptor, validity90_aes_record *record,
+                                          GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    if (record->ciphertext_len < 0x10 || record->ciphertext_len % 0x10 != 0) {
+        g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_DECRYPTION_FAILED,
+                    "AES Decrypt: Invalid data length: %lx", record->ciphertext_len);
+        return FALSE;
     }
-    if ((cmd_res = gcry_cipher_setiv(cipher, data, 0x10)) != 0) {
+    if (!validity90_aes_cbc_set_iv(decryptor->cipher, record->iv)) {
         g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_CIPHER_FAILED,
-                    "AES Decrypt: Cipher setiv failed, ret: %x - %s", cmd_res, gcry_strerror(cmd_res));
-        result = FALSE;
-        goto end;
+                    "AES Decrypt: Cipher setiv failed");
+        return FALSE;
     }
-    if ((cmd_res = gcry_cipher_decrypt(cipher, out_buff, data_len - 0x10, data + 0x10, data_len - 0x10)) != 0) {
+    if (!validity90_aes_cbc_decrypt(decryptor->cipher, record->ciphertext, record->out_buff,
+                                    record->ciphertext_len)) {
         g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_DECRYPTION_FAILED,
-                    "AES Decrypt: Decryption failed, ret: %x - %s", cmd_res, gcry_strerror(cmd_res));
-        result = FALSE;
-        goto end;
+                    "AES Decrypt: Decryption failed");
+        return FALSE;
     }
 
-    gsize out_len = 0;
-
-    if (!validity90_check_aes_padding(out_buff, data_len - 0x10, &out_len)) {
+    if (!validity90_check_aes_padding(record->out_buff, record->ciphertext_len, &record->out_len)) {
         g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_PADDING_FAILED,
                     "AES Decrypt: Decryption failed, inconsistent padding");
-        result = FALSE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_aes_decryptor_decrypt_batch(validity90_aes_decryptor *decryptor, validity90_aes_record *records,
+                                                guint records_count, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    for (guint i = 0; i < records_count; i++) {
+        if (!validity90_aes_decryptor_decrypt(decryptor, &records[i], error)) {
+            g_prefix_error(error, "Record %u: ", i);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_aes_decrypt_into(const guint8 *data, const gsize data_len, const guint8 *key, const gsize key_len,
+                                     guint8 *out_buff, gsize *out_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    // On the stack, the one shot path allocates nothing but the cipher handle
+    validity90_aes_decryptor decryptor = { NULL };
+    validity90_aes_record record = {
+        .iv = data,
+        .ciphertext = data + 0x10,
+        .ciphertext_len = data_len - 0x10,
+        .out_buff = out_buff,
+    };
+    gboolean result = FALSE;
+
+    if (data_len < 0x20 || data_len % 0x10 != 0) {
+        g_set_error(error, VALIDITY90_UTILS_ERROR, VALIDITY90_ERROR_CODE_AES_DECRYPTION_FAILED,
+                    "AES Decrypt: Invalid data length: %lx", data_len);
+        goto end;
+    }
+    if (!aes_decryptor_init(&decryptor, key, key_len, error)) {
+        goto end;
+    }
+    if (!validity90_aes_decryptor_decrypt(&decryptor, &record, error)) {
         goto end;
     }
 
-    *out_data = g_byte_array_sized_new(out_len);
-    g_byte_array_append(*out_data, out_buff, out_len);
+    *out_len = record.out_len;
+    result = TRUE;
 
 end:
-    g_clear_pointer(&cipher, gcry_cipher_close);
+    aes_decryptor_clear(&decryptor);
 
     return result;
 }
 
-gboolean validity90_tls_prf_raw(const guint8 *secret, const gsize secret_len, const guint8 *seed, const gsize seed_len,
-                                const gsize required_len, guint8 *out_buff, GError **error) {
+gboolean validity90_aes_decrypt(const guint8 *data, const gsize data_len, const guint8 *key, const gsize key_len,
+                                GByteArray **out_data, GError **error) {
     g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+    // Decrypted straight into the result, whatever the size
+    GByteArray *out = g_byte_array_sized_new(MAX(data_len, 0x10) - 0x10);
+    gsize out_len = 0;
+
+    g_byte_array_set_size(out, MAX(data_len, 0x10) - 0x10);
+    if (!validity90_aes_decrypt_into(data, data_len, key, key_len, out->data, &out_len, error)) {
+        memset(out->data, 0, out->len);
+        g_byte_array_free(out, TRUE);
+        return FALSE;
+    }
+
+    // Padding bytes aren't part of the plaintext
+    memset(out->data + out_len, 0, out->len - out_len);
+    g_byte_array_set_size(out, out_len);
+    *out_data = out;
+
+    return TRUE;
+}
+
+/*
+ * HMAC-SHA256 built from plain SHA256 over iovecs: a keyed HMAC handle is an
+ * allocation per call, this keeps the one shot PRF on the stack.
+ */
+typedef struct hmac_sha256_key {
+    guint8 ipad[0x40];
+    guint8 opad[0x40];
+} hmac_sha256_key;
+
+static void hmac_sha256_key_init(hmac_sha256_key *hkey, const guint8 *key, gsize key_len) {
+    guint8 block[0x40] = { 0 };
+
+    if (key_len > G_N_ELEMENTS(block)) {
+        validity90_sha256_buffer(key, key_len, block);
+    } else {
+        memcpy(block, key, key_len);
+    }
+
+    for (int i = 0; i < G_N_ELEMENTS(block); i++) {
+        hkey->ipad[i] = block[i] ^ 0x36;
+        hkey->opad[i] = block[i] ^ 0x5c;
+    }
+    memset(block, 0, G_N_ELEMENTS(block));
+}
+
+/*
+ * HMAC(secret, a || label || seed), empty parts are skipped. out may be a,
+ * the message is consumed before the digest is written.
+ */
+typedef gboolean (*prf_hmac_func)(gpointer key, const guint8 *a, gsize a_len, const guint8 *label, gsize label_len,
+                                  const guint8 *seed, gsize seed_len, guint8 *out);
+
+static gboolean hmac_sha256(gpointer key, const guint8 *a, gsize a_len, const guint8 *label, gsize label_len,
+                            const guint8 *seed, gsize seed_len, guint8 *out) {
+    const hmac_sha256_key *hkey = key;
+    const guint8 *parts[] = { a, label, seed };
+    const gsize parts_len[] = { a_len, label_len, seed_len };
+    guint8 inner[0x20];
+    validity90_crypto_buffer inner_buffs[4] = {
+        { hkey->ipad, 0x40 },
+    };
+    validity90_crypto_buffer outer_buffs[2] = {
+        { hkey->opad, 0x40 },
+        { inner, 0x20 },
+    };
+    int inner_count = 1;
+
+    for (int i = 0; i < G_N_ELEMENTS(parts); i++) {
+        if (parts_len[i] > 0) {
+            inner_buffs[inner_count++] = (validity90_crypto_buffer) { parts[i], parts_len[i] };
+        }
+    }
+
+    validity90_sha256_buffers(inner_buffs, inner_count, inner);
+    validity90_sha256_buffers(outer_buffs, 2, out);
+    memset(inner, 0, G_N_ELEMENTS(inner));
+
+    return TRUE;
+}
+
+// P_SHA256(secret, label || seed)
+static gboolean tls_prf_expand(prf_hmac_func hmac, gpointer key, const guint8 *label, const gsize label_len,
+                               const guint8 *seed, const gsize seed_len, const gsize required_len, guint8 *out_buff,
+                               GError **error) {
     gboolean result = TRUE;
 
     gsize written_bytes = 0;
     guint8 iteration_buff[0x20];
-    guint8 *hmac_data = gcry_xmalloc_secure(seed_len + 0x20);
+    guint8 a[0x20];
 
-    gcry_buffer_t hmac_buffs[2] = {
-        {.size = secret_len, .off = 0, .len = secret_len, .data = (guint8*) secret},
-        {.size = seed_len + 0x20, .off = 0x20, .len = seed_len, .data = hmac_data},
-    };
-    memcpy(hmac_data + 0x20, seed, seed_len);
+    // A[1] = HMAC(secret, seed)
+    if (!hmac(key, NULL, 0, label, label_len, seed, seed_len, a)) {
+        g_set_error(error, VALIDITY90_UTILS_ERROR, 0, "TLS_PRF_RAW: gen A[i] hash failed");
+        result = FALSE;
+        goto end;
+    }
 
     while (written_bytes < required_len) {
-        // Gen A[i]
-        gpg_error_t res = 0;
-        if ((res = gcry_md_hash_buffers(GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC, hmac_data, hmac_buffs, 2)) != 0) {
-            g_set_error(error, VALIDITY90_UTILS_ERROR, 0, "TLS_PRF_RAW: gen A[i] hash failed, cause: 0x%x", res);
+        if (!hmac(key, a, G_N_ELEMENTS(a), label, label_len, seed, seed_len, iteration_buff)) {
+            g_set_error(error, VALIDITY90_UTILS_ERROR, 1, "TLS_PRF_RAW: hash failed");
             result = FALSE;
             goto end;
         }
+        memcpy(out_buff + written_bytes, iteration_buff, MIN(0x20, required_len - written_bytes));
+        written_bytes += 0x20;
 
-        // Configure buff
-        hmac_buffs[1].off = 0;
-        hmac_buffs[1].len = seed_len + 0x20;
-
-        if ((res = gcry_md_hash_buffers(GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC, iteration_buff, hmac_buffs, 2)) != 0) {
-            g_set_error(error, VALIDITY90_UTILS_ERROR, 1, "TLS_PRF_RAW: hash failed, cause: 0x%x", res);
+        // A[i + 1] = HMAC(secret, A[i])
+        if (!hmac(key, a, G_N_ELEMENTS(a), NULL, 0, NULL, 0, a)) {
+            g_set_error(error, VALIDITY90_UTILS_ERROR, 0, "TLS_PRF_RAW: gen A[i] hash failed");
             result = FALSE;
             goto end;
         }
-        memcpy(out_buff + written_bytes, iteration_buff, MIN(0x20, required_len - written_bytes));
-        written_bytes += 0x20;
-
-        // Configure A
-        hmac_buffs[1].off = 0;
-        hmac_buffs[1].len = 0x20;
     };
 
 end:
-    gcry_free(hmac_data);
+    memset(a, 0, G_N_ELEMENTS(a));
+    memset(iteration_buff, 0, G_N_ELEMENTS(iteration_buff));
+
+    return result;
+}
+
+gboolean validity90_tls_prf_raw(const guint8 *secret, const gsize secret_len, const guint8 *seed, const gsize seed_len,
+                                const gsize required_len, guint8 *out_buff, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    hmac_sha256_key hkey;
+
+    hmac_sha256_key_init(&hkey, secret, secret_len);
+    gboolean result = tls_prf_expand(hmac_sha256, &hkey, NULL, 0, seed, seed_len, required_len, out_buff, error);
+    memset(&hkey, 0, sizeof(hkey));
 
     return result;
 }
@@ -219,19 +406,122 @@ gboolean validity90_tls_prf(const guint8 *secret, const gsize secret_len, const
                          const gsize required_len, guint8 *out_buff, GError **error) {
     g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-    gsize label_len = strlen(label);
-    guint8 *label_seed = gcry_xmalloc_secure(label_len + seed_len);
+    hmac_sha256_key hkey;
 
-    memcpy(label_seed, label, label_len);
-    memcpy(label_seed + label_len, seed, seed_len);
+    // Label and seed are hashed in place, never joined
+    hmac_sha256_key_init(&hkey, secret, secret_len);
+    gboolean result = tls_prf_expand(hmac_sha256, &hkey, (const guint8*) label, strlen(label), seed, seed_len,
+                                     required_len, out_buff, error);
+    memset(&hkey, 0, sizeof(hkey));
 
-    gsize label_seed_len = label_len + seed_len;
+    return result;
+}
 
-    gboolean res = validity90_tls_prf_raw(secret, secret_len, label_seed, label_seed_len, required_len, out_buff, error);
+struct validity90_tls_prf_engine {
+    validity90_hmac *hmac;
+};
 
-    gcry_free(label_seed);
+static gboolean tls_prf_engine_hmac(gpointer key, const guint8 *a, gsize a_len, const guint8 *label,
+                                    gsize label_len, const guint8 *seed, gsize seed_len, guint8 *out) {
+    validity90_tls_prf_engine *engine = key;
 
-    return res;
+    // Back to the keyed inner state, the pads were hashed once when keyed
+    validity90_hmac_reset(engine->hmac);
+    if (a_len > 0) {
+        validity90_hmac_write(engine->hmac, a, a_len);
+    }
+    if (label_len > 0) {
+        validity90_hmac_write(engine->hmac, label, label_len);
+    }
+    if (seed_len > 0) {
+        validity90_hmac_write(engine->hmac, seed, seed_len);
+    }
+
+    // Finishes with the keyed outer state, out may be a
+    validity90_hmac_final(engine->hmac, out);
+
+    return TRUE;
+}
+
+validity90_tls_prf_engine *validity90_tls_prf_engine_new(const guint8 *secret, const gsize secret_len, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    validity90_tls_prf_engine *engine = g_malloc0(sizeof(validity90_tls_prf_engine));
+
+    if ((engine->hmac = validity90_hmac_new(secret, secret_len)) == NULL) {
+        g_set_error(error, VALIDITY90_UTILS_ERROR, 0, "TLS_PRF: HMAC setup failed");
+        validity90_tls_prf_engine_free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+void validity90_tls_prf_engine_free(validity90_tls_prf_engine *engine) {
+    if (engine == NULL) {
+        return;
+    }
+    // Wipes the keyed states
+    g_clear_pointer(&engine->hmac, validity90_hmac_free);
+    g_free(engine);
+}
+
+gboolean validity90_tls_prf_engine_derive(validity90_tls_prf_engine *engine, const char *label, const guint8 *seed,
+                                          const gsize seed_len, const gsize required_len, guint8 *out_buff,
+                                          GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    return tls_prf_expand(tls_prf_engine_hmac, engine, (const guint8*) label, label != NULL ? strlen(label) : 0,
+                          seed, seed_len, required_len, out_buff, error);
+}
+
+gboolean validity90_tls_prf_engine_derive_batch(validity90_tls_prf_engine *engine, validity90_tls_prf_output *outputs,
+                                                guint outputs_count, GError **error) {
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    for (guint i = 0; i < outputs_count; i++) {
+        validity90_tls_prf_output *output = &outputs[i];
+
+        if (!validity90_tls_prf_engine_derive(engine, output->label, output->seed, output->seed_len,
+                                              output->required_len, output->out_buff, error)) {
+            g_prefix_error(error, "Output %u: ", i);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean validity90_parse_hex(const char *hex, guint8 **out, gsize *out_len) {
+    GByteArray *bytes = g_byte_array_new();
+    int high = -1;
+
+    for (; *hex != '\0'; hex++) {
+        if (g_ascii_isspace(*hex)) {
+            continue;
+        }
+        int digit = g_ascii_xdigit_value(*hex);
+        if (digit < 0) {
+            g_byte_array_free(bytes, TRUE);
+            return FALSE;
+        }
+        if (high < 0) {
+            high = digit;
+        } else {
+            guint8 byte = (high << 4) | digit;
+            g_byte_array_append(bytes, &byte, 1);
+            high = -1;
+        }
+    }
+
+    if (high >= 0 || bytes->len == 0) {
+        g_byte_array_free(bytes, TRUE);
+        return FALSE;
+    }
+
+    *out_len = bytes->len;
+    *out = g_byte_array_free(bytes, FALSE);
+    return TRUE;
 }
 
 void reverse_mem(guint8* data, gsize size) {
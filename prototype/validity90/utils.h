@@ -32,8 +32,17 @@ GQuark validity90_utils_error_quark(void);
 
 /*
  * Binary stream tools
+ *
+ * A bstream is a read cursor over caller owned memory, the data is never
+ * copied and must outlive the stream. Integers are little-endian.
  */
-typedef struct bstream bstream;
+typedef struct bstream {
+    const guint8 *data;
+    gsize data_size;
+    gsize pos;
+} bstream;
+
+void bstream_init(bstream *stream, const guint8 *data, const gsize data_size);
 
 bstream *bstream_create(const guint8 *data, const gsize data_size);
 void bstream_free(bstream *stream);
@@ -45,6 +54,13 @@ gsize bstream_get_pos(bstream *stream);
 
 gboolean bstream_read_uint8(bstream *stream, guint8 *res);
 gboolean bstream_read_uint16(bstream *stream, guint16 *res);
+gboolean bstream_read_uint32(bstream *stream, guint32 *res);
+gboolean bstream_read_uint16_array(bstream *stream, guint16 *res, gsize count);
+gboolean bstream_read_uint32_array(bstream *stream, guint32 *res, gsize count);
+
+/* Borrows size bytes of the underlying buffer */
+gboolean bstream_read_slice(bstream *stream, gsize size, const guint8 **res);
+/* Same as bstream_read_slice, but returns a g_malloc'ed copy */
 gboolean bstream_read_bytes(bstream *stream, gsize size, guint8 **res);
 
 /*
@@ -56,8 +72,39 @@ enum validity90_crypto_error_s {
     VALIDITY90_ERROR_CODE_AES_PADDING_FAILED,
 };
 
+/* Takes the same time for any padding of the last block */
 gboolean validity90_check_aes_padding(const guint8 *data, const gsize data_len, gsize *real_len);
 
+/*
+ * AES-CBC decryptor keyed once and reused for any number of records, each
+ * with its own IV. Padding is checked with validity90_check_aes_padding.
+ */
+typedef struct validity90_aes_decryptor validity90_aes_decryptor;
+
+typedef struct validity90_aes_record {
+    const guint8 *iv;
+    const guint8 *ciphertext;
+    gsize ciphertext_len;
+    // Must hold ciphertext_len bytes, may be the ciphertext itself
+    guint8 *out_buff;
+    // Plaintext length once decrypted
+    gsize out_len;
+} validity90_aes_record;
+
+validity90_aes_decryptor *validity90_aes_decryptor_new(const guint8 *key, const gsize key_len, GError **error);
+void validity90_aes_decryptor_free(validity90_aes_decryptor *decryptor);
+
+gboolean validity90_aes_decryptor_decrypt(validity90_aes_decryptor *decryptor, validity90_aes_record *record,
+                                          GError **error);
+
+/* Stops at the first record that fails, the error names its index */
+gboolean validity90_aes_decryptor_decrypt_batch(validity90_aes_decryptor *decryptor, validity90_aes_record *records,
+                                                guint records_count, GError **error);
+
+/* data is IV || ciphertext, out_buff must hold data_len - 0x10 bytes */
+gboolean validity90_aes_decrypt_into(const guint8 *data, const gsize data_len, const guint8 *key, const gsize key_len,
+                                     guint8 *out_buff, gsize *out_len, GError **error);
+
 gboolean validity90_aes_decrypt(const guint8 *data, const gsize data_len, const guint8 *key, const gsize key_len,
                                 GByteArray **out_data, GError **error);
 
@@ -67,11 +114,40 @@ gboolean validity90_tls_prf_raw(const guint8 *secret, const gsize secret_len, co
 gboolean validity90_tls_prf(const guint8 *secret, const gsize secret_len, const char *label, const guint8 *seed, const gsize seed_len,
                          const gsize required_len, guint8 *out_buff, GError **error);
 
+/*
+ * TLS PRF for a secret that derives several outputs: the HMAC is keyed once
+ * and every block starts from the keyed inner and outer states. label may be
+ * NULL for a raw seed.
+ */
+typedef struct validity90_tls_prf_engine validity90_tls_prf_engine;
+
+typedef struct validity90_tls_prf_output {
+    const char *label;
+    const guint8 *seed;
+    gsize seed_len;
+    gsize required_len;
+    guint8 *out_buff;
+} validity90_tls_prf_output;
+
+validity90_tls_prf_engine *validity90_tls_prf_engine_new(const guint8 *secret, const gsize secret_len, GError **error);
+void validity90_tls_prf_engine_free(validity90_tls_prf_engine *engine);
+
+gboolean validity90_tls_prf_engine_derive(validity90_tls_prf_engine *engine, const char *label, const guint8 *seed,
+                                          const gsize seed_len, const gsize required_len, guint8 *out_buff,
+                                          GError **error);
+
+/* Stops at the first output that fails, the error names its index */
+gboolean validity90_tls_prf_engine_derive_batch(validity90_tls_prf_engine *engine, validity90_tls_prf_output *outputs,
+                                                guint outputs_count, GError **error);
+
 /*
  * Misc.
  */
 void reverse_mem(guint8* data, gsize size);
 
+/* Hex digits with any whitespace between them, FALSE when empty or not hex */
+gboolean validity90_parse_hex(const char *hex, guint8 **out, gsize *out_len);
+
 void print_array_(const guint8* data, gsize len);
 
 #if defined (__cplusplus)
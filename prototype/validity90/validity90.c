@@ -21,9 +21,8 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
-#include <gcrypt.h>
-#include <gnutls/gnutls.h>
 
+#include "crypto.h"
 #include "utils.h"
 #include "validity90.h"
 
@@ -45,23 +44,25 @@ typedef enum rsp6_record_type {
 } rsp6_record_type;
 
 gboolean validity90_handle_rsp6_ecdsa_packet(const guint8 *data, gsize data_len,
-                                             const guint8 *serial, gsize serial_len, GByteArray** d_mpi_component, GError **error) {
+                                             const guint8 *serial, gsize serial_len, guint8 *d_component, GError **error) {
     g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
     gboolean result = TRUE;
 
-    if (data_len < 0x80) {
-        g_set_error(error, VALIDITY90_RSP6_ERROR, 0, "RSP6: ecdsa packet length too small: %lx", data_len);
-        result = FALSE;
-        goto end;
-    }
-
     // Get AES master key
     guint8 factory_key[] = {
         0x71, 0x7c, 0xd7, 0x2d, 0x09, 0x62, 0xbc, 0x4a, 0x28, 0x46, 0x13, 0x8d, 0xbb, 0x2c, 0x24, 0x19,
         0x25, 0x12, 0xa7, 0x64, 0x07, 0x06, 0x5f, 0x38, 0x38, 0x46, 0x13, 0x9d, 0x4b, 0xec, 0x20, 0x33,
     };
     guint8 master_key_aes[0x20];
+    guint8 ecdsa_key[0x70];
+    gsize ecdsa_key_len = 0;
+
+    if (data_len < 0x81) {
+        g_set_error(error, VALIDITY90_RSP6_ERROR, 0, "RSP6: ecdsa packet length too small: %lx", data_len);
+        result = FALSE;
+        goto end;
+    }
 
     if (!validity90_tls_prf(factory_key, G_N_ELEMENTS(factory_key), "GWK", serial, serial_len, 0x20, master_key_aes, error)) {
         result = FALSE;
@@ -69,64 +70,51 @@ gboolean validity90_handle_rsp6_ecdsa_packet(const guint8 *data, gsize data_len,
     }
 
     // Decrypt
-    GByteArray *ecdsa_key = NULL;
-
-    g_assert_cmphex(data[0], ==, 0x02);
     if (data[0] != 0x02) {
         g_set_error(error, VALIDITY90_RSP6_ERROR, 0, "RSP6: ecdsa packet invalid prefix format");
         result = FALSE;
         goto end;
     }
 
-    if (!validity90_aes_decrypt(data + 1, 0x80, master_key_aes, 0x20, &ecdsa_key, error)) {
+    if (!validity90_aes_decrypt_into(data + 1, 0x80, master_key_aes, 0x20, ecdsa_key, &ecdsa_key_len, error)) {
         result = FALSE;
         goto end;
     }
 
-    // Reverse parts
-    // X, Y components
-    reverse_mem(ecdsa_key->data, 0x20);
-    reverse_mem(ecdsa_key->data + 0x20, 0x20);
-
-    // d component
-    reverse_mem(ecdsa_key->data + 0x40, 0x20);
+    if (ecdsa_key_len < 0x60) {
+        g_set_error(error, VALIDITY90_RSP6_ERROR, 0, "RSP6: ecdsa key too short: %lx", ecdsa_key_len);
+        result = FALSE;
+        goto end;
+    }
 
-    // Assign key
-    (*d_mpi_component) = g_byte_array_sized_new(0x20);
-    g_byte_array_append(*d_mpi_component, ecdsa_key->data + 0x40, 0x20);
+    // Key is X, Y, d; only d is needed, X and Y come with the certificate
+    memcpy(d_component, ecdsa_key + 0x40, 0x20);
+    reverse_mem(d_component, 0x20);
 
 end:
-    g_clear_pointer(&ecdsa_key, g_byte_array_free_to_bytes);
+    memset(master_key_aes, 0, G_N_ELEMENTS(master_key_aes));
+    memset(ecdsa_key, 0, G_N_ELEMENTS(ecdsa_key));
 
     return result;
 }
 
-gboolean validity90_handle_rsp6_pubkey_packet(const guint8 *data, gsize data_len, GByteArray **q_component, GError **error) {
+gboolean validity90_handle_rsp6_pubkey_packet(const guint8 *data, gsize data_len, guint8 *q_component, GError **error) {
     g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-    gboolean result = TRUE;
-
     if (data_len < 0x6c) {
         g_set_error(error, VALIDITY90_RSP6_ERROR, 0, "RSP6: pubkey packet length too small: %lx", data_len);
-        result = FALSE;
-        goto end;
+        return FALSE;
     }
 
-    *q_component = g_byte_array_sized_new(0x40);
     // X component
-    g_byte_array_append(*q_component, data + 0x08, 0x20);
-    reverse_mem((*q_component)->data, 0x20);
+    memcpy(q_component, data + 0x08, 0x20);
+    reverse_mem(q_component, 0x20);
 
     // Y component
-    g_byte_array_append(*q_component, data + 0x4c, 0x20);
-    reverse_mem((*q_component)->data + 0x20, 0x20);
-
-end:
-    if (!result) {
-        g_clear_pointer(q_component, g_byte_array_free_to_bytes);
-    }
+    memcpy(q_component + 0x20, data + 0x4c, 0x20);
+    reverse_mem(q_component + 0x20, 0x20);
 
-    return result;
+    return TRUE;
 }
 
 gboolean validity90_parse_rsp6(const guint8 *data, gsize data_len, const guint8 *serial, gsize serial_len, rsp6_info_ptr *info_out, GError **error) {
@@ -134,15 +122,17 @@ gboolean validity90_parse_rsp6(const guint8 *data, gsize data_len, const guint8
 
     gboolean result = TRUE;
 
-    bstream *stream = bstream_create(data, data_len);
+    bstream stream;
+    bstream_init(&stream, data, data_len);
 
-    rsp6_info *info = g_malloc(sizeof(rsp6_info));
-    info->tls_cert_raw = g_byte_array_new();
-    info->tls_client_privkey = g_byte_array_new();
-    info->tls_server_pubkey = g_byte_array_new();
+    rsp6_info *info = NULL;
+    *info_out = NULL;
 
-    *info_out = info;
-    GByteArray *ecdsa_d = NULL, *ecdsa_q = NULL, *ecdh = NULL;
+    // Q (X, Y) and d components of the client key, Q of the server key
+    guint8 ecdsa_key[0x60], ecdh_key[0x40];
+    gboolean has_ecdsa_d = FALSE, has_ecdsa_q = FALSE, has_ecdh = FALSE;
+    const guint8 *cert = NULL;
+    guint16 cert_len = 0;
 
     if (data_len < 8) {
         g_set_error(error, VALIDITY90_RSP6_ERROR, RSP6_ERR_INVALID_LENGTH, "RSP6 length is <8 (%lx)", data_len);
@@ -151,38 +141,38 @@ gboolean validity90_parse_rsp6(const guint8 *data, gsize data_len, const guint8
     }
 
     // Skip header
-    bstream_set_pos(stream, 8);
+    bstream_set_pos(&stream, 8);
 
     // Derive enc key
-    while (bstream_remaining(stream) > 0) {
-        // Header
-        guint16 type, size;
-        guint8 *hash, *data;
+    while (bstream_remaining(&stream) > 0) {
+        // Header: type, size
+        guint16 header[2];
+        const guint8 *hash, *data;
         guint8 calc_hash[0x20];
 
         // Read header
-        if (!bstream_read_uint16(stream, &type) ||
-            !bstream_read_uint16(stream, &size) ||
-            !bstream_read_bytes(stream, 0x20, &hash)) {
+        if (!bstream_read_uint16_array(&stream, header, G_N_ELEMENTS(header)) ||
+            !bstream_read_slice(&stream, 0x20, &hash)) {
 
             g_set_error(error, VALIDITY90_RSP6_ERROR, RSP6_ERR_INVALID_LENGTH, "RSP6 can't read packet header");
             result = FALSE;
             goto end;
         }
+        guint16 type = header[0], size = header[1];
 
         // Stop parsing
         if (type == RSP6_END) {
             break;
         }
 
-        if (!bstream_read_bytes(stream, size, &data)) {
+        if (!bstream_read_slice(&stream, size, &data)) {
             g_set_error(error, VALIDITY90_RSP6_ERROR, RSP6_ERR_INVALID_LENGTH, "RSP6 can't read packet data");
             result = FALSE;
             goto end;
         }
 
         // Check hash
-        gcry_md_hash_buffer(GCRY_MD_SHA256, calc_hash, data, size);
+        validity90_sha256_buffer(data, size, calc_hash);
 
         if (memcmp(calc_hash, hash, 0x20) != 0) {
             g_set_error(error, VALIDITY90_RSP6_ERROR, RSP6_ERR_HASH_MISSMATCH, "RSP6 hass missmatch for packet %x", type);
@@ -192,27 +182,31 @@ gboolean validity90_parse_rsp6(const guint8 *data, gsize data_len, const guint8
 
         switch (type) {
         case RSP6_TLS_CERT:
-            if (!validity90_handle_rsp6_pubkey_packet(data, size, &ecdsa_q, error)) {
+            if (!validity90_handle_rsp6_pubkey_packet(data, size, ecdsa_key, error)) {
                 result = FALSE;
                 goto end;
             }
+            has_ecdsa_q = TRUE;
 
-            g_byte_array_append(info->tls_cert_raw, data, size);
+            cert = data;
+            cert_len = size;
 
             break;
 
         case RSP6_ECDSA_PRIV_ENCRYPTED:
-            if (!validity90_handle_rsp6_ecdsa_packet(data, size, serial, serial_len, &ecdsa_d, error)) {
+            if (!validity90_handle_rsp6_ecdsa_packet(data, size, serial, serial_len, ecdsa_key + 0x40, error)) {
                 result = FALSE;
                 goto end;
             }
+            has_ecdsa_d = TRUE;
             break;
 
         case RSP6_ECDH_PUB:
-            if (!validity90_handle_rsp6_pubkey_packet(data, size, &ecdh, error)) {
+            if (!validity90_handle_rsp6_pubkey_packet(data, size, ecdh_key, error)) {
                 result = FALSE;
                 goto end;
             }
+            has_ecdh = TRUE;
             break;
 
         case RSP6_UNKNOWN_0:
@@ -226,41 +220,54 @@ gboolean validity90_parse_rsp6(const guint8 *data, gsize data_len, const guint8
         }
     }
 
-    if (ecdsa_d == NULL || ecdsa_q == NULL) {
+    if (!has_ecdsa_d || !has_ecdsa_q) {
         g_set_error(error, VALIDITY90_RSP6_ERROR, RSP6_ERR_NO_ECDSA_COMPONENTS,
-                    "RSP6 missing ecdsa components, priv: %d, pub: %d", ecdsa_d != NULL, ecdsa_q != NULL);
+                    "RSP6 missing ecdsa components, priv: %d, pub: %d", has_ecdsa_d, has_ecdsa_q);
         result = FALSE;
         goto end;
     }
 
-    if (ecdh == NULL) {
+    if (!has_ecdh) {
         g_set_error(error, VALIDITY90_RSP6_ERROR, RSP6_ERR_NO_ECDH_COMPONENT, "RSP6 missing ecdh component");
         result = FALSE;
         goto end;
     }
 
+    // Only the outputs get allocated, and only once everything is parsed
+    info = g_malloc(sizeof(rsp6_info));
+
+    info->tls_cert_raw = g_byte_array_sized_new(cert_len);
+    g_byte_array_append(info->tls_cert_raw, cert, cert_len);
+
     // Set ECDSA private key
-    g_byte_array_append(info->tls_client_privkey, ecdsa_q->data, ecdsa_q->len);
-    g_byte_array_append(info->tls_client_privkey, ecdsa_d->data, ecdsa_d->len);
+    info->tls_client_privkey = g_byte_array_sized_new(G_N_ELEMENTS(ecdsa_key));
+    g_byte_array_append(info->tls_client_privkey, ecdsa_key, G_N_ELEMENTS(ecdsa_key));
 
     // Set ECDH pub key
-    g_byte_array_append(info->tls_server_pubkey, ecdh->data, ecdh->len);
+    info->tls_server_pubkey = g_byte_array_sized_new(G_N_ELEMENTS(ecdh_key));
+    g_byte_array_append(info->tls_server_pubkey, ecdh_key, G_N_ELEMENTS(ecdh_key));
+
+    *info_out = info;
 
 end:
-    if (!result) {
-        g_clear_pointer(&info->tls_cert_raw, g_byte_array_free_to_bytes);
-        g_clear_pointer(&info->tls_client_privkey, g_byte_array_free_to_bytes);
-        g_clear_pointer(&info->tls_server_pubkey, g_byte_array_free_to_bytes);
-        g_clear_pointer(&info, g_free);
-        *info_out = NULL;
-    }
-    bstream_free(stream);
-    g_clear_pointer(&ecdsa_d, g_byte_array_free_to_bytes);
-    g_clear_pointer(&ecdsa_q, g_byte_array_free_to_bytes);
+    memset(ecdsa_key, 0, G_N_ELEMENTS(ecdsa_key));
 
     return result;
 }
 
+void validity90_rsp6_info_free(rsp6_info *info) {
+    if (info == NULL) {
+        return;
+    }
+    if (info->tls_client_privkey != NULL) {
+        memset(info->tls_client_privkey->data, 0, info->tls_client_privkey->len);
+    }
+    g_clear_pointer(&info->tls_cert_raw, g_byte_array_unref);
+    g_clear_pointer(&info->tls_client_privkey, g_byte_array_unref);
+    g_clear_pointer(&info->tls_server_pubkey, g_byte_array_unref);
+    g_free(info);
+}
+
 /*
 struct validity90 {
     byte_array* tls_driver_ecdsa_private_key;
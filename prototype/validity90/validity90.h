@@ -22,7 +22,6 @@
 
 #include <stdint.h>
 #include <glib.h>
-#include <gcrypt.h>
 
 #if defined (__cplusplus)
 extern "C" {
@@ -47,6 +46,8 @@ enum validity_error_codes {
 
 gboolean validity90_parse_rsp6(const guint8 *data, gsize data_len, const guint8 *serial, gsize serial_len, rsp6_info_ptr *info_out, GError **err);
 
+void validity90_rsp6_info_free(rsp6_info *info);
+
 /*
 
 typedef struct validity90 validity90;